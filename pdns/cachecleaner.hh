@@ -74,6 +74,39 @@ template <typename S, typename C, typename T> void pruneCollection(C& container,
   }
 }
 
+// CLOCK-like eviction for caches whose entries carry a mutable d_referenced flag, set on a hit instead of moving the
+// entry to the back of the 'sequence' index every time: entries that have been used since the last time we looked at
+// them are moved to the back and lose their mark, until enough unused ones have been found at the front of each shard
+// to be removed by the pruning. During a random subdomain attack the cache fills up with entries that are never used
+// again, so these get evicted instead of the ones that are actually useful.
+// toTrim is the number of entries the pruning is about to remove
+template <typename S, typename T> void giveSecondChanceMutexCollectionsVector(std::vector<T>& maps, size_t toTrim)
+{
+  if (maps.empty()) {
+    return;
+  }
+
+  const size_t perShard = toTrim / maps.size() + 1;
+  for (auto& mc : maps) {
+    auto map = mc.lock();
+    auto& sidx = boost::multi_index::get<S>(map->d_map);
+    size_t unused = 0;
+    size_t toLookAt = sidx.size();
+    for (auto entry = sidx.begin(); entry != sidx.end() && unused < perShard && toLookAt > 0; --toLookAt) {
+      if (entry->d_referenced) {
+        entry->d_referenced = false;
+        auto next = std::next(entry);
+        sidx.relocate(sidx.end(), entry);
+        entry = next;
+      }
+      else {
+        ++unused;
+        ++entry;
+      }
+    }
+  }
+}
+
 // note: this expects iterator from first index
 template <typename S, typename T> void moveCacheItemToFrontOrBack(T& collection, typename T::iterator& iter, bool front)
 {
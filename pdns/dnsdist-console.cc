@@ -417,6 +417,7 @@ const std::vector<ConsoleKeyword> g_consoleKeywords{
   { "AllowResponseAction", true, "", "let these packets go through" },
   { "AllRule", true, "", "matches all traffic" },
   { "AndRule", true, "list of DNS rules", "matches if all sub-rules matches" },
+  { "benchQueryPipeline", true, "[{pcap=\"file.pcap\", suffix=\"powerdns.com.\", names=1000, iterations=100000, threads=1}]", "bench the query pipeline (rules, caches, policies and response rules) in-process, reporting the time spent per query in each stage" },
   { "benchRule", true, "DNS Rule [, iterations [, suffix]]", "bench the specified DNS rule" },
   { "carbonServer", true, "serverIP, [ourname], [interval]", "report statistics to serverIP using our hostname, or 'ourname' if provided, every 'interval' seconds" },
   { "clearConsoleHistory", true, "", "clear the internal (in-memory) history of console commands" },
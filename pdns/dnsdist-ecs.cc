@@ -647,11 +647,46 @@ bool handleEDNSClientSubnet(PacketBuffer& packet, const size_t maximumSize, cons
   return true;
 }
 
+namespace {
+struct CachedECSOption
+{
+  ComboAddress d_source;
+  std::string d_option;
+  uint16_t d_prefixLength{0};
+  bool d_valid{false};
+};
+}
+
+/* Queries coming from the same client network get exactly the same ECS option,
+   so instead of generating it again for every query we keep a small, direct-mapped
+   per-thread cache keyed by the truncated source and the prefix length.
+   Entries are overwritten in place, reusing the existing string storage. */
+const std::string& getCachedECSOption(const ComboAddress& source, uint16_t ECSPrefixLength)
+{
+  static const size_t s_cacheSize = 256;
+  static thread_local std::array<CachedECSOption, s_cacheSize> t_ecsOptionsCache;
+
+  ComboAddress truncated(source);
+  truncated.truncate(ECSPrefixLength);
+
+  auto& entry = t_ecsOptionsCache[ComboAddress::addressOnlyHash()(truncated) % s_cacheSize];
+  if (entry.d_valid && entry.d_prefixLength == ECSPrefixLength && ComboAddress::addressOnlyEqual()(entry.d_source, truncated)) {
+    return entry.d_option;
+  }
+
+  entry.d_option.clear();
+  generateECSOption(truncated, entry.d_option, ECSPrefixLength);
+  entry.d_source = truncated;
+  entry.d_prefixLength = ECSPrefixLength;
+  entry.d_valid = true;
+
+  return entry.d_option;
+}
+
 bool handleEDNSClientSubnet(DNSQuestion& dq, bool& ednsAdded, bool& ecsAdded)
 {
   assert(dq.remote != nullptr);
-  string newECSOption;
-  generateECSOption(dq.ecsSet ? dq.ecs.getNetwork() : *dq.remote, newECSOption, dq.ecsSet ? dq.ecs.getBits() : dq.ecsPrefixLength);
+  const auto& newECSOption = getCachedECSOption(dq.ecsSet ? dq.ecs.getNetwork() : *dq.remote, dq.ecsSet ? dq.ecs.getBits() : dq.ecsPrefixLength);
 
   return handleEDNSClientSubnet(dq.getMutableData(), dq.getMaximumSize(), dq.qname->wirelength(), ednsAdded, ecsAdded, dq.ecsOverride, newECSOption);
 }
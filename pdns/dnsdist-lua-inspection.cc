@@ -20,6 +20,7 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 #include "dnsdist.hh"
+#include "dnsdist-benchmark.hh"
 #include "dnsdist-lua.hh"
 #include "dnsdist-dynblocks.hh"
 #include "dnsdist-nghttp2.hh"
@@ -533,6 +534,35 @@ void setupLuaInspection(LuaContext& luaCtx)
       }
     });
 
+  luaCtx.writeFunction("benchQueryPipeline", [](boost::optional<std::unordered_map<std::string, boost::variant<size_t, std::string>>> vars) {
+      QueryPipelineBenchmarkParameters params;
+      if (vars) {
+        if (vars->count("pcap")) {
+          params.pcapFile = boost::get<std::string>((*vars)["pcap"]);
+        }
+        if (vars->count("suffix")) {
+          params.suffix = boost::get<std::string>((*vars)["suffix"]);
+        }
+        if (vars->count("names")) {
+          params.distinctNames = boost::get<size_t>((*vars)["names"]);
+        }
+        if (vars->count("iterations")) {
+          params.iterations = boost::get<size_t>((*vars)["iterations"]);
+        }
+        if (vars->count("threads")) {
+          params.threads = boost::get<size_t>((*vars)["threads"]);
+        }
+      }
+
+      try {
+        g_outputBuffer = benchmarkQueryPipeline(params);
+      }
+      catch (const std::exception& e) {
+        g_outputBuffer = "Error while benchmarking the query pipeline: " + std::string(e.what()) + "\n";
+        errlog("Error while benchmarking the query pipeline: %s", e.what());
+      }
+    });
+
   luaCtx.writeFunction("showResponseLatency", []() {
       setLuaNoSideEffect();
       map<double, unsigned int> histo;
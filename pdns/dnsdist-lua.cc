@@ -189,6 +189,10 @@ static void parseTLSConfig(TLSConfig& config, const std::string& context, boost:
     config.d_ticketsKeyRotationDelay = boost::get<int>((*vars)["ticketsKeysRotationDelay"]);
   }
 
+  if (vars->count("reloadTicketKeyFile")) {
+    config.d_reloadTicketKeyFile = boost::get<bool>((*vars)["reloadTicketKeyFile"]);
+  }
+
   if (vars->count("numberOfTicketsKeys")) {
     config.d_numberOfTicketsKeys = boost::get<int>((*vars)["numberOfTicketsKeys"]);
   }
@@ -1116,29 +1116,9 @@ static void handleIncomingTCPQuery(int pipefd, FDMultiplexer::funcparam_t& param
   }
 }
 
-static void handleCrossProtocolQuery(int pipefd, FDMultiplexer::funcparam_t& param)
+static void processCrossProtocolQuery(TCPClientThreadData* threadData, CrossProtocolQuery* tmp, const struct timeval& now)
 {
-  auto threadData = boost::any_cast<TCPClientThreadData*>(param);
-  CrossProtocolQuery* tmp{nullptr};
-
-  ssize_t got = read(pipefd, &tmp, sizeof(tmp));
-  if (got == 0) {
-    throw std::runtime_error("EOF while reading from the TCP cross-protocol pipe (" + std::to_string(pipefd) + ") in " + std::string(isNonBlocking(pipefd) ? "non-blocking" : "blocking") + " mode");
-  }
-  else if (got == -1) {
-    if (errno == EAGAIN || errno == EINTR) {
-      return;
-    }
-    throw std::runtime_error("Error while reading from the TCP cross-protocol pipe (" + std::to_string(pipefd) + ") in " + std::string(isNonBlocking(pipefd) ? "non-blocking" : "blocking") + " mode:" + stringerror());
-  }
-  else if (got != sizeof(tmp)) {
-    throw std::runtime_error("Partial read while reading from the TCP cross-protocol pipe (" + std::to_string(pipefd) + ") in " + std::string(isNonBlocking(pipefd) ? "non-blocking" : "blocking") + " mode");
-  }
-
   try {
-    struct timeval now;
-    gettimeofday(&now, nullptr);
-
     std::shared_ptr<TCPQuerySender> tqs = tmp->getTCPQuerySender();
     auto query = std::move(tmp->query);
     auto downstreamServer = std::move(tmp->downstream);
@@ -1162,6 +1142,26 @@ static void handleCrossProtocolQuery(int pipefd, FDMultiplexer::funcparam_t& par
   }
 }
 
+static void handleCrossProtocolQuery(int pipefd, FDMultiplexer::funcparam_t& param)
+{
+  auto threadData = boost::any_cast<TCPClientThreadData*>(param);
+  /* during truncation storms, or when a pool only has TCP backends, a lot of queries
+     are waiting in the pipe, so drain several of them per wake-up */
+  std::array<CrossProtocolQuery*, 16> queries;
+
+  const size_t count = dnsdist::readPointersFromPipe(pipefd, queries, "TCP cross-protocol");
+  if (count == 0) {
+    return;
+  }
+
+  struct timeval now;
+  gettimeofday(&now, nullptr);
+
+  for (size_t idx = 0; idx < count; idx++) {
+    processCrossProtocolQuery(threadData, queries.at(idx), now);
+  }
+}
+
 static void handleCrossProtocolResponse(int pipefd, FDMultiplexer::funcparam_t& param)
 {
   TCPCrossProtocolResponse* tmp{nullptr};
@@ -45,6 +45,7 @@
 #endif
 
 #include "dnsdist.hh"
+#include "dnsdist-benchmark.hh"
 #include "dnsdist-cache.hh"
 #include "dnsdist-console.hh"
 #include "dnsdist-dynblocks.hh"
@@ -842,6 +843,7 @@ bool processRulesResult(const DNSAction::Action& action, DNSQuestion& dq, std::s
 
 static bool applyRulesToQuery(LocalHolders& holders, DNSQuestion& dq, const struct timespec& now)
 {
+  setQueryPipelineStage(QueryPipelineStage::Rings);
   g_rings.insertQuery(now, *dq.remote, *dq.qname, dq.qtype, dq.getData().size(), *dq.getHeader(), dq.getProtocol());
 
   if (g_qcount.enabled) {
@@ -861,6 +863,7 @@ static bool applyRulesToQuery(LocalHolders& holders, DNSQuestion& dq, const stru
     }
   }
 
+  setQueryPipelineStage(QueryPipelineStage::DynBlocks);
   if(auto got = holders.dynNMGBlock->lookup(*dq.remote)) {
     auto updateBlockStats = [&got]() {
       ++g_stats.dynBlocked;
@@ -979,6 +982,7 @@ static bool applyRulesToQuery(LocalHolders& holders, DNSQuestion& dq, const stru
     }
   }
 
+  setQueryPipelineStage(QueryPipelineStage::Rules);
   DNSAction::Action action=DNSAction::Action::None;
   string ruleresult;
   bool drop = false;
@@ -1123,6 +1127,7 @@ static void queueResponse(const ClientState& cs, const PacketBuffer& response, c
 /* self-generated responses or cache hits */
 static bool prepareOutgoingResponse(LocalHolders& holders, ClientState& cs, DNSQuestion& dq, bool cacheHit)
 {
+  setQueryPipelineStage(QueryPipelineStage::Response);
   DNSResponse dr(dq.qname, dq.qtype, dq.qclass, dq.local, dq.remote, dq.getMutableData(), dq.protocol, dq.queryTime);
 
   dr.uniqueId = dq.uniqueId;
@@ -1191,6 +1196,7 @@ ProcessQueryResult processQuery(DNSQuestion& dq, ClientState& cs, LocalHolders&
       return ProcessQueryResult::SendAnswer;
     }
 
+    setQueryPipelineStage(QueryPipelineStage::Policy);
     std::shared_ptr<ServerPool> serverPool = getPool(*holders.pools, dq.poolname);
     std::shared_ptr<ServerPolicy> poolPolicy = serverPool->policy;
     dq.packetCache = serverPool->packetCache;
@@ -1198,6 +1204,7 @@ ProcessQueryResult processQuery(DNSQuestion& dq, ClientState& cs, LocalHolders&
     const auto servers = serverPool->getServers();
     selectedBackend = policy.getSelectedBackend(*servers, dq);
 
+    setQueryPipelineStage(QueryPipelineStage::Cache);
     uint32_t allowExpired = selectedBackend ? 0 : g_staleCacheEntriesTTL;
 
     if (dq.packetCache && !dq.skipCache) {
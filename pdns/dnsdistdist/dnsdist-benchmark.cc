@@ -0,0 +1,291 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <thread>
+
+#include <boost/format.hpp>
+
+#include "dnsdist.hh"
+#include "dnsdist-benchmark.hh"
+#include "dnsdist-ecs.hh"
+
+#include "dnspcap.hh"
+#include "dnswriter.hh"
+#include "gettime.hh"
+
+thread_local QueryPipelineTimings* t_queryPipelineTimings{nullptr};
+
+static uint64_t getElapsedNanoseconds(const struct timespec& start, const struct timespec& end)
+{
+  return (end.tv_sec - start.tv_sec) * 1000000000ULL + end.tv_nsec - start.tv_nsec;
+}
+
+void QueryPipelineTimings::start(QueryPipelineStage stage)
+{
+  gettime(&d_stageStart);
+  d_current = stage;
+  d_running = true;
+}
+
+void QueryPipelineTimings::switchTo(QueryPipelineStage stage)
+{
+  if (!d_running) {
+    return start(stage);
+  }
+
+  struct timespec now;
+  gettime(&now);
+  d_nsecs.at(static_cast<size_t>(d_current)) += getElapsedNanoseconds(d_stageStart, now);
+  d_stageStart = now;
+  d_current = stage;
+}
+
+void QueryPipelineTimings::stop()
+{
+  if (!d_running) {
+    return;
+  }
+
+  struct timespec now;
+  gettime(&now);
+  d_nsecs.at(static_cast<size_t>(d_current)) += getElapsedNanoseconds(d_stageStart, now);
+  d_running = false;
+}
+
+namespace {
+struct BenchmarkQuery
+{
+  PacketBuffer packet;
+  ComboAddress remote;
+};
+
+struct BenchmarkResults
+{
+  QueryPipelineTimings timings;
+  uint64_t aclDrops{0};
+  uint64_t drops{0};
+  uint64_t answered{0};
+  uint64_t forwarded{0};
+  uint64_t responseDrops{0};
+  uint64_t errors{0};
+};
+}
+
+static std::vector<BenchmarkQuery> loadQueriesFromPCAP(const std::string& file)
+{
+  std::vector<BenchmarkQuery> queries;
+  PcapPacketReader pr(file);
+
+  while (pr.getUDPPacket()) {
+    if (pr.d_len < sizeof(dnsheader)) {
+      continue;
+    }
+    const struct dnsheader* dh = reinterpret_cast<const struct dnsheader*>(pr.d_payload);
+    if (dh->qr || ntohs(dh->qdcount) == 0) {
+      continue;
+    }
+
+    BenchmarkQuery query;
+    query.packet.insert(query.packet.end(), pr.d_payload, pr.d_payload + pr.d_len);
+    query.remote = pr.getSource();
+    queries.push_back(std::move(query));
+  }
+
+  return queries;
+}
+
+static std::vector<BenchmarkQuery> generateQueries(const DNSName& suffix, size_t count)
+{
+  std::vector<BenchmarkQuery> queries;
+  queries.reserve(count);
+
+  for (size_t idx = 0; idx < count; idx++) {
+    BenchmarkQuery query;
+    DNSName qname(std::to_string(idx));
+    qname += suffix;
+    GenericDNSPacketWriter<PacketBuffer> pw(query.packet, qname, (idx % 2) == 0 ? QType::A : QType::AAAA);
+    pw.getHeader()->rd = 1;
+    pw.getHeader()->id = htons(idx % 65536);
+    query.remote = ComboAddress("192.0.2.1");
+    query.remote.sin4.sin_addr.s_addr = htonl(0xc0000200 + (idx % 256));
+    queries.push_back(std::move(query));
+  }
+
+  return queries;
+}
+
+/* what our fake backend sends back: a single A record for A queries, NoError/NoData otherwise */
+static void generateFakeResponse(const DNSQuestion& dq, PacketBuffer& response)
+{
+  const auto dh = dq.getHeader();
+  response.clear();
+  GenericDNSPacketWriter<PacketBuffer> pw(response, *dq.qname, dq.qtype, dq.qclass, dh->opcode);
+  pw.getHeader()->id = dh->id;
+  pw.getHeader()->qr = 1;
+  pw.getHeader()->rd = dh->rd;
+  pw.getHeader()->ra = 1;
+  pw.getHeader()->cd = dh->cd;
+  if (dq.qtype == QType::A) {
+    pw.startRecord(*dq.qname, QType::A, 60, QClass::IN, DNSResourceRecord::ANSWER);
+    pw.xfr32BitInt(0xc0000201);
+  }
+  if (queryHasEDNS(dq)) {
+    pw.addOpt(1232, 0, 0);
+  }
+  pw.commit();
+}
+
+static void benchmarkWorker(const std::vector<BenchmarkQuery>& queries, uint64_t first, uint64_t count, BenchmarkResults& results)
+{
+  LocalHolders holders;
+  auto localRespRuleActions = g_respruleactions.getLocal();
+  ClientState cs(ComboAddress("127.0.0.1:53"), false, false, 0, "", {});
+  PacketBuffer query;
+  PacketBuffer response;
+  auto& timings = results.timings;
+  t_queryPipelineTimings = &timings;
+
+  for (uint64_t idx = first; idx < (first + count); idx++) {
+    const auto& item = queries.at(idx % queries.size());
+    /* the copy is not accounted, as we would get the query straight into our buffer */
+    query = item.packet;
+
+    timings.start(QueryPipelineStage::ACL);
+    try {
+      if (!holders.acl->match(item.remote)) {
+        ++results.aclDrops;
+        timings.stop();
+        continue;
+      }
+
+      setQueryPipelineStage(QueryPipelineStage::Parsing);
+      struct timespec queryRealTime;
+      gettime(&queryRealTime, true);
+
+      if (!checkQueryHeaders(reinterpret_cast<const struct dnsheader*>(query.data()))) {
+        ++results.drops;
+        timings.stop();
+        continue;
+      }
+
+      uint16_t qtype, qclass;
+      unsigned int qnameWireLength = 0;
+      DNSName qname(reinterpret_cast<const char*>(query.data()), query.size(), sizeof(dnsheader), false, &qtype, &qclass, &qnameWireLength);
+      DNSQuestion dq(&qname, qtype, qclass, &cs.local, &item.remote, query, dnsdist::Protocol::DoUDP, &queryRealTime);
+      std::shared_ptr<DownstreamState> selectedBackend{nullptr};
+
+      auto result = processQuery(dq, cs, holders, selectedBackend);
+
+      if (result == ProcessQueryResult::Drop) {
+        ++results.drops;
+      }
+      else if (result == ProcessQueryResult::SendAnswer) {
+        ++results.answered;
+      }
+      else if (result == ProcessQueryResult::PassToBackend && selectedBackend != nullptr) {
+        setQueryPipelineStage(QueryPipelineStage::Backend);
+        generateFakeResponse(dq, response);
+
+        IDState ids;
+        ids.cs = &cs;
+        ids.origID = dq.getHeader()->id;
+        setIDStateFromDNSQuestion(ids, dq, std::move(qname));
+
+        setQueryPipelineStage(QueryPipelineStage::Response);
+        auto dr = makeDNSResponseFromIDState(ids, response);
+        if (processResponse(response, localRespRuleActions, dr, false, true)) {
+          ++results.forwarded;
+        }
+        else {
+          ++results.responseDrops;
+        }
+      }
+    }
+    catch (const std::exception& e) {
+      ++results.errors;
+    }
+    timings.stop();
+  }
+
+  t_queryPipelineTimings = nullptr;
+}
+
+std::string benchmarkQueryPipeline(const QueryPipelineBenchmarkParameters& params)
+{
+  std::vector<BenchmarkQuery> queries;
+  if (!params.pcapFile.empty()) {
+    queries = loadQueriesFromPCAP(params.pcapFile);
+  }
+  else {
+    queries = generateQueries(DNSName(params.suffix), params.distinctNames);
+  }
+
+  if (queries.empty()) {
+    throw std::runtime_error("No queries to benchmark the query pipeline with");
+  }
+
+  const size_t threadsCount = std::max(params.threads, static_cast<size_t>(1));
+  std::vector<BenchmarkResults> results(threadsCount);
+  std::vector<std::thread> threads;
+  threads.reserve(threadsCount);
+
+  const uint64_t perThread = params.iterations / threadsCount;
+  StopWatch sw;
+  sw.start();
+  for (size_t idx = 0; idx < threadsCount; idx++) {
+    /* the last thread gets the remainder */
+    uint64_t count = idx == (threadsCount - 1) ? (params.iterations - perThread * idx) : perThread;
+    threads.emplace_back(benchmarkWorker, std::cref(queries), idx * perThread, count, std::ref(results.at(idx)));
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  double udiff = sw.udiff();
+
+  BenchmarkResults total;
+  std::array<uint64_t, static_cast<size_t>(QueryPipelineStage::Count)> nsecs{};
+  for (const auto& result : results) {
+    total.aclDrops += result.aclDrops;
+    total.drops += result.drops;
+    total.answered += result.answered;
+    total.forwarded += result.forwarded;
+    total.responseDrops += result.responseDrops;
+    total.errors += result.errors;
+    for (size_t stage = 0; stage < nsecs.size(); stage++) {
+      nsecs.at(stage) += result.timings.getNanoseconds(static_cast<QueryPipelineStage>(stage));
+    }
+  }
+
+  static const std::array<const char*, static_cast<size_t>(QueryPipelineStage::Count)> stageNames = { "parsing", "acl", "rings", "dynblocks", "rules", "policy", "cache", "backend", "response" };
+  const double iterations = params.iterations > 0 ? params.iterations : 1;
+  boost::format fmt("%-12s %10.1f ns/query\n");
+  std::string report = (boost::format("Processed %d queries (%d distinct) with %d thread(s) in %.1f ms, %.1f qps\n") % params.iterations % queries.size() % threadsCount % (udiff / 1000.0) % (1000000.0 * params.iterations / udiff)).str();
+  report += (boost::format("%d ACL drops, %d drops, %d answered directly, %d forwarded, %d responses dropped, %d errors\n") % total.aclDrops % total.drops % total.answered % total.forwarded % total.responseDrops % total.errors).str();
+
+  uint64_t totalNsecs = 0;
+  for (size_t stage = 0; stage < nsecs.size(); stage++) {
+    report += (fmt % stageNames.at(stage) % (nsecs.at(stage) / iterations)).str();
+    totalNsecs += nsecs.at(stage);
+  }
+  report += (fmt % "total" % (totalNsecs / iterations)).str();
+
+  return report;
+}
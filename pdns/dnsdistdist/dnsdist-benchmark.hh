@@ -0,0 +1,74 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#pragma once
+
+#include <array>
+#include <string>
+#include <time.h>
+
+enum class QueryPipelineStage : uint8_t { Parsing, ACL, Rings, DynBlocks, Rules, Policy, Cache, Backend, Response, Count };
+
+/* Accounts the time spent in each stage of the query pipeline. This is only
+   used by benchQueryPipeline(), processQuery() and friends check whether
+   t_queryPipelineTimings is set and do nothing otherwise. */
+class QueryPipelineTimings
+{
+public:
+  void start(QueryPipelineStage stage);
+  void switchTo(QueryPipelineStage stage);
+  void stop();
+  uint64_t getNanoseconds(QueryPipelineStage stage) const
+  {
+    return d_nsecs.at(static_cast<size_t>(stage));
+  }
+
+private:
+  std::array<uint64_t, static_cast<size_t>(QueryPipelineStage::Count)> d_nsecs{};
+  struct timespec d_stageStart;
+  QueryPipelineStage d_current{QueryPipelineStage::Parsing};
+  bool d_running{false};
+};
+
+extern thread_local QueryPipelineTimings* t_queryPipelineTimings;
+
+inline void setQueryPipelineStage(QueryPipelineStage stage)
+{
+  if (t_queryPipelineTimings != nullptr) {
+    t_queryPipelineTimings->switchTo(stage);
+  }
+}
+
+struct QueryPipelineBenchmarkParameters
+{
+  std::string pcapFile;
+  std::string suffix{"powerdns.com."};
+  uint64_t iterations{100000};
+  size_t distinctNames{1000};
+  size_t threads{1};
+};
+
+/* Feeds queries, read from a PCAP file or generated under a given suffix, to processQuery()
+   in-process, answers the ones that should be sent to a backend with a fake response
+   and processes it with processResponse(). Returns a human-readable report of the time
+   spent per query in each stage. This goes through the real rules, rings, caches and
+   statistics, so it should not be used on a production instance. */
+std::string benchmarkQueryPipeline(const QueryPipelineBenchmarkParameters& params);
@@ -21,6 +21,7 @@
  */
 #pragma once
 
+#include <array>
 #include <unistd.h>
 #include "iputils.hh"
 #include "dnsdist.hh"
@@ -185,6 +186,51 @@ struct CrossProtocolQuery
   bool isXFR{false};
 };
 
+namespace dnsdist
+{
+/* Writes ptr to the first pipe that is not full among the count pipes returned by getPipe(index),
+   starting at index start and wrapping around. Returns false if all of them are full, or if
+   writing failed for any other reason, in which case the remaining pipes are not tried. */
+template <typename T, typename F>
+bool writePointerToFirstAvailablePipe(T* ptr, uint64_t start, uint64_t count, const F& getPipe)
+{
+  for (uint64_t idx = 0; idx < count; idx++) {
+    int pipe = getPipe((start + idx) % count);
+    ssize_t res = write(pipe, &ptr, sizeof(ptr));
+    if (res == sizeof(ptr)) {
+      return true;
+    }
+    if (res != -1 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+      break;
+    }
+  }
+  return false;
+}
+
+/* Reads as many pointers as fit in ptrs from the pipe with a single read(), and returns how many
+   were read, 0 if none were available. Writes of a pointer to a pipe are atomic, so we only ever
+   get whole pointers: EOF, errors and partial reads throw. */
+template <typename T, size_t N>
+size_t readPointersFromPipe(int pipe, std::array<T*, N>& ptrs, const std::string& name)
+{
+  ssize_t got = read(pipe, ptrs.data(), sizeof(T*) * N);
+  if (got == 0) {
+    throw std::runtime_error("EOF while reading from the " + name + " pipe (" + std::to_string(pipe) + ") in " + std::string(isNonBlocking(pipe) ? "non-blocking" : "blocking") + " mode");
+  }
+  else if (got == -1) {
+    if (errno == EAGAIN || errno == EINTR) {
+      return 0;
+    }
+    throw std::runtime_error("Error while reading from the " + name + " pipe (" + std::to_string(pipe) + ") in " + std::string(isNonBlocking(pipe) ? "non-blocking" : "blocking") + " mode:" + stringerror());
+  }
+  else if (static_cast<size_t>(got) % sizeof(T*) != 0) {
+    throw std::runtime_error("Partial read while reading from the " + name + " pipe (" + std::to_string(pipe) + ") in " + std::string(isNonBlocking(pipe) ? "non-blocking" : "blocking") + " mode");
+  }
+
+  return static_cast<size_t>(got) / sizeof(T*);
+}
+}
+
 class TCPClientCollection
 {
 public:
@@ -228,17 +274,19 @@ public:
     }
 
     uint64_t pos = d_pos++;
-    auto pipe = d_tcpclientthreads.at(pos % d_numthreads).d_crossProtocolQueriesPipe.getHandle();
     auto tmp = cpq.release();
 
-    if (write(pipe, &tmp, sizeof(tmp)) != sizeof(tmp)) {
-      ++g_stats.tcpCrossProtocolQueryPipeFull;
-      delete tmp;
-      tmp = nullptr;
-      return false;
+    /* if the pipe of the selected worker is full, try the other ones before
+       dropping the query, as a busy worker should not make us lose queries
+       that others could handle */
+    if (dnsdist::writePointerToFirstAvailablePipe(tmp, pos, d_numthreads, [this](uint64_t idx) { return d_tcpclientthreads.at(idx).d_crossProtocolQueriesPipe.getHandle(); })) {
+      return true;
     }
 
-    return true;
+    ++g_stats.tcpCrossProtocolQueryPipeFull;
+    delete tmp;
+    tmp = nullptr;
+    return false;
   }
 
   bool hasReachedMaxThreads() const
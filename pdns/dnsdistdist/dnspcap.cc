@@ -0,0 +1 @@
+../dnspcap.cc
\ No newline at end of file
@@ -105,7 +105,16 @@ public:
       return;
     }
 
-    d_ticketKeys->rotateTicketsKey(now);
+    try {
+      if (!d_reloadTicketKeyFile || !d_ticketKeys->reloadModifiedTicketsKeysFile()) {
+        d_ticketKeys->rotateTicketsKey(now);
+      }
+    }
+    catch (const std::exception& e) {
+      /* this is called from the OpenSSL tickets key callback, so we can't let the exception escape.
+         Keep the current keys and try again at the next rotation */
+      warnlog("Error while rotating the DoH tickets keys, keeping the current ones: %s", e.what());
+    }
 
     if (d_ticketsKeyRotationDelay > 0) {
       d_ticketsKeyNextRotation = now + d_ticketsKeyRotationDelay;
@@ -157,6 +166,7 @@ public:
   std::unique_ptr<FILE, int(*)(FILE*)> d_keyLogFile{nullptr, fclose};
   ClientState* d_cs{nullptr};
   time_t d_ticketsKeyRotationDelay{0};
+  bool d_reloadTicketKeyFile{false};
 
 private:
   h2o_accept_ctx_t d_h2o_accept_ctx;
@@ -1459,6 +1469,7 @@ static void setupTLSContext(DOHAcceptContext& acceptCtx,
   h2o_ssl_register_alpn_protocols(ctx.get(), h2o_http2_alpn_protocols);
 
   acceptCtx.d_ticketsKeyRotationDelay = tlsConfig.d_ticketsKeyRotationDelay;
+  acceptCtx.d_reloadTicketKeyFile = tlsConfig.d_reloadTicketKeyFile;
   if (tlsConfig.d_ticketKeyFile.empty()) {
     acceptCtx.handleTicketsKeyRotation();
   }
@@ -1476,6 +1487,7 @@ static void setupAcceptContext(DOHAcceptContext& ctx, DOHServerConfig& dsc, bool
   nativeCtx->ctx = &dsc.h2o_ctx;
   nativeCtx->hosts = dsc.h2o_config.hosts;
   ctx.d_ticketsKeyRotationDelay = dsc.df->d_tlsConfig.d_ticketsKeyRotationDelay;
+  ctx.d_reloadTicketKeyFile = dsc.df->d_tlsConfig.d_reloadTicketKeyFile;
 
   if (setupTLS && dsc.df->isHTTPS()) {
     try {
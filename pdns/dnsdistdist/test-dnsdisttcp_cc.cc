@@ -28,6 +28,7 @@
 #include "dnsdist.hh"
 #include "dnsdist-proxy-protocol.hh"
 #include "dnsdist-rings.hh"
+#include "dnsdist-tcp.hh"
 #include "dnsdist-tcp-downstream.hh"
 #include "dnsdist-tcp-upstream.hh"
 
@@ -3838,4 +3839,128 @@ BOOST_AUTO_TEST_CASE(test_IncomingConnectionOOOR_BackendNotOOOR)
   }
 }
 
+static std::vector<FDWrapper> makeNonBlockingPipes(size_t count, std::vector<FDWrapper>& writeEnds)
+{
+  std::vector<FDWrapper> readEnds;
+  for (size_t idx = 0; idx < count; idx++) {
+    int fds[2] = {-1, -1};
+    BOOST_REQUIRE(pipe(fds) == 0);
+    readEnds.emplace_back(fds[0]);
+    writeEnds.emplace_back(fds[1]);
+    BOOST_REQUIRE(setNonBlocking(fds[0]));
+    BOOST_REQUIRE(setNonBlocking(fds[1]));
+  }
+  return readEnds;
+}
+
+/* fill the pipe until a write would block, returns the number of pointers written */
+static size_t fillPipe(int fd)
+{
+  size_t count = 0;
+  int* ptr = nullptr;
+  while (write(fd, &ptr, sizeof(ptr)) == sizeof(ptr)) {
+    count++;
+  }
+  BOOST_REQUIRE(errno == EAGAIN || errno == EWOULDBLOCK);
+  return count;
+}
+
+static size_t drainPipe(int fd)
+{
+  std::array<int*, 16> ptrs;
+  size_t total = 0;
+  size_t got = 0;
+  while ((got = dnsdist::readPointersFromPipe(fd, ptrs, "test")) > 0) {
+    total += got;
+  }
+  return total;
+}
+
+BOOST_AUTO_TEST_CASE(test_CrossProtocolPipes_SpillOver)
+{
+  std::vector<FDWrapper> writeEnds;
+  auto readEnds = makeNonBlockingPipes(3, writeEnds);
+  auto getPipe = [&writeEnds](uint64_t idx) { return writeEnds.at(idx).getHandle(); };
+  int value = 42;
+  std::array<int*, 16> ptrs;
+
+  /* the selected pipe is used when it is not full */
+  BOOST_CHECK(dnsdist::writePointerToFirstAvailablePipe(&value, 1, writeEnds.size(), getPipe));
+  BOOST_CHECK_EQUAL(dnsdist::readPointersFromPipe(readEnds.at(0).getHandle(), ptrs, "test"), 0U);
+  BOOST_REQUIRE_EQUAL(dnsdist::readPointersFromPipe(readEnds.at(1).getHandle(), ptrs, "test"), 1U);
+  BOOST_CHECK(ptrs.at(0) == &value);
+  BOOST_CHECK_EQUAL(dnsdist::readPointersFromPipe(readEnds.at(2).getHandle(), ptrs, "test"), 0U);
+
+  /* the selected pipe is full, the query goes to the next worker */
+  fillPipe(writeEnds.at(1).getHandle());
+  BOOST_CHECK(dnsdist::writePointerToFirstAvailablePipe(&value, 1, writeEnds.size(), getPipe));
+  BOOST_CHECK_EQUAL(dnsdist::readPointersFromPipe(readEnds.at(0).getHandle(), ptrs, "test"), 0U);
+  BOOST_REQUIRE_EQUAL(dnsdist::readPointersFromPipe(readEnds.at(2).getHandle(), ptrs, "test"), 1U);
+  BOOST_CHECK(ptrs.at(0) == &value);
+
+  /* wrapping around to the first worker */
+  fillPipe(writeEnds.at(2).getHandle());
+  BOOST_CHECK(dnsdist::writePointerToFirstAvailablePipe(&value, 1, writeEnds.size(), getPipe));
+  BOOST_REQUIRE_EQUAL(dnsdist::readPointersFromPipe(readEnds.at(0).getHandle(), ptrs, "test"), 1U);
+  BOOST_CHECK(ptrs.at(0) == &value);
+
+  /* all of them are full */
+  fillPipe(writeEnds.at(0).getHandle());
+  BOOST_CHECK(!dnsdist::writePointerToFirstAvailablePipe(&value, 1, writeEnds.size(), getPipe));
+
+  /* as soon as one is drained, it gets the next queries */
+  BOOST_CHECK_GT(drainPipe(readEnds.at(0).getHandle()), 0U);
+  BOOST_CHECK(dnsdist::writePointerToFirstAvailablePipe(&value, 2, writeEnds.size(), getPipe));
+  BOOST_CHECK_EQUAL(drainPipe(readEnds.at(0).getHandle()), 1U);
+
+  /* errors other than a full pipe do not spill over */
+  auto getInvalidFirstPipe = [&writeEnds](uint64_t idx) { return idx == 0 ? -1 : writeEnds.at(idx).getHandle(); };
+  drainPipe(readEnds.at(1).getHandle());
+  BOOST_CHECK(!dnsdist::writePointerToFirstAvailablePipe(&value, 0, writeEnds.size(), getInvalidFirstPipe));
+  BOOST_CHECK_EQUAL(dnsdist::readPointersFromPipe(readEnds.at(1).getHandle(), ptrs, "test"), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(test_CrossProtocolPipes_BatchLimit)
+{
+  std::vector<FDWrapper> writeEnds;
+  auto readEnds = makeNonBlockingPipes(1, writeEnds);
+  const int readFD = readEnds.at(0).getHandle();
+  const int writeFD = writeEnds.at(0).getHandle();
+  auto getPipe = [writeFD](uint64_t) { return writeFD; };
+
+  std::vector<int> values(40);
+  for (auto& value : values) {
+    BOOST_REQUIRE(dnsdist::writePointerToFirstAvailablePipe(&value, 0, 1, getPipe));
+  }
+
+  /* no more than the size of the batch per read, in order */
+  std::array<int*, 16> ptrs;
+  size_t received = 0;
+  for (const size_t expected : {16U, 16U, 8U}) {
+    BOOST_REQUIRE_EQUAL(dnsdist::readPointersFromPipe(readFD, ptrs, "test"), expected);
+    for (size_t idx = 0; idx < expected; idx++) {
+      BOOST_CHECK(ptrs.at(idx) == &values.at(received + idx));
+    }
+    received += expected;
+  }
+  BOOST_CHECK_EQUAL(dnsdist::readPointersFromPipe(readFD, ptrs, "test"), 0U);
+
+  /* a smaller batch */
+  std::array<int*, 4> smallBatch;
+  for (size_t idx = 0; idx < 6; idx++) {
+    BOOST_REQUIRE(dnsdist::writePointerToFirstAvailablePipe(&values.at(idx), 0, 1, getPipe));
+  }
+  BOOST_CHECK_EQUAL(dnsdist::readPointersFromPipe(readFD, smallBatch, "test"), 4U);
+  BOOST_CHECK_EQUAL(dnsdist::readPointersFromPipe(readFD, smallBatch, "test"), 2U);
+
+  /* a partial pointer is an error */
+  char garbage = 0;
+  BOOST_REQUIRE_EQUAL(write(writeFD, &garbage, sizeof(garbage)), 1);
+  BOOST_CHECK_THROW(dnsdist::readPointersFromPipe(readFD, ptrs, "test"), std::runtime_error);
+
+  /* and so is EOF */
+  writeEnds.clear();
+  BOOST_CHECK_THROW(dnsdist::readPointersFromPipe(readFD, ptrs, "test"), std::runtime_error);
+}
+
 BOOST_AUTO_TEST_SUITE_END();
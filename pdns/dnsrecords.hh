@@ -253,7 +253,7 @@ class CNAMERecordContent : public DNSRecordContent
 public:
   includeboilerplate(CNAME)
   CNAMERecordContent(const DNSName& content) : d_content(content){}
-  DNSName getTarget() const { return d_content; }
+  const DNSName& getTarget() const { return d_content; }
 private:
   DNSName d_content;
 };
@@ -138,6 +138,10 @@ public:
 
   dnsheader* getHeader();
   void getRecordPayload(string& records); // call __before commit__
+  size_t getRecordPayloadSize() const // call __before commit__, the payload is the end of getContent()
+  {
+    return d_content.size() - d_sor;
+  }
 
   void setCanonic(bool val)
   {
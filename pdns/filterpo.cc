@@ -39,10 +39,196 @@ static const std::string rpzClientIPName("rpz-client-ip"),
   rpzNSDnameName("rpz-nsdname"),
   rpzNSIPName("rpz-nsip");
 
+std::atomic<uint64_t> DNSFilterEngine::Zone::CopyOnWriteOwner::s_ids{0};
+
 DNSFilterEngine::DNSFilterEngine()
 {
 }
 
+DNSFilterEngine::NameLookupKeys::NameLookupKeys(const DNSName& qname) :
+  d_qname(qname)
+{
+  /* for www.powerdns.com, we need to check:
+     www.powerdns.com.
+       *.powerdns.com.
+                *.com.
+                    *.
+   */
+  d_keys.at(0).d_hash = qname.hash();
+  d_count = 1;
+
+  const auto& storage = qname.getStorage();
+  if (storage.empty()) {
+    return;
+  }
+
+  /* the wildcards are hashed from a copy of the covered suffix, prefixed with the '*' label */
+  std::array<unsigned char, 257> wildcard;
+  wildcard.at(0) = 1;
+  wildcard.at(1) = '*';
+  size_t offset = 0;
+  while (offset < storage.size() && storage.at(offset) != 0) {
+    offset += static_cast<uint8_t>(storage.at(offset)) + 1;
+    if (offset >= storage.size()) {
+      break;
+    }
+    size_t suffixLen = storage.size() - offset;
+    memcpy(&wildcard.at(2), &storage.at(offset), suffixLen);
+    auto& key = d_keys.at(d_count);
+    key.d_hash = burtleCI(wildcard.data(), suffixLen + 2, 0);
+    key.d_offset = offset;
+    ++d_count;
+  }
+}
+
+bool DNSFilterEngine::NameLookupKeys::matches(size_t idx, const DNSName& name) const
+{
+  const auto& key = d_keys.at(idx);
+  if (key.d_offset == 0) {
+    return name == d_qname;
+  }
+
+  const auto& storage = d_qname.getStorage();
+  const auto& candidate = name.getStorage();
+  size_t suffixLen = storage.size() - key.d_offset;
+  if (candidate.size() != suffixLen + 2 || candidate.at(0) != 1 || candidate.at(1) != '*') {
+    return false;
+  }
+  return std::equal(candidate.cbegin() + 2, candidate.cend(), storage.cbegin() + key.d_offset, [](unsigned char a, unsigned char b) {
+    return dns_tolower(a) == dns_tolower(b);
+  });
+}
+
+DNSName DNSFilterEngine::NameLookupKeys::getName(size_t idx) const
+{
+  if (idx == 0) {
+    return d_qname;
+  }
+
+  DNSName suffix(d_qname);
+  for (size_t chopped = 0; chopped < idx; chopped++) {
+    suffix.chopOff();
+  }
+  return g_wildcarddnsname + suffix;
+}
+
+const DNSFilterEngine::Policy* DNSFilterEngine::Zone::NamePolicyMap::find(const DNSName& name) const
+{
+  uint32_t hash = name.hash();
+  const auto& bucket = d_buckets.at(getBucketIndex(hash));
+  if (!bucket) {
+    return nullptr;
+  }
+
+  auto it = findEntry(bucket->d_value, hash, [&name](const DNSName& candidate) { return candidate == name; });
+  if (it == bucket->d_value.end()) {
+    return nullptr;
+  }
+  return &it->d_policy;
+}
+
+const DNSFilterEngine::Policy* DNSFilterEngine::Zone::NamePolicyMap::find(const NameLookupKeys& keys, size_t idx) const
+{
+  uint32_t hash = keys.getHash(idx);
+  const auto& bucket = d_buckets.at(getBucketIndex(hash));
+  if (!bucket) {
+    return nullptr;
+  }
+
+  auto it = findEntry(bucket->d_value, hash, [&keys, idx](const DNSName& candidate) { return keys.matches(idx, candidate); });
+  if (it == bucket->d_value.end()) {
+    return nullptr;
+  }
+  return &it->d_policy;
+}
+
+DNSFilterEngine::Policy* DNSFilterEngine::Zone::NamePolicyMap::findWritable(const DNSName& name)
+{
+  if (find(name) == nullptr) {
+    return nullptr;
+  }
+
+  uint32_t hash = name.hash();
+  auto& entries = getWritablePart(d_buckets.at(getBucketIndex(hash)), d_owner);
+  return &findEntry(entries, hash, [&name](const DNSName& candidate) { return candidate == name; })->d_policy;
+}
+
+void DNSFilterEngine::Zone::NamePolicyMap::insertEntry(bucket_t& bucket, Entry&& entry)
+{
+  auto it = std::upper_bound(bucket.begin(), bucket.end(), entry.d_hash, [](uint32_t value, const Entry& existing) {
+    return value < existing.d_hash;
+  });
+  bucket.insert(it, std::move(entry));
+}
+
+void DNSFilterEngine::Zone::NamePolicyMap::insert(const DNSName& name, Policy&& pol)
+{
+  if (find(name) != nullptr) {
+    return;
+  }
+
+  uint32_t hash = name.hash();
+  auto& entries = getWritablePart(d_buckets.at(getBucketIndex(hash)), d_owner);
+  insertEntry(entries, Entry{name, std::move(pol), hash});
+  ++d_size;
+  reserve(d_size);
+}
+
+void DNSFilterEngine::Zone::NamePolicyMap::erase(const DNSName& name)
+{
+  if (find(name) == nullptr) {
+    return;
+  }
+
+  uint32_t hash = name.hash();
+  auto& entries = getWritablePart(d_buckets.at(getBucketIndex(hash)), d_owner);
+  entries.erase(findEntry(entries, hash, [&name](const DNSName& candidate) { return candidate == name; }));
+  --d_size;
+}
+
+void DNSFilterEngine::Zone::NamePolicyMap::clear()
+{
+  d_buckets.clear();
+  d_buckets.resize(s_minBuckets);
+  d_size = 0;
+}
+
+void DNSFilterEngine::Zone::NamePolicyMap::reserve(size_t count)
+{
+  size_t needed = d_buckets.size();
+  while (needed < s_maxBuckets && count > needed * s_maxAverageBucketSize) {
+    needed *= s_growthFactor;
+  }
+  if (needed != d_buckets.size()) {
+    rehash(needed);
+  }
+}
+
+void DNSFilterEngine::Zone::NamePolicyMap::rehash(size_t bucketsCount)
+{
+  /* every bucket is going to be rebuilt anyway, so we can just steal the policies
+     from the buckets we own, and need to copy the ones from buckets that we share */
+  auto oldBuckets = std::move(d_buckets);
+  d_buckets.clear();
+  d_buckets.resize(bucketsCount);
+
+  for (auto& bucket : oldBuckets) {
+    if (!bucket) {
+      continue;
+    }
+    bool owned = bucket->d_owner == d_owner.get();
+    for (auto& entry : bucket->d_value) {
+      auto& entries = getWritablePart(d_buckets.at(getBucketIndex(entry.d_hash)), d_owner);
+      if (owned) {
+        insertEntry(entries, std::move(entry));
+      }
+      else {
+        insertEntry(entries, Entry(entry));
+      }
+    }
+  }
+}
+
 bool DNSFilterEngine::Zone::findExactQNamePolicy(const DNSName& qname, DNSFilterEngine::Policy& pol) const
 {
   return findExactNamedPolicy(d_qpolName, qname, pol);
@@ -55,7 +241,7 @@ bool DNSFilterEngine::Zone::findExactNSPolicy(const DNSName& qname, DNSFilterEng
 
 bool DNSFilterEngine::Zone::findNSIPPolicy(const ComboAddress& addr, DNSFilterEngine::Policy& pol) const
 {
-  if (const auto fnd = d_propolNSAddr.lookup(addr)) {
+  if (const auto fnd = d_propolNSAddr.get().lookup(addr)) {
     pol = fnd->second;
     return true;
   }
@@ -64,7 +250,7 @@ bool DNSFilterEngine::Zone::findNSIPPolicy(const ComboAddress& addr, DNSFilterEn
 
 bool DNSFilterEngine::Zone::findResponsePolicy(const ComboAddress& addr, DNSFilterEngine::Policy& pol) const
 {
-  if (const auto fnd = d_postpolAddr.lookup(addr)) {
+  if (const auto fnd = d_postpolAddr.get().lookup(addr)) {
     pol = fnd->second;
     return true;
   }
@@ -73,56 +259,52 @@ bool DNSFilterEngine::Zone::findResponsePolicy(const ComboAddress& addr, DNSFilt
 
 bool DNSFilterEngine::Zone::findClientPolicy(const ComboAddress& addr, DNSFilterEngine::Policy& pol) const
 {
-  if (const auto fnd = d_qpolAddr.lookup(addr)) {
+  if (const auto fnd = d_qpolAddr.get().lookup(addr)) {
     pol = fnd->second;
     return true;
   }
   return false;
 }
 
-bool DNSFilterEngine::Zone::findNamedPolicy(const std::unordered_map<DNSName, DNSFilterEngine::Policy>& polmap, const DNSName& qname, DNSFilterEngine::Policy& pol)
+bool DNSFilterEngine::Zone::findQNamePolicy(const NameLookupKeys& keys, DNSFilterEngine::Policy& pol) const
 {
-  if (polmap.empty()) {
-    return false;
-  }
-
-  /* for www.powerdns.com, we need to check:
-     www.powerdns.com.
-       *.powerdns.com.
-                *.com.
-                    *.
-   */
+  return findNamedPolicy(d_qpolName, keys, pol);
+}
 
-  std::unordered_map<DNSName, DNSFilterEngine::Policy>::const_iterator iter;
-  iter = polmap.find(qname);
+bool DNSFilterEngine::Zone::findNSPolicy(const NameLookupKeys& keys, DNSFilterEngine::Policy& pol) const
+{
+  return findNamedPolicy(d_propolName, keys, pol);
+}
 
-  if(iter != polmap.end()) {
-    pol=iter->second;
-    return true;
+bool DNSFilterEngine::Zone::findNamedPolicy(const NamePolicyMap& polmap, const NameLookupKeys& keys, DNSFilterEngine::Policy& pol)
+{
+  if (polmap.empty()) {
+    return false;
   }
 
-  DNSName s(qname);
-  while(s.chopOff()){
-    iter = polmap.find(g_wildcarddnsname+s);
-    if(iter != polmap.end()) {
-      pol=iter->second;
-      pol.d_trigger = iter->first;
-      pol.d_hit = qname.toStringNoDot();
+  /* the exact name first, then the most specific wildcard */
+  for (size_t idx = 0; idx < keys.size(); idx++) {
+    const auto found = polmap.find(keys, idx);
+    if (found != nullptr) {
+      pol = *found;
+      pol.d_trigger = keys.getName(idx);
+      pol.d_hit = keys.getQName().toStringNoDot();
       return true;
     }
   }
+
   return false;
 }
 
-bool DNSFilterEngine::Zone::findExactNamedPolicy(const std::unordered_map<DNSName, DNSFilterEngine::Policy>& polmap, const DNSName& qname, DNSFilterEngine::Policy& pol)
+bool DNSFilterEngine::Zone::findExactNamedPolicy(const NamePolicyMap& polmap, const DNSName& qname, DNSFilterEngine::Policy& pol)
 {
   if (polmap.empty()) {
     return false;
   }
 
-  const auto& it = polmap.find(qname);
-  if (it != polmap.end()) {
-    pol = it->second;
+  const auto found = polmap.find(qname);
+  if (found != nullptr) {
+    pol = *found;
     pol.d_trigger = qname;
     pol.d_hit = qname.toStringNoDot();
     return true;
@@ -134,67 +316,29 @@ bool DNSFilterEngine::Zone::findExactNamedPolicy(const std::unordered_map<DNSNam
 bool DNSFilterEngine::getProcessingPolicy(const DNSName& qname, const std::unordered_map<std::string,bool>& discardedPolicies, Policy& pol) const
 {
   // cout<<"Got question for nameserver name "<<qname<<endl;
-  std::vector<bool> zoneEnabled(d_zones.size());
-  size_t count = 0;
-  bool allEmpty = true;
+  /* the keys are only computed once we know that at least one zone needs to be checked,
+     then shared between all zones */
+  boost::optional<NameLookupKeys> keys;
   for (const auto& z : d_zones) {
-    bool enabled = true;
-    const auto& zoneName = z->getName();
     if (z->getPriority() >= pol.getPriority()) {
-      enabled = false;
+      continue;
     }
-    else if (discardedPolicies.find(zoneName) != discardedPolicies.end()) {
-      enabled = false;
+    if (!z->hasNSPolicies()) {
+      continue;
     }
-    else {
-      if (z->hasNSPolicies()) {
-        allEmpty = false;
-      }
-      else {
-        enabled = false;
-      }
+    const auto& zoneName = z->getName();
+    if (discardedPolicies.find(zoneName) != discardedPolicies.end()) {
+      continue;
     }
 
-    zoneEnabled[count] = enabled;
-    ++count;
-  }
-
-  if (allEmpty) {
-    return false;
-  }
-
-  /* prepare the wildcard-based names */
-  std::vector<DNSName> wcNames;
-  wcNames.reserve(qname.countLabels());
-  DNSName s(qname);
-  while (s.chopOff()){
-    wcNames.emplace_back(g_wildcarddnsname+s);
-  }
-
-  count = 0;
-  for(const auto& z : d_zones) {
-    if (!zoneEnabled[count]) {
-      ++count;
-      continue;
+    if (!keys) {
+      keys.emplace(qname);
     }
-    if (z->findExactNSPolicy(qname, pol)) {
+    if (z->findNSPolicy(*keys, pol)) {
       // cerr<<"Had a hit on the nameserver ("<<qname<<") used to process the query"<<endl;
-      pol.d_trigger = qname;
       pol.d_trigger.appendRawLabel(rpzNSDnameName);
-      pol.d_hit = qname.toStringNoDot();
       return true;
     }
-
-    for (const auto& wc : wcNames) {
-      if (z->findExactNSPolicy(wc, pol)) {
-        // cerr<<"Had a hit on the nameserver ("<<qname<<") used to process the query"<<endl;
-        pol.d_trigger = wc;
-        pol.d_trigger.appendRawLabel(rpzNSDnameName);
-        pol.d_hit = qname.toStringNoDot();
-        return true;
-      }
-    }
-    ++count;
   }
 
   return false;
@@ -247,68 +391,28 @@ bool DNSFilterEngine::getClientPolicy(const ComboAddress& ca, const std::unorder
 bool DNSFilterEngine::getQueryPolicy(const DNSName& qname, const std::unordered_map<std::string,bool>& discardedPolicies, Policy& pol) const
 {
   //cerr<<"Got question for "<<qname<<' '<< pol.getPriority()<< endl;
-  std::vector<bool> zoneEnabled(d_zones.size());
-  size_t count = 0;
-  bool allEmpty = true;
+  /* the keys are only computed once we know that at least one zone needs to be checked,
+     then shared between all zones */
+  boost::optional<NameLookupKeys> keys;
   for (const auto& z : d_zones) {
-    bool enabled = true;
     if (z->getPriority() >= pol.getPriority()) {
-      enabled = false;
-    } else {
-      const auto& zoneName = z->getName();
-      if (discardedPolicies.find(zoneName) != discardedPolicies.end()) {
-        enabled = false;
-      }
-      else {
-        if (z->hasQNamePolicies()) {
-          allEmpty = false;
-        }
-        else {
-          enabled = false;
-        }
-      }
+      continue;
     }
-
-    zoneEnabled[count] = enabled;
-    ++count;
-  }
-
-  if (allEmpty) {
-    return false;
-  }
-
-  /* prepare the wildcard-based names */
-  std::vector<DNSName> wcNames;
-  wcNames.reserve(qname.countLabels());
-  DNSName s(qname);
-  while (s.chopOff()){
-    wcNames.emplace_back(g_wildcarddnsname+s);
-  }
-
-  count = 0;
-  for (const auto& z : d_zones) {
-    if (!zoneEnabled[count]) {
-      ++count;
+    if (!z->hasQNamePolicies()) {
+      continue;
+    }
+    const auto& zoneName = z->getName();
+    if (discardedPolicies.find(zoneName) != discardedPolicies.end()) {
       continue;
     }
 
-    if (z->findExactQNamePolicy(qname, pol)) {
+    if (!keys) {
+      keys.emplace(qname);
+    }
+    if (z->findQNamePolicy(*keys, pol)) {
       // cerr<<"Had a hit on the name of the query"<<endl;
-      pol.d_trigger = qname;
-      pol.d_hit = qname.toStringNoDot();
       return true;
     }
-
-    for (const auto& wc : wcNames) {
-      if (z->findExactQNamePolicy(wc, pol)) {
-        // cerr<<"Had a hit on the name of the query"<<endl;
-        pol.d_trigger = wc;
-        pol.d_hit = qname.toStringNoDot();
-        return true;
-      }
-    }
-
-    ++count;
   }
 
   return false;
@@ -372,12 +476,12 @@ void DNSFilterEngine::assureZones(size_t zone)
     d_zones.resize(zone+1);
 }
 
-void DNSFilterEngine::Zone::addNameTrigger(std::unordered_map<DNSName,Policy>& map, const DNSName& n, Policy&& pol, bool ignoreDuplicate, PolicyType ptype)
+void DNSFilterEngine::Zone::addNameTrigger(NamePolicyMap& map, const DNSName& n, Policy&& pol, bool ignoreDuplicate, PolicyType ptype)
 {
-  auto it = map.find(n);
+  auto existing = map.findWritable(n);
 
-  if (it != map.end()) {
-    auto& existingPol = it->second;
+  if (existing != nullptr) {
+    auto& existingPol = *existing;
 
     if (pol.d_kind != PolicyKind::Custom && !ignoreDuplicate) {
       throw std::runtime_error("Adding a " + getTypeToString(ptype) + "-based filter policy of kind " + getKindToString(pol.d_kind) + " but a policy of kind " + getKindToString(existingPol.d_kind) + " already exists for the following name: " + n.toLogString());
@@ -392,14 +496,15 @@ void DNSFilterEngine::Zone::addNameTrigger(std::unordered_map<DNSName,Policy>& m
     std::move(pol.d_custom.begin(), pol.d_custom.end(), std::back_inserter(existingPol.d_custom));
   }
   else {
-    auto& qpol = map.insert({n, std::move(pol)}).first->second;
-    qpol.d_zoneData = d_zoneData;
-    qpol.d_type = ptype;
+    pol.d_zoneData = d_zoneData;
+    pol.d_type = ptype;
+    map.insert(n, std::move(pol));
   }
 }
 
-void DNSFilterEngine::Zone::addNetmaskTrigger(NetmaskTree<Policy>& nmt, const Netmask& nm, Policy&& pol, bool ignoreDuplicate, PolicyType ptype)
+void DNSFilterEngine::Zone::addNetmaskTrigger(NetmaskPolicyTree& tree, const Netmask& nm, Policy&& pol, bool ignoreDuplicate, PolicyType ptype)
 {
+  auto& nmt = tree.getWritable();
   bool exists = nmt.has_key(nm);
 
   if (exists) {
@@ -426,16 +531,16 @@ void DNSFilterEngine::Zone::addNetmaskTrigger(NetmaskTree<Policy>& nmt, const Ne
   }
 }
 
-bool DNSFilterEngine::Zone::rmNameTrigger(std::unordered_map<DNSName,Policy>& map, const DNSName& n, const Policy& pol)
+bool DNSFilterEngine::Zone::rmNameTrigger(NamePolicyMap& map, const DNSName& n, const Policy& pol)
 {
-  auto found = map.find(n);
-  if (found == map.end()) {
+  auto found = map.findWritable(n);
+  if (found == nullptr) {
     return false;
   }
 
-  auto& existing = found->second;
+  auto& existing = *found;
   if (existing.d_kind != DNSFilterEngine::PolicyKind::Custom) {
-    map.erase(found);
+    map.erase(n);
     return true;
   }
 
@@ -454,20 +559,22 @@ bool DNSFilterEngine::Zone::rmNameTrigger(std::unordered_map<DNSName,Policy>& ma
 
   // No records left for this trigger?
   if (existing.d_custom.size() == 0) {
-    map.erase(found);
+    map.erase(n);
     return true;
   }
 
   return result;
 }
 
-bool DNSFilterEngine::Zone::rmNetmaskTrigger(NetmaskTree<Policy>& nmt, const Netmask& nm, const Policy& pol)
+bool DNSFilterEngine::Zone::rmNetmaskTrigger(NetmaskPolicyTree& tree, const Netmask& nm, const Policy& pol)
 {
-  bool found = nmt.has_key(nm);
+  bool found = tree.get().has_key(nm);
   if (!found) {
     return false;
   }
 
+  auto& nmt = tree.getWritable();
+
   // XXX NetMaskTree's node_type has a non-const second, but lookup() returns a const node_type *, so we cannot modify second
   // Should look into making lookup) return a non-const node_type *...
   auto& existing = const_cast<Policy&>(nmt.lookup(nm)->second);
@@ -677,14 +784,6 @@ std::vector<DNSRecord> DNSFilterEngine::Policy::getRecords(const DNSName& qname)
   return result;
 }
 
-void DNSFilterEngine::Zone::dumpNamedPolicy(FILE* fp, const DNSName& name, const Policy& pol)
-{
-  auto records = pol.getRecords(name);
-  for (const auto& dr : records) {
-    fprintf(fp, "%s %" PRIu32 " IN %s %s\n", dr.d_name.toString().c_str(), dr.d_ttl, QType(dr.d_type).toString().c_str(), dr.d_content->getZoneRepresentation().c_str());
-  }
-}
-
 DNSName DNSFilterEngine::Zone::maskToRPZ(const Netmask& nm)
 {
   int bits = nm.getBits();
@@ -756,42 +855,46 @@ DNSName DNSFilterEngine::Zone::maskToRPZ(const Netmask& nm)
 }
 
 
-void DNSFilterEngine::Zone::dumpAddrPolicy(FILE* fp, const Netmask& nm, const DNSName& name, const Policy& pol)
+void DNSFilterEngine::Zone::visitRecords(const std::function<void(const DNSRecord&)>& visitor) const
 {
-  DNSName full = maskToRPZ(nm);
-  full += name;
+  static const DNSName nsDnameSuffix(rpzNSDnameName), clientIPSuffix(rpzClientIPName), nsIPSuffix(rpzNSIPName), ipSuffix(rpzIPName);
 
-  auto records = pol.getRecords(full);
-  for (const auto& dr : records) {
-    fprintf(fp, "%s %" PRIu32 " IN %s %s\n", dr.d_name.toString().c_str(), dr.d_ttl, QType(dr.d_type).toString().c_str(), dr.d_content->getZoneRepresentation().c_str());
-  }
-}
+  auto visitPolicy = [&visitor](const DNSName& name, const Policy& pol) {
+    for (const auto& dr : pol.getRecords(name)) {
+      visitor(dr);
+    }
+  };
 
-void DNSFilterEngine::Zone::dump(FILE* fp) const
-{
-  /* fake the SOA record */
-  auto soa = DNSRecordContent::mastermake(QType::SOA, QClass::IN, "fake.RPZ. hostmaster.fake.RPZ. " + std::to_string(d_serial) + " " + std::to_string(d_refresh) + " 600 3600000 604800");
-  fprintf(fp, "%s IN SOA %s\n", d_domain.toString().c_str(), soa->getZoneRepresentation().c_str());
+  d_qpolName.visit([&visitPolicy](const DNSName& name, const Policy& pol) {
+    visitPolicy(name, pol);
+  });
 
-  for (const auto& pair : d_qpolName) {
-    dumpNamedPolicy(fp, pair.first + d_domain, pair.second);
-  }
+  d_propolName.visit([&visitPolicy](const DNSName& name, const Policy& pol) {
+    visitPolicy(name + nsDnameSuffix, pol);
+  });
 
-  for (const auto& pair : d_propolName) {
-    dumpNamedPolicy(fp, pair.first + DNSName(rpzNSDnameName) + d_domain, pair.second);
+  for (const auto& pair : d_qpolAddr.get()) {
+    visitPolicy(maskToRPZ(pair.first) + clientIPSuffix, pair.second);
   }
 
-  for (const auto& pair : d_qpolAddr) {
-    dumpAddrPolicy(fp, pair.first, DNSName(rpzClientIPName) + d_domain, pair.second);
+  for (const auto& pair : d_propolNSAddr.get()) {
+    visitPolicy(maskToRPZ(pair.first) + nsIPSuffix, pair.second);
   }
 
-  for (const auto& pair : d_propolNSAddr) {
-    dumpAddrPolicy(fp, pair.first, DNSName(rpzNSIPName) + d_domain, pair.second);
+  for (const auto& pair : d_postpolAddr.get()) {
+    visitPolicy(maskToRPZ(pair.first) + ipSuffix, pair.second);
   }
+}
 
-  for (const auto& pair : d_postpolAddr) {
-    dumpAddrPolicy(fp, pair.first, DNSName(rpzIPName) + d_domain, pair.second);
-  }
+void DNSFilterEngine::Zone::dump(FILE* fp) const
+{
+  /* fake the SOA record */
+  auto soa = DNSRecordContent::mastermake(QType::SOA, QClass::IN, "fake.RPZ. hostmaster.fake.RPZ. " + std::to_string(d_serial) + " " + std::to_string(d_refresh) + " 600 3600000 604800");
+  fprintf(fp, "%s IN SOA %s\n", d_domain.toString().c_str(), soa->getZoneRepresentation().c_str());
+
+  visitRecords([this, fp](const DNSRecord& dr) {
+    fprintf(fp, "%s %" PRIu32 " IN %s %s\n", (dr.d_name + d_domain).toString().c_str(), dr.d_ttl, QType(dr.d_type).toString().c_str(), dr.d_content->getZoneRepresentation().c_str());
+  });
 }
 
 void mergePolicyTags(std::unordered_set<std::string>& tags, const std::unordered_set<std::string>& newTags)
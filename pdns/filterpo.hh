@@ -24,7 +24,11 @@
 #include "dns.hh"
 #include "dnsname.hh"
 #include "dnsparser.hh"
+#include <array>
+#include <atomic>
+#include <functional>
 #include <map>
+#include <memory>
 #include <unordered_map>
 #include <limits>
 
@@ -171,6 +175,45 @@ public:
     DNSRecord getRecordFromCustom(const DNSName& qname, const std::shared_ptr<DNSRecordContent>& custom) const;
   };
 
+  /* The names that a name can match as a QNAME or NSDNAME trigger: the name itself,
+     then the wildcards covering it, from the most specific one to the least specific one.
+     They are hashed once per lookup, then looked up in every zone without allocating. */
+  class NameLookupKeys
+  {
+  public:
+    NameLookupKeys(const DNSName& qname);
+
+    size_t size() const
+    {
+      return d_count;
+    }
+    const DNSName& getQName() const
+    {
+      return d_qname;
+    }
+    uint32_t getHash(size_t idx) const
+    {
+      return d_keys.at(idx).d_hash;
+    }
+    /* whether the trigger name matches the key at this index */
+    bool matches(size_t idx, const DNSName& name) const;
+    /* the trigger name for the key at this index, only built once we have a hit */
+    DNSName getName(size_t idx) const;
+
+  private:
+    struct Key
+    {
+      uint32_t d_hash{0};
+      /* offset of the covered suffix in the storage of the name, 0 for the name itself */
+      uint16_t d_offset{0};
+    };
+
+    const DNSName& d_qname;
+    /* a name has at most 127 labels, so 128 keys with the name itself */
+    std::array<Key, 128> d_keys;
+    size_t d_count{0};
+  };
+
   class Zone {
   public:
     Zone(): d_zoneData(std::make_shared<PolicyZoneData>())
@@ -244,10 +287,12 @@ public:
 
     size_t size() const
     {
-      return d_qpolAddr.size() + d_postpolAddr.size() + d_propolName.size() + d_propolNSAddr.size() + d_qpolName.size();
+      return d_qpolAddr.get().size() + d_postpolAddr.get().size() + d_propolName.size() + d_propolNSAddr.get().size() + d_qpolName.size();
     }
 
     void dump(FILE * fp) const;
+    /* calls the visitor for every RPZ record of this zone, with names relative to the zone */
+    void visitRecords(const std::function<void(const DNSRecord&)>& visitor) const;
 
     void addClientTrigger(const Netmask& nm, Policy&& pol, bool ignoreDuplicate = false);
     void addQNameTrigger(const DNSName& nm, Policy&& pol, bool ignoreDuplicate = false);
@@ -263,13 +308,15 @@ public:
 
     bool findExactQNamePolicy(const DNSName& qname, DNSFilterEngine::Policy& pol) const;
     bool findExactNSPolicy(const DNSName& qname, DNSFilterEngine::Policy& pol) const;
+    bool findQNamePolicy(const NameLookupKeys& keys, DNSFilterEngine::Policy& pol) const;
+    bool findNSPolicy(const NameLookupKeys& keys, DNSFilterEngine::Policy& pol) const;
     bool findNSIPPolicy(const ComboAddress& addr, DNSFilterEngine::Policy& pol) const;
     bool findResponsePolicy(const ComboAddress& addr, DNSFilterEngine::Policy& pol) const;
     bool findClientPolicy(const ComboAddress& addr, DNSFilterEngine::Policy& pol) const;
 
     bool hasClientPolicies() const
     {
-      return !d_qpolAddr.empty();
+      return !d_qpolAddr.get().empty();
     }
     bool hasQNamePolicies() const
     {
@@ -281,11 +328,11 @@ public:
     }
     bool hasNSIPPolicies() const
     {
-      return !d_propolNSAddr.empty();
+      return !d_propolNSAddr.get().empty();
     }
     bool hasResponsePolicies() const
     {
-      return !d_postpolAddr.empty();
+      return !d_postpolAddr.get().empty();
     }
     Priority getPriority() const {
       return d_zoneData->d_priority;
@@ -297,22 +344,185 @@ public:
     static DNSName maskToRPZ(const Netmask& nm);
 
   private:
-    void addNameTrigger(std::unordered_map<DNSName,Policy>& map, const DNSName& n, Policy&& pol, bool ignoreDuplicate, PolicyType ptype);
-    void addNetmaskTrigger(NetmaskTree<Policy>& nmt, const Netmask& nm, Policy&& pol, bool ignoreDuplicate, PolicyType ptype);
-    bool rmNameTrigger(std::unordered_map<DNSName,Policy>& map, const DNSName& n, const Policy& pol);
-    bool rmNetmaskTrigger(NetmaskTree<Policy>& nmt, const Netmask& nm, const Policy& pol);
+    /* A zone is never modified once it has been published, so applying an update means
+       copying it first. To keep that cheap for large zones, copies share their policies
+       until they are modified. Every container gets a new owner ID when it is copied, and
+       so does the container it was copied from: a shared part is only modified in place by
+       the container that created it as long as it has not been copied since, otherwise it
+       is duplicated first. */
+    class CopyOnWriteOwner
+    {
+    public:
+      CopyOnWriteOwner() :
+        d_id(++s_ids)
+      {
+      }
+      CopyOnWriteOwner(const CopyOnWriteOwner& rhs) :
+        d_id(++s_ids)
+      {
+        rhs.d_id = ++s_ids;
+      }
+      CopyOnWriteOwner& operator=(const CopyOnWriteOwner& rhs)
+      {
+        d_id = ++s_ids;
+        rhs.d_id = ++s_ids;
+        return *this;
+      }
+      uint64_t get() const
+      {
+        return d_id;
+      }
+
+    private:
+      mutable std::atomic<uint64_t> d_id;
+      static std::atomic<uint64_t> s_ids;
+    };
+
+    template <typename T>
+    struct CopyOnWritePart
+    {
+      T d_value;
+      uint64_t d_owner;
+    };
+
+    template <typename T>
+    static T& getWritablePart(std::shared_ptr<CopyOnWritePart<T>>& part, const CopyOnWriteOwner& owner)
+    {
+      if (!part) {
+        part = std::make_shared<CopyOnWritePart<T>>(CopyOnWritePart<T>{T(), owner.get()});
+      }
+      else if (part->d_owner != owner.get()) {
+        part = std::make_shared<CopyOnWritePart<T>>(CopyOnWritePart<T>{part->d_value, owner.get()});
+      }
+      return part->d_value;
+    }
+
+    /* Names are spread over buckets, so that modifying a copy only duplicates the buckets
+       holding the modified names. The number of buckets grows with the number of entries. */
+    class NamePolicyMap
+    {
+    public:
+      NamePolicyMap() :
+        d_buckets(s_minBuckets)
+      {
+      }
+
+      const Policy* find(const DNSName& name) const;
+      const Policy* find(const NameLookupKeys& keys, size_t idx) const;
+      Policy* findWritable(const DNSName& name);
+      void insert(const DNSName& name, Policy&& pol);
+      void erase(const DNSName& name);
+      void clear();
+      void reserve(size_t count);
+
+      size_t size() const
+      {
+        return d_size;
+      }
+      bool empty() const
+      {
+        return d_size == 0;
+      }
+
+      template <typename F>
+      void visit(F func) const
+      {
+        for (const auto& bucket : d_buckets) {
+          if (bucket) {
+            for (const auto& entry : bucket->d_value) {
+              func(entry.d_name, entry.d_policy);
+            }
+          }
+        }
+      }
+
+    private:
+      struct Entry
+      {
+        DNSName d_name;
+        Policy d_policy;
+        uint32_t d_hash;
+      };
+      /* Entries are sorted by hash, so that a lookup with an already computed hash
+         does not have to hash the name again */
+      typedef std::vector<Entry> bucket_t;
+
+      size_t getBucketIndex(uint32_t hash) const
+      {
+        return hash & (d_buckets.size() - 1);
+      }
+
+      template <typename B, typename F>
+      static auto findEntry(B& bucket, uint32_t hash, F matches) -> decltype(bucket.begin())
+      {
+        auto it = std::lower_bound(bucket.begin(), bucket.end(), hash, [](const Entry& entry, uint32_t value) {
+          return entry.d_hash < value;
+        });
+        for (; it != bucket.end() && it->d_hash == hash; ++it) {
+          if (matches(it->d_name)) {
+            return it;
+          }
+        }
+        return bucket.end();
+      }
+      static void insertEntry(bucket_t& bucket, Entry&& entry);
+      void rehash(size_t bucketsCount);
+
+      static constexpr size_t s_minBuckets = 16;
+      static constexpr size_t s_maxBuckets = 1 << 20;
+      static constexpr size_t s_maxAverageBucketSize = 32;
+      /* Used both when growing one insertion at a time and when reserving, so that a map ends up
+         with the same number of buckets either way. Every rehash copies the buckets still shared
+         with the previous version of the zone, so growing by 4 instead of 2 halves the number of
+         rehashes while a zone is loaded, for at most twice as many (mostly small) buckets. It has
+         to be a power of two, and s_maxBuckets / s_minBuckets a power of it. */
+      static constexpr size_t s_growthFactor = 4;
+
+      std::vector<std::shared_ptr<CopyOnWritePart<bucket_t>>> d_buckets;
+      CopyOnWriteOwner d_owner;
+      size_t d_size{0};
+    };
+
+    /* Netmask trees are not split, but still only copied when they are modified */
+    class NetmaskPolicyTree
+    {
+    public:
+      const NetmaskTree<Policy>& get() const
+      {
+        static const NetmaskTree<Policy> empty;
+        if (!d_tree) {
+          return empty;
+        }
+        return d_tree->d_value;
+      }
+      NetmaskTree<Policy>& getWritable()
+      {
+        return getWritablePart(d_tree, d_owner);
+      }
+      void clear()
+      {
+        d_tree.reset();
+      }
+
+    private:
+      std::shared_ptr<CopyOnWritePart<NetmaskTree<Policy>>> d_tree{nullptr};
+      CopyOnWriteOwner d_owner;
+    };
+
+    void addNameTrigger(NamePolicyMap& map, const DNSName& n, Policy&& pol, bool ignoreDuplicate, PolicyType ptype);
+    void addNetmaskTrigger(NetmaskPolicyTree& nmt, const Netmask& nm, Policy&& pol, bool ignoreDuplicate, PolicyType ptype);
+    bool rmNameTrigger(NamePolicyMap& map, const DNSName& n, const Policy& pol);
+    bool rmNetmaskTrigger(NetmaskPolicyTree& nmt, const Netmask& nm, const Policy& pol);
 
   private:
-    static bool findExactNamedPolicy(const std::unordered_map<DNSName, DNSFilterEngine::Policy>& polmap, const DNSName& qname, DNSFilterEngine::Policy& pol);
-    static bool findNamedPolicy(const std::unordered_map<DNSName, DNSFilterEngine::Policy>& polmap, const DNSName& qname, DNSFilterEngine::Policy& pol);
-    static void dumpNamedPolicy(FILE* fp, const DNSName& name, const Policy& pol);
-    static void dumpAddrPolicy(FILE* fp, const Netmask& nm, const DNSName& name, const Policy& pol);
-
-    std::unordered_map<DNSName, Policy> d_qpolName;   // QNAME trigger (RPZ)
-    NetmaskTree<Policy> d_qpolAddr;         // Source address
-    std::unordered_map<DNSName, Policy> d_propolName; // NSDNAME (RPZ)
-    NetmaskTree<Policy> d_propolNSAddr;     // NSIP (RPZ)
-    NetmaskTree<Policy> d_postpolAddr;      // IP trigger (RPZ)
+    static bool findExactNamedPolicy(const NamePolicyMap& polmap, const DNSName& qname, DNSFilterEngine::Policy& pol);
+    static bool findNamedPolicy(const NamePolicyMap& polmap, const NameLookupKeys& keys, DNSFilterEngine::Policy& pol);
+
+    NamePolicyMap d_qpolName;   // QNAME trigger (RPZ)
+    NetmaskPolicyTree d_qpolAddr;         // Source address
+    NamePolicyMap d_propolName; // NSDNAME (RPZ)
+    NetmaskPolicyTree d_propolNSAddr;     // NSIP (RPZ)
+    NetmaskPolicyTree d_postpolAddr;      // IP trigger (RPZ)
     DNSName d_domain;
     std::shared_ptr<PolicyZoneData> d_zoneData{nullptr};
     uint32_t d_serial{0};
@@ -615,6 +615,11 @@ public:
 
   bool operator==(const Netmask& rhs) const
   {
+    /* the address part of an empty netmask is not initialized, and all empty
+       netmasks are considered equal by operator<, so be consistent */
+    if (empty() || rhs.empty()) {
+      return empty() && rhs.empty();
+    }
     return tie(d_network, d_bits) == tie(rhs.d_network, rhs.d_bits);
   }
 
@@ -665,6 +670,14 @@ private:
   uint8_t d_bits;
 };
 
+inline size_t hash_value(const Netmask& nm)
+{
+  if (nm.empty()) {
+    return 0;
+  }
+  return ComboAddress::addressOnlyHash()(nm.getNetwork()) ^ nm.getBits();
+}
+
 /** Binary tree map implementation with <Netmask,T> pair.
  *
  * This is an binary tree implementation for storing attributes for IPv4 and IPv6 prefixes.
@@ -25,6 +25,7 @@
 #include <type_traits>
 #include <new>
 #include <sys/mman.h>
+#include <unistd.h>
 
 // On OpenBSD mem used as stack should be marked MAP_STACK
 #if !defined(MAP_STACK)
@@ -39,31 +40,42 @@ struct lazy_allocator {
     static_assert (std::is_trivial<T>::value,
                    "lazy_allocator must only be used with trivial types");
 
+    /* The memory is directly mmap()'ed, so that pages are only backed
+     * by actual memory once they are touched, with an inaccessible guard
+     * page right below it: this memory is used for mthread stacks, which
+     * grow downwards, and we want an overflow to crash right away instead
+     * of silently corrupting whatever is located before the stack.
+     */
     pointer
     allocate (size_type const n) {
-#ifdef __OpenBSD__
-        void *p = mmap(nullptr, n * sizeof(value_type),
+        size_type const pageSize = getPageSize();
+        void *p = mmap(nullptr, getPaddedSize(n) + pageSize,
           PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON | MAP_STACK, -1, 0);
         if (p == MAP_FAILED)
           throw std::bad_alloc();
-        return static_cast<pointer>(p);
-#else
-        return static_cast<pointer>(::operator new (n * sizeof(value_type)));
-#endif
+        if (mprotect(p, pageSize, PROT_NONE) != 0) {
+          munmap(p, getPaddedSize(n) + pageSize);
+          throw std::bad_alloc();
+        }
+        return reinterpret_cast<pointer>(static_cast<char*>(p) + pageSize);
     }
 
     void
     deallocate (pointer const ptr, size_type const n) noexcept {
-#ifdef __OpenBSD__
-        munmap(ptr, n * sizeof(value_type));
-#else
-#if defined(__cpp_sized_deallocation) &&  (__cpp_sized_deallocation >= 201309)
-        ::operator delete (ptr, n * sizeof(value_type));
-#else
-        (void) n;
-        ::operator delete (ptr);
-#endif
-#endif
+        size_type const pageSize = getPageSize();
+        munmap(reinterpret_cast<char*>(ptr) - pageSize, getPaddedSize(n) + pageSize);
+    }
+
+    static size_type
+    getPageSize () noexcept {
+        static size_type const pageSize = sysconf(_SC_PAGESIZE);
+        return pageSize;
+    }
+
+    static size_type
+    getPaddedSize (size_type const n) noexcept {
+        size_type const pageSize = getPageSize();
+        return ((n * sizeof(value_type) + pageSize - 1) / pageSize) * pageSize;
     }
 
     void construct (T*) const noexcept {}
@@ -506,7 +506,16 @@ OpenSSLTLSTicketKeysRing::~OpenSSLTLSTicketKeysRing()
 
 void OpenSSLTLSTicketKeysRing::addKey(std::shared_ptr<OpenSSLTLSTicketKey> newKey)
 {
-  d_ticketKeys.write_lock()->push_front(newKey);
+  auto keys = d_ticketKeys.write_lock();
+  /* reloading a file might give us a key we already have, move it to the front
+     instead of wasting a slot on a duplicate */
+  for (auto it = keys->begin(); it != keys->end(); ++it) {
+    if ((*it)->nameMatches(*newKey)) {
+      keys->erase(it);
+      break;
+    }
+  }
+  keys->push_front(newKey);
 }
 
 std::shared_ptr<OpenSSLTLSTicketKey> OpenSSLTLSTicketKeysRing::getEncryptionKey()
@@ -533,6 +542,9 @@ size_t OpenSSLTLSTicketKeysRing::getKeysCount()
 
 void OpenSSLTLSTicketKeysRing::loadTicketsKeys(const std::string& keyFile)
 {
+  /* get the state before reading the keys, so that a concurrent update
+     will be picked up by the next rotation */
+  TLSTicketsKeyFileState state(keyFile);
   bool keyLoaded = false;
   std::ifstream file(keyFile);
   try {
@@ -551,6 +563,7 @@ void OpenSSLTLSTicketKeysRing::loadTicketsKeys(const std::string& keyFile)
   }
 
   file.close();
+  *(d_keyFileState.lock()) = std::move(state);
 }
 
 void OpenSSLTLSTicketKeysRing::rotateTicketsKey(time_t now)
@@ -559,6 +572,19 @@ void OpenSSLTLSTicketKeysRing::rotateTicketsKey(time_t now)
   addKey(newKey);
 }
 
+bool OpenSSLTLSTicketKeysRing::reloadModifiedTicketsKeysFile()
+{
+  auto currentState = *(d_keyFileState.lock());
+  if (currentState.d_file.empty()) {
+    return false;
+  }
+
+  if (TLSTicketsKeyFileState(currentState.d_file) != currentState) {
+    loadTicketsKeys(currentState.d_file);
+  }
+  return true;
+}
+
 OpenSSLTLSTicketKey::OpenSSLTLSTicketKey()
 {
   if (RAND_bytes(d_name, sizeof(d_name)) != 1) {
@@ -6,6 +6,7 @@
 #include <memory>
 #include <string>
 #include <vector>
+#include <sys/stat.h>
 
 #include "config.h"
 #include "circular_buffer.hh"
@@ -37,6 +38,9 @@ public:
   bool d_releaseBuffers{true};
   /* whether so-called secure renegotiation should be allowed for TLS < 1.3 */
   bool d_enableRenegotiation{false};
+  /* whether rotating the tickets keys reloads d_ticketKeyFile, if it has been modified,
+     instead of generating a new random key */
+  bool d_reloadTicketKeyFile{false};
 };
 
 struct TLSErrorCounters
@@ -52,6 +56,43 @@ struct TLSErrorCounters
   std::atomic<uint64_t> d_unsupportedProtocol{0}; /* we don't accept this TLS version, sorry */
 };
 
+/* Identity of a tickets key file at the time it was loaded, so that a periodic rotation
+   can reload it only when it has been updated, usually by an external process distributing
+   the same keys to several instances. */
+struct TLSTicketsKeyFileState
+{
+  TLSTicketsKeyFileState()
+  {
+  }
+
+  TLSTicketsKeyFileState(const std::string& file): d_file(file)
+  {
+    struct stat st;
+    if (stat(file.c_str(), &st) == 0) {
+      d_dev = st.st_dev;
+      d_ino = st.st_ino;
+      d_size = st.st_size;
+      d_mtime = st.st_mtime;
+    }
+  }
+
+  bool operator==(const TLSTicketsKeyFileState& rhs) const
+  {
+    return d_file == rhs.d_file && d_dev == rhs.d_dev && d_ino == rhs.d_ino && d_size == rhs.d_size && d_mtime == rhs.d_mtime;
+  }
+
+  bool operator!=(const TLSTicketsKeyFileState& rhs) const
+  {
+    return !(*this == rhs);
+  }
+
+  std::string d_file;
+  dev_t d_dev{0};
+  ino_t d_ino{0};
+  off_t d_size{0};
+  time_t d_mtime{0};
+};
+
 #ifdef HAVE_LIBSSL
 #include <openssl/ssl.h>
 
@@ -77,6 +118,10 @@ public:
   ~OpenSSLTLSTicketKey();
 
   bool nameMatches(const unsigned char name[TLS_TICKETS_KEY_NAME_SIZE]) const;
+  bool nameMatches(const OpenSSLTLSTicketKey& rhs) const
+  {
+    return nameMatches(rhs.d_name);
+  }
   int encrypt(unsigned char keyName[TLS_TICKETS_KEY_NAME_SIZE], unsigned char *iv, EVP_CIPHER_CTX *ectx, HMAC_CTX *hctx) const;
   bool decrypt(const unsigned char* iv, EVP_CIPHER_CTX *ectx, HMAC_CTX *hctx) const;
 
@@ -97,9 +142,14 @@ public:
   size_t getKeysCount();
   void loadTicketsKeys(const std::string& keyFile);
   void rotateTicketsKey(time_t now);
+  /* reloads the file the keys have been loaded from if it has been modified since,
+     returns false if they have not been loaded from a file */
+  bool reloadModifiedTicketsKeysFile();
 
 private:
   SharedLockGuarded<boost::circular_buffer<std::shared_ptr<OpenSSLTLSTicketKey> > > d_ticketKeys;
+  /* set if the keys have been loaded from a file */
+  LockGuarded<TLSTicketsKeyFileState> d_keyFileState;
 };
 
 void* libssl_get_ticket_key_callback_data(SSL* s);
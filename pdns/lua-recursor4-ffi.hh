@@ -89,4 +89,62 @@ extern "C"
   void pdns_ffi_param_set_padding_disabled(pdns_ffi_param_t* ref, bool disabled) __attribute__((visibility("default")));
   void pdns_ffi_param_add_meta_single_string_kv(pdns_ffi_param_t* ref, const char* key, const char* val) __attribute__((visibility("default")));
   void pdns_ffi_param_add_meta_single_int64_kv(pdns_ffi_param_t* ref, const char* key, int64_t val) __attribute__((visibility("default")));
+
+  /* used by the preresolve_ffi, nxdomain_ffi, nodata_ffi and postresolve_ffi hooks */
+  typedef struct pdns_resolve_ffi_handle pdns_resolve_ffi_handle_t;
+
+  typedef enum
+  {
+    pdns_policy_kind_noaction = 0,
+    pdns_policy_kind_drop = 1,
+    pdns_policy_kind_nxdomain = 2,
+    pdns_policy_kind_nodata = 3,
+    pdns_policy_kind_truncate = 4,
+    pdns_policy_kind_custom = 5
+  } pdns_policy_kind_t;
+
+  typedef struct pdns_ffi_record
+  {
+    const char* name;
+    size_t name_len;
+    const char* content;
+    size_t content_len;
+    uint32_t ttl;
+    pdns_record_place_t place;
+    uint16_t type;
+  } pdns_ffi_record_t;
+
+  const char* pdns_resolve_ffi_handle_get_qname(pdns_resolve_ffi_handle_t* ref) __attribute__((visibility("default")));
+  void pdns_resolve_ffi_handle_get_qname_raw(pdns_resolve_ffi_handle_t* ref, const char** qname, size_t* qnameSize) __attribute__((visibility("default")));
+  uint16_t pdns_resolve_ffi_handle_get_qtype(const pdns_resolve_ffi_handle_t* ref) __attribute__((visibility("default")));
+  const char* pdns_resolve_ffi_handle_get_remote(pdns_resolve_ffi_handle_t* ref) __attribute__((visibility("default")));
+  void pdns_resolve_ffi_handle_get_remote_raw(pdns_resolve_ffi_handle_t* ref, const void** addr, size_t* addrSize) __attribute__((visibility("default")));
+  uint16_t pdns_resolve_ffi_handle_get_remote_port(const pdns_resolve_ffi_handle_t* ref) __attribute__((visibility("default")));
+  const char* pdns_resolve_ffi_handle_get_local(pdns_resolve_ffi_handle_t* ref) __attribute__((visibility("default")));
+  void pdns_resolve_ffi_handle_get_local_raw(pdns_resolve_ffi_handle_t* ref, const void** addr, size_t* addrSize) __attribute__((visibility("default")));
+  uint16_t pdns_resolve_ffi_handle_get_local_port(const pdns_resolve_ffi_handle_t* ref) __attribute__((visibility("default")));
+  bool pdns_resolve_ffi_handle_get_tcp(const pdns_resolve_ffi_handle_t* ref) __attribute__((visibility("default")));
+  unsigned int pdns_resolve_ffi_handle_get_tag(const pdns_resolve_ffi_handle_t* ref) __attribute__((visibility("default")));
+  int pdns_resolve_ffi_handle_get_rcode(const pdns_resolve_ffi_handle_t* ref) __attribute__((visibility("default")));
+  bool pdns_resolve_ffi_handle_has_policytag(const pdns_resolve_ffi_handle_t* ref, const char* name) __attribute__((visibility("default")));
+  pdns_policy_kind_t pdns_resolve_ffi_handle_get_appliedpolicy_kind(const pdns_resolve_ffi_handle_t* ref) __attribute__((visibility("default")));
+
+  void pdns_resolve_ffi_handle_set_rcode(pdns_resolve_ffi_handle_t* ref, int rcode) __attribute__((visibility("default")));
+  void pdns_resolve_ffi_handle_set_variable(pdns_resolve_ffi_handle_t* ref, bool variable) __attribute__((visibility("default")));
+  void pdns_resolve_ffi_handle_set_follow_cname_records(pdns_resolve_ffi_handle_t* ref, bool follow) __attribute__((visibility("default")));
+  void pdns_resolve_ffi_handle_add_policytag(pdns_resolve_ffi_handle_t* ref, const char* name) __attribute__((visibility("default")));
+  // returns false if there is no applied policy, or if the kind is not valid
+  bool pdns_resolve_ffi_handle_set_appliedpolicy_kind(pdns_resolve_ffi_handle_t* ref, pdns_policy_kind_t kind) __attribute__((visibility("default")));
+
+  /* the records are not copied: they can be read in place, and are only modified through these functions */
+  size_t pdns_resolve_ffi_handle_get_records_count(const pdns_resolve_ffi_handle_t* ref) __attribute__((visibility("default")));
+  /* returns false if there is no record at this index. When 'raw' is true, the name and content are
+     in wire format, otherwise they are in text format. The pointers are valid until the hook returns or the records are modified. */
+  bool pdns_resolve_ffi_handle_get_record(pdns_resolve_ffi_handle_t* ref, size_t idx, pdns_ffi_record_t* record, bool raw) __attribute__((visibility("default")));
+  /* replaces the content of an existing record, returns false if something went wrong */
+  bool pdns_resolve_ffi_handle_set_record(pdns_resolve_ffi_handle_t* ref, size_t idx, const char* content, size_t contentSize, bool raw) __attribute__((visibility("default")));
+  void pdns_resolve_ffi_handle_clear_records(pdns_resolve_ffi_handle_t* ref) __attribute__((visibility("default")));
+  /* returns true if the record was correctly added, false if something went wrong.
+     Passing a NULL pointer to 'name' will result in the qname being used for the record owner name. */
+  bool pdns_resolve_ffi_handle_add_record(pdns_resolve_ffi_handle_t* ref, const char* name, uint16_t type, uint32_t ttl, const char* content, size_t contentSize, pdns_record_place_t place, bool raw) __attribute__((visibility("default")));
 }
@@ -30,6 +30,7 @@
 #include "ednssubnet.hh"
 #include "filterpo.hh"
 #include "rec-snmp.hh"
+#include "lua-recursor4-resolve-ffi.hh"
 #include <unordered_set>
 
 RecursorLua4::RecursorLua4() { prepareContext(); }
@@ -477,6 +478,10 @@ void RecursorLua4::postLoad()
   d_nxdomain = d_lw->readVariable<boost::optional<luacall_t>>("nxdomain").get_value_or(0);
   d_postresolve = d_lw->readVariable<boost::optional<luacall_t>>("postresolve").get_value_or(0);
   d_preoutquery = d_lw->readVariable<boost::optional<luacall_t>>("preoutquery").get_value_or(0);
+  d_preresolve_ffi = d_lw->readVariable<boost::optional<resolve_ffi_t>>("preresolve_ffi").get_value_or(0);
+  d_nodata_ffi = d_lw->readVariable<boost::optional<resolve_ffi_t>>("nodata_ffi").get_value_or(0);
+  d_nxdomain_ffi = d_lw->readVariable<boost::optional<resolve_ffi_t>>("nxdomain_ffi").get_value_or(0);
+  d_postresolve_ffi = d_lw->readVariable<boost::optional<resolve_ffi_t>>("postresolve_ffi").get_value_or(0);
   d_maintenance = d_lw->readVariable<boost::optional<luamaintenance_t>>("maintenance").get_value_or(0);
 
   d_ipfilter = d_lw->readVariable<boost::optional<ipfilter_t>>("ipfilter").get_value_or(0);
@@ -505,7 +510,7 @@ void RecursorLua4::maintenance() const
 bool RecursorLua4::prerpz(DNSQuestion& dq, int& ret, RecEventTrace& et) const
 {
   et.add(RecEventTrace::LuaPreRPZ);
-  bool ok = genhook(d_prerpz, dq, ret);
+  bool ok = genhook(d_prerpz, dq, ret, g_stats.luaPrerpz);
   et.add(RecEventTrace::LuaPreRPZ, ok, false);
   return ok;
 }
@@ -513,7 +518,7 @@ bool RecursorLua4::prerpz(DNSQuestion& dq, int& ret, RecEventTrace& et) const
 bool RecursorLua4::preresolve(DNSQuestion& dq, int& ret, RecEventTrace& et) const
 {
   et.add(RecEventTrace::LuaPreResolve);
-  bool ok = genhook(d_preresolve, dq, ret);
+  bool ok = d_preresolve_ffi ? genhook_ffi(d_preresolve_ffi, dq, ret, g_stats.luaPreresolve) : genhook(d_preresolve, dq, ret, g_stats.luaPreresolve);
   et.add(RecEventTrace::LuaPreResolve, ok, false);
   return ok;
 }
@@ -521,7 +526,7 @@ bool RecursorLua4::preresolve(DNSQuestion& dq, int& ret, RecEventTrace& et) cons
 bool RecursorLua4::nxdomain(DNSQuestion& dq, int& ret, RecEventTrace& et) const
 {
   et.add(RecEventTrace::LuaNXDomain);
-  bool ok = genhook(d_nxdomain, dq, ret);
+  bool ok = d_nxdomain_ffi ? genhook_ffi(d_nxdomain_ffi, dq, ret, g_stats.luaNxdomain) : genhook(d_nxdomain, dq, ret, g_stats.luaNxdomain);
   et.add(RecEventTrace::LuaNXDomain, ok, false);
   return ok;
 }
@@ -529,7 +534,7 @@ bool RecursorLua4::nxdomain(DNSQuestion& dq, int& ret, RecEventTrace& et) const
 bool RecursorLua4::nodata(DNSQuestion& dq, int& ret, RecEventTrace& et) const
 {
   et.add(RecEventTrace::LuaNoData);
-  bool ok = genhook(d_nodata, dq, ret);
+  bool ok = d_nodata_ffi ? genhook_ffi(d_nodata_ffi, dq, ret, g_stats.luaNodata) : genhook(d_nodata, dq, ret, g_stats.luaNodata);
   et.add(RecEventTrace::LuaNoData, ok, false);
   return ok;
 }
@@ -537,7 +542,7 @@ bool RecursorLua4::nodata(DNSQuestion& dq, int& ret, RecEventTrace& et) const
 bool RecursorLua4::postresolve(DNSQuestion& dq, int& ret, RecEventTrace& et) const
 {
   et.add(RecEventTrace::LuaPostResolve);
-  bool ok = genhook(d_postresolve, dq, ret);
+  bool ok = d_postresolve_ffi ? genhook_ffi(d_postresolve_ffi, dq, ret, g_stats.luaPostresolve) : genhook(d_postresolve, dq, ret, g_stats.luaPostresolve);
   et.add(RecEventTrace::LuaPostResolve, ok, false);
   return ok;
 }
@@ -551,15 +556,20 @@ bool RecursorLua4::preoutquery(const ComboAddress& ns, const ComboAddress& reque
   RecursorLua4::DNSQuestion dq(ns, requestor, query, qtype.getCode(), isTcp, variableAnswer, wantsRPZ, logQuery, addPaddingToResponse);
   dq.currentRecords = &res;
   et.add(RecEventTrace::LuaPreOutQuery);
-  bool ok = genhook(d_preoutquery, dq, ret);
+  bool ok = genhook(d_preoutquery, dq, ret, g_stats.luaPreoutquery);
   et.add(RecEventTrace::LuaPreOutQuery, ok, false);
   return ok;
 }
 
 bool RecursorLua4::ipfilter(const ComboAddress& remote, const ComboAddress& local, const struct dnsheader& dh) const
 {
-  if (d_ipfilter)
-    return d_ipfilter(remote, local, dh);
+  if (d_ipfilter) {
+    DTime dt;
+    dt.set();
+    bool ret = d_ipfilter(remote, local, dh);
+    g_stats.luaIpfilter(dt.udiff());
+    return ret;
+  }
   return false; // don't block
 }
 
@@ -574,12 +584,11 @@ bool RecursorLua4::policyHitEventFilter(const ComboAddress& remote, const DNSNam
   event.policyTags = &tags;
   event.discardedPolicies = &discardedPolicies;
 
-  if (d_policyHitEventFilter(event)) {
-    return true;
-  }
-  else {
-    return false;
-  }
+  DTime dt;
+  dt.set();
+  bool ret = d_policyHitEventFilter(event);
+  g_stats.luaPolicyEventFilter(dt.udiff());
+  return ret;
 }
 
 unsigned int RecursorLua4::gettag(const ComboAddress& remote, const Netmask& ednssubnet, const ComboAddress& local, const DNSName& qname, uint16_t qtype, std::unordered_set<std::string>* policyTags, LuaContext::LuaObject& data, const EDNSOptionViewMap& ednsOptions, bool tcp, std::string& requestorId, std::string& deviceId, std::string& deviceName, std::string& routingTag, const std::vector<ProxyProtocolValue>& proxyProtocolValues) const
@@ -592,7 +601,10 @@ unsigned int RecursorLua4::gettag(const ComboAddress& remote, const Netmask& edn
       proxyProtocolValuesMap.emplace_back(num++, &value);
     }
 
+    DTime dt;
+    dt.set();
     auto ret = d_gettag(remote, ednssubnet, local, qname, qtype, ednsOptions, tcp, proxyProtocolValuesMap);
+    g_stats.luaGettag(dt.udiff());
 
     if (policyTags) {
       const auto& tags = std::get<1>(ret);
@@ -653,7 +665,10 @@ unsigned int RecursorLua4::gettag_ffi(RecursorLua4::FFIParams& params) const
   if (d_gettag_ffi) {
     pdns_ffi_param_t param(params);
 
+    DTime dt;
+    dt.set();
     auto ret = d_gettag_ffi(&param);
+    g_stats.luaGettag(dt.udiff());
     if (ret) {
       params.data = *ret;
     }
@@ -663,7 +678,7 @@ unsigned int RecursorLua4::gettag_ffi(RecursorLua4::FFIParams& params) const
   return 0;
 }
 
-bool RecursorLua4::genhook(const luacall_t& func, DNSQuestion& dq, int& ret) const
+bool RecursorLua4::genhook(const luacall_t& func, DNSQuestion& dq, int& ret, const pdns::AtomicHistogram& times) const
 {
   if (!func)
     return false;
@@ -683,7 +698,10 @@ bool RecursorLua4::genhook(const luacall_t& func, DNSQuestion& dq, int& ret) con
   dq.udpCallback.clear();
 
   dq.rcode = ret;
+  DTime dt;
+  dt.set();
   bool handled = func(&dq);
+  times(dt.udiff());
 
   if (handled) {
   loop:;
@@ -723,6 +741,11 @@ bool RecursorLua4::genhook(const luacall_t& func, DNSQuestion& dq, int& ret) con
   return handled;
 }
 
+bool RecursorLua4::genhook_ffi(const resolve_ffi_t& func, DNSQuestion& dq, int& ret, const pdns::AtomicHistogram& times) const
+{
+  return callResolveFFIHook(func, dq, ret, times);
+}
+
 RecursorLua4::~RecursorLua4() {}
 
 const char* pdns_ffi_param_get_qname(pdns_ffi_param_t* ref)
@@ -755,18 +778,6 @@ const char* pdns_ffi_param_get_remote(pdns_ffi_param_t* ref)
   return ref->remoteStr->c_str();
 }
 
-static void pdns_ffi_comboaddress_to_raw(const ComboAddress& ca, const void** addr, size_t* addrSize)
-{
-  if (ca.isIPv4()) {
-    *addr = &ca.sin4.sin_addr.s_addr;
-    *addrSize = sizeof(ca.sin4.sin_addr.s_addr);
-  }
-  else {
-    *addr = &ca.sin6.sin6_addr.s6_addr;
-    *addrSize = sizeof(ca.sin6.sin6_addr.s6_addr);
-  }
-}
-
 void pdns_ffi_param_get_remote_raw(pdns_ffi_param_t* ref, const void** addr, size_t* addrSize)
 {
   pdns_ffi_comboaddress_to_raw(ref->params.remote, addr, addrSize);
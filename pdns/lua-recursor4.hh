@@ -36,6 +36,7 @@
 #include "proxy-protocol.hh"
 #include "noinitvector.hh"
 #include "rec-eventtrace.hh"
+#include "histogram.hh"
 
 #include <unordered_map>
 
@@ -58,6 +59,20 @@ struct LuaContext::Pusher<pdns_ffi_param*>
   }
 };
 
+// pdns_resolve_ffi_handle_t is a lightuserdata
+template <>
+struct LuaContext::Pusher<pdns_resolve_ffi_handle*>
+{
+  static const int minSize = 1;
+  static const int maxSize = 1;
+
+  static PushedObject push(lua_State* state, pdns_resolve_ffi_handle* ptr) noexcept
+  {
+    lua_pushlightuserdata(state, ptr);
+    return PushedObject{state, 1};
+  }
+};
+
 class RecursorLua4 : public BaseLua4
 {
 public:
@@ -199,7 +214,7 @@ public:
 
   bool needDQ() const
   {
-    return (d_prerpz || d_preresolve || d_nxdomain || d_nodata || d_postresolve);
+    return (d_prerpz || d_preresolve || d_nxdomain || d_nodata || d_postresolve || d_preresolve_ffi || d_nxdomain_ffi || d_nodata_ffi || d_postresolve_ffi);
   }
 
   typedef std::function<std::tuple<unsigned int, boost::optional<std::unordered_map<int, string>>, boost::optional<LuaContext::LuaObject>, boost::optional<std::string>, boost::optional<std::string>, boost::optional<std::string>, boost::optional<string>>(ComboAddress, Netmask, ComboAddress, DNSName, uint16_t, const EDNSOptionViewMap&, bool, const std::vector<std::pair<int, const ProxyProtocolValue*>>&)> gettag_t;
@@ -217,7 +232,11 @@ private:
   luamaintenance_t d_maintenance;
   typedef std::function<bool(DNSQuestion*)> luacall_t;
   luacall_t d_prerpz, d_preresolve, d_nxdomain, d_nodata, d_postresolve, d_preoutquery, d_postoutquery;
-  bool genhook(const luacall_t& func, DNSQuestion& dq, int& ret) const;
+  bool genhook(const luacall_t& func, DNSQuestion& dq, int& ret, const pdns::AtomicHistogram& times) const;
+  /* when set, the FFI variant of a hook is called instead of the regular one */
+  typedef std::function<bool(pdns_resolve_ffi_handle_t*)> resolve_ffi_t;
+  resolve_ffi_t d_preresolve_ffi, d_nxdomain_ffi, d_nodata_ffi, d_postresolve_ffi;
+  bool genhook_ffi(const resolve_ffi_t& func, DNSQuestion& dq, int& ret, const pdns::AtomicHistogram& times) const;
   typedef std::function<bool(ComboAddress, ComboAddress, struct dnsheader)> ipfilter_t;
   ipfilter_t d_ipfilter;
   typedef std::function<bool(PolicyEvent&)> policyEventFilter_t;
@@ -390,7 +390,12 @@ static LWResult::Result asyncresolve(const ComboAddress& ip, const DNSName& doma
       g_stats.ipv6queries++;
     }
 
-    ret = asendto((const char*)&*vpacket.begin(), vpacket.size(), 0, ip, qid, domain, type, &queryfd);
+    boost::optional<Netmask> ecs{boost::none};
+    if (weWantEDNSSubnet) {
+      ecs = Netmask(outgoingECSAddr, outgoingECSBits);
+    }
+
+    ret = asendto((const char*)&*vpacket.begin(), vpacket.size(), 0, ip, qid, domain, type, ecs, sendRDQuery, EDNS0Level > 0, EDNS0Level > 0 && g_dnssecmode != DNSSECMode::Off, &queryfd);
 
     if (ret != LWResult::Result::Success) {
       return ret;
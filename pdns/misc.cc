@@ -974,6 +974,19 @@ uint32_t burtle(const unsigned char* k, uint32_t length, uint32_t initval)
   return c;
 }
 
+/* lowercases the four ASCII bytes of a word at once, leaving everything
+   outside of 'A'..'Z' (including bytes >= 0x80) untouched, exactly like dns_tolower() */
+static inline uint32_t dns_tolower_word(uint32_t w)
+{
+  const uint32_t heptets = w & 0x7f7f7f7fU;
+  /* high bit of each byte set if the byte is > 'Z' */
+  const uint32_t isAboveZ = heptets + 0x25252525U;
+  /* high bit of each byte set if the byte is >= 'A' */
+  const uint32_t isAtLeastA = heptets + 0x3f3f3f3fU;
+  const uint32_t isUpper = (isAtLeastA ^ isAboveZ) & ~w & 0x80808080U;
+  return w | (isUpper >> 2);
+}
+
 uint32_t burtleCI(const unsigned char* k, uint32_t length, uint32_t initval)
 {
   uint32_t a,b,c,len;
@@ -985,9 +998,9 @@ uint32_t burtleCI(const unsigned char* k, uint32_t length, uint32_t initval)
 
   /*---------------------------------------- handle most of the key */
   while (len >= 12) {
-    a += (dns_tolower(k[0]) +((uint32_t)dns_tolower(k[1])<<8) +((uint32_t)dns_tolower(k[2])<<16) +((uint32_t)dns_tolower(k[3])<<24));
-    b += (dns_tolower(k[4]) +((uint32_t)dns_tolower(k[5])<<8) +((uint32_t)dns_tolower(k[6])<<16) +((uint32_t)dns_tolower(k[7])<<24));
-    c += (dns_tolower(k[8]) +((uint32_t)dns_tolower(k[9])<<8) +((uint32_t)dns_tolower(k[10])<<16)+((uint32_t)dns_tolower(k[11])<<24));
+    a += dns_tolower_word(k[0] +((uint32_t)k[1]<<8) +((uint32_t)k[2]<<16) +((uint32_t)k[3]<<24));
+    b += dns_tolower_word(k[4] +((uint32_t)k[5]<<8) +((uint32_t)k[6]<<16) +((uint32_t)k[7]<<24));
+    c += dns_tolower_word(k[8] +((uint32_t)k[9]<<8) +((uint32_t)k[10]<<16)+((uint32_t)k[11]<<24));
     burtlemix(a,b,c);
     k += 12; len -= 12;
   }
@@ -27,10 +27,23 @@
 #include <stdio.h>
 #include <iostream>
 
+#include <sys/mman.h>
+
 #ifdef PDNS_USE_VALGRIND
 #include <valgrind/valgrind.h>
 #endif /* PDNS_USE_VALGRIND */
 
+#ifdef HAVE_FIBER_SANITIZER
+#include <sanitizer/asan_interface.h>
+#endif /* HAVE_FIBER_SANITIZER */
+
+/* mincore() takes a 'char*' vector on some platforms and an 'unsigned char*' one on others */
+template<typename Addr, typename Vec>
+static inline int callMincore(int (*func)(Addr, size_t, Vec*), void* addr, size_t length, unsigned char* vec)
+{
+  return func(addr, length, reinterpret_cast<Vec*>(vec));
+}
+
 /** \page MTasker
     Simple system for implementing cooperative multitasking of functions, with 
     support for waiting on events which can return values.
@@ -267,7 +280,17 @@ template<class Key, class Val, class Cmp>void MTasker<Key,Val,Cmp>::makeThread(t
   auto uc=std::make_shared<pdns_ucontext_t>();
   
   uc->uc_link = &d_kernel; // come back to kernel after dying
-  uc->uc_stack.resize (d_stacksize+1);
+  if (!d_cachedStacks.empty()) {
+    uc->uc_stack = std::move(d_cachedStacks.back());
+    d_cachedStacks.pop_back();
+#ifdef HAVE_FIBER_SANITIZER
+    // the frames of the previous thread that never returned might still be poisoned
+    ASAN_UNPOISON_MEMORY_REGION(uc->uc_stack.data(), uc->uc_stack.size());
+#endif /* HAVE_FIBER_SANITIZER */
+  }
+  else {
+    uc->uc_stack.resize (d_stacksize+1);
+  }
 #ifdef PDNS_USE_VALGRIND
   uc->valgrind_id = VALGRIND_STACK_REGISTER(&uc->uc_stack[0],
                                             &uc->uc_stack[uc->uc_stack.size()-1]);
@@ -318,7 +341,17 @@ template<class Key, class Val, class Cmp>bool MTasker<Key,Val,Cmp>::schedule(con
     return true;
   }
   if(!d_zombiesQueue.empty()) {
-    d_threads.erase(d_zombiesQueue.front());
+    auto zombie = d_threads.find(d_zombiesQueue.front());
+    if (zombie != d_threads.end()) {
+      auto& stack = zombie->second.context->uc_stack;
+      if (d_measureStackUsage) {
+        measureStackUsage(stack);
+      }
+      if (d_cachedStacks.size() < d_maxCachedStacks) {
+        d_cachedStacks.push_back(std::move(stack));
+      }
+      d_threads.erase(zombie);
+    }
     --d_threadsCount;
     d_zombiesQueue.pop();
     return true;
@@ -403,6 +436,42 @@ template<class Key, class Val, class Cmp>uint64_t MTasker<Key,Val,Cmp>::getMaxSt
   return d_threads[d_tid].startOfStack - d_threads[d_tid].highestStackSeen;
 }
 
+//! Returns the maximum number of bytes of a stack touched by any terminated MThread so far
+/** This is only measured if requested when creating the MTasker, and has a page granularity.
+*/
+template<class Key, class Val, class Cmp>uint64_t MTasker<Key,Val,Cmp>::getMaxStackTouched() const
+{
+  return d_maxStackTouched;
+}
+
+/* Stack pages are only backed by memory once they have been touched, so the lowest
+   resident page tells us how deep the stack went. Since stacks are reused this is the
+   deepest any thread using this stack ever went, which is exactly what we want to know. */
+template<class Key, class Val, class Cmp>void MTasker<Key,Val,Cmp>::measureStackUsage(const std::vector<char, lazy_allocator<char>>& stack)
+{
+  if (stack.empty()) {
+    return;
+  }
+
+  const size_t pageSize = lazy_allocator<char>::getPageSize();
+  const size_t pages = lazy_allocator<char>::getPaddedSize(stack.size()) / pageSize;
+  std::vector<unsigned char> resident(pages);
+  char* start = const_cast<char*>(stack.data());
+  if (callMincore(mincore, start, pages * pageSize, resident.data()) != 0) {
+    return;
+  }
+
+  for (size_t idx = 0; idx < pages; idx++) {
+    if (resident.at(idx) & 1) {
+      uint64_t touched = stack.size() - idx * pageSize;
+      if (touched > d_maxStackTouched) {
+        d_maxStackTouched = touched;
+      }
+      break;
+    }
+  }
+}
+
 //! Returns the maximum stack usage so far of this MThread
 template<class Key, class Val, class Cmp>unsigned int MTasker<Key,Val,Cmp>::getUsec()
 {
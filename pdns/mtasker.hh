@@ -21,6 +21,7 @@
  */
 #pragma once
 #include <stdint.h>
+#include <atomic>
 #include <queue>
 #include <vector>
 #include <map>
@@ -67,8 +68,12 @@ private:
 
   typedef std::map<int, ThreadInfo> mthreads_t;
   mthreads_t d_threads;
+  /* stacks of terminated threads, kept around to be reused by the next ones */
+  std::vector<std::vector<char, lazy_allocator<char>>> d_cachedStacks;
   size_t d_stacksize;
-  size_t d_threadsCount;
+  size_t d_maxCachedStacks;
+  uint64_t d_maxStackTouched{0};
+  std::atomic<size_t> d_threadsCount; // read by other threads, for statistics and load balancing
   int d_tid;
   int d_maxtid;
 
@@ -117,13 +122,21 @@ public:
   /** Constructor with a small default stacksize. If any of your threads exceeds this stack, your application will crash. 
       This limit applies solely to the stack, the heap is not limited in any way. If threads need to allocate a lot of data,
       the use of new/delete is suggested. 
+      Up to stackCacheSize stacks are allocated right away and reused by new threads instead of allocating a new one.
+      If measureStackUsage is set, the number of bytes of each stack actually touched is measured when a thread exits,
+      see getMaxStackTouched().
    */
-  MTasker(size_t stacksize=16*8192) : d_stacksize(stacksize), d_threadsCount(0), d_tid(0), d_maxtid(0), d_waitstatus(Error)
+  MTasker(size_t stacksize=16*8192, size_t stackCacheSize=0, bool measureStackUsage=false) : d_stacksize(stacksize), d_maxCachedStacks(stackCacheSize), d_threadsCount(0), d_tid(0), d_maxtid(0), d_waitstatus(Error), d_measureStackUsage(measureStackUsage)
   {
     initMainStackBounds();
 
     // make sure our stack is 16-byte aligned to make all the architectures happy
     d_stacksize = d_stacksize >> 4 << 4;
+
+    d_cachedStacks.reserve(d_maxCachedStacks);
+    while (d_cachedStacks.size() < d_maxCachedStacks) {
+      d_cachedStacks.emplace_back(d_stacksize + 1);
+    }
   }
 
   typedef void tfunc_t(void *); //!< type of the pointer that starts a thread 
@@ -137,9 +150,13 @@ public:
   unsigned int numProcesses() const;
   int getTid() const;
   uint64_t getMaxStackUsage();
+  uint64_t getMaxStackTouched() const;
   unsigned int getUsec();
 
 private:
+  void measureStackUsage(const std::vector<char, lazy_allocator<char>>& stack);
+
   EventKey d_eventkey;   // for waitEvent, contains exact key it was awoken for
+  bool d_measureStackUsage;
 };
 #include "mtasker.cc"
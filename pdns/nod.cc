@@ -49,11 +49,13 @@ void PersistentSBF::remove_tmp_files(const filesystem::path& p, std::lock_guard<
   }
 }
 
-// This looks for an old (per-thread) snapshot. The first one it finds,
-// it restores from that. Then immediately snapshots with the current thread id,// before removing the old snapshot
-// In this way, we can have per-thread SBFs, but still snapshot and restore.
-// The mutex has to be static because we can't have multiple (i.e. per-thread)
-// instances iterating and writing to the cache dir at the same time
+// This looks for the newest old snapshot and restores from that. Then
+// immediately snapshots with the current thread id, before removing the old
+// snapshots. Older versions used per-thread SBFs and left one snapshot per
+// thread, the ones not restored are removed as well to stop proliferation.
+// The mutex has to be static because we can't have multiple instances
+// (for example the NOD and UDR ones) iterating and writing to the cache dir at
+// the same time
 bool PersistentSBF::init(bool ignore_pid) {
   if (d_init)
     return false;
@@ -65,15 +67,17 @@ bool PersistentSBF::init(bool ignore_pid) {
       if (filesystem::exists(p) && filesystem::is_directory(p)) {
         remove_tmp_files(p, lock);
         filesystem::path newest_file;
-        std::time_t newest_time=time(nullptr);
+        std::time_t newest_time = 0;
+        std::vector<filesystem::path> old_files;
         Regex file_regex(d_prefix + ".*\\." + bf_suffix + "$");
         for (filesystem::directory_iterator i(p); i != filesystem::directory_iterator(); ++i) {
           if (filesystem::is_regular_file(i->path()) &&
               file_regex.match(i->path().filename().string())) {
             if (ignore_pid ||
                 (i->path().filename().string().find(std::to_string(getpid())) == std::string::npos)) {
+              old_files.push_back(i->path());
               // look for the newest file matching the regex
-              if ((last_write_time(i->path()) < newest_time) ||
+              if ((last_write_time(i->path()) > newest_time) ||
                   newest_file.empty()) {
                 newest_time = last_write_time(i->path());
                 newest_file = i->path();
@@ -88,7 +92,7 @@ bool PersistentSBF::init(bool ignore_pid) {
             infile.open(filename, std::ios::in | std::ios::binary);
             g_log << Logger::Warning << "Found SBF file " << filename << endl;
             // read the file into the sbf
-            d_sbf.lock()->restore(infile);
+            d_sbf.restore(infile);
             infile.close();
             // now dump it out again with new thread id & process id
             snapshotCurrent(std::this_thread::get_id());
@@ -101,6 +105,12 @@ bool PersistentSBF::init(bool ignore_pid) {
             g_log<<Logger::Warning<<"NODDB init: Cannot parse file: " << filename << ": " << e.what() << "; removed" << endl;
           }
         }
+        for (const auto& old_file : old_files) {
+          if (old_file != newest_file) {
+            boost::system::error_code ec;
+            filesystem::remove(old_file, ec);
+          }
+        }
       }
     }
     catch (const filesystem::filesystem_error& e) {
@@ -125,9 +135,8 @@ void PersistentSBF::setCacheDir(const std::string& cachedir)
 }
 
 // Dump the SBF to a file
-// To spend the least amount of time inside the mutex, we dump to an
-// intermediate stringstream, otherwise the lock would be waiting for
-// file IO to complete
+// The SBF is not locked, so concurrent lookups and updates are not
+// blocked while dumping to the intermediate stringstream
 bool PersistentSBF::snapshotCurrent(std::thread::id tid)
 {
   if (d_cachedir.length()) {
@@ -140,10 +149,7 @@ bool PersistentSBF::snapshotCurrent(std::thread::id tid)
       try {
         std::ofstream ofile;
         std::stringstream iss;
-        {
-          // only lock while dumping to a stringstream
-          d_sbf.lock()->dump(iss);
-        }
+        d_sbf.dump(iss);
         // Now write it out to the file
         std::string ftmp = f.string() + ".XXXXXXXX";
         int fd = mkstemp(&ftmp.at(0));
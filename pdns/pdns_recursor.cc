@@ -42,6 +42,7 @@
 #include <iostream>
 #include <errno.h>
 #include <boost/static_assert.hpp>
+#include <deque>
 #include <map>
 #include <set>
 #include "recursor_cache.hh"
@@ -104,6 +105,9 @@
 
 #include "rec-snmp.hh"
 #include "rec-taskqueue.hh"
+#include "rec-mpscqueue.hh"
+#include "rec-shared-outgoing.hh"
+#include "rec-udpclientsocks.hh"
 
 #ifdef HAVE_SYSTEMD
 #include <systemd/sd-daemon.h>
@@ -136,15 +140,16 @@ static thread_local uint64_t t_frameStreamServersGeneration;
 thread_local std::unique_ptr<MT_t> MT; // the big MTasker
 std::unique_ptr<MemRecursorCache> g_recCache;
 std::unique_ptr<NegCache> g_negCache;
+std::unique_ptr<RecursorPacketCache> g_packetCache;
 
-thread_local std::unique_ptr<RecursorPacketCache> t_packetCache;
 thread_local FDMultiplexer* t_fdm{nullptr};
 thread_local std::unique_ptr<addrringbuf_t> t_remotes, t_servfailremotes, t_largeanswerremotes, t_bogusremotes;
 thread_local std::unique_ptr<boost::circular_buffer<pair<DNSName, uint16_t> > > t_queryring, t_servfailqueryring, t_bogusqueryring;
 thread_local std::shared_ptr<NetmaskGroup> t_allowFrom;
 #ifdef NOD_ENABLED
-thread_local std::shared_ptr<nod::NODDB> t_nodDBp;
-thread_local std::shared_ptr<nod::UniqueResponseDB> t_udrDBp;
+// Shared between all threads, the underlying stable bloom filters are lock-free
+static std::shared_ptr<nod::NODDB> g_nodDBp;
+static std::shared_ptr<nod::UniqueResponseDB> g_udrDBp;
 #endif /* NOD_ENABLED */
 __thread struct timeval g_now; // timestamp, updated (too) frequently
 
@@ -164,6 +169,19 @@ struct RecThreadInfo
     int readQueriesToThread{-1};
   };
 
+  /* queries distributed to a worker go through this queue, the writeQueriesToThread
+     pipe is only used to wake the worker up when it might be waiting for them */
+  struct QueriesQueue
+  {
+    QueriesQueue(size_t capacity): queue(capacity)
+    {
+    }
+
+    MPSCQueue<pipefunc_t> queue;
+    /* set when a wake-up has been sent and the worker has not yet started draining the queue */
+    std::atomic<bool> notified{false};
+  };
+
   /* FD corresponding to TCP sockets this thread is listening
      on.
      These FDs are also in deferredAdds when we have one
@@ -174,8 +192,15 @@ struct RecThreadInfo
      same FD and g_deferredAdds is then used instead */
   deferredAdd_t deferredAdds;
   struct ThreadPipeSet pipes;
+  std::unique_ptr<QueriesQueue> queriesQueue;
   std::thread thread;
+  /* CPU-time clock of the thread, set when it is started, so that its CPU usage can be read
+     without asking the thread */
+  boost::optional<clockid_t> cpuClock{boost::none};
   MT_t* mt{nullptr};
+  /* number of mthreads running in this thread, published by the thread itself on every iteration
+     of its main loop so that the concurrent-queries metric can be read from another thread */
+  std::unique_ptr<pdns::stat_t> runningMThreads{std::make_unique<pdns::stat_t>()};
   uint64_t numberOfDistributedQueries{0};
   int exitCode{0};
   /* handle the web server, carbon, statistics and the control channel */
@@ -250,6 +275,8 @@ static std::set<uint16_t> s_avoidUdpSourcePorts;
 #endif
 static uint16_t s_minUdpSourcePort;
 static uint16_t s_maxUdpSourcePort;
+static size_t s_udpSourcePortPoolSize;
+static uint32_t s_udpSourcePortMaxUses;
 static double s_balancingFactor;
 static bool s_addExtendedResolutionDNSErrors;
 
@@ -621,21 +648,32 @@ class UDPClientSocks
 {
   unsigned int d_numsocks;
 public:
-  UDPClientSocks() : d_numsocks(0)
+  UDPClientSocks() : d_numsocks(0), d_pool(s_udpSourcePortPoolSize, s_udpSourcePortMaxUses)
   {
   }
 
   LWResult::Result getSocket(const ComboAddress& toaddr, int* fd)
   {
-    *fd = makeClientSocket(toaddr.sin4.sin_family);
-    if(*fd < 0) { // temporary error - receive exception otherwise
-      return LWResult::Result::OSLimitError;
+    const int family = toaddr.sin4.sin_family;
+    *fd = d_pool.get(family, g_now.tv_sec);
+    const bool reused = *fd >= 0;
+    if (!reused) {
+      *fd = makeClientSocket(family);
+      if(*fd < 0) { // temporary error - receive exception otherwise
+        return LWResult::Result::OSLimitError;
+      }
+      d_pool.add(*fd, family);
+      g_stats.udpSocketsCreated++;
+    }
+    else {
+      g_stats.udpSocketsReused++;
     }
 
+    /* connecting an already connected UDP socket replaces the previous peer */
     if(connect(*fd, (struct sockaddr*)(&toaddr), toaddr.getSocklen()) < 0) {
       int err = errno;
       try {
-        closesocket(*fd);
+        d_pool.release(*fd, false, g_now.tv_sec);
       }
       catch(const PDNSException& e) {
         g_log<<Logger::Error<<"Error closing UDP socket after connect() failed: "<<e.reason<<endl;
@@ -648,12 +686,18 @@ public:
       return LWResult::Result::PermanentError;
     }
 
+    if (reused) {
+      /* datagrams (or errors) that were queued before we connected to the new peer
+         might come from the previous one, get rid of them */
+      drainSocket(*fd);
+    }
+
     d_numsocks++;
     return LWResult::Result::Success;
   }
 
-  // return a socket to the pool, or simply erase it
-  void returnSocket(int fd)
+  // return a socket to the pool, or simply erase it if the exchange failed
+  void returnSocket(int fd, bool succeeded)
   {
     try {
       t_fdm->removeReadFD(fd);
@@ -662,17 +706,30 @@ public:
       // we sometimes return a socket that has not yet been assigned to t_fdm
     }
 
+    --d_numsocks;
+
     try {
-      closesocket(fd);
+      d_pool.release(fd, succeeded, g_now.tv_sec);
     }
     catch(const PDNSException& e) {
       g_log<<Logger::Error<<"Error closing returned UDP socket: "<<e.reason<<endl;
     }
-
-    --d_numsocks;
   }
 
 private:
+  static void drainSocket(int fd)
+  {
+    char buffer[512];
+    /* the socket is non-blocking, the bound prevents us from looping forever if
+       the previous peer keeps sending (or an error keeps being reported) */
+    for (size_t idx = 0; idx < 16; idx++) {
+      if (recv(fd, buffer, sizeof(buffer), 0) < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        break;
+      }
+    }
+  }
+
+  UDPClientSocketsPool d_pool;
 
   // returns -1 for errors which might go away, throws for ones that won't
   static int makeClientSocket(int family)
@@ -729,9 +786,15 @@ private:
 
 static thread_local std::unique_ptr<UDPClientSocks> t_udpclientsocks;
 
+static std::unique_ptr<SharedOutgoingQueries> s_sharedOutgoingQueries{nullptr};
+/* the shared queries owned by this thread, indexed by the socket they have been sent from */
+static thread_local std::unordered_map<int, SharedOutgoingQueries::Key> t_sharedOutgoingQueriesOwned;
+
+static void releaseSharedOutgoingQuery(int fd, const PacketBuffer* content);
+
 /* these two functions are used by LWRes */
 LWResult::Result asendto(const char *data, size_t len, int flags,
-                         const ComboAddress& toaddr, uint16_t id, const DNSName& domain, uint16_t qtype, int* fd)
+                         const ComboAddress& toaddr, uint16_t id, const DNSName& domain, uint16_t qtype, const boost::optional<Netmask>& ecs, bool rd, bool edns, bool dnssecOK, int* fd)
 {
 
   auto pident = std::make_shared<PacketID>();
@@ -754,6 +817,17 @@ LWResult::Result asendto(const char *data, size_t len, int flags,
     }
   }
 
+  // otherwise see if another worker has the same query in flight
+  boost::optional<SharedOutgoingQueries::Key> sharedKey{boost::none};
+  if (s_sharedOutgoingQueries && s_threadInfos.at(t_id).isWorker) {
+    sharedKey = SharedOutgoingQueries::Key{toaddr, domain, ecs ? *ecs : Netmask(), qtype, rd, edns, dnssecOK};
+    if (s_sharedOutgoingQueries->addWaiter(*sharedKey, t_id, id)) {
+      g_stats.sharedOutgoingQueries++;
+      *fd = -1;
+      return LWResult::Result::Success;
+    }
+  }
+
   auto ret = t_udpclientsocks->getSocket(toaddr, fd);
   if (ret != LWResult::Result::Success) {
     return ret;
@@ -768,11 +842,15 @@ LWResult::Result asendto(const char *data, size_t len, int flags,
   int tmp = errno;
 
   if (sent < 0) {
-    t_udpclientsocks->returnSocket(*fd);
+    t_udpclientsocks->returnSocket(*fd, false);
     errno = tmp; // this is for logging purposes only
     return LWResult::Result::PermanentError;
   }
 
+  if (sharedKey && s_sharedOutgoingQueries->addOwner(*sharedKey, t_id)) {
+    t_sharedOutgoingQueriesOwned[*fd] = std::move(*sharedKey);
+  }
+
   return LWResult::Result::Success;
 }
 
@@ -794,7 +872,8 @@ LWResult::Result arecvfrom(PacketBuffer& packet, int flags, const ComboAddress&
   if (ret > 0) {
     /* handleUDPServerResponse() will close the socket for us no matter what */
     if (packet.empty()) { // means "error"
-      return LWResult::Result::PermanentError;
+      /* unless the shared query we were waiting for timed out in the thread owning it */
+      return pident->sharedTimeout ? LWResult::Result::Timeout : LWResult::Result::PermanentError;
     }
 
     *d_len=packet.size();
@@ -812,7 +891,9 @@ LWResult::Result arecvfrom(PacketBuffer& packet, int flags, const ComboAddress&
   else {
     /* getting there means error or timeout, it's up to us to close the socket */
     if (fd >= 0) {
-      t_udpclientsocks->returnSocket(fd);
+      /* let the waiters from other threads know, instead of having them wait until they time out on their own */
+      releaseSharedOutgoingQuery(fd, nullptr);
+      t_udpclientsocks->returnSocket(fd, false);
     }
   }
 
@@ -1027,7 +1108,10 @@ static void protobufLogQuery(LocalStateHolder<LuaConfigItems>& luaconfsLocal, co
   ComboAddress requestor = requestorNM.getMaskedNetwork();
   requestor.setPort(remote.getPort());
 
-  pdns::ProtoZero::RecMessage m{128, std::string::size_type(policyTags.empty() ? 0 : 64)}; // It's a guess
+  /* reused for every query logged by this thread, so its buffers quickly reach the size we need */
+  static thread_local pdns::ProtoZero::RecMessage m;
+  m.reset();
+  m.reserve(128, std::string::size_type(policyTags.empty() ? 0 : 64)); // It's a guess
   m.setType(pdns::ProtoZero::Message::MessageType::DNSQueryType);
   m.setRequest(uniqueId, requestor, local, qname, qtype, qclass, id, tcp, len);
   m.setServerIdentity(SyncRes::s_serverID);
@@ -1043,7 +1127,7 @@ static void protobufLogQuery(LocalStateHolder<LuaConfigItems>& luaconfsLocal, co
     m.setMeta(mit.first, mit.second.stringVal, mit.second.intVal);
   }
 
-  std::string msg(m.finishAndMoveBuf());
+  const std::string& msg = m.finishAndGetBuf();
   for (auto& server : *t_protobufServers) {
     server->queueData(msg);
   }
@@ -1055,7 +1139,7 @@ static void protobufLogResponse(pdns::ProtoZero::RecMessage& message)
     return;
   }
 
-  std::string msg(message.finishAndMoveBuf());
+  const std::string& msg = message.finishAndGetBuf();
   for (auto& server : *t_protobufServers) {
     server->queueData(msg);
   }
@@ -1069,9 +1153,18 @@ static void protobufLogResponse(const struct dnsheader* dh, LocalStateHolder<Lua
                                 const string& deviceName, const std::map<std::string, RecursorLua4::MetaValue>& meta,
                                 const RecEventTrace& eventTrace)
 {
-  pdns::ProtoZero::RecMessage pbMessage(pbData ? pbData->d_message : "", pbData ? pbData->d_response : "", 64, 10); // The extra bytes we are going to add
+  /* reused for every packet cache hit logged by this thread, so that copying the cached
+     content does not require any allocation once the buffers have grown large enough */
+  static thread_local pdns::ProtoZero::RecMessage pbMessage;
   // Normally we take the immutable string from the cache and append a few values, but if it's not there (can this happen?)
   // we start with an empty string and append the minimal
+  if (pbData) {
+    pbMessage.reset(pbData->d_message, pbData->d_response);
+  }
+  else {
+    pbMessage.reset();
+  }
+  pbMessage.reserve(64, 10); // The extra bytes we are going to add
   if (!pbData) {
     pbMessage.setType(pdns::ProtoZero::Message::MessageType::DNSResponseType);
     pbMessage.setServerIdentity(SyncRes::s_serverID);
@@ -1400,7 +1493,7 @@ static bool nodCheckNewDomain(const DNSName& dname)
   // First check the (sub)domain isn't ignored for NOD purposes
   if (!g_nodDomainWL.check(dname)) {
     // Now check the NODDB (note this is probabilistic so can have FNs/FPs)
-    if (t_nodDBp && t_nodDBp->isNewDomain(dname)) {
+    if (g_nodDBp && g_nodDBp->isNewDomain(dname)) {
       if (g_nodLog) {
         // This should probably log to a dedicated log file
         g_log<<Logger::Notice<<"Newly observed domain nod="<<dname<<endl;
@@ -1436,7 +1529,7 @@ static bool udrCheckUniqueDNSRecord(const DNSName& dname, uint16_t qtype, const
     // Create a string that represent a triplet of (qname, qtype and RR[type, name, content])
     std::stringstream ss;
     ss << dname.toDNSStringLC() << ":" << qtype <<  ":" << qtype << ":" << record.d_type << ":" << record.d_name.toDNSStringLC() << ":" << record.d_content->getZoneRepresentation();
-    if (t_udrDBp && t_udrDBp->isUniqueResponse(ss.str())) {
+    if (g_udrDBp && g_udrDBp->isUniqueResponse(ss.str())) {
       if (g_udrLog) {  
         // This should also probably log to a dedicated file. 
         g_log<<Logger::Notice<<"Unique response observed: qname="<<dname<<" qtype="<<QType(qtype)<< " rrtype=" << QType(record.d_type) << " rrname=" << record.d_name << " rrcontent=" << record.d_content->getZoneRepresentation() << endl;
@@ -2094,7 +2187,9 @@ static void startDoResolve(void *p)
 #endif /* NOD ENABLED */
 
         if (t_protobufServers) {
-          pbMessage.addRR(*i, luaconfsLocal->protobufExportConfig.exportTypes, udr);
+          /* the record has just been written to the packet, so we can copy its rdata from there */
+          const size_t rdataLen = pw.getRecordPayloadSize();
+          pbMessage.addRR(*i, luaconfsLocal->protobufExportConfig.exportTypes, udr, packet.data() + packet.size() - rdataLen, rdataLen);
         }
       }
       if(needCommit)
@@ -2273,7 +2368,7 @@ static void startDoResolve(void *p)
         minTTL = min(minTTL, SyncRes::s_packetcacheservfailttl);
       }
       minTTL = min(minTTL, SyncRes::s_packetcachettl);
-      t_packetCache->insertResponsePacket(dc->d_tag, dc->d_qhash, std::move(dc->d_query), dc->d_mdp.d_qname,
+      g_packetCache->insertResponsePacket(dc->d_tag, dc->d_qhash, std::move(dc->d_query), dc->d_mdp.d_qname,
                                           dc->d_mdp.d_qtype, dc->d_mdp.d_qclass,
                                           string((const char*)&*packet.begin(), packet.size()),
                                           g_now.tv_sec,
@@ -2427,6 +2522,7 @@ static void startDoResolve(void *p)
   runTaskOnce(g_logCommonErrors);
 
   g_stats.maxMThreadStackUsage = max(MT->getMaxStackUsage(), g_stats.maxMThreadStackUsage.load());
+  g_stats.maxMThreadStackTouched = max(MT->getMaxStackTouched(), g_stats.maxMThreadStackTouched.load());
 }
 
 static void makeControlChannelSocket(int processNum=-1)
@@ -2559,9 +2655,9 @@ static bool checkForCacheHit(bool qnameParsed, unsigned int tag, const string& d
   vState valState;
   
   if (qnameParsed) {
-    cacheHit = !SyncRes::s_nopacketcache && t_packetCache->getResponsePacket(tag, data, qname, qtype, qclass, now.tv_sec, &response, &age, &valState, &qhash, &pbData, tcp);
+    cacheHit = !SyncRes::s_nopacketcache && g_packetCache->getResponsePacket(tag, data, qname, qtype, qclass, now.tv_sec, &response, &age, &valState, &qhash, &pbData, tcp);
   } else {
-    cacheHit = !SyncRes::s_nopacketcache && t_packetCache->getResponsePacket(tag, data, qname, &qtype, &qclass, now.tv_sec, &response, &age, &valState, &qhash, &pbData, tcp);
+    cacheHit = !SyncRes::s_nopacketcache && g_packetCache->getResponsePacket(tag, data, qname, &qtype, &qclass, now.tv_sec, &response, &age, &valState, &qhash, &pbData, tcp);
   }
 
   if (cacheHit) {
@@ -3721,17 +3817,17 @@ static void doStats(void)
     g_log << Logger::Notice<< "stats: cache contended/acquired " << rc_stats.first << '/' << rc_stats.second << " = " << r << '%' << endl;
 
     g_log<<Logger::Notice<<"stats: throttle map: "
-      << broadcastAccFunction<uint64_t>(pleaseGetThrottleSize) <<", ns speeds: "
-      << broadcastAccFunction<uint64_t>(pleaseGetNsSpeedsSize)<<", failed ns: "
-      << broadcastAccFunction<uint64_t>(pleaseGetFailedServersSize)<<", ednsmap: "
-      <<broadcastAccFunction<uint64_t>(pleaseGetEDNSStatusesSize)<<endl;
+      << SyncRes::getThrottledServersSize() <<", ns speeds: "
+      << SyncRes::getNSSpeedsSize()<<", failed ns: "
+      << SyncRes::getFailedServersSize()<<", ednsmap: "
+      << SyncRes::getEDNSStatusesSize()<<endl;
     g_log<<Logger::Notice<<"stats: outpacket/query ratio "<<ratePercentage(SyncRes::s_outqueries, SyncRes::s_queries)<<"%";
     g_log<<Logger::Notice<<", "<<ratePercentage(SyncRes::s_throttledqueries, SyncRes::s_outqueries+SyncRes::s_throttledqueries)<<"% throttled"<<endl;
     g_log<<Logger::Notice<<"stats: "<<SyncRes::s_tcpoutqueries<<"/"<<SyncRes::s_dotoutqueries << "/" << getCurrentIdleTCPConnections() << " outgoing tcp/dot/idle connections, "<<
-      broadcastAccFunction<uint64_t>(pleaseGetConcurrentQueries)<<" queries running, "<<SyncRes::s_outgoingtimeouts<<" outgoing timeouts "<<endl;
+      getConcurrentQueries()<<" queries running, "<<SyncRes::s_outgoingtimeouts<<" outgoing timeouts "<<endl;
 
-    uint64_t pcSize = broadcastAccFunction<uint64_t>(pleaseGetPacketCacheSize);
-    uint64_t pcHits = broadcastAccFunction<uint64_t>(pleaseGetPacketCacheHits);
+    uint64_t pcSize = g_packetCache->size();
+    uint64_t pcHits = g_packetCache->getHits();
     g_log<<Logger::Notice<<"stats: " <<  pcSize <<
       " packet cache entries, "<< ratePercentage(pcHits, SyncRes::s_queries) << "% packet cache hits"<<endl;
 
@@ -3785,19 +3881,20 @@ static void houseKeeping(void *)
     past = now;
     past.tv_sec -= 5;
     if (last_prune < past) {
-      t_packetCache->doPruneTo(g_maxPacketCacheEntries / (g_numWorkerThreads + g_numDistributorThreads));
-
-      time_t limit;
-      if(!((cleanCounter++)%40)) {  // this is a full scan!
-	limit=now.tv_sec-300;
-        SyncRes::pruneNSSpeeds(limit);
-      }
-      limit = now.tv_sec - SyncRes::s_serverdownthrottletime * 10;
-      SyncRes::pruneFailedServers(limit);
-      limit = now.tv_sec - 2*3600;
-      SyncRes::pruneEDNSStatuses(limit);
-      SyncRes::pruneThrottledServers();
-      SyncRes::pruneNonResolving(now.tv_sec - SyncRes::s_nonresolvingnsthrottletime);
+      // these tables are shared between all threads, so only one of them needs to prune them
+      if (isHandlerThread()) {
+        time_t limit;
+        if(!((cleanCounter++)%40)) {  // this is a full scan!
+          limit=now.tv_sec-300;
+          SyncRes::pruneNSSpeeds(limit);
+        }
+        limit = now.tv_sec - SyncRes::s_serverdownthrottletime * 10;
+        SyncRes::pruneFailedServers(limit);
+        limit = now.tv_sec - 2*3600;
+        SyncRes::pruneEDNSStatuses(limit);
+        SyncRes::pruneThrottledServers();
+        SyncRes::pruneNonResolving(now.tv_sec - SyncRes::s_nonresolvingnsthrottletime);
+      }
       Utility::gettimeofday(&last_prune, nullptr);
       t_tcp_manager.cleanup(now);
     }
@@ -3805,10 +3902,14 @@ static void houseKeeping(void *)
     if(isHandlerThread()) {
       if (now.tv_sec - last_RC_prune > 5) {
         g_recCache->doPrune(g_maxCacheEntries);
+        g_packetCache->doPruneTo(g_maxPacketCacheEntries);
         g_negCache->prune(g_maxCacheEntries / 10);
         if (g_aggressiveNSECCache) {
           g_aggressiveNSECCache->prune(now.tv_sec);
         }
+        if (g_signatureCache) {
+          g_signatureCache->prune(now.tv_sec);
+        }
         last_RC_prune = now.tv_sec;
       }
       // Divide by 12 to get the original 2 hour cycle if s_maxcachettl is default (1 day)
@@ -3901,6 +4002,11 @@ static void makeThreadPipes()
   if (pipeBufferSize > 0) {
     g_log<<Logger::Info<<"Resizing the buffer of the distribution pipe to "<<pipeBufferSize<<endl;
   }
+  auto queueSize = ::arg().asNum("distribution-queue-size");
+  if (queueSize <= 0) {
+    g_log<<Logger::Error<<"distribution-queue-size should be larger than 0"<<endl;
+    exit(99);
+  }
 
   /* thread 0 is the handler / SNMP, we start at 1 */
   for(unsigned int n = 1; n <= (g_numWorkerThreads + g_numDistributorThreads); ++n) {
@@ -3939,6 +4045,8 @@ static void makeThreadPipes()
     if (!setNonBlocking(threadInfos.pipes.writeQueriesToThread)) {
       unixDie("Making pipe for inter-thread communications non-blocking");
     }
+
+    threadInfos.queriesQueue = std::make_unique<RecThreadInfo::QueriesQueue>(queueSize);
   }
 }
 
@@ -3990,7 +4098,39 @@ void broadcastFunction(const pipefunc_t& func)
   }
 }
 
-static bool trySendingQueryToWorker(unsigned int target, ThreadMSG* tmsg)
+static void wakeUpWorker(const RecThreadInfo& targetInfo)
+{
+  static const char wakeUp = 0;
+  ssize_t written = write(targetInfo.pipes.writeQueriesToThread, &wakeUp, sizeof(wakeUp));
+  if (written != sizeof(wakeUp)) {
+    int error = errno;
+    /* there can only be one pending wake-up per worker so the pipe should never be full,
+       but if it somehow is the worker will wake up anyway */
+    if (written < 0 && (error == EAGAIN || error == EWOULDBLOCK)) {
+      return;
+    }
+    unixDie("write to thread pipe returned wrong size or error:" + std::to_string(error));
+  }
+}
+
+static bool pushToWorkerQueue(RecThreadInfo& targetInfo, pipefunc_t& func)
+{
+  auto& queue = *targetInfo.queriesQueue;
+  if (!queue.queue.push(std::move(func))) {
+    /* push() leaves func untouched when the queue is full */
+    return false;
+  }
+
+  /* only the first function queued since the worker started draining the queue needs
+     to wake it up, a busy worker will pick up the next ones without any syscall */
+  if (!queue.notified.exchange(true)) {
+    wakeUpWorker(targetInfo);
+  }
+
+  return true;
+}
+
+static bool trySendingQueryToWorker(unsigned int target, pipefunc_t& func)
 {
   auto& targetInfo = s_threadInfos[target];
   if(!targetInfo.isWorker) {
@@ -3998,28 +4138,90 @@ static bool trySendingQueryToWorker(unsigned int target, ThreadMSG* tmsg)
     _exit(1);
   }
 
-  const auto& tps = targetInfo.pipes;
+  if (!pushToWorkerQueue(targetInfo, func)) {
+    return false;
+  }
+
+  ++targetInfo.numberOfDistributedQueries;
 
-  ssize_t written = write(tps.writeQueriesToThread, &tmsg, sizeof(tmsg));
-  if (written > 0) {
-    if (static_cast<size_t>(written) != sizeof(tmsg)) {
-      delete tmsg;
-      unixDie("write to thread pipe returned wrong size or error");
-    }
+  return true;
+}
+
+// hand the answer to a shared outgoing query owned by this thread over to the waiting workers,
+// an empty content denotes an error and no content at all a timeout
+static void releaseSharedOutgoingQuery(int fd, const PacketBuffer* content)
+{
+  if (!s_sharedOutgoingQueries) {
+    return;
   }
-  else {
-    int error = errno;
-    if (error == EAGAIN || error == EWOULDBLOCK) {
-      return false;
-    } else {
-      delete tmsg;
-      unixDie("write to thread pipe returned wrong size or error:" + std::to_string(error));
+
+  auto owned = t_sharedOutgoingQueriesOwned.find(fd);
+  if (owned == t_sharedOutgoingQueriesOwned.end()) {
+    return;
+  }
+
+  const auto key = std::move(owned->second);
+  t_sharedOutgoingQueriesOwned.erase(owned);
+
+  auto waiters = s_sharedOutgoingQueries->release(key, t_id);
+  if (waiters.empty()) {
+    return;
+  }
+
+  const bool timedOut = content == nullptr;
+  auto packet = std::make_shared<const PacketBuffer>(timedOut ? PacketBuffer() : *content);
+  for (const auto& waiter : waiters) {
+    pipefunc_t func = [key, packet, timedOut, id = waiter.id]() -> void* {
+      auto pident = std::make_shared<PacketID>();
+      pident->remote = key.remote;
+      pident->domain = key.qname;
+      pident->type = key.qtype;
+      pident->id = id;
+      pident->fd = -1;
+      if (timedOut) {
+        auto iter = MT->d_waiters.find(pident);
+        if (iter != MT->d_waiters.end()) {
+          iter->key->sharedTimeout = true;
+        }
+      }
+      MT->sendEvent(pident, packet.get());
+      return nullptr;
+    };
+
+    if (!pushToWorkerQueue(s_threadInfos.at(waiter.threadId), func)) {
+      /* the waiter will time out */
+      g_stats.sharedOutgoingDrops++;
     }
   }
+}
 
-  ++targetInfo.numberOfDistributedQueries;
+static void setThreadCPUClock(RecThreadInfo& infos, pthread_t thread)
+{
+  clockid_t clock;
+  if (pthread_getcpuclockid(thread, &clock) == 0) {
+    infos.cpuClock = clock;
+  }
+}
 
-  return true;
+// thread numbers skip the handler, like the ones used for the cpu-msec-thread-N metrics
+uint64_t getThreadCPUMsec(unsigned int n)
+{
+  const auto& infos = s_threadInfos.at(/* skip handler */ 1 + n);
+  struct timespec ts;
+  if (!infos.cpuClock || clock_gettime(*infos.cpuClock, &ts) != 0) {
+    return 0;
+  }
+  return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+/* the MTasker of a thread belongs to that thread, so we read the number of mthreads it last published */
+uint64_t getConcurrentQueries()
+{
+  uint64_t total = 0;
+  for (const auto& threadInfo : s_threadInfos) {
+    total += threadInfo.runningMThreads->load();
+  }
+  return total;
 }
 
 static unsigned int getWorkerLoad(size_t workerIdx)
@@ -4074,30 +4276,63 @@ void distributeAsyncFunction(const string& packet, const pipefunc_t& func)
   unsigned int hash = hashQuestion(packet.c_str(), packet.length(), g_disthashseed);
   unsigned int target = selectWorker(hash);
 
-  ThreadMSG* tmsg = new ThreadMSG();
-  tmsg->func = func;
-  tmsg->wantAnswer = false;
+  pipefunc_t tmp(func);
 
-  if (!trySendingQueryToWorker(target, tmsg)) {
-    /* if this function failed but did not raise an exception, it means that the pipe
+  if (!trySendingQueryToWorker(target, tmp)) {
+    /* if this function failed but did not raise an exception, it means that the queue
        was full, let's try another one */
     unsigned int newTarget = 0;
     do {
       newTarget = /* skip handler */ 1 + g_numDistributorThreads + dns_random(g_numWorkerThreads);
     } while (newTarget == target);
 
-    if (!trySendingQueryToWorker(newTarget, tmsg)) {
+    if (!trySendingQueryToWorker(newTarget, tmp)) {
       g_stats.queryPipeFullDrops++;
-      delete tmsg;
     }
   }
 }
 
+static void handleQueriesQueue(int fd, FDMultiplexer::funcparam_t& var)
+{
+  char wakeUp;
+  if (read(fd, &wakeUp, sizeof(wakeUp)) != sizeof(wakeUp)) { // fd == readQueriesToThread
+    unixDie("read from thread pipe returned wrong size or error");
+  }
+
+  auto& queue = *s_threadInfos.at(t_id).queriesQueue;
+  /* from now on, a distributor queuing a query has to wake us up again. This has to be
+     an exchange and not a store, so that we see every query queued before it */
+  queue.notified.exchange(false);
+
+  /* don't starve the other events if the distributors keep feeding us */
+  static const size_t maxBatchSize = 256;
+  pipefunc_t func;
+  size_t count = 0;
+  for (; count < maxBatchSize && queue.queue.pop(func); count++) {
+    try {
+      func();
+    }
+    catch(std::exception& e) {
+      if(g_logCommonErrors)
+        g_log<<Logger::Error<<"PIPE function we executed created exception: "<<e.what()<<endl;
+    }
+    catch(PDNSException& e) {
+      if(g_logCommonErrors)
+        g_log<<Logger::Error<<"PIPE function we executed created PDNS exception: "<<e.reason<<endl;
+    }
+  }
+
+  if (count == maxBatchSize && !queue.notified.exchange(true)) {
+    /* there might be more, come back after the other events have been processed */
+    wakeUpWorker(s_threadInfos.at(t_id));
+  }
+}
+
 static void handlePipeRequest(int fd, FDMultiplexer::funcparam_t& var)
 {
   ThreadMSG* tmsg = nullptr;
 
-  if(read(fd, &tmsg, sizeof(tmsg)) != sizeof(tmsg)) { // fd == readToThread || fd == readQueriesToThread
+  if(read(fd, &tmsg, sizeof(tmsg)) != sizeof(tmsg)) { // fd == readToThread
     unixDie("read from thread pipe returned wrong size or error");
   }
 
@@ -4187,7 +4422,6 @@ template RecursorControlChannel::Answer broadcastAccFunction(const boost::functi
 template uint64_t broadcastAccFunction(const boost::function<uint64_t*()>& fun); // explicit instantiation
 template vector<ComboAddress> broadcastAccFunction(const boost::function<vector<ComboAddress> *()>& fun); // explicit instantiation
 template vector<pair<DNSName,uint16_t> > broadcastAccFunction(const boost::function<vector<pair<DNSName, uint16_t> > *()>& fun); // explicit instantiation
-template ThreadTimes broadcastAccFunction(const boost::function<ThreadTimes*()>& fun);
 
 static void handleRCC(int fd, FDMultiplexer::funcparam_t& var)
 {
@@ -4395,8 +4629,9 @@ static void handleUDPServerResponse(int fd, FDMultiplexer::funcparam_t& var)
           ": packet smaller than DNS header"<<endl;
     }
 
-    t_udpclientsocks->returnSocket(fd);
     PacketBuffer empty;
+    releaseSharedOutgoingQuery(fd, &empty);
+    t_udpclientsocks->returnSocket(fd, false);
 
     MT_t::waiters_t::iterator iter=MT->d_waiters.find(pid);
     if(iter != MT->d_waiters.end())
@@ -4471,8 +4706,9 @@ retryWithName:
     }
   }
   else if(fd >= 0) {
-    /* we either found a waiter (1) or encountered an issue (-1), it's up to us to clean the socket anyway */
-    t_udpclientsocks->returnSocket(fd);
+    /* we found a waiter, it's up to us to clean the socket anyway */
+    releaseSharedOutgoingQuery(fd, &packet);
+    t_udpclientsocks->returnSocket(fd, true);
   }
 }
 
@@ -4745,41 +4981,42 @@ static void setCPUMap(const std::map<unsigned int, std::set<int> >& cpusMap, uns
 }
 
 #ifdef NOD_ENABLED
-static void setupNODThread()
+// Called once, after dropping privileges so that the snapshots are owned by the right user
+static void setupNODDBs()
 {
   if (g_nodEnabled) {
     uint32_t num_cells = ::arg().asNum("new-domain-db-size");
-    t_nodDBp = std::make_shared<nod::NODDB>(num_cells);
+    g_nodDBp = std::make_shared<nod::NODDB>(num_cells);
     try {
-      t_nodDBp->setCacheDir(::arg()["new-domain-history-dir"]);
+      g_nodDBp->setCacheDir(::arg()["new-domain-history-dir"]);
     }
     catch (const PDNSException& e) {
       g_log<<Logger::Error<<"new-domain-history-dir (" << ::arg()["new-domain-history-dir"] << ") is not readable or does not exist"<<endl;
       _exit(1);
     }
-    if (!t_nodDBp->init()) {
+    if (!g_nodDBp->init()) {
       g_log<<Logger::Error<<"Could not initialize domain tracking"<<endl;
       _exit(1);
     }
-    std::thread t(nod::NODDB::startHousekeepingThread, t_nodDBp, std::this_thread::get_id());
+    std::thread t(nod::NODDB::startHousekeepingThread, g_nodDBp, std::this_thread::get_id());
     t.detach();
     g_nod_pbtag = ::arg()["new-domain-pb-tag"];
   }
   if (g_udrEnabled) {
     uint32_t num_cells = ::arg().asNum("unique-response-db-size");
-    t_udrDBp = std::make_shared<nod::UniqueResponseDB>(num_cells);
+    g_udrDBp = std::make_shared<nod::UniqueResponseDB>(num_cells);
     try {
-      t_udrDBp->setCacheDir(::arg()["unique-response-history-dir"]);
+      g_udrDBp->setCacheDir(::arg()["unique-response-history-dir"]);
     }
     catch (const PDNSException& e) {
       g_log<<Logger::Error<<"unique-response-history-dir (" << ::arg()["unique-response-history-dir"] << ") is not readable or does not exist"<<endl;
       _exit(1);
     }
-    if (!t_udrDBp->init()) {
+    if (!g_udrDBp->init()) {
       g_log<<Logger::Error<<"Could not initialize unique response tracking"<<endl;
       _exit(1);
     }
-    std::thread t(nod::UniqueResponseDB::startHousekeepingThread, t_udrDBp, std::this_thread::get_id());
+    std::thread t(nod::UniqueResponseDB::startHousekeepingThread, g_udrDBp, std::this_thread::get_id());
     t.detach();
     g_udr_pbtag = ::arg()["unique-response-pb-tag"];
   }
@@ -4986,6 +5223,8 @@ static int serviceMain(int argc, char*argv[])
   SyncRes::s_rootNXTrust = ::arg().mustDo( "root-nx-trust");
   SyncRes::s_refresh_ttlperc = ::arg().asNum("refresh-on-ttl-perc");
   RecursorPacketCache::s_refresh_ttlperc = SyncRes::s_refresh_ttlperc;
+  MemRecursorCache::s_maxServedStaleExtensions = ::arg().asNum("serve-stale-extensions");
+  MemRecursorCache::s_packedRecords = ::arg().mustDo("record-cache-packed-records");
   SyncRes::s_tcp_fast_open = ::arg().asNum("tcp-fast-open");
   SyncRes::s_tcp_fast_open_connect = ::arg().mustDo("tcp-fast-open-connect");
 
@@ -5153,6 +5392,10 @@ static int serviceMain(int argc, char*argv[])
     }
   }
 
+  if (::arg().asNum("signature-cache-size") > 0 && g_dnssecmode != DNSSECMode::Off && g_dnssecmode != DNSSECMode::ProcessNoValidate) {
+    g_signatureCache = make_unique<SignatureCache>(::arg().asNum("signature-cache-size"), ::arg().asNum("record-cache-shards"));
+  }
+
   {
     SuffixMatchNode dontThrottleNames;
     vector<string> parts;
@@ -5364,6 +5607,10 @@ static int serviceMain(int argc, char*argv[])
     g_log<<Logger::Warning<<e.what()<<endl;
   }
 
+#ifdef NOD_ENABLED
+  setupNODDBs();
+#endif /* NOD_ENABLED */
+
   startLuaConfigDelayedThreads(delayedLuaThreads, g_luaconfs.getCopy().generation);
   delayedLuaThreads.rpzPrimaryThreads.clear(); // no longer needed
   delayedLuaThreads.ztcConfigs.clear(); // no longer needed
@@ -5419,6 +5666,11 @@ static int serviceMain(int argc, char*argv[])
     }
     s_avoidUdpSourcePorts.insert(port);
   }
+  s_udpSourcePortPoolSize = ::arg().asNum("udp-source-port-pool-size");
+  s_udpSourcePortMaxUses = ::arg().asNum("udp-source-port-max-uses");
+  if (::arg().mustDo("share-outgoing-queries") && g_numWorkerThreads > 1) {
+    s_sharedOutgoingQueries = std::make_unique<SharedOutgoingQueries>(64);
+  }
 
   unsigned int currentThreadId = 1;
   const auto cpusMap = parseCPUMap();
@@ -5437,6 +5689,7 @@ static int serviceMain(int argc, char*argv[])
     setCPUMap(cpusMap, currentThreadId, pthread_self());
 
     auto& infos = s_threadInfos.at(currentThreadId);
+    setThreadCPUClock(infos, pthread_self());
     infos.isListener = true;
     infos.isWorker = true;
     recursorThread(currentThreadId++, "worker");
@@ -5467,6 +5720,7 @@ static int serviceMain(int argc, char*argv[])
         auto& infos = s_threadInfos.at(currentThreadId);
         infos.thread = std::thread(recursorThread, currentThreadId++, "distr");
         setCPUMap(cpusMap, currentThreadId, infos.thread.native_handle());
+        setThreadCPUClock(infos, infos.thread.native_handle());
       }
     }
 
@@ -5476,6 +5730,7 @@ static int serviceMain(int argc, char*argv[])
       auto& infos = s_threadInfos.at(currentThreadId);
       infos.thread = std::thread(recursorThread, currentThreadId++, "worker");
       setCPUMap(cpusMap, currentThreadId, infos.thread.native_handle());
+      setThreadCPUClock(infos, infos.thread.native_handle());
     }
 
 #ifdef HAVE_SYSTEMD
@@ -5523,14 +5778,6 @@ try
     g_log<<Logger::Warning<<"Done priming cache with root hints"<<endl;
   }
 
-  t_packetCache = std::unique_ptr<RecursorPacketCache>(new RecursorPacketCache());
-
-
-#ifdef NOD_ENABLED
-  if (threadInfo.isWorker)
-    setupNODThread();
-#endif /* NOD_ENABLED */
-
   /* the listener threads handle TCP queries */
   if(threadInfo.isWorker || threadInfo.isListener) {
     try {
@@ -5569,7 +5816,7 @@ try
     t_bogusqueryring = std::unique_ptr<boost::circular_buffer<pair<DNSName, uint16_t> > >(new boost::circular_buffer<pair<DNSName, uint16_t> >());
     t_bogusqueryring->set_capacity(ringsize);
   }
-  MT = std::make_unique<MT_t>(::arg().asNum("stack-size"));
+  MT = std::make_unique<MT_t>(::arg().asNum("stack-size"), ::arg().asNum("stack-cache-size"), ::arg().mustDo("measure-mthread-stack-usage"));
   threadInfo.mt = MT.get();
 
   /* start protobuf export threads if needed */
@@ -5602,7 +5849,9 @@ try
   else {
 
     t_fdm->addReadFD(threadInfo.pipes.readToThread, handlePipeRequest);
-    t_fdm->addReadFD(threadInfo.pipes.readQueriesToThread, handlePipeRequest);
+    if (threadInfo.isWorker) {
+      t_fdm->addReadFD(threadInfo.pipes.readQueriesToThread, handleQueriesQueue);
+    }
 
     if (threadInfo.isListener) {
       if (g_reusePort) {
@@ -5638,6 +5887,7 @@ try
 
   while (!RecursorControlChannel::stop) {
     while(MT->schedule(&g_now)); // MTasker letting the mthreads do their thing
+    threadInfo.runningMThreads->store(MT->numProcesses());
 
     // Use primes, it avoid not being scheduled in cases where the counter has a regular pattern.
     // We want to call handler thread often, it gets scheduled about 2 times per second
@@ -5686,6 +5936,7 @@ try
 
     t_fdm->run(&g_now);
     // 'run' updates g_now for us
+    threadInfo.runningMThreads->store(MT->numProcesses());
 
     if(threadInfo.isListener) {
       if(listenOnTCP) {
@@ -5784,6 +6035,8 @@ int main(int argc, char **argv)
 #else
     ::arg().set("stack-size","stack size per mthread")="200000";
 #endif
+    ::arg().set("stack-cache-size", "Number of stacks of terminated mthreads kept per thread for reuse, all allocated at startup")="100";
+    ::arg().set("measure-mthread-stack-usage", "Measure how much of its stack each mthread actually touched")="no";
     ::arg().set("soa-minimum-ttl","Don't change")="0";
     ::arg().set("no-shuffle","Don't change")="off";
     ::arg().set("local-port","port to listen on")="53";
@@ -5868,6 +6121,7 @@ int main(int argc, char **argv)
     ::arg().set("max-cache-ttl", "maximum number of seconds to keep a cached entry in memory")="86400";
     ::arg().set("packetcache-ttl", "maximum number of seconds to keep a cached entry in packetcache")="3600";
     ::arg().set("max-packetcache-entries", "maximum number of entries to keep in the packetcache")="500000";
+    ::arg().set("packetcache-shards", "Number of shards in the packet cache")="1024";
     ::arg().set("packetcache-servfail-ttl", "maximum number of seconds to keep a cached servfail entry in packetcache")="60";
     ::arg().set("server-id", "Returned when queried for 'id.server' TXT or NSID, defaults to hostname, set custom or 'disabled'")="";
     ::arg().set("stats-ringbuffer-entries", "maximum number of packets to store statistics for")="10000";
@@ -5922,7 +6176,8 @@ int main(int argc, char **argv)
     ::arg().set("max-recursion-depth", "Maximum number of internal recursion calls per query, 0 for unlimited")="40";
     ::arg().set("max-udp-queries-per-round", "Maximum number of UDP queries processed per recvmsg() round, before returning back to normal processing")="10000";
     ::arg().set("protobuf-use-kernel-timestamp", "Compute the latency of queries in protobuf messages by using the timestamp set by the kernel when the query was received (when available)")="";
-    ::arg().set("distribution-pipe-buffer-size", "Size in bytes of the internal buffer of the pipe used by the distributor to pass incoming queries to a worker thread")="0";
+    ::arg().set("distribution-pipe-buffer-size", "Size in bytes of the internal buffer of the pipe used by the distributor to wake up a worker thread")="0";
+    ::arg().set("distribution-queue-size", "Maximum number of queries waiting in the queue used by the distributor to pass incoming queries to a worker thread")="8192";
 
     ::arg().set("include-dir","Include *.conf files from this directory")="";
     ::arg().set("security-poll-suffix","Domain name from which to query security update notifications")="secpoll.powerdns.com.";
@@ -5940,7 +6195,7 @@ int main(int argc, char **argv)
     for (size_t idx = 0; idx < 128; idx++) {
       defaultAPIDisabledStats += ", ecs-v6-response-bits-" + std::to_string(idx + 1);
     }
-    std::string defaultDisabledStats = defaultAPIDisabledStats + ", cumul-clientanswers, cumul-authanswers, policy-hits";
+    std::string defaultDisabledStats = defaultAPIDisabledStats + ", cumul-clientanswers, cumul-authanswers, cumul-luahooks, policy-hits";
 
     ::arg().set("stats-api-blacklist", "List of statistics that are disabled when retrieving the complete list of statistics via the API (deprecated)")=defaultAPIDisabledStats;
     ::arg().set("stats-carbon-blacklist", "List of statistics that are prevented from being exported via Carbon (deprecated)")=defaultDisabledStats;
@@ -5971,6 +6226,9 @@ int main(int argc, char **argv)
     ::arg().set("udp-source-port-min", "Minimum UDP port to bind on")="1024";
     ::arg().set("udp-source-port-max", "Maximum UDP port to bind on")="65535";
     ::arg().set("udp-source-port-avoid", "List of comma separated UDP port number to avoid")="11211";
+    ::arg().set("udp-source-port-pool-size", "Maximum number of idle outgoing UDP sockets kept by each thread to be reused for later queries, 0 to always use a new socket")="0";
+    ::arg().set("udp-source-port-max-uses", "Maximum number of queries sent from a given outgoing UDP socket when udp-source-port-pool-size is enabled")="16";
+    ::arg().set("share-outgoing-queries", "If set, a worker thread waits for the answer to an identical outgoing UDP query already sent by another worker instead of sending it again")="no";
     ::arg().set("rng", "Specify random number generator to use. Valid values are auto,sodium,openssl,getrandom,arc4random,urandom.")="auto";
     ::arg().set("public-suffix-list-file", "Path to the Public Suffix List file, if any")="";
     ::arg().set("distribution-load-factor", "The load factor used when PowerDNS is distributing queries to worker threads")="0.0";
@@ -5978,8 +6236,10 @@ int main(int argc, char **argv)
     ::arg().setSwitch("qname-minimization", "Use Query Name Minimization")="yes";
     ::arg().setSwitch("nothing-below-nxdomain", "When an NXDOMAIN exists in cache for a name with fewer labels than the qname, send NXDOMAIN without doing a lookup (see RFC 8020)")="dnssec";
     ::arg().set("max-generate-steps", "Maximum number of $GENERATE steps when loading a zone from a file")="0";
+    ::arg().setSwitch("record-cache-packed-records", "Store the records in the record cache as packed wire-format data, trading CPU on cache hits for memory")="no";
     ::arg().set("record-cache-shards", "Number of shards in the record cache")="1024";
     ::arg().set("refresh-on-ttl-perc", "If a record is requested from the cache and only this % of original TTL remains, refetch") = "0";
+    ::arg().set("serve-stale-extensions", "Number of times a record's ttl is extended by 30s to be served stale") = "0";
 
     ::arg().set("x-dnssec-names", "Collect DNSSEC statistics for names or suffixes in this list in separate x-dnssec counters")="";
 
@@ -6003,6 +6263,8 @@ int main(int argc, char **argv)
 
     ::arg().set("aggressive-nsec-cache-size", "The number of records to cache in the aggressive cache. If set to a value greater than 0, and DNSSEC processing or validation is enabled, the recursor will cache NSEC and NSEC3 records to generate negative answers, as defined in rfc8198")="100000";
 
+    ::arg().set("signature-cache-size", "The number of successful DNSSEC signature verifications to remember, so that the same signature does not have to be verified again. 0 to disable")="100000";
+
     ::arg().set("edns-padding-from", "List of netmasks (proxy IP in case of XPF or proxy-protocol presence, client IP otherwise) for which EDNS padding will be enabled in responses, provided that 'edns-padding-mode' applies")="";
     ::arg().set("edns-padding-mode", "Whether to add EDNS padding to all responses ('always') or only to responses for queries containing the EDNS padding option ('padded-queries-only', the default). In both modes, padding will only be added to responses for queries coming from `edns-padding-from`_ sources")="padded-queries-only";
     ::arg().set("edns-padding-tag", "Packetcache tag associated to responses sent with EDNS padding, to prevent sending these to clients for which padding is not enabled.")="7830";
@@ -6108,6 +6370,7 @@ int main(int argc, char **argv)
     }
     g_recCache = std::unique_ptr<MemRecursorCache>(new MemRecursorCache(::arg().asNum("record-cache-shards")));
     g_negCache = std::unique_ptr<NegCache>(new NegCache(::arg().asNum("record-cache-shards")));
+    g_packetCache = std::unique_ptr<RecursorPacketCache>(new RecursorPacketCache(::arg().asNum("packetcache-shards")));
 
     g_quiet=::arg().mustDo("quiet");
     Logger::Urgency logUrgency = (Logger::Urgency)::arg().asNum("loglevel");
@@ -228,6 +228,7 @@ static void rpzPrimary(LuaConfigItems& lci, luaConfigDelayedThreads& delayedThre
 
   size_t zoneIdx;
   std::string dumpFile;
+  std::string snapshotFile;
   std::shared_ptr<SOARecordContent> sr = nullptr;
 
   try {
@@ -271,6 +272,10 @@ static void rpzPrimary(LuaConfigItems& lci, luaConfigDelayedThreads& delayedThre
       if(have.count("dumpFile")) {
         dumpFile = boost::get<std::string>(have["dumpFile"]);
       }
+
+      if(have.count("snapshotFile")) {
+        snapshotFile = boost::get<std::string>(have["snapshotFile"]);
+      }
     }
 
     if (localAddress != ComboAddress()) {
@@ -287,7 +292,30 @@ static void rpzPrimary(LuaConfigItems& lci, luaConfigDelayedThreads& delayedThre
     zone->setName(polName);
     zoneIdx = lci.dfe.addZone(zone);
 
-    if (!seedFile.empty()) {
+    if (!snapshotFile.empty() && access(snapshotFile.c_str(), R_OK) == 0) {
+      g_log<<Logger::Info<<"Pre-loading RPZ zone "<<zoneName<<" from snapshot file '"<<snapshotFile<<"'"<<endl;
+      try {
+        sr = loadRPZFromSnapshot(snapshotFile, zone, defpol, defpolOverrideLocal, maxTTL);
+
+        if (zone->getDomain() != domain) {
+          throw PDNSException("The RPZ zone " + zoneName + " loaded from the snapshot file (" + zone->getDomain().toString() + ") does not match the one passed in parameter (" + domain.toString() + ")");
+        }
+      }
+      catch(const PDNSException& e) {
+        g_log<<Logger::Warning<<"Unable to pre-load RPZ zone "<<zoneName<<" from snapshot file '"<<snapshotFile<<"': "<<e.reason<<endl;
+        sr = nullptr;
+        zone->clear();
+        zone->setDomain(domain);
+      }
+      catch(const std::exception& e) {
+        g_log<<Logger::Warning<<"Unable to pre-load RPZ zone "<<zoneName<<" from snapshot file '"<<snapshotFile<<"': "<<e.what()<<endl;
+        sr = nullptr;
+        zone->clear();
+        zone->setDomain(domain);
+      }
+    }
+
+    if (sr == nullptr && !seedFile.empty()) {
       g_log<<Logger::Info<<"Pre-loading RPZ zone "<<zoneName<<" from seed file '"<<seedFile<<"'"<<endl;
       try {
         sr = loadRPZFromFile(seedFile, zone, defpol, defpolOverrideLocal, maxTTL);
@@ -319,7 +347,7 @@ static void rpzPrimary(LuaConfigItems& lci, luaConfigDelayedThreads& delayedThre
     exit(1);  // FIXME proper exit code?
   }
 
-  delayedThreads.rpzPrimaryThreads.push_back(std::make_tuple(primaries, defpol, defpolOverrideLocal, maxTTL, zoneIdx, tt, maxReceivedXFRMBytes, localAddress, axfrTimeout, refresh, sr, dumpFile));
+  delayedThreads.rpzPrimaryThreads.push_back(std::make_tuple(primaries, defpol, defpolOverrideLocal, maxTTL, zoneIdx, tt, maxReceivedXFRMBytes, localAddress, axfrTimeout, refresh, sr, dumpFile, snapshotFile));
 }
 
 void loadRecursorLuaConfig(const std::string& fname, luaConfigDelayedThreads& delayedThreads)
@@ -685,7 +713,7 @@ void startLuaConfigDelayedThreads(const luaConfigDelayedThreads& delayedThreads,
     try {
       // The get calls all return a value object here. That is essential, since we want copies so that RPZIXFRTracker gets values
       // with the proper lifetime.
-      std::thread t(RPZIXFRTracker, std::get<0>(rpzPrimary), std::get<1>(rpzPrimary), std::get<2>(rpzPrimary), std::get<3>(rpzPrimary), std::get<4>(rpzPrimary), std::get<5>(rpzPrimary), std::get<6>(rpzPrimary) * 1024 * 1024, std::get<7>(rpzPrimary), std::get<8>(rpzPrimary), std::get<9>(rpzPrimary), std::get<10>(rpzPrimary), std::get<11>(rpzPrimary), generation);
+      std::thread t(RPZIXFRTracker, std::get<0>(rpzPrimary), std::get<1>(rpzPrimary), std::get<2>(rpzPrimary), std::get<3>(rpzPrimary), std::get<4>(rpzPrimary), std::get<5>(rpzPrimary), std::get<6>(rpzPrimary) * 1024 * 1024, std::get<7>(rpzPrimary), std::get<8>(rpzPrimary), std::get<9>(rpzPrimary), std::get<10>(rpzPrimary), std::get<11>(rpzPrimary), std::get<12>(rpzPrimary), generation);
       t.detach();
     }
     catch(const std::exception& e) {
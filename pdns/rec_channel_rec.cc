@@ -354,38 +354,8 @@ static uint64_t dumpAggressiveNSECCache(int fd)
   return g_aggressiveNSECCache->dumpToFile(fp, now);
 }
 
-static uint64_t* pleaseDump(int fd)
-{
-  return new uint64_t(t_packetCache->doDump(fd));
-}
-
-static uint64_t* pleaseDumpEDNSMap(int fd)
-{
-  return new uint64_t(SyncRes::doEDNSDump(fd));
-}
-
-static uint64_t* pleaseDumpNSSpeeds(int fd)
-{
-  return new uint64_t(SyncRes::doDumpNSSpeeds(fd));
-}
-
-static uint64_t* pleaseDumpThrottleMap(int fd)
-{
-  return new uint64_t(SyncRes::doDumpThrottleMap(fd));
-}
-
-static uint64_t* pleaseDumpFailedServers(int fd)
-{
-  return new uint64_t(SyncRes::doDumpFailedServers(fd));
-}
-
-static uint64_t* pleaseDumpNonResolvingNS(int fd)
-{
-  return new uint64_t(SyncRes::doDumpNonResolvingNS(fd));
-}
-
-// Generic dump to file command
-static RecursorControlChannel::Answer doDumpToFile(int s, uint64_t* (*function)(int s), const string& name)
+// Generic dump to file command, for the tables shared between all threads
+static RecursorControlChannel::Answer doDumpToFile(int s, uint64_t (*function)(int s), const string& name)
 {
   auto fdw = getfd(s);
 
@@ -395,8 +365,7 @@ static RecursorControlChannel::Answer doDumpToFile(int s, uint64_t* (*function)(
 
   uint64_t total = 0;
   try {
-    int fd = fdw;
-    total = broadcastAccFunction<uint64_t>([function, fd]{ return function(fd); });
+    total = function(fdw);
   }
   catch(std::exception& e)
   {
@@ -421,7 +390,7 @@ static RecursorControlChannel::Answer doDumpCache(int s)
   uint64_t total = 0;
   try {
     int fd = fdw;
-    total = g_recCache->doDump(fd) + dumpNegCache(fd) + broadcastAccFunction<uint64_t>([fd]{ return pleaseDump(fd); }) + dumpAggressiveNSECCache(fd);
+    total = g_recCache->doDump(fd) + dumpNegCache(fd) + g_packetCache->doDump(fd) + dumpAggressiveNSECCache(fd);
   }
   catch(...){}
 
@@ -463,11 +432,6 @@ static RecursorControlChannel::Answer doDumpRPZ(int s, T begin, T end)
   return {0, "done\n"};
 }
 
-uint64_t* pleaseWipePacketCache(const DNSName& canon, bool subtree, uint16_t qtype)
-{
-  return new uint64_t(t_packetCache->doWipePacketCache(canon, qtype, subtree));
-}
-
 template<typename T>
 static string doWipeCache(T begin, T end, uint16_t qtype)
 {
@@ -493,7 +457,7 @@ static string doWipeCache(T begin, T end, uint16_t qtype)
   for (auto wipe : toWipe) {
     try {
       count += g_recCache->doWipeCache(wipe.first, wipe.second, qtype);
-      pcount += broadcastAccFunction<uint64_t>([=]{ return pleaseWipePacketCache(wipe.first, wipe.second, qtype);});
+      pcount += g_packetCache->doWipePacketCache(wipe.first, qtype, wipe.second);
       countNeg += g_negCache->wipe(wipe.first, wipe.second);
       if (g_aggressiveNSECCache) {
         g_aggressiveNSECCache->removeZoneInfo(wipe.first, wipe.second);
@@ -613,7 +577,7 @@ static string doAddNTA(T begin, T end)
       });
   try {
     g_recCache->doWipeCache(who, true, 0xffff);
-    broadcastAccFunction<uint64_t>([=]{return pleaseWipePacketCache(who, true, 0xffff);});
+    g_packetCache->doWipePacketCache(who, 0xffff, true);
     g_negCache->wipe(who, true);
     if (g_aggressiveNSECCache) {
       g_aggressiveNSECCache->removeZoneInfo(who, true);
@@ -670,7 +634,7 @@ static string doClearNTA(T begin, T end)
                           lci.negAnchors.erase(entry);
                         });
       g_recCache->doWipeCache(entry, true, 0xffff);
-      broadcastAccFunction<uint64_t>([=]{return pleaseWipePacketCache(entry, true, 0xffff);});
+      g_packetCache->doWipePacketCache(entry, 0xffff, true);
       g_negCache->wipe(entry, true);
       if (g_aggressiveNSECCache) {
         g_aggressiveNSECCache->removeZoneInfo(entry, true);
@@ -736,7 +700,7 @@ static string doAddTA(T begin, T end)
       lci.dsAnchors[who].insert(*ds);
       });
     g_recCache->doWipeCache(who, true, 0xffff);
-    broadcastAccFunction<uint64_t>([=]{return pleaseWipePacketCache(who, true, 0xffff);});
+    g_packetCache->doWipePacketCache(who, 0xffff, true);
     g_negCache->wipe(who, true);
     if (g_aggressiveNSECCache) {
       g_aggressiveNSECCache->removeZoneInfo(who, true);
@@ -786,7 +750,7 @@ static string doClearTA(T begin, T end)
                           lci.dsAnchors.erase(entry);
                         });
       g_recCache->doWipeCache(entry, true, 0xffff);
-      broadcastAccFunction<uint64_t>([=]{return pleaseWipePacketCache(entry, true, 0xffff);});
+      g_packetCache->doWipePacketCache(entry, 0xffff, true);
       g_negCache->wipe(entry, true);
       if (g_aggressiveNSECCache) {
         g_aggressiveNSECCache->removeZoneInfo(entry, true);
@@ -894,48 +858,6 @@ static uint64_t getUserTimeMsec()
   return (ru.ru_utime.tv_sec*1000ULL + ru.ru_utime.tv_usec/1000);
 }
 
-/* This is a pretty weird set of functions. To get per-thread cpu usage numbers,
-   we have to ask a thread over a pipe. We could do so surgically, so if you want to know about
-   thread 3, we pick pipe 3, but we lack that infrastructure.
-
-   We can however ask "execute this function on all threads and add up the results".
-   This is what the first function does using a custom object ThreadTimes, which if you add
-   to each other keeps filling the first one with CPU usage numbers
-*/
-
-static ThreadTimes* pleaseGetThreadCPUMsec()
-{
-  uint64_t ret=0;
-#ifdef RUSAGE_THREAD
-  struct rusage ru;
-  getrusage(RUSAGE_THREAD, &ru);
-  ret = (ru.ru_utime.tv_sec*1000ULL + ru.ru_utime.tv_usec/1000);
-  ret += (ru.ru_stime.tv_sec*1000ULL + ru.ru_stime.tv_usec/1000);
-#endif
-  return new ThreadTimes{ret, vector<uint64_t>()};
-}
-
-/* Next up, when you want msec data for a specific thread, we check
-   if we recently executed pleaseGetThreadCPUMsec. If we didn't we do so
-   now and consult all threads.
-
-   We then answer you from the (re)fresh(ed) ThreadTimes.
-*/
-static uint64_t doGetThreadCPUMsec(int n)
-{
-  static std::mutex s_mut;
-  static time_t last = 0;
-  static ThreadTimes tt;
-
-  std::lock_guard<std::mutex> l(s_mut);
-  if(last != time(nullptr)) {
-   tt = broadcastAccFunction<ThreadTimes>(pleaseGetThreadCPUMsec);
-   last = time(nullptr);
-  }
-
-  return tt.times.at(n);
-}
-
 static uint64_t calculateUptime()
 {
   return time(nullptr) - g_stats.startupTime;
@@ -975,14 +897,9 @@ static string doCurrentQueries()
   return broadcastAccFunction<string>(pleaseGetCurrentQueries);
 }
 
-uint64_t* pleaseGetThrottleSize()
-{
-  return new uint64_t(SyncRes::getThrottledServersSize());
-}
-
 static uint64_t getThrottleSize()
 {
-  return broadcastAccFunction<uint64_t>(pleaseGetThrottleSize);
+  return SyncRes::getThrottledServersSize();
 }
 
 static uint64_t getNegCacheSize()
@@ -990,45 +907,14 @@ static uint64_t getNegCacheSize()
   return g_negCache->size();
 }
 
-static uint64_t* pleaseGetFailedHostsSize()
-{
-  uint64_t tmp=(SyncRes::getThrottledServersSize());
-  return new uint64_t(tmp);
-}
-
 static uint64_t getFailedHostsSize()
 {
-  return broadcastAccFunction<uint64_t>(pleaseGetFailedHostsSize);
-}
-
-uint64_t* pleaseGetNsSpeedsSize()
-{
-  return new uint64_t(SyncRes::getNSSpeedsSize());
+  return SyncRes::getThrottledServersSize();
 }
 
 static uint64_t getNsSpeedsSize()
 {
-  return broadcastAccFunction<uint64_t>(pleaseGetNsSpeedsSize);
-}
-
-uint64_t* pleaseGetFailedServersSize()
-{
-  return new uint64_t(SyncRes::getFailedServersSize());
-}
-
-uint64_t* pleaseGetEDNSStatusesSize()
-{
-  return new uint64_t(SyncRes::getEDNSStatusesSize());
-}
-
-uint64_t* pleaseGetConcurrentQueries()
-{
-  return new uint64_t(getMT() ? getMT()->numProcesses() : 0);
-}
-
-static uint64_t getConcurrentQueries()
-{
-  return broadcastAccFunction<uint64_t>(pleaseGetConcurrentQueries);
+  return SyncRes::getNSSpeedsSize();
 }
 
 static uint64_t doGetCacheSize()
@@ -1051,44 +937,24 @@ static uint64_t doGetCacheMisses()
   return g_recCache->cacheMisses;
 }
 
-uint64_t* pleaseGetPacketCacheSize()
-{
-  return new uint64_t(t_packetCache ? t_packetCache->size() : 0);
-}
-
-static uint64_t* pleaseGetPacketCacheBytes()
-{
-  return new uint64_t(t_packetCache ? t_packetCache->bytes() : 0);
-}
-
 static uint64_t doGetPacketCacheSize()
 {
-  return broadcastAccFunction<uint64_t>(pleaseGetPacketCacheSize);
+  return g_packetCache ? g_packetCache->size() : 0;
 }
 
 static uint64_t doGetPacketCacheBytes()
 {
-  return broadcastAccFunction<uint64_t>(pleaseGetPacketCacheBytes);
-}
-
-uint64_t* pleaseGetPacketCacheHits()
-{
-  return new uint64_t(t_packetCache ? t_packetCache->d_hits : 0);
+  return g_packetCache ? g_packetCache->bytes() : 0;
 }
 
 static uint64_t doGetPacketCacheHits()
 {
-  return broadcastAccFunction<uint64_t>(pleaseGetPacketCacheHits);
-}
-
-static uint64_t* pleaseGetPacketCacheMisses()
-{
-  return new uint64_t(t_packetCache ? t_packetCache->d_misses : 0);
+  return g_packetCache ? g_packetCache->getHits() : 0;
 }
 
 static uint64_t doGetPacketCacheMisses()
 {
-  return broadcastAccFunction<uint64_t>(pleaseGetPacketCacheMisses);
+  return g_packetCache ? g_packetCache->getMisses() : 0;
 }
 
 static uint64_t doGetMallocated()
@@ -1152,12 +1018,37 @@ static StatsMap toStatsMap(const string& name, const pdns::AtomicHistogram& hist
   return entries;
 }
 
+static StatsMap toLuaHooksStatsMap(const string& name, const std::vector<std::pair<std::string, const pdns::AtomicHistogram*>>& histograms)
+{
+  const string pbasename = getPrometheusName(name);
+  StatsMap entries;
+  char buf[32];
+  std::string pname;
+
+  for (const auto& entry : histograms) {
+    const auto& hook = entry.first;
+    const auto& histogram = *entry.second;
+    const auto& data = histogram.getCumulativeBuckets();
+    for (const auto& bucket : data) {
+      snprintf(buf, sizeof(buf), "%g", bucket.d_boundary / 1e6);
+      pname = pbasename + "seconds_bucket{hook=\"" + hook + "\",le=\"" +
+        (bucket.d_boundary == std::numeric_limits<uint64_t>::max() ? "+Inf" : buf) + "\"}";
+      entries.emplace(bucket.d_name, StatsMapEntry{pname, std::to_string(bucket.d_count)});
+    }
+    snprintf(buf, sizeof(buf), "%g", histogram.getSum() / 1e6);
+    entries.emplace(histogram.getName() + "sum", StatsMapEntry{pbasename + "seconds_sum{hook=\"" + hook + "\"}", buf});
+    entries.emplace(histogram.getName() + "count", StatsMapEntry{pbasename + "seconds_count{hook=\"" + hook + "\"}", std::to_string(data.back().d_count)});
+  }
+
+  return entries;
+}
+
 static StatsMap toCPUStatsMap(const string& name)
 {
   const string pbasename = getPrometheusName(name);
   StatsMap entries;
   for (unsigned int n = 0; n < g_numThreads; ++n) {
-    uint64_t tm = doGetThreadCPUMsec(n);
+    uint64_t tm = getThreadCPUMsec(n);
     std::string pname = pbasename + "{thread=\"" + std::to_string(n) + "\"}";
     entries.emplace(make_pair(name + "-thread-" + std::to_string(n), StatsMapEntry{pname, std::to_string(tm)}));
   }
@@ -1204,11 +1095,14 @@ static void registerAllStats1()
   addGetStat("cache-bytes", doGetCacheBytes); 
   addGetStat("record-cache-contended", []() { return g_recCache->stats().first;});
   addGetStat("record-cache-acquired", []() { return g_recCache->stats().second;});
+  addGetStat("record-cache-served-stale", &SyncRes::s_servedstale);
   
   addGetStat("packetcache-hits", doGetPacketCacheHits);
   addGetStat("packetcache-misses", doGetPacketCacheMisses); 
   addGetStat("packetcache-entries", doGetPacketCacheSize); 
   addGetStat("packetcache-bytes", doGetPacketCacheBytes); 
+  addGetStat("packetcache-contended", []() { return g_packetCache->stats().first; });
+  addGetStat("packetcache-acquired", []() { return g_packetCache->stats().second; });
 
   addGetStat("aggressive-nsec-cache-entries", [](){ return g_aggressiveNSECCache ? g_aggressiveNSECCache->getEntriesCount() : 0; });
   addGetStat("aggressive-nsec-cache-nsec-hits", [](){ return g_aggressiveNSECCache ? g_aggressiveNSECCache->getNSECHits() : 0; });
@@ -1216,6 +1110,10 @@ static void registerAllStats1()
   addGetStat("aggressive-nsec-cache-nsec-wc-hits", [](){ return g_aggressiveNSECCache ? g_aggressiveNSECCache->getNSECWildcardHits() : 0; });
   addGetStat("aggressive-nsec-cache-nsec3-wc-hits", [](){ return g_aggressiveNSECCache ? g_aggressiveNSECCache->getNSEC3WildcardHits() : 0; });
 
+  addGetStat("signature-verifications", &g_signatureVerifications);
+  addGetStat("signature-cache-hits", [](){ return g_signatureCache ? g_signatureCache->d_hits.load() : 0; });
+  addGetStat("signature-cache-entries", [](){ return g_signatureCache ? g_signatureCache->size() : 0; });
+
   addGetStat("malloc-bytes", doGetMallocated);
   
   addGetStat("servfail-answers", &g_stats.servFails);
@@ -1273,6 +1171,7 @@ static void registerAllStats1()
   addGetStat("ignored-packets", &g_stats.ignoredCount);
   addGetStat("empty-queries", &g_stats.emptyQueriesCount);
   addGetStat("max-mthread-stack", &g_stats.maxMThreadStackUsage);
+  addGetStat("max-mthread-stack-touched", &g_stats.maxMThreadStackTouched);
 
   addGetStat("negcache-entries", getNegCacheSize);
   addGetStat("throttle-entries", getThrottleSize);
@@ -1419,6 +1318,10 @@ static void registerAllStats1()
   addGetStat("taskqueue-size",  []() { return getTaskSize(); });
 
   addGetStat("dns64-prefix-answers",  &g_stats.dns64prefixanswers);
+  addGetStat("udp-sockets-created", &g_stats.udpSocketsCreated);
+  addGetStat("udp-sockets-reused", &g_stats.udpSocketsReused);
+  addGetStat("shared-outgoing-queries", &g_stats.sharedOutgoingQueries);
+  addGetStat("shared-outgoing-drops", &g_stats.sharedOutgoingDrops);
 
   addGetStat("almost-expired-pushed",  []() { return getAlmostExpiredTasksPushed(); });
   addGetStat("almost-expired-run",  []() { return getAlmostExpiredTasksRun(); });
@@ -1443,6 +1346,9 @@ static void registerAllStats1()
   addGetStat("cumul-authanswers", []() {
     return toStatsMap(g_stats.cumulativeAuth4Answers.getName(), g_stats.cumulativeAuth4Answers, g_stats.cumulativeAuth6Answers);
   });
+  addGetStat("cumul-luahooks", []() {
+    return toLuaHooksStatsMap("cumul-luahooks-", {{"gettag", &g_stats.luaGettag}, {"ipfilter", &g_stats.luaIpfilter}, {"nodata", &g_stats.luaNodata}, {"nxdomain", &g_stats.luaNxdomain}, {"policyeventfilter", &g_stats.luaPolicyEventFilter}, {"postresolve", &g_stats.luaPostresolve}, {"preoutquery", &g_stats.luaPreoutquery}, {"prerpz", &g_stats.luaPrerpz}, {"preresolve", &g_stats.luaPreresolve}});
+  });
   addGetStat("policy-hits", []() {
     return toRPZStatsMap("policy-hits", g_stats.policyHits);
   });
@@ -1996,22 +1902,22 @@ RecursorControlChannel::Answer RecursorControlParser::getAnswer(int s, const str
     return doDumpCache(s);
   }
   if (cmd == "dump-ednsstatus" || cmd == "dump-edns") {
-    return doDumpToFile(s, pleaseDumpEDNSMap, cmd);
+    return doDumpToFile(s, SyncRes::doEDNSDump, cmd);
   }
   if (cmd == "dump-nsspeeds") {
-    return doDumpToFile(s, pleaseDumpNSSpeeds, cmd);
+    return doDumpToFile(s, SyncRes::doDumpNSSpeeds, cmd);
   }
   if (cmd == "dump-failedservers") {
-    return doDumpToFile(s, pleaseDumpFailedServers, cmd);
+    return doDumpToFile(s, SyncRes::doDumpFailedServers, cmd);
   }
   if (cmd == "dump-rpz") {
     return doDumpRPZ(s, begin, end);
   }
   if (cmd == "dump-throttlemap") {
-    return doDumpToFile(s, pleaseDumpThrottleMap, cmd);
+    return doDumpToFile(s, SyncRes::doDumpThrottleMap, cmd);
   }
   if (cmd == "dump-non-resolving") {
-    return doDumpToFile(s, pleaseDumpNonResolvingNS, cmd);
+    return doDumpToFile(s, SyncRes::doDumpNonResolvingNS, cmd);
   }
   if (cmd == "wipe-cache" || cmd == "flushname") {
     return {0, doWipeCache(begin, end, 0xffff)};
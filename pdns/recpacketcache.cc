@@ -10,34 +10,40 @@
 #include "namespaces.hh"
 #include "rec-taskqueue.hh"
 
-RecursorPacketCache::RecursorPacketCache()
+RecursorPacketCache::RecursorPacketCache(size_t shardsCount) :
+  d_maps(shardsCount)
 {
-  d_hits = d_misses = 0;
 }
 
 unsigned int RecursorPacketCache::s_refresh_ttlperc{0};
 
-int RecursorPacketCache::doWipePacketCache(const DNSName& name, uint16_t qtype, bool subtree)
+uint64_t RecursorPacketCache::doWipePacketCache(const DNSName& name, uint16_t qtype, bool subtree)
 {
-  int count=0;
-  auto& idx = d_packetCache.get<NameTag>();
-  for(auto iter = idx.lower_bound(name); iter != idx.end(); ) {
-    if(subtree) {
-      if(!iter->d_name.isPartOf(name)) {   // this is case insensitive
-	break;
+  uint64_t count = 0;
+  for (auto& map : d_maps) {
+    auto shard = map.lock();
+    auto& idx = shard->d_map.get<NameTag>();
+    for (auto iter = idx.lower_bound(name); iter != idx.end(); ) {
+      if (subtree) {
+        if (!iter->d_name.isPartOf(name)) {   // this is case insensitive
+          break;
+        }
+      }
+      else {
+        if (iter->d_name != name) {
+          break;
+        }
       }
-    }
-    else {
-      if(iter->d_name != name)
-	break;
-    }
 
-    if(qtype==0xffff || iter->d_type == qtype) {
-      iter=idx.erase(iter);
-      count++;
+      if (qtype == 0xffff || iter->d_type == qtype) {
+        iter = idx.erase(iter);
+        --map.d_entriesCount;
+        count++;
+      }
+      else {
+        ++iter;
+      }
     }
-    else
-      ++iter;
   }
   return count;
 }
@@ -53,7 +59,7 @@ bool RecursorPacketCache::qrMatch(const packetCache_t::index<HashTag>::type::ite
   return queryMatches(iter->d_query, queryPacket, qname, optionsToSkip);
 }
 
-bool RecursorPacketCache::checkResponseMatches(std::pair<packetCache_t::index<HashTag>::type::iterator, packetCache_t::index<HashTag>::type::iterator> range, const std::string& queryPacket, const DNSName& qname, uint16_t qtype, uint16_t qclass, time_t now, std::string* responsePacket, uint32_t* age, vState* valState, OptPBData* pbdata)
+bool RecursorPacketCache::checkResponseMatches(MapCombo::LockedContent& shard, std::pair<packetCache_t::index<HashTag>::type::iterator, packetCache_t::index<HashTag>::type::iterator> range, const std::string& queryPacket, const DNSName& qname, uint16_t qtype, uint16_t qclass, time_t now, std::string* responsePacket, uint32_t* age, vState* valState, OptPBData* pbdata)
 {
   for(auto iter = range.first ; iter != range.second ; ++iter) {
     // the possibility is VERY real that we get hits that are not right - birthday paradox
@@ -82,8 +88,8 @@ bool RecursorPacketCache::checkResponseMatches(std::pair<packetCache_t::index<Ha
         responsePacket->replace(sizeof(dnsheader), wirelength, queryPacket, sizeof(dnsheader), wirelength);
       }
 
-      d_hits++;
-      moveCacheItemToBack<SequencedTag>(d_packetCache, iter);
+      shard.d_hits++;
+      moveCacheItemToBack<SequencedTag>(shard.d_map, iter);
 
       if (pbdata != nullptr) {
         if (iter->d_pbdata) {
@@ -96,8 +102,8 @@ bool RecursorPacketCache::checkResponseMatches(std::pair<packetCache_t::index<Ha
       return true;
     }
     else {
-      moveCacheItemToFront<SequencedTag>(d_packetCache, iter);
-      d_misses++;
+      moveCacheItemToFront<SequencedTag>(shard.d_map, iter);
+      shard.d_misses++;
       break;
     }
   }
@@ -127,38 +133,42 @@ bool RecursorPacketCache::getResponsePacket(unsigned int tag, const std::string&
                                             std::string* responsePacket, uint32_t* age, vState* valState, uint32_t* qhash, OptPBData* pbdata, bool tcp)
 {
   *qhash = canHashPacket(queryPacket, s_skipOptions);
-  const auto& idx = d_packetCache.get<HashTag>();
+  auto shard = getMap(*qhash).lock();
+  const auto& idx = shard->d_map.get<HashTag>();
   auto range = idx.equal_range(tie(tag, *qhash, tcp));
 
   if(range.first == range.second) {
-    d_misses++;
+    shard->d_misses++;
     return false;
   }
 
-  return checkResponseMatches(range, queryPacket, qname, qtype, qclass, now, responsePacket, age, valState, pbdata);
+  return checkResponseMatches(*shard, range, queryPacket, qname, qtype, qclass, now, responsePacket, age, valState, pbdata);
 }
 
 bool RecursorPacketCache::getResponsePacket(unsigned int tag, const std::string& queryPacket, DNSName& qname, uint16_t* qtype, uint16_t* qclass, time_t now,
                                             std::string* responsePacket, uint32_t* age, vState* valState, uint32_t* qhash, OptPBData *pbdata, bool tcp)
 {
   *qhash = canHashPacket(queryPacket, s_skipOptions);
-  const auto& idx = d_packetCache.get<HashTag>();
+  auto shard = getMap(*qhash).lock();
+  const auto& idx = shard->d_map.get<HashTag>();
   auto range = idx.equal_range(tie(tag, *qhash, tcp));
 
   if(range.first == range.second) {
-    d_misses++;
+    shard->d_misses++;
     return false;
   }
 
   qname = DNSName(queryPacket.c_str(), queryPacket.length(), sizeof(dnsheader), false, qtype, qclass, 0);
 
-  return checkResponseMatches(range, queryPacket, qname, *qtype, *qclass, now, responsePacket, age, valState, pbdata);
+  return checkResponseMatches(*shard, range, queryPacket, qname, *qtype, *qclass, now, responsePacket, age, valState, pbdata);
 }
 
 
 void RecursorPacketCache::insertResponsePacket(unsigned int tag, uint32_t qhash, std::string&& query, const DNSName& qname, uint16_t qtype, uint16_t qclass, std::string&& responsePacket, time_t now, uint32_t ttl, const vState& valState, OptPBData&& pbdata, bool tcp)
 {
-  auto& idx = d_packetCache.get<HashTag>();
+  auto& map = getMap(qhash);
+  auto shard = map.lock();
+  auto& idx = shard->d_map.get<HashTag>();
   auto range = idx.equal_range(tie(tag, qhash, tcp));
   auto iter = range.first;
 
@@ -167,7 +177,7 @@ void RecursorPacketCache::insertResponsePacket(unsigned int tag, uint32_t qhash,
       continue;
     }
 
-    moveCacheItemToBack<SequencedTag>(d_packetCache, iter);
+    moveCacheItemToBack<SequencedTag>(shard->d_map, iter);
     iter->d_packet = std::move(responsePacket);
     iter->d_query = std::move(query);
     iter->d_ttd = now + ttl;
@@ -194,27 +204,64 @@ void RecursorPacketCache::insertResponsePacket(unsigned int tag, uint32_t qhash,
       e.d_pbdata = std::move(*pbdata);
     }
 
-    d_packetCache.insert(e);
+    shard->d_map.insert(std::move(e));
+    ++map.d_entriesCount;
   }
 }
 
-uint64_t RecursorPacketCache::size()
+uint64_t RecursorPacketCache::size() const
 {
-  return d_packetCache.size();
+  uint64_t count = 0;
+  for (const auto& map : d_maps) {
+    count += map.d_entriesCount;
+  }
+  return count;
 }
 
 uint64_t RecursorPacketCache::bytes()
 {
   uint64_t sum=0;
-  for(const auto& e :  d_packetCache) {
-    sum += sizeof(e) + e.d_packet.length() + 4;
+  for (auto& map : d_maps) {
+    auto shard = map.lock();
+    for (const auto& e : shard->d_map) {
+      sum += sizeof(e) + e.d_packet.length() + 4;
+    }
   }
   return sum;
 }
 
+uint64_t RecursorPacketCache::getHits()
+{
+  uint64_t sum = 0;
+  for (auto& map : d_maps) {
+    sum += map.lock()->d_hits;
+  }
+  return sum;
+}
+
+uint64_t RecursorPacketCache::getMisses()
+{
+  uint64_t sum = 0;
+  for (auto& map : d_maps) {
+    sum += map.lock()->d_misses;
+  }
+  return sum;
+}
+
+pair<uint64_t, uint64_t> RecursorPacketCache::stats()
+{
+  uint64_t contended = 0, acquired = 0;
+  for (auto& map : d_maps) {
+    auto shard = map.lock();
+    contended += shard->d_contended_count;
+    acquired += shard->d_acquired_count;
+  }
+  return pair<uint64_t, uint64_t>(contended, acquired);
+}
+
 void RecursorPacketCache::doPruneTo(size_t maxCached)
 {
-  pruneCollection<SequencedTag>(*this, d_packetCache, maxCached);
+  pruneMutexCollectionsVector<SequencedTag>(*this, d_maps, maxCached, size());
 }
 
 uint64_t RecursorPacketCache::doDump(int fd)
@@ -224,19 +271,41 @@ uint64_t RecursorPacketCache::doDump(int fd)
     return 0;
   }
 
-  fprintf(fp.get(), "; main packet cache dump from thread follows\n;\n");
+  fprintf(fp.get(), "; main packet cache dump follows\n;\n");
 
-  const auto& sidx = d_packetCache.get<SequencedTag>();
   uint64_t count = 0;
   time_t now = time(nullptr);
 
-  for (const auto& i : sidx) {
-    count++;
-    try {
-      fprintf(fp.get(), "%s %" PRId64 " %s  ; tag %d %s\n", i.d_name.toString().c_str(), static_cast<int64_t>(i.d_ttd - now), DNSRecordContent::NumberToType(i.d_type).c_str(), i.d_tag, i.d_tcp ? "tcp" : "udp");
+  /* only what we need from the entries of a shard is copied under the lock, not the packets,
+     and written out without holding it */
+  struct DumpEntry
+  {
+    DNSName d_name;
+    time_t d_ttd;
+    uint32_t d_tag;
+    uint16_t d_type;
+    bool d_tcp;
+  };
+  std::vector<DumpEntry> entries;
+  for (auto& map : d_maps) {
+    entries.clear();
+    {
+      auto shard = map.lock();
+      const auto& sidx = shard->d_map.get<SequencedTag>();
+      entries.reserve(sidx.size());
+      for (const auto& i : sidx) {
+        entries.push_back({i.d_name, i.d_ttd, i.d_tag, i.d_type, i.d_tcp});
+      }
     }
-    catch(...) {
-      fprintf(fp.get(), "; error printing '%s'\n", i.d_name.empty() ? "EMPTY" : i.d_name.toString().c_str());
+
+    for (const auto& i : entries) {
+      count++;
+      try {
+        fprintf(fp.get(), "%s %" PRId64 " %s  ; tag %d %s\n", i.d_name.toString().c_str(), static_cast<int64_t>(i.d_ttd - now), DNSRecordContent::NumberToType(i.d_type).c_str(), i.d_tag, i.d_tcp ? "tcp" : "udp");
+      }
+      catch(...) {
+        fprintf(fp.get(), "; error printing '%s'\n", i.d_name.empty() ? "EMPTY" : i.d_name.toString().c_str());
+      }
     }
   }
   return count;
@@ -32,7 +32,9 @@
 #include <boost/multi_index/sequenced_index.hpp>
 #include <boost/optional.hpp>
 
+#include "lock.hh"
 #include "packetcache.hh"
+#include "stat_t.hh"
 #include "validate.hh"
 
 #ifdef HAVE_CONFIG_H
@@ -41,7 +43,7 @@
 
 using namespace ::boost::multi_index;
 
-//! Stores whole packets, ready for lobbing back at the client. Not threadsafe.
+//! Stores whole packets, ready for lobbing back at the client. Shared by all threads, sharded by query hash.
 /* Note: we store answers as value AND KEY, and with careful work, we make sure that
    you can use a query as a key too. But query and answer must compare as identical! 
    
@@ -58,7 +60,7 @@ public:
   };
   typedef boost::optional<PBData> OptPBData;
 
-  RecursorPacketCache();
+  RecursorPacketCache(size_t shardsCount = 1024);
   bool getResponsePacket(unsigned int tag, const std::string& queryPacket, time_t now, std::string* responsePacket, uint32_t* age, uint32_t* qhash);
   bool getResponsePacket(unsigned int tag, const std::string& queryPacket, const DNSName& qname, uint16_t qtype, uint16_t qclass, time_t now, std::string* responsePacket, uint32_t* age, uint32_t* qhash);
   bool getResponsePacket(unsigned int tag, const std::string& queryPacket, const DNSName& qname, uint16_t qtype, uint16_t qclass, time_t now, std::string* responsePacket, uint32_t* age, vState* valState, uint32_t* qhash, OptPBData* pbdata, bool tcp);
@@ -67,12 +69,13 @@ public:
   void insertResponsePacket(unsigned int tag, uint32_t qhash, std::string&& query, const DNSName& qname, uint16_t qtype, uint16_t qclass, std::string&& responsePacket, time_t now, uint32_t ttl, const vState& valState, OptPBData&& pbdata, bool tcp);
   void doPruneTo(size_t maxSize=250000);
   uint64_t doDump(int fd);
-  int doWipePacketCache(const DNSName& name, uint16_t qtype=0xffff, bool subtree=false);
+  uint64_t doWipePacketCache(const DNSName& name, uint16_t qtype=0xffff, bool subtree=false);
   
-  void prune();
-  uint64_t d_hits, d_misses;
-  uint64_t size();
+  uint64_t size() const;
   uint64_t bytes();
+  uint64_t getHits();
+  uint64_t getMisses();
+  pair<uint64_t, uint64_t> stats();
 
 private:
   struct HashTag {};
@@ -124,8 +127,52 @@ private:
       >
     > packetCache_t;
 
-  packetCache_t d_packetCache;
+  struct MapCombo
+  {
+    MapCombo() {}
+    MapCombo(const MapCombo &) = delete;
+    MapCombo & operator=(const MapCombo &) = delete;
+    struct LockedContent
+    {
+      packetCache_t d_map;
+      uint64_t d_hits{0};
+      uint64_t d_misses{0};
+      uint64_t d_contended_count{0};
+      uint64_t d_acquired_count{0};
+
+      void invalidate()
+      {
+      }
+    };
+
+    pdns::stat_t d_entriesCount{0};
+
+    LockGuardedTryHolder<LockedContent> lock()
+    {
+      auto locked = d_content.try_lock();
+      if (!locked.owns_lock()) {
+        locked.lock();
+        ++locked->d_contended_count;
+      }
+      ++locked->d_acquired_count;
+      return locked;
+    }
+
+  private:
+    LockGuarded<LockedContent> d_content;
+  };
+
+  vector<MapCombo> d_maps;
+  MapCombo& getMap(uint32_t qhash)
+  {
+    return d_maps.at(qhash % d_maps.size());
+  }
 
   static bool qrMatch(const packetCache_t::index<HashTag>::type::iterator& iter, const std::string& queryPacket, const DNSName& qname, uint16_t qtype, uint16_t qclass);
-  bool checkResponseMatches(std::pair<packetCache_t::index<HashTag>::type::iterator, packetCache_t::index<HashTag>::type::iterator> range, const std::string& queryPacket, const DNSName& qname, uint16_t qtype, uint16_t qclass, time_t now, std::string* responsePacket, uint32_t* age, vState* valState, OptPBData* pbdata);
+  bool checkResponseMatches(MapCombo::LockedContent& shard, std::pair<packetCache_t::index<HashTag>::type::iterator, packetCache_t::index<HashTag>::type::iterator> range, const std::string& queryPacket, const DNSName& qname, uint16_t qtype, uint16_t qclass, time_t now, std::string* responsePacket, uint32_t* age, vState* valState, OptPBData* pbdata);
+
+public:
+  void preRemoval(MapCombo::LockedContent& map, const Entry& entry)
+  {
+  }
 };
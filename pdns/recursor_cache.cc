@@ -15,6 +15,9 @@
 #include "cachecleaner.hh"
 #include "rec-taskqueue.hh"
 
+uint16_t MemRecursorCache::s_maxServedStaleExtensions;
+bool MemRecursorCache::s_packedRecords{false};
+
 MemRecursorCache::MemRecursorCache(size_t mapsCount) : d_maps(mapsCount)
 {
 }
@@ -62,11 +65,60 @@ size_t MemRecursorCache::bytes()
       for (const auto& record : i.d_records) {
         ret += sizeof(record); // XXX WRONG we don't know the stored size!
       }
+      ret += i.d_packedRecords.size();
     }
   }
   return ret;
 }
 
+void MemRecursorCache::CacheEntry::setRecords(const vector<DNSRecord>& content, bool packed) const
+{
+  if (!packed) {
+    if (!d_packedRecords.empty()) {
+      std::string().swap(d_packedRecords);
+    }
+    d_records.clear();
+    d_records.reserve(content.size());
+    for (const auto& i : content) {
+      d_records.push_back(i.d_content);
+    }
+    return;
+  }
+
+  /* release the memory held by the shared records, this is the whole point */
+  if (!d_records.empty()) {
+    records_t().swap(d_records);
+  }
+  d_packedRecords.clear();
+  for (const auto& i : content) {
+    const auto rdata = i.d_content->serialize(d_qname);
+    d_packedRecords.reserve(d_packedRecords.size() + 2 + rdata.size());
+    d_packedRecords.push_back(static_cast<char>((rdata.size() >> 8) & 0xff));
+    d_packedRecords.push_back(static_cast<char>(rdata.size() & 0xff));
+    d_packedRecords.append(rdata);
+  }
+}
+
+/* returns the records of the entry, materializing them into unpacked if they are packed */
+const MemRecursorCache::CacheEntry::records_t& MemRecursorCache::CacheEntry::getRecords(records_t& unpacked) const
+{
+  if (d_packedRecords.empty()) {
+    return d_records;
+  }
+
+  size_t pos = 0;
+  while (pos + 2 <= d_packedRecords.size()) {
+    const size_t len = (static_cast<uint8_t>(d_packedRecords.at(pos)) << 8) + static_cast<uint8_t>(d_packedRecords.at(pos + 1));
+    pos += 2;
+    if (pos + len > d_packedRecords.size()) {
+      throw std::runtime_error("Invalid packed records for '" + d_qname.toLogString() + "' in the record cache");
+    }
+    unpacked.push_back(DNSRecordContent::deserialize(d_qname, d_qtype.getCode(), d_packedRecords.substr(pos, len)));
+    pos += len;
+  }
+  return unpacked;
+}
+
 static void updateDNSSECValidationStateFromCache(boost::optional<vState>& state, const vState stateUpdate)
 {
   // if there was no state it's easy */
@@ -110,9 +162,11 @@ time_t MemRecursorCache::handleHit(MapCombo::LockedContent& content, MemRecursor
   }
 
   if (res) {
-    res->reserve(res->size() + entry->d_records.size());
+    CacheEntry::records_t unpacked;
+    const auto& records = entry->getRecords(unpacked);
+    res->reserve(res->size() + records.size());
 
-    for(const auto& k : entry->d_records) {
+    for(const auto& k : records) {
       DNSRecord dr;
       dr.d_name = qname;
       dr.d_type = entry->d_qtype;
@@ -142,12 +196,29 @@ time_t MemRecursorCache::handleHit(MapCombo::LockedContent& content, MemRecursor
     *fromAuthZone = entry->d_authZone;
   }
 
-  moveCacheItemToBack<SequencedTag>(content.d_map, entry);
+  /* instead of moving the entry to the back of the expunge queue on every hit,
+     we only mark it and the pruning gives it a second chance when pruning gets to it */
+  entry->d_referenced = true;
 
   return ttd;
 }
 
-MemRecursorCache::cache_t::const_iterator MemRecursorCache::getEntryUsingECSIndex(MapCombo::LockedContent& map, time_t now, const DNSName &qname, const QType qtype, bool requireAuth, const ComboAddress& who)
+MemRecursorCache::cache_t::iterator MemRecursorCache::findEntry(MapCombo::LockedContent& map, const DNSName& qname, const QType qtype, const OptTag& rtag, const Netmask& netmask)
+{
+  // MUTEX SHOULD BE ACQUIRED (as indicated by the reference to the content which is protected by a lock)
+  /* exact lookups go through the (name, tag) hashed index, which is much cheaper than the
+     canonical comparisons of the ordered one, then scan the few entries it holds for that name */
+  const auto& idx = map.d_map.get<NameAndRTagOnlyHashedTag>();
+  auto range = idx.equal_range(tie(qname, rtag));
+  for (auto entry = range.first; entry != range.second; ++entry) {
+    if (entry->d_qtype == qtype && entry->d_netmask == netmask) {
+      return map.d_map.project<OrderedTag>(entry);
+    }
+  }
+  return map.d_map.end();
+}
+
+MemRecursorCache::cache_t::const_iterator MemRecursorCache::getEntryUsingECSIndex(MapCombo::LockedContent& map, time_t now, const DNSName &qname, const QType qtype, bool requireAuth, const ComboAddress& who, bool serveStale)
 {
   // MUTEX SHOULD BE ACQUIRED (as indicated by the reference to the content which is protected by a lock)
   auto ecsIndexKey = tie(qname, qtype);
@@ -160,8 +231,7 @@ MemRecursorCache::cache_t::const_iterator MemRecursorCache::getEntryUsingECSInde
         /* we have nothing more specific for you */
         break;
       }
-      auto key = boost::make_tuple(qname, qtype, boost::none, best);
-      auto entry = map.d_map.find(key);
+      auto entry = findEntry(map, qname, qtype, boost::none, best);
       if (entry == map.d_map.end()) {
         /* ecsIndex is not up-to-date */
         ecsIndex->removeNetmask(best);
@@ -172,8 +242,11 @@ MemRecursorCache::cache_t::const_iterator MemRecursorCache::getEntryUsingECSInde
         continue;
       }
 
-      if (entry->d_ttd > now) {
+      if (entry->d_ttd > now || (serveStale && entry->canServeStale(now))) {
         if (!requireAuth || entry->d_auth) {
+          if (entry->d_ttd <= now) {
+            updateStaleEntry(now, entry);
+          }
           return entry;
         }
         /* we need auth data and the best match is not authoritative */
@@ -192,11 +265,13 @@ MemRecursorCache::cache_t::const_iterator MemRecursorCache::getEntryUsingECSInde
   }
 
   /* we have nothing specific, let's see if we have a generic one */
-  auto key = boost::make_tuple(qname, qtype, boost::none, Netmask());
-  auto entry = map.d_map.find(key);
+  auto entry = findEntry(map, qname, qtype, boost::none, Netmask());
   if (entry != map.d_map.end()) {
-    if (entry->d_ttd > now) {
+    if (entry->d_ttd > now || (serveStale && entry->canServeStale(now))) {
       if (!requireAuth || entry->d_auth) {
+        if (entry->d_ttd <= now) {
+          updateStaleEntry(now, entry);
+        }
         return entry;
       }
     }
@@ -236,6 +311,25 @@ bool MemRecursorCache::entryMatches(MemRecursorCache::OrderedTagIterator_t& entr
   return match;
 }
 
+// Extend the TTD of an expired entry that we are about to serve stale, and schedule a refresh
+// of that entry. Since the entry is then valid again for the extension period, we will not try
+// to refresh it more often than once per period.
+void MemRecursorCache::updateStaleEntry(time_t now, MemRecursorCache::OrderedTagIterator_t& entry)
+{
+  // MUTEX SHOULD BE ACQUIRED
+  // An entry that has not been requested for a while should not be served stale past the
+  // window, so the periods that have elapsed since it expired count as extensions as well
+  const time_t extension = entry->getStaleExtension();
+  const time_t elapsed = (now - entry->d_ttd) / extension;
+  entry->d_servedStale = std::min(entry->d_servedStale + 1 + elapsed, static_cast<time_t>(s_maxServedStaleExtensions));
+  entry->d_ttd = now + extension;
+
+  if (entry->d_qname != g_rootdnsname) {
+    pushAlmostExpiredTask(entry->d_qname, entry->d_qtype, entry->d_ttd);
+    entry->d_submitted = true;
+  }
+}
+
 // Fake a cache miss if more than refreshTTLPerc of the original TTL has passed
 time_t MemRecursorCache::fakeTTD(MemRecursorCache::OrderedTagIterator_t& entry, const DNSName& qname, QType qtype, time_t ret, time_t now, uint32_t origTTL, bool refresh)
 {
@@ -257,10 +351,12 @@ time_t MemRecursorCache::fakeTTD(MemRecursorCache::OrderedTagIterator_t& entry,
   return ttl;
 }
 // returns -1 for no hits
-time_t MemRecursorCache::get(time_t now, const DNSName &qname, const QType qt, bool requireAuth, vector<DNSRecord>* res, const ComboAddress& who, bool refresh, const OptTag& routingTag, vector<std::shared_ptr<RRSIGRecordContent>>* signatures, std::vector<std::shared_ptr<DNSRecord>>* authorityRecs, bool* variable, vState* state, bool* wasAuth, DNSName* fromAuthZone)
+time_t MemRecursorCache::get(time_t now, const DNSName &qname, const QType qt, bool requireAuth, vector<DNSRecord>* res, const ComboAddress& who, Flags flags, const OptTag& routingTag, vector<std::shared_ptr<RRSIGRecordContent>>* signatures, std::vector<std::shared_ptr<DNSRecord>>* authorityRecs, bool* variable, vState* state, bool* wasAuth, DNSName* fromAuthZone)
 {
   boost::optional<vState> cachedState{boost::none};
   uint32_t origTTL;
+  const bool refresh = flags & Refresh;
+  const bool serveStale = flags & ServeStale;
 
   if(res) {
     res->clear();
@@ -281,11 +377,11 @@ time_t MemRecursorCache::get(time_t now, const DNSName &qname, const QType qt, b
     if (qtype == QType::ADDR) {
       time_t ret = -1;
 
-      auto entryA = getEntryUsingECSIndex(*map, now, qname, QType::A, requireAuth, who);
+      auto entryA = getEntryUsingECSIndex(*map, now, qname, QType::A, requireAuth, who, serveStale);
       if (entryA != map->d_map.end()) {
         ret = handleHit(*map, entryA, qname, origTTL, res, signatures, authorityRecs, variable, cachedState, wasAuth, fromAuthZone);
       }
-      auto entryAAAA = getEntryUsingECSIndex(*map, now, qname, QType::AAAA, requireAuth, who);
+      auto entryAAAA = getEntryUsingECSIndex(*map, now, qname, QType::AAAA, requireAuth, who, serveStale);
       if (entryAAAA != map->d_map.end()) {
         time_t ttdAAAA = handleHit(*map, entryAAAA, qname, origTTL, res, signatures, authorityRecs, variable, cachedState, wasAuth, fromAuthZone);
         if (ret > 0) {
@@ -302,7 +398,7 @@ time_t MemRecursorCache::get(time_t now, const DNSName &qname, const QType qt, b
       return ret > 0 ? (ret - now) : ret;
     }
     else {
-      auto entry = getEntryUsingECSIndex(*map, now, qname, qtype, requireAuth, who);
+      auto entry = getEntryUsingECSIndex(*map, now, qname, qtype, requireAuth, who, serveStale);
       if (entry != map->d_map.end()) {
         time_t ret = handleHit(*map, entry, qname, origTTL, res, signatures, authorityRecs, variable, cachedState, wasAuth, fromAuthZone);
         if (state && cachedState) {
@@ -324,7 +420,7 @@ time_t MemRecursorCache::get(time_t now, const DNSName &qname, const QType qt, b
       for (auto i=entries.first; i != entries.second; ++i) {
         firstIndexIterator = map->d_map.project<OrderedTag>(i);
 
-        if (i->d_ttd <= now) {
+        if (i->d_ttd <= now && !(serveStale && i->canServeStale(now))) {
           moveCacheItemToFront<SequencedTag>(map->d_map, firstIndexIterator);
           continue;
         }
@@ -332,6 +428,10 @@ time_t MemRecursorCache::get(time_t now, const DNSName &qname, const QType qt, b
         if (!entryMatches(firstIndexIterator, qtype, requireAuth, who)) {
           continue;
         }
+
+        if (i->d_ttd <= now) {
+          updateStaleEntry(now, firstIndexIterator);
+        }
         found = true;
         ttd = handleHit(*map, firstIndexIterator, qname, origTTL, res, signatures, authorityRecs, variable, cachedState, wasAuth, fromAuthZone);
 
@@ -360,7 +460,7 @@ time_t MemRecursorCache::get(time_t now, const DNSName &qname, const QType qt, b
     for (auto i=entries.first; i != entries.second; ++i) {
       firstIndexIterator = map->d_map.project<OrderedTag>(i);
 
-      if (i->d_ttd <= now) {
+      if (i->d_ttd <= now && !(serveStale && i->canServeStale(now))) {
         moveCacheItemToFront<SequencedTag>(map->d_map, firstIndexIterator);
         continue;
       }
@@ -369,6 +469,10 @@ time_t MemRecursorCache::get(time_t now, const DNSName &qname, const QType qt, b
         continue;
       }
 
+      if (i->d_ttd <= now) {
+        updateStaleEntry(now, firstIndexIterator);
+      }
+
       found = true;
       ttd = handleHit(*map, firstIndexIterator, qname, origTTL, res, signatures, authorityRecs, variable, cachedState, wasAuth, fromAuthZone);
 
@@ -391,7 +495,38 @@ void MemRecursorCache::replace(time_t now, const DNSName &qname, const QType qt,
   auto& mc = getMap(qname);
   auto map = mc.lock();
 
-  map->d_cachecachevalid = false;
+  replaceLocked(mc, *map, now, qname, qt, content, signatures, authorityRecs, auth, authZone, ednsmask, routingTag, state, from);
+}
+
+size_t MemRecursorCache::replaceBulk(time_t now, const vector<BulkRRSet>& rrsets, const DNSName& authZone)
+{
+  static const std::vector<std::shared_ptr<DNSRecord>> noAuthorityRecs;
+
+  /* group the RRsets by shard so that each shard lock is only taken once, instead of once per RRset */
+  vector<std::pair<size_t, size_t>> order;
+  order.reserve(rrsets.size());
+  for (size_t idx = 0; idx < rrsets.size(); idx++) {
+    order.emplace_back(getMapIndex(rrsets[idx].d_qname), idx);
+  }
+  std::sort(order.begin(), order.end());
+
+  auto it = order.cbegin();
+  while (it != order.cend()) {
+    const size_t shard = it->first;
+    auto& mc = d_maps.at(shard);
+    auto map = mc.lock();
+    for (; it != order.cend() && it->first == shard; ++it) {
+      const auto& rrset = rrsets[it->second];
+      replaceLocked(mc, *map, now, rrset.d_qname, rrset.d_qtype, rrset.d_records, rrset.d_signatures, noAuthorityRecs, rrset.d_auth, authZone, boost::none, boost::none, vState::Indeterminate, boost::none);
+    }
+  }
+
+  return order.size();
+}
+
+void MemRecursorCache::replaceLocked(MapCombo& mc, MapCombo::LockedContent& map, time_t now, const DNSName &qname, const QType qt, const vector<DNSRecord>& content, const vector<shared_ptr<RRSIGRecordContent>>& signatures, const std::vector<std::shared_ptr<DNSRecord>>& authorityRecs, bool auth, const DNSName& authZone, boost::optional<Netmask> ednsmask, const OptTag& routingTag, vState state, boost::optional<ComboAddress> from)
+{
+  map.d_cachecachevalid = false;
   if (ednsmask) {
     ednsmask = ednsmask->getNormalized();
   }
@@ -400,9 +535,9 @@ void MemRecursorCache::replace(time_t now, const DNSName &qname, const QType qt,
   // We only store an ednsmask if we do not have a tag and we do have a mask.
   auto key = boost::make_tuple(qname, qt.getCode(), ednsmask ? routingTag : boost::none, (ednsmask && !routingTag) ? *ednsmask : Netmask());
   bool isNew = false;
-  cache_t::iterator stored = map->d_map.find(key);
-  if (stored == map->d_map.end()) {
-    stored = map->d_map.insert(CacheEntry(key, auth)).first;
+  cache_t::iterator stored = findEntry(map, qname, qt, key.get<2>(), key.get<3>());
+  if (stored == map.d_map.end()) {
+    stored = map.d_map.insert(CacheEntry(key, auth)).first;
     ++mc.d_entriesCount;
     isNew = true;
   }
@@ -416,74 +551,67 @@ void MemRecursorCache::replace(time_t now, const DNSName &qname, const QType qt,
     /* don't bother building an ecsIndex if we don't have any netmask-specific entries */
     if (!routingTag && ednsmask && !ednsmask->empty()) {
       auto ecsIndexKey = boost::make_tuple(qname, qt.getCode());
-      auto ecsIndex = map->d_ecsIndex.find(ecsIndexKey);
-      if (ecsIndex == map->d_ecsIndex.end()) {
-        ecsIndex = map->d_ecsIndex.insert(ECSIndexEntry(qname, qt.getCode())).first;
+      auto ecsIndex = map.d_ecsIndex.find(ecsIndexKey);
+      if (ecsIndex == map.d_ecsIndex.end()) {
+        ecsIndex = map.d_ecsIndex.insert(ECSIndexEntry(qname, qt.getCode())).first;
       }
       ecsIndex->addMask(*ednsmask);
     }
   }
 
-  time_t maxTTD=std::numeric_limits<time_t>::max();
-  CacheEntry ce=*stored; // this is a COPY
-  ce.d_qtype=qt.getCode();
-
-  if(!auth && ce.d_auth) {  // unauth data came in, we have some auth data, but is it fresh?
-    if(ce.d_ttd > now) { // we still have valid data, ignore unauth data
+  if (!auth && stored->d_auth) {  // unauth data came in, we have some auth data, but is it fresh?
+    if (stored->d_ttd > now) { // we still have valid data, ignore unauth data
       return;
     }
-    else {
-      ce.d_auth = false;  // new data won't be auth
-    }
+    // otherwise the new data won't be auth
   }
 
   if (auth) {
     /* we don't want to keep a non-auth entry while we have an auth one */
-    if (vStateIsBogus(state) && (!vStateIsBogus(ce.d_state) && ce.d_state != vState::Indeterminate) && ce.d_ttd > now) {
+    if (vStateIsBogus(state) && (!vStateIsBogus(stored->d_state) && stored->d_state != vState::Indeterminate) && stored->d_ttd > now) {
       /* the new entry is Bogus, the existing one is not and is still valid, let's keep the existing one */
       return;
     }
   }
 
-  ce.d_state = state;
-
+  time_t maxTTD=std::numeric_limits<time_t>::max();
   // refuse any attempt to *raise* the TTL of auth NS records, as it would make it possible
   // for an auth to keep a "ghost" zone alive forever, even after the delegation is gone from
   // the parent
   // BUT make sure that we CAN refresh the root
-  if (ce.d_auth && auth && qt == QType::NS && !isNew && !qname.isRoot()) {
-    //    cerr<<"\tLimiting TTL of auth->auth NS set replace to "<<ce.d_ttd<<endl;
-    maxTTD = ce.d_ttd;
-  }
-
-  if (auth) {
-    ce.d_auth = true;
+  if (stored->d_auth && auth && qt == QType::NS && !isNew && !qname.isRoot()) {
+    //    cerr<<"\tLimiting TTL of auth->auth NS set replace to "<<stored->d_ttd<<endl;
+    maxTTD = stored->d_ttd;
   }
 
-  ce.d_signatures = signatures;
-  ce.d_authorityRecs = authorityRecs;
-  ce.d_records.clear();
-  ce.d_records.reserve(content.size());
-  ce.d_authZone = authZone;
+  if (!isNew) {
+    stored->d_referenced = true;
+  }
+
+  /* the key (name, type, tag, netmask) does not change, so we update the entry in place
+     instead of copying it, with all its records, and replacing it, which would also
+     re-check its position in every index */
+  stored->d_auth = auth;
+  stored->d_state = state;
+  stored->d_signatures = signatures;
+  stored->d_authorityRecs = authorityRecs;
+  stored->setRecords(content, s_packedRecords);
+  stored->d_authZone = authZone;
   if (from) {
-    ce.d_from = *from;
+    stored->d_from = *from;
   } else {
-    ce.d_from = ComboAddress();
+    stored->d_from = ComboAddress();
   }
 
   for (const auto& i : content) {
     /* Yes, we have altered the d_ttl value by adding time(nullptr) to it
        prior to calling this function, so the TTL actually holds a TTD. */
-    ce.d_ttd = min(maxTTD, static_cast<time_t>(i.d_ttl));   // XXX this does weird things if TTLs differ in the set
-    ce.d_orig_ttl = ce.d_ttd - now;
-    ce.d_records.push_back(i.d_content);
+    stored->d_ttd = min(maxTTD, static_cast<time_t>(i.d_ttl));   // XXX this does weird things if TTLs differ in the set
+    stored->d_orig_ttl = stored->d_ttd - now;
   }
 
-  if (!isNew) {
-    moveCacheItemToBack<SequencedTag>(map->d_map, stored);
-  }
-  ce.d_submitted = false;
-  map->d_map.replace(stored, ce);
+  stored->d_submitted = false;
+  stored->d_servedStale = 0;
 }
 
 size_t MemRecursorCache::doWipeCache(const DNSName& name, bool sub, const QType qtype)
@@ -593,7 +721,7 @@ bool MemRecursorCache::updateValidationStatus(time_t now, const DNSName &qname,
 
   bool updated = false;
   if (!map->d_ecsIndex.empty() && !routingTag) {
-    auto entry = getEntryUsingECSIndex(*map, now, qname, qtype, requireAuth, who);
+    auto entry = getEntryUsingECSIndex(*map, now, qname, qtype, requireAuth, who, false);
     if (entry == map->d_map.end()) {
       return false;
     }
@@ -641,13 +769,30 @@ uint64_t MemRecursorCache::doDump(int fd)
   fprintf(fp.get(), "; main record cache dump follows\n;\n");
   uint64_t count = 0;
 
+  /* the entries of a shard are copied under the lock (the records themselves are shared
+     pointers, so this is cheap) and written out after releasing it, so that the workers
+     are never kept waiting while we format and write to the file */
+  std::vector<CacheEntry> entries;
   for (auto& mc : d_maps) {
-    auto map = mc.lock();
-    const auto& sidx = map->d_map.get<SequencedTag>();
+    entries.clear();
+    {
+      auto map = mc.lock();
+      const auto& sidx = map->d_map.get<SequencedTag>();
+      entries.reserve(sidx.size());
+      std::copy(sidx.begin(), sidx.end(), std::back_inserter(entries));
+    }
 
     time_t now = time(nullptr);
-    for (const auto& i : sidx) {
-      for (const auto& j : i.d_records) {
+    for (const auto& i : entries) {
+      CacheEntry::records_t unpacked;
+      const CacheEntry::records_t* records = &i.d_records;
+      try {
+        records = &i.getRecords(unpacked);
+      }
+      catch(...) {
+        fprintf(fp.get(), "; error unpacking '%s'\n", i.d_qname.empty() ? "EMPTY" : i.d_qname.toString().c_str());
+      }
+      for (const auto& j : *records) {
         count++;
         try {
           fprintf(fp.get(), "%s %" PRIu32 " %" PRId64 " IN %s %s ; (%s) auth=%i zone=%s from=%s %s %s\n", i.d_qname.toString().c_str(), i.d_orig_ttl, static_cast<int64_t>(i.d_ttd - now), i.d_qtype.toString().c_str(), j->getZoneRepresentation().c_str(), vStateToString(i.d_state).c_str(), i.d_auth, i.d_authZone.toLogString().c_str(), i.d_from.toString().c_str(), i.d_netmask.empty() ? "" : i.d_netmask.toString().c_str(), !i.d_rtag ? "" : i.d_rtag.get().c_str());
@@ -674,6 +819,9 @@ void MemRecursorCache::doPrune(size_t keep)
 {
   //size_t maxCached = d_maxEntries;
   size_t cacheSize = size();
+  if (cacheSize > keep) {
+    giveSecondChanceMutexCollectionsVector<SequencedTag>(d_maps, cacheSize - keep);
+  }
   pruneMutexCollectionsVector<SequencedTag>(*this, d_maps, keep, cacheSize);
 }
 
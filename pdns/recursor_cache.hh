@@ -57,10 +57,38 @@ public:
 
   typedef boost::optional<std::string> OptTag;
 
-  time_t get(time_t, const DNSName &qname, const QType qt, bool requireAuth, vector<DNSRecord>* res, const ComboAddress& who, bool refresh = false, const OptTag& routingTag = boost::none, vector<std::shared_ptr<RRSIGRecordContent>>* signatures=nullptr, std::vector<std::shared_ptr<DNSRecord>>* authorityRecs=nullptr, bool* variable=nullptr, vState* state=nullptr, bool* wasAuth=nullptr, DNSName* fromAuthZone=nullptr);
+  /* flags for get(): Refresh fakes a miss for almost expired entries so that they get refetched,
+     ServeStale allows expired entries that are still within the serve-stale window to be returned */
+  typedef uint8_t Flags;
+  static constexpr Flags None = 0;
+  static constexpr Flags Refresh = 1 << 0;
+  static constexpr Flags ServeStale = 1 << 1;
+
+  // The number of times a stale cache entry is extended
+  static uint16_t s_maxServedStaleExtensions;
+  // The time a stale cache entry is extended
+  static constexpr uint32_t s_serveStaleExtensionPeriod = 30;
+  // Store the records of new and updated entries as packed wire-format rdata
+  static bool s_packedRecords;
+
+  time_t get(time_t, const DNSName &qname, const QType qt, bool requireAuth, vector<DNSRecord>* res, const ComboAddress& who, Flags flags = None, const OptTag& routingTag = boost::none, vector<std::shared_ptr<RRSIGRecordContent>>* signatures=nullptr, std::vector<std::shared_ptr<DNSRecord>>* authorityRecs=nullptr, bool* variable=nullptr, vState* state=nullptr, bool* wasAuth=nullptr, DNSName* fromAuthZone=nullptr);
 
   void replace(time_t, const DNSName &qname, const QType qt,  const vector<DNSRecord>& content, const vector<shared_ptr<RRSIGRecordContent>>& signatures, const std::vector<std::shared_ptr<DNSRecord>>& authorityRecs, bool auth, const DNSName& authZone, boost::optional<Netmask> ednsmask=boost::none, const OptTag& routingTag = boost::none, vState state=vState::Indeterminate, boost::optional<ComboAddress> from=boost::none);
 
+  /* an RRset for replaceBulk(), as for replace() the TTL of the records holds a TTD */
+  struct BulkRRSet
+  {
+    DNSName d_qname;
+    vector<DNSRecord> d_records;
+    vector<shared_ptr<RRSIGRecordContent>> d_signatures;
+    QType d_qtype;
+    bool d_auth;
+  };
+
+  /* inserts the RRsets shard by shard, taking each shard lock only once.
+     Returns the number of RRsets handled. */
+  size_t replaceBulk(time_t now, const vector<BulkRRSet>& rrsets, const DNSName& authZone);
+
   void doPrune(size_t keep);
   uint64_t doDump(int fd);
 
@@ -75,30 +103,53 @@ private:
   struct CacheEntry
   {
     CacheEntry(const boost::tuple<DNSName, QType, OptTag, Netmask>& key, bool auth):
-      d_qname(key.get<0>()), d_netmask(key.get<3>().getNormalized()), d_rtag(key.get<2>()), d_state(vState::Indeterminate), d_ttd(0), d_qtype(key.get<1>()), d_auth(auth), d_submitted(false)
+      d_qname(key.get<0>()), d_netmask(key.get<3>().getNormalized()), d_rtag(key.get<2>()), d_state(vState::Indeterminate), d_ttd(0), d_qtype(key.get<1>()), d_auth(auth), d_submitted(false), d_referenced(false), d_servedStale(0)
     {
     }
 
     typedef vector<std::shared_ptr<DNSRecordContent>> records_t;
+
+    /* used by the cache cleaner: expired entries are kept around for as long as
+       they can still be served stale */
     time_t getTTD() const
     {
-      return d_ttd;
+      return d_ttd + static_cast<time_t>(s_maxServedStaleExtensions - d_servedStale) * getStaleExtension();
     }
 
-    records_t d_records;
-    std::vector<std::shared_ptr<RRSIGRecordContent>> d_signatures;
-    std::vector<std::shared_ptr<DNSRecord>> d_authorityRecs;
+    time_t getStaleExtension() const
+    {
+      return std::max(1U, std::min(d_orig_ttl, s_serveStaleExtensionPeriod));
+    }
+
+    bool canServeStale(time_t now) const
+    {
+      return d_servedStale < s_maxServedStaleExtensions && getTTD() > now;
+    }
+
+    void setRecords(const vector<DNSRecord>& content, bool packed) const;
+    const records_t& getRecords(records_t& unpacked) const;
+
+    /* everything but the key (name, type, tag and netmask) is mutable, so that replace()
+       can update an existing entry in place, under the lock, without re-indexing it */
+    mutable records_t d_records;
+    /* when packed, the records are only stored here instead of in d_records, each one as
+       its rdata length (16 bits, network order) followed by its rdata in wire format */
+    mutable std::string d_packedRecords;
+    mutable std::vector<std::shared_ptr<RRSIGRecordContent>> d_signatures;
+    mutable std::vector<std::shared_ptr<DNSRecord>> d_authorityRecs;
     DNSName d_qname;
-    DNSName d_authZone;
-    ComboAddress d_from;
+    mutable DNSName d_authZone;
+    mutable ComboAddress d_from;
     Netmask d_netmask;
     OptTag d_rtag;
     mutable vState d_state;
     mutable time_t d_ttd;
-    uint32_t d_orig_ttl;
+    mutable uint32_t d_orig_ttl;
     QType d_qtype;
-    bool d_auth;
+    mutable bool d_auth;
     mutable bool d_submitted;     // whether this entry has been queued for refetch
+    mutable bool d_referenced;    // whether this entry has been used since the last time the pruning went over it
+    mutable uint16_t d_servedStale; // how many times this entry has been extended to be served stale
   };
 
   /* The ECS Index (d_ecsIndex) keeps track of whether there is any ECS-specific
@@ -243,16 +294,23 @@ private:
   };
 
   vector<MapCombo> d_maps;
+  size_t getMapIndex(const DNSName &qname) const
+  {
+    return qname.hash() % d_maps.size();
+  }
   MapCombo& getMap(const DNSName &qname)
   {
-    return d_maps.at(qname.hash() % d_maps.size());
+    return d_maps.at(getMapIndex(qname));
   }
 
   static time_t fakeTTD(OrderedTagIterator_t& entry, const DNSName& qname, QType qtype, time_t ret, time_t now, uint32_t origTTL, bool refresh);
 
+  static cache_t::iterator findEntry(MapCombo::LockedContent& content, const DNSName& qname, QType qtype, const OptTag& rtag, const Netmask& netmask);
   bool entryMatches(OrderedTagIterator_t& entry, QType qt, bool requireAuth, const ComboAddress& who);
   Entries getEntries(MapCombo::LockedContent& content, const DNSName &qname, const QType qt, const OptTag& rtag);
-  cache_t::const_iterator getEntryUsingECSIndex(MapCombo::LockedContent& content, time_t now, const DNSName &qname, QType qtype, bool requireAuth, const ComboAddress& who);
+  cache_t::const_iterator getEntryUsingECSIndex(MapCombo::LockedContent& content, time_t now, const DNSName &qname, QType qtype, bool requireAuth, const ComboAddress& who, bool serveStale);
+  static void updateStaleEntry(time_t now, OrderedTagIterator_t& entry);
+  static void replaceLocked(MapCombo& mc, MapCombo::LockedContent& map, time_t now, const DNSName &qname, const QType qt, const vector<DNSRecord>& content, const vector<shared_ptr<RRSIGRecordContent>>& signatures, const std::vector<std::shared_ptr<DNSRecord>>& authorityRecs, bool auth, const DNSName& authZone, boost::optional<Netmask> ednsmask, const OptTag& routingTag, vState state, boost::optional<ComboAddress> from);
 
   time_t handleHit(MapCombo::LockedContent& content, OrderedTagIterator_t& entry, const DNSName& qname, uint32_t& origTTL, vector<DNSRecord>* res, vector<std::shared_ptr<RRSIGRecordContent>>* signatures, std::vector<std::shared_ptr<DNSRecord>>* authorityRecs, bool* variable, boost::optional<vState>& state, bool* wasAuth, DNSName* authZone);
 
@@ -32,19 +32,110 @@ std::unique_ptr<AggressiveNSECCache> g_aggressiveNSECCache{nullptr};
 /* this is defined in syncres.hh and we are not importing that here */
 extern std::unique_ptr<MemRecursorCache> g_recCache;
 
+std::atomic<uint64_t> AggressiveNSECCache::s_instances{0};
+
+const AggressiveNSECCache::zones_t& AggressiveNSECCache::getZones() const
+{
+  /* the instance ID is needed because the unit tests create several caches in the same thread */
+  static thread_local struct
+  {
+    std::shared_ptr<const zones_t> d_zones{nullptr};
+    uint64_t d_id{0};
+    uint64_t d_generation{0};
+  } t_local;
+
+  if (t_local.d_id != d_id || t_local.d_generation != d_zonesGeneration.load()) {
+    auto current = d_zones.lock();
+    t_local.d_zones = current->d_zones;
+    t_local.d_generation = current->d_generation;
+    t_local.d_id = d_id;
+  }
+
+  return *t_local.d_zones;
+}
+
+/* Once enough zones are pending, see getZone(), a new version of the tree is published.
+   The threshold grows with the number of zones, so that the total cost of the copies stays
+   linear in the number of zones instead of being quadratic. */
+static const uint64_t s_minPendingZones = 64;
+
+/*
+ * Copy the current version of the tree, add the pending zones to it and let act() modify it,
+ * then publish the result unless neither the pending zones nor act() changed anything.
+ * MUTEX SHOULD BE ACQUIRED (as indicated by the reference to the snapshot which is protected by a lock)
+ */
+template <typename F>
+void AggressiveNSECCache::modifyZones(ZonesSnapshot& current, F act)
+{
+  auto zones = std::make_shared<zones_t>(*current.d_zones);
+  bool modified = false;
+  if (d_pendingZonesCount > 0) {
+    auto pending = d_pendingZones.write_lock();
+    pending->visit([&zones](const zones_t& node) {
+      if (node.d_value) {
+        auto name = node.d_value->lock()->d_zone;
+        zones->add(name, std::shared_ptr<LockGuarded<ZoneEntry>>(node.d_value));
+      }
+    });
+    *pending = zones_t();
+    d_pendingZonesCount = 0;
+    modified = true;
+  }
+
+  if (act(*zones)) {
+    modified = true;
+  }
+
+  if (!modified) {
+    return;
+  }
+
+  uint64_t count = 0;
+  zones->visit([&count](const zones_t& node) {
+    if (node.d_value) {
+      ++count;
+    }
+  });
+  current.d_zonesCount = count;
+  current.d_zones = std::move(zones);
+  current.d_generation = ++d_zonesGeneration;
+}
+
 std::shared_ptr<LockGuarded<AggressiveNSECCache::ZoneEntry>> AggressiveNSECCache::getBestZone(const DNSName& zone)
 {
   std::shared_ptr<LockGuarded<AggressiveNSECCache::ZoneEntry>> entry{nullptr};
+
+  auto got = getZones().lookup(zone);
+  if (got) {
+    entry = *got;
+  }
+
+  if (d_pendingZonesCount == 0) {
+    return entry;
+  }
+
+  /* a zone added since the current version was published might be a closer match.
+     Like a lookup in the published version, this should never wait for a writer, so
+     if one is busy with the pending zones we are fine with what we have found so far */
+  std::shared_ptr<LockGuarded<ZoneEntry>> pendingEntry{nullptr};
   {
-    auto zones = d_zones.try_read_lock();
-    if (!zones.owns_lock()) {
+    auto pendingZones = d_pendingZones.try_read_lock();
+    if (!pendingZones.owns_lock()) {
       return entry;
     }
-
-    auto got = zones->lookup(zone);
-    if (got) {
-      return *got;
+    auto pending = pendingZones->lookup(zone);
+    if (!pending || !*pending) {
+      return entry;
     }
+    pendingEntry = *pending;
+  }
+
+  if (!entry) {
+    return pendingEntry;
+  }
+  auto pendingLabels = pendingEntry->lock()->d_zone.countLabels();
+  if (pendingLabels > entry->lock()->d_zone.countLabels()) {
+    return pendingEntry;
   }
   return entry;
 }
@@ -52,8 +143,7 @@ std::shared_ptr<LockGuarded<AggressiveNSECCache::ZoneEntry>> AggressiveNSECCache
 std::shared_ptr<LockGuarded<AggressiveNSECCache::ZoneEntry>> AggressiveNSECCache::getZone(const DNSName& zone)
 {
   {
-    auto zones = d_zones.read_lock();
-    auto got = zones->lookup(zone);
+    auto got = getZones().lookup(zone);
     if (got && *got) {
       auto locked = (*got)->lock();
       if (locked->d_zone == zone) {
@@ -62,27 +152,47 @@ std::shared_ptr<LockGuarded<AggressiveNSECCache::ZoneEntry>> AggressiveNSECCache
     }
   }
 
-  auto entry = std::make_shared<LockGuarded<ZoneEntry>>(zone);
-
+  auto current = d_zones.lock();
+  /* it might have been inserted in the mean time, or be waiting to be published */
   {
-    auto zones = d_zones.write_lock();
-    /* it might have been inserted in the mean time */
-    auto got = zones->lookup(zone);
+    auto got = current->d_zones->lookup(zone);
+    if (got && *got) {
+      auto locked = (*got)->lock();
+      if (locked->d_zone == zone) {
+        return *got;
+      }
+    }
+  }
+  {
+    auto pending = d_pendingZones.read_lock();
+    auto got = pending->lookup(zone);
     if (got && *got) {
       auto locked = (*got)->lock();
       if (locked->d_zone == zone) {
         return *got;
       }
     }
-    zones->add(zone, std::shared_ptr<LockGuarded<ZoneEntry>>(entry));
-    return entry;
   }
+
+  /* copying the whole tree for every new zone would make warming up the cache quadratic in
+     the number of zones, so new zones are kept aside and published in batches */
+  auto entry = std::make_shared<LockGuarded<ZoneEntry>>(zone);
+  d_pendingZones.write_lock()->add(zone, std::shared_ptr<LockGuarded<ZoneEntry>>(entry));
+  ++d_pendingZonesCount;
+
+  if (d_pendingZonesCount >= std::max(s_minPendingZones, current->d_zonesCount / 8)) {
+    modifyZones(*current, [](zones_t& tree) {
+      return false;
+    });
+  }
+
+  return entry;
 }
 
-void AggressiveNSECCache::updateEntriesCount(SuffixMatchTree<std::shared_ptr<LockGuarded<ZoneEntry>>>& zones)
+void AggressiveNSECCache::updateEntriesCount(const zones_t& zones)
 {
   uint64_t counter = 0;
-  zones.visit([&counter](const SuffixMatchTree<std::shared_ptr<LockGuarded<ZoneEntry>>>& node) {
+  zones.visit([&counter](const zones_t& node) {
     if (node.d_value) {
       counter += node.d_value->lock()->d_entries.size();
     }
@@ -92,32 +202,60 @@ void AggressiveNSECCache::updateEntriesCount(SuffixMatchTree<std::shared_ptr<Loc
 
 void AggressiveNSECCache::removeZoneInfo(const DNSName& zone, bool subzones)
 {
-  auto zones = d_zones.write_lock();
-
+  /* threads that have not looked anything up in a while might still be holding a reference
+     to the previous version of the tree, and thus to the removed zones, so we release their
+     content right away instead of waiting for the last reference to go away */
+  auto current = d_zones.lock();
   if (subzones) {
-    zones->remove(zone, true);
-    updateEntriesCount(*zones);
+    modifyZones(*current, [this, &zone](zones_t& zones) {
+      zones.visit([&zone](const zones_t& node) {
+        if (!node.d_value) {
+          return;
+        }
+        auto locked = node.d_value->lock();
+        if (locked->d_zone.isPartOf(zone)) {
+          locked->d_entries.clear();
+          locked->d_hashes.clear();
+        }
+      });
+      zones.remove(zone, true);
+      updateEntriesCount(zones);
+      return true;
+    });
   }
   else {
-    auto got = zones->lookup(zone);
-    if (!got || !*got) {
-      return;
-    }
+    modifyZones(*current, [this, &zone](zones_t& zones) {
+      auto got = zones.lookup(zone);
+      if (!got || !*got) {
+        return false;
+      }
 
-    /* let's increase the ref count of the shared pointer
-       so we get the lock, remove the zone from the tree,
-       then release the lock before the entry is deleted */
-    auto entry = *got;
-    {
+      /* the entry is still referenced by the current version of the tree,
+         so it will not be deleted while we hold its lock */
       auto locked = (*got)->lock();
       if (locked->d_zone != zone) {
-        return;
+        return false;
       }
-      auto removed = locked->d_entries.size();
-      zones->remove(zone, false);
-      d_entriesCount -= removed;
-    }
+      d_entriesCount -= locked->d_entries.size();
+      locked->d_entries.clear();
+      locked->d_hashes.clear();
+      zones.remove(zone, false);
+      return true;
+    });
+  }
+}
+
+size_t AggressiveNSECCache::getNSEC3HashesCount(const DNSName& zone)
+{
+  auto entry = getBestZone(zone);
+  if (!entry) {
+    return 0;
   }
+  auto locked = entry->lock();
+  if (locked->d_zone != zone) {
+    return 0;
+  }
+  return locked->d_hashes.size();
 }
 
 void AggressiveNSECCache::prune(time_t now)
@@ -129,13 +267,14 @@ void AggressiveNSECCache::prune(time_t now)
   uint64_t lookedAt = 0;
   uint64_t toLook = std::max(d_entriesCount / 5U, static_cast<uint64_t>(1U));
 
+  /* holding the lock prevents the zones from being removed, and their entries accounted for, while we prune them */
+  auto zones = d_zones.lock();
+
   if (d_entriesCount > maxNumberOfEntries) {
     uint64_t toErase = d_entriesCount - maxNumberOfEntries;
     toLook = toErase * 5;
     // we are full, scan at max 5 * toErase entries and stop once we have nuked enough
-
-    auto zones = d_zones.write_lock();
-    zones->visit([now, &erased, toErase, toLook, &lookedAt, &emptyEntries](const SuffixMatchTree<std::shared_ptr<LockGuarded<ZoneEntry>>>& node) {
+    auto pruneZone = [now, &erased, toErase, toLook, &lookedAt, &emptyEntries](const zones_t& node) {
       if (!node.d_value || erased > toErase || lookedAt > toLook) {
         return;
       }
@@ -159,12 +298,14 @@ void AggressiveNSECCache::prune(time_t now)
       if (zoneEntry->d_entries.size() == 0) {
         emptyEntries.push_back(zoneEntry->d_zone);
       }
-    });
+    };
+    zones->d_zones->visit(pruneZone);
+    d_pendingZones.read_lock()->visit(pruneZone);
+    d_entriesCount -= erased;
   }
   else {
     // we are not full, just look through 10% of the cache and nuke everything that is expired
-    auto zones = d_zones.write_lock();
-    zones->visit([now, &erased, toLook, &lookedAt, &emptyEntries](const SuffixMatchTree<std::shared_ptr<LockGuarded<ZoneEntry>>>& node) {
+    auto pruneZone = [now, &erased, toLook, &lookedAt, &emptyEntries](const zones_t& node) {
       if (!node.d_value) {
         return;
       }
@@ -187,16 +328,19 @@ void AggressiveNSECCache::prune(time_t now)
       if (zoneEntry->d_entries.size() == 0) {
         emptyEntries.push_back(zoneEntry->d_zone);
       }
-    });
+    };
+    zones->d_zones->visit(pruneZone);
+    d_pendingZones.read_lock()->visit(pruneZone);
+    d_entriesCount -= erased;
   }
 
-  d_entriesCount -= erased;
-
   if (!emptyEntries.empty()) {
-    auto zones = d_zones.write_lock();
-    for (const auto& entry : emptyEntries) {
-      zones->remove(entry);
-    }
+    modifyZones(*zones, [&emptyEntries](zones_t& tree) {
+      for (const auto& entry : emptyEntries) {
+        tree.remove(entry);
+      }
+      return true;
+    });
   }
 }
 
@@ -310,6 +454,7 @@ void AggressiveNSECCache::insertNSEC(const DNSName& zone, const DNSName& owner,
         // If it instead is different servers using different parameters, well, too bad.
         d_entriesCount -= zoneEntry->d_entries.size();
         zoneEntry->d_entries.clear();
+        zoneEntry->d_hashes.clear();
       }
     }
 
@@ -382,6 +527,37 @@ bool AggressiveNSECCache::getNSECBefore(time_t now, std::shared_ptr<LockGuarded<
   return true;
 }
 
+/* Under a random subdomain attack the queried name, and thus the next closer, is different every time,
+   but the closest encloser candidates and the wildcard are not, so we keep their hashes around
+   instead of going through all the iterations again for every query. */
+std::string AggressiveNSECCache::getNSEC3Hash(std::shared_ptr<LockGuarded<AggressiveNSECCache::ZoneEntry>>& zone, const std::string& salt, uint16_t iterations, const DNSName& name, bool cache)
+{
+  if (cache) {
+    auto zoneEntry = zone->try_lock();
+    if (zoneEntry.owns_lock() && zoneEntry->d_salt == salt && zoneEntry->d_iterations == iterations) {
+      auto it = zoneEntry->d_hashes.find(name);
+      if (it != zoneEntry->d_hashes.end()) {
+        return it->second;
+      }
+    }
+  }
+
+  /* hashing might be expensive, let's not do it while holding the lock */
+  auto hash = hashQNameWithSalt(salt, iterations, name);
+
+  if (cache) {
+    auto zoneEntry = zone->try_lock();
+    if (zoneEntry.owns_lock() && zoneEntry->d_salt == salt && zoneEntry->d_iterations == iterations) {
+      if (zoneEntry->d_hashes.size() >= s_maxNSEC3HashesPerZone) {
+        zoneEntry->d_hashes.clear();
+      }
+      zoneEntry->d_hashes.emplace(name, hash);
+    }
+  }
+
+  return hash;
+}
+
 bool AggressiveNSECCache::getNSEC3(time_t now, std::shared_ptr<LockGuarded<AggressiveNSECCache::ZoneEntry>>& zone, const DNSName& name, ZoneEntry::CacheEntry& entry)
 {
   auto zoneEntry = zone->try_lock();
@@ -530,7 +706,7 @@ bool AggressiveNSECCache::getNSEC3Denial(time_t now, std::shared_ptr<LockGuarded
     iterations = entry->d_iterations;
   }
 
-  auto nameHash = DNSName(toBase32Hex(hashQNameWithSalt(salt, iterations, name))) + zone;
+  auto nameHash = DNSName(toBase32Hex(getNSEC3Hash(zoneEntry, salt, iterations, name, false))) + zone;
 
   ZoneEntry::CacheEntry exactNSEC3;
   if (getNSEC3(now, zoneEntry, nameHash, exactNSEC3)) {
@@ -578,7 +754,7 @@ bool AggressiveNSECCache::getNSEC3Denial(time_t now, std::shared_ptr<LockGuarded
   bool found = false;
   ZoneEntry::CacheEntry closestNSEC3;
   while (!found && closestEncloser.chopOff()) {
-    auto closestHash = DNSName(toBase32Hex(hashQNameWithSalt(salt, iterations, closestEncloser))) + zone;
+    auto closestHash = DNSName(toBase32Hex(getNSEC3Hash(zoneEntry, salt, iterations, closestEncloser, true))) + zone;
 
     if (getNSEC3(now, zoneEntry, closestHash, closestNSEC3)) {
       LOG("Found closest encloser at " << closestEncloser << " (" << closestHash << ")" << endl);
@@ -626,7 +802,7 @@ bool AggressiveNSECCache::getNSEC3Denial(time_t now, std::shared_ptr<LockGuarded
   DNSName nsecFound;
   DNSName nextCloser(closestEncloser);
   nextCloser.prependRawLabel(name.getRawLabel(labelIdx - 1));
-  auto nextCloserHash = toBase32Hex(hashQNameWithSalt(salt, iterations, nextCloser));
+  auto nextCloserHash = toBase32Hex(getNSEC3Hash(zoneEntry, salt, iterations, nextCloser, false));
   LOG("Looking for a NSEC3 covering the next closer " << nextCloser << " (" << nextCloserHash << ")" << endl);
 
   ZoneEntry::CacheEntry nextCloserEntry;
@@ -655,7 +831,7 @@ bool AggressiveNSECCache::getNSEC3Denial(time_t now, std::shared_ptr<LockGuarded
   /* An ancestor NSEC3 would be fine here, since it does prove that there is no delegation at the next closer
      name (we don't insert opt-out NSEC3s into the cache). */
   DNSName wildcard(g_wildcarddnsname + closestEncloser);
-  auto wcHash = toBase32Hex(hashQNameWithSalt(salt, iterations, wildcard));
+  auto wcHash = toBase32Hex(getNSEC3Hash(zoneEntry, salt, iterations, wildcard, true));
   LOG("Looking for a NSEC3 covering the wildcard " << wildcard << " (" << wcHash << ")" << endl);
 
   ZoneEntry::CacheEntry wcEntry;
@@ -875,29 +1051,47 @@ size_t AggressiveNSECCache::dumpToFile(std::unique_ptr<FILE, int (*)(FILE*)>& fp
 {
   size_t ret = 0;
 
-  auto zones = d_zones.read_lock();
-  zones->visit([&ret, now, &fp](const SuffixMatchTree<std::shared_ptr<LockGuarded<ZoneEntry>>>& node) {
+  std::shared_ptr<const zones_t> zones;
+  {
+    /* publish the pending zones first, so that they are dumped as well */
+    auto current = d_zones.lock();
+    modifyZones(*current, [](zones_t& tree) {
+      return false;
+    });
+    zones = current->d_zones;
+  }
+  zones->visit([&ret, now, &fp](const zones_t& node) {
     if (!node.d_value) {
       return;
     }
 
-    auto zone = node.d_value->lock();
-    fprintf(fp.get(), "; Zone %s\n", zone->d_zone.toString().c_str());
+    /* copy the entries under the lock, then write them out without holding it */
+    std::vector<ZoneEntry::CacheEntry> entries;
+    std::string zoneName;
+    bool nsec3;
+    {
+      auto zone = node.d_value->lock();
+      zoneName = zone->d_zone.toString();
+      nsec3 = zone->d_nsec3;
+      entries.reserve(zone->d_entries.size());
+      std::copy(zone->d_entries.begin(), zone->d_entries.end(), std::back_inserter(entries));
+    }
+    fprintf(fp.get(), "; Zone %s\n", zoneName.c_str());
 
-    for (const auto& entry : zone->d_entries) {
+    for (const auto& entry : entries) {
       int64_t ttl = entry.d_ttd - now.tv_sec;
       try {
-        fprintf(fp.get(), "%s %" PRId64 " IN %s %s\n", entry.d_owner.toString().c_str(), ttl, zone->d_nsec3 ? "NSEC3" : "NSEC", entry.d_record->getZoneRepresentation().c_str());
+        fprintf(fp.get(), "%s %" PRId64 " IN %s %s\n", entry.d_owner.toString().c_str(), ttl, nsec3 ? "NSEC3" : "NSEC", entry.d_record->getZoneRepresentation().c_str());
         for (const auto& signature : entry.d_signatures) {
           fprintf(fp.get(), "- RRSIG %s\n", signature->getZoneRepresentation().c_str());
         }
         ++ret;
       }
       catch (const std::exception& e) {
-        fprintf(fp.get(), "; Error dumping record from zone %s: %s\n", zone->d_zone.toString().c_str(), e.what());
+        fprintf(fp.get(), "; Error dumping record from zone %s: %s\n", zoneName.c_str(), e.what());
       }
       catch (...) {
-        fprintf(fp.get(), "; Error dumping record from zone %s\n", zone->d_zone.toString().c_str());
+        fprintf(fp.get(), "; Error dumping record from zone %s\n", zoneName.c_str());
       }
     }
   });
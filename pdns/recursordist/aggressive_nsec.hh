@@ -27,6 +27,8 @@
 #include <boost/multi_index/hashed_index.hpp>
 #include <boost/multi_index/key_extractors.hpp>
 #include <boost/multi_index/sequenced_index.hpp>
+#include <atomic>
+#include <unordered_map>
 
 #include "base32.hh"
 #include "dnsname.hh"
@@ -38,7 +40,7 @@ class AggressiveNSECCache
 {
 public:
   AggressiveNSECCache(uint64_t entries) :
-    d_maxEntries(entries)
+    d_zones(ZonesSnapshot()), d_id(++s_instances), d_maxEntries(entries)
   {
   }
 
@@ -72,6 +74,12 @@ public:
     return d_nsec3WildcardHits;
   }
 
+  /* number of NSEC3 hashes currently cached for that zone */
+  size_t getNSEC3HashesCount(const DNSName& zone);
+
+  /* the NSEC3 hashes cached for a zone are cleared once there are that many of them */
+  static constexpr size_t s_maxNSEC3HashesPerZone{1024};
+
   void prune(time_t now);
   size_t dumpToFile(std::unique_ptr<FILE, int (*)(FILE*)>& fp, const struct timeval& now);
 
@@ -120,24 +128,54 @@ private:
       cache_t;
 
     cache_t d_entries;
+    /* NSEC3 hashes of the names that are looked up over and over again
+       (closest encloser candidates, wildcards), for the current salt and iterations */
+    std::unordered_map<DNSName, std::string> d_hashes;
     const DNSName d_zone;
     std::string d_salt;
     uint16_t d_iterations{0};
     bool d_nsec3{false};
   };
 
+  typedef SuffixMatchTree<std::shared_ptr<LockGuarded<ZoneEntry>>> zones_t;
+
+  struct ZonesSnapshot
+  {
+    std::shared_ptr<const zones_t> d_zones{std::make_shared<const zones_t>()};
+    uint64_t d_zonesCount{0};
+    uint64_t d_generation{1};
+  };
+
   std::shared_ptr<LockGuarded<ZoneEntry>> getZone(const DNSName& zone);
   std::shared_ptr<LockGuarded<ZoneEntry>> getBestZone(const DNSName& zone);
   bool getNSECBefore(time_t now, std::shared_ptr<LockGuarded<ZoneEntry>>& zoneEntry, const DNSName& name, ZoneEntry::CacheEntry& entry);
+  std::string getNSEC3Hash(std::shared_ptr<LockGuarded<ZoneEntry>>& zoneEntry, const std::string& salt, uint16_t iterations, const DNSName& name, bool cache);
   bool getNSEC3(time_t now, std::shared_ptr<LockGuarded<ZoneEntry>>& zoneEntry, const DNSName& name, ZoneEntry::CacheEntry& entry);
   bool getNSEC3Denial(time_t now, std::shared_ptr<LockGuarded<ZoneEntry>>& zoneEntry, std::vector<DNSRecord>& soaSet, std::vector<std::shared_ptr<RRSIGRecordContent>>& soaSignatures, const DNSName& name, const QType& type, std::vector<DNSRecord>& ret, int& res, bool doDNSSEC);
   bool synthesizeFromNSEC3Wildcard(time_t now, const DNSName& name, const QType& type, std::vector<DNSRecord>& ret, int& res, bool doDNSSEC, ZoneEntry::CacheEntry& nextCloser, const DNSName& wildcardName);
   bool synthesizeFromNSECWildcard(time_t now, const DNSName& name, const QType& type, std::vector<DNSRecord>& ret, int& res, bool doDNSSEC, ZoneEntry::CacheEntry& nsec, const DNSName& wildcardName);
 
   /* slowly updates d_entriesCount */
-  void updateEntriesCount(SuffixMatchTree<std::shared_ptr<LockGuarded<ZoneEntry>>>& zones);
-
-  SharedLockGuarded<SuffixMatchTree<std::shared_ptr<LockGuarded<ZoneEntry>>>> d_zones;
+  void updateEntriesCount(const zones_t& zones);
+
+  /* The zones tree is never modified once it has been published: writers, serialized
+     by the d_zones lock, work on a copy that then replaces the current version.
+     Readers use a thread-local reference to the current version, only refreshed
+     when the generation has changed, so looking up a zone does not require any lock.
+     New zones are first added to a small pending tree, looked up under a shared lock
+     while it is not empty, and published in batches. */
+  const zones_t& getZones() const;
+  template <typename F>
+  void modifyZones(ZonesSnapshot& current, F act);
+
+  mutable LockGuarded<ZonesSnapshot> d_zones;
+  /* zones added since the current version was published, not visible to lock-free lookups yet.
+     Only modified while holding the d_zones lock */
+  SharedLockGuarded<zones_t> d_pendingZones;
+  std::atomic<uint64_t> d_zonesGeneration{1};
+  std::atomic<uint64_t> d_pendingZonesCount{0};
+  const uint64_t d_id;
+  static std::atomic<uint64_t> s_instances;
   pdns::stat_t d_nsecHits{0};
   pdns::stat_t d_nsec3Hits{0};
   pdns::stat_t d_nsecWildcardHits{0};
@@ -0,0 +1,304 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "lua-recursor4-resolve-ffi.hh"
+#include "logger.hh"
+#include "misc.hh"
+#include "syncres.hh"
+
+bool callResolveFFIHook(const std::function<bool(pdns_resolve_ffi_handle_t*)>& func, RecursorLua4::DNSQuestion& dq, int& ret, const pdns::AtomicHistogram& times)
+{
+  pdns_resolve_ffi_handle_t handle(dq, ret);
+
+  DTime dt;
+  dt.set();
+  bool handled = func(&handle);
+  times(dt.udiff());
+
+  if (handled) {
+    ret = handle.rcode;
+    if (handle.followCNAMERecords && dq.currentRecords) {
+      ret = followCNAMERecords(*dq.currentRecords, QType(dq.qtype), ret);
+    }
+  }
+
+  return handled;
+}
+
+void pdns_ffi_comboaddress_to_raw(const ComboAddress& ca, const void** addr, size_t* addrSize)
+{
+  if (ca.isIPv4()) {
+    *addr = &ca.sin4.sin_addr.s_addr;
+    *addrSize = sizeof(ca.sin4.sin_addr.s_addr);
+  }
+  else {
+    *addr = &ca.sin6.sin6_addr.s6_addr;
+    *addrSize = sizeof(ca.sin6.sin6_addr.s6_addr);
+  }
+}
+
+const char* pdns_resolve_ffi_handle_get_qname(pdns_resolve_ffi_handle_t* ref)
+{
+  if (!ref->qnameStr) {
+    ref->qnameStr = std::make_unique<std::string>(ref->dq.qname.toStringNoDot());
+  }
+
+  return ref->qnameStr->c_str();
+}
+
+void pdns_resolve_ffi_handle_get_qname_raw(pdns_resolve_ffi_handle_t* ref, const char** qname, size_t* qnameSize)
+{
+  const auto& storage = ref->dq.qname.getStorage();
+  *qname = storage.data();
+  *qnameSize = storage.size();
+}
+
+uint16_t pdns_resolve_ffi_handle_get_qtype(const pdns_resolve_ffi_handle_t* ref)
+{
+  return ref->dq.qtype;
+}
+
+const char* pdns_resolve_ffi_handle_get_remote(pdns_resolve_ffi_handle_t* ref)
+{
+  if (!ref->remoteStr) {
+    ref->remoteStr = std::make_unique<std::string>(ref->dq.remote.toString());
+  }
+
+  return ref->remoteStr->c_str();
+}
+
+void pdns_resolve_ffi_handle_get_remote_raw(pdns_resolve_ffi_handle_t* ref, const void** addr, size_t* addrSize)
+{
+  pdns_ffi_comboaddress_to_raw(ref->dq.remote, addr, addrSize);
+}
+
+uint16_t pdns_resolve_ffi_handle_get_remote_port(const pdns_resolve_ffi_handle_t* ref)
+{
+  return ref->dq.remote.getPort();
+}
+
+const char* pdns_resolve_ffi_handle_get_local(pdns_resolve_ffi_handle_t* ref)
+{
+  if (!ref->localStr) {
+    ref->localStr = std::make_unique<std::string>(ref->dq.local.toString());
+  }
+
+  return ref->localStr->c_str();
+}
+
+void pdns_resolve_ffi_handle_get_local_raw(pdns_resolve_ffi_handle_t* ref, const void** addr, size_t* addrSize)
+{
+  pdns_ffi_comboaddress_to_raw(ref->dq.local, addr, addrSize);
+}
+
+uint16_t pdns_resolve_ffi_handle_get_local_port(const pdns_resolve_ffi_handle_t* ref)
+{
+  return ref->dq.local.getPort();
+}
+
+bool pdns_resolve_ffi_handle_get_tcp(const pdns_resolve_ffi_handle_t* ref)
+{
+  return ref->dq.isTcp;
+}
+
+unsigned int pdns_resolve_ffi_handle_get_tag(const pdns_resolve_ffi_handle_t* ref)
+{
+  return ref->dq.tag;
+}
+
+int pdns_resolve_ffi_handle_get_rcode(const pdns_resolve_ffi_handle_t* ref)
+{
+  return ref->rcode;
+}
+
+bool pdns_resolve_ffi_handle_has_policytag(const pdns_resolve_ffi_handle_t* ref, const char* name)
+{
+  if (ref->dq.policyTags == nullptr) {
+    return false;
+  }
+  return ref->dq.policyTags->count(std::string(name)) > 0;
+}
+
+pdns_policy_kind_t pdns_resolve_ffi_handle_get_appliedpolicy_kind(const pdns_resolve_ffi_handle_t* ref)
+{
+  if (ref->dq.appliedPolicy == nullptr) {
+    return pdns_policy_kind_noaction;
+  }
+  return static_cast<pdns_policy_kind_t>(ref->dq.appliedPolicy->d_kind);
+}
+
+void pdns_resolve_ffi_handle_set_rcode(pdns_resolve_ffi_handle_t* ref, int rcode)
+{
+  ref->rcode = rcode;
+}
+
+void pdns_resolve_ffi_handle_set_variable(pdns_resolve_ffi_handle_t* ref, bool variable)
+{
+  ref->dq.variable = variable;
+}
+
+void pdns_resolve_ffi_handle_set_follow_cname_records(pdns_resolve_ffi_handle_t* ref, bool follow)
+{
+  ref->followCNAMERecords = follow;
+}
+
+void pdns_resolve_ffi_handle_add_policytag(pdns_resolve_ffi_handle_t* ref, const char* name)
+{
+  if (ref->dq.policyTags != nullptr) {
+    ref->dq.policyTags->insert(std::string(name));
+  }
+}
+
+bool pdns_resolve_ffi_handle_set_appliedpolicy_kind(pdns_resolve_ffi_handle_t* ref, pdns_policy_kind_t kind)
+{
+  if (ref->dq.appliedPolicy == nullptr) {
+    return false;
+  }
+
+  /* the value comes straight from Lua, and the kind is later used to index the policy results metrics */
+  DNSFilterEngine::PolicyKind policyKind;
+  switch (kind) {
+  case pdns_policy_kind_noaction:
+    policyKind = DNSFilterEngine::PolicyKind::NoAction;
+    break;
+  case pdns_policy_kind_drop:
+    policyKind = DNSFilterEngine::PolicyKind::Drop;
+    break;
+  case pdns_policy_kind_nxdomain:
+    policyKind = DNSFilterEngine::PolicyKind::NXDOMAIN;
+    break;
+  case pdns_policy_kind_nodata:
+    policyKind = DNSFilterEngine::PolicyKind::NODATA;
+    break;
+  case pdns_policy_kind_truncate:
+    policyKind = DNSFilterEngine::PolicyKind::Truncate;
+    break;
+  case pdns_policy_kind_custom:
+    policyKind = DNSFilterEngine::PolicyKind::Custom;
+    break;
+  default:
+    g_log << Logger::Error << "Invalid policy kind " << static_cast<int>(kind) << " passed to pdns_resolve_ffi_handle_set_appliedpolicy_kind() from Lua, ignoring" << endl;
+    return false;
+  }
+
+  ref->dq.appliedPolicy->d_kind = policyKind;
+  return true;
+}
+
+size_t pdns_resolve_ffi_handle_get_records_count(const pdns_resolve_ffi_handle_t* ref)
+{
+  if (ref->dq.currentRecords == nullptr) {
+    return 0;
+  }
+  return ref->dq.currentRecords->size();
+}
+
+bool pdns_resolve_ffi_handle_get_record(pdns_resolve_ffi_handle_t* ref, size_t idx, pdns_ffi_record_t* record, bool raw)
+{
+  if (ref->dq.currentRecords == nullptr || idx >= ref->dq.currentRecords->size()) {
+    return false;
+  }
+
+  try {
+    auto& dr = ref->dq.currentRecords->at(idx);
+    if (raw) {
+      const auto& storage = dr.d_name.getStorage();
+      record->name = storage.data();
+      record->name_len = storage.size();
+      ref->recordStrings.push_back(dr.d_content->serialize(dr.d_name, true));
+    }
+    else {
+      ref->recordStrings.push_back(dr.d_name.toStringNoDot());
+      record->name = ref->recordStrings.back().c_str();
+      record->name_len = ref->recordStrings.back().size();
+      ref->recordStrings.push_back(dr.d_content->getZoneRepresentation());
+    }
+    record->content = ref->recordStrings.back().c_str();
+    record->content_len = ref->recordStrings.back().size();
+    record->ttl = dr.d_ttl;
+    record->place = static_cast<pdns_record_place_t>(dr.d_place);
+    record->type = dr.d_type;
+    return true;
+  }
+  catch (const std::exception& e) {
+    g_log << Logger::Error << "Error attempting to get a record from Lua via pdns_resolve_ffi_handle_get_record(): " << e.what() << endl;
+    return false;
+  }
+}
+
+bool pdns_resolve_ffi_handle_set_record(pdns_resolve_ffi_handle_t* ref, size_t idx, const char* content, size_t contentSize, bool raw)
+{
+  if (ref->dq.currentRecords == nullptr || idx >= ref->dq.currentRecords->size()) {
+    return false;
+  }
+
+  try {
+    auto& dr = ref->dq.currentRecords->at(idx);
+    if (raw) {
+      dr.d_content = DNSRecordContent::deserialize(dr.d_name, dr.d_type, std::string(content, contentSize));
+    }
+    else {
+      dr.d_content = DNSRecordContent::mastermake(dr.d_type, QClass::IN, std::string(content, contentSize));
+    }
+    return true;
+  }
+  catch (const std::exception& e) {
+    g_log << Logger::Error << "Error attempting to set a record from Lua via pdns_resolve_ffi_handle_set_record(): " << e.what() << endl;
+    return false;
+  }
+}
+
+void pdns_resolve_ffi_handle_clear_records(pdns_resolve_ffi_handle_t* ref)
+{
+  if (ref->dq.currentRecords != nullptr) {
+    ref->dq.currentRecords->clear();
+  }
+}
+
+bool pdns_resolve_ffi_handle_add_record(pdns_resolve_ffi_handle_t* ref, const char* name, uint16_t type, uint32_t ttl, const char* content, size_t contentSize, pdns_record_place_t place, bool raw)
+{
+  if (ref->dq.currentRecords == nullptr) {
+    return false;
+  }
+
+  try {
+    DNSRecord dr;
+    dr.d_name = name != nullptr ? DNSName(name) : ref->dq.qname;
+    dr.d_ttl = ttl;
+    dr.d_type = type;
+    dr.d_class = QClass::IN;
+    dr.d_place = DNSResourceRecord::Place(place);
+    if (raw) {
+      dr.d_content = DNSRecordContent::deserialize(dr.d_name, dr.d_type, std::string(content, contentSize));
+    }
+    else {
+      dr.d_content = DNSRecordContent::mastermake(type, QClass::IN, std::string(content, contentSize));
+    }
+    ref->dq.currentRecords->push_back(std::move(dr));
+
+    return true;
+  }
+  catch (const std::exception& e) {
+    g_log << Logger::Error << "Error attempting to add a record from Lua via pdns_resolve_ffi_handle_add_record(): " << e.what() << endl;
+    return false;
+  }
+}
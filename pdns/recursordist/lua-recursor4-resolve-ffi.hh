@@ -0,0 +1,55 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#pragma once
+
+#include <list>
+
+#include "histogram.hh"
+#include "lua-recursor4.hh"
+
+/* The state handed to the preresolve_ffi, nxdomain_ffi, nodata_ffi and postresolve_ffi
+   hooks, as a lightuserdata, and accessed through the pdns_resolve_ffi_handle_* functions */
+struct pdns_resolve_ffi_handle
+{
+public:
+  pdns_resolve_ffi_handle(RecursorLua4::DNSQuestion& dq_, int rcode_) :
+    dq(dq_), rcode(rcode_)
+  {
+  }
+
+  RecursorLua4::DNSQuestion& dq;
+  int rcode;
+  bool followCNAMERecords{false};
+  std::unique_ptr<std::string> qnameStr{nullptr};
+  std::unique_ptr<std::string> localStr{nullptr};
+  std::unique_ptr<std::string> remoteStr{nullptr};
+  /* names and contents handed out by pdns_resolve_ffi_handle_get_record(),
+     they need to stay valid until the hook returns */
+  std::list<std::string> recordStrings;
+};
+
+/* Call one of these hooks, recording the time spent in it into times.
+   Unlike RecursorLua4::genhook(), the records are not copied to and from dq.records:
+   the FFI functions work directly on dq.currentRecords. */
+bool callResolveFFIHook(const std::function<bool(pdns_resolve_ffi_handle_t*)>& func, RecursorLua4::DNSQuestion& dq, int& ret, const pdns::AtomicHistogram& times);
+
+void pdns_ffi_comboaddress_to_raw(const ComboAddress& ca, const void** addr, size_t* addrSize);
@@ -40,6 +40,47 @@ size_t NegCache::size() const
   return count;
 }
 
+/*!
+ * Exact (name, type) lookups go through the hashed index, which is much cheaper than
+ * the canonical comparisons of the ordered one. This matters during random subdomain
+ * attacks, where every query does several of them.
+ * MUTEX SHOULD BE ACQUIRED (as indicated by the reference to the content which is protected by a lock)
+ */
+NegCache::negcache_t::iterator NegCache::findEntry(MapCombo::LockedContent& content, const DNSName& qname, QType qtype)
+{
+  const auto& idx = content.d_map.get<HashedTag>();
+  auto entry = idx.find(boost::make_tuple(qname, qtype));
+  if (entry == idx.end()) {
+    return content.d_map.end();
+  }
+  return content.d_map.project<CompositeKey>(entry);
+}
+
+/*!
+ * Set ne to the (name, type) entry if there is one and it has not expired.
+ * MUTEX SHOULD BE ACQUIRED (as indicated by the reference to the content which is protected by a lock)
+ */
+bool NegCache::getEntry(MapCombo::LockedContent& content, const DNSName& qname, QType qtype, const struct timeval& now, NegCacheEntry& ne)
+{
+  auto ni = findEntry(content, qname, qtype);
+  if (ni == content.d_map.end()) {
+    return false;
+  }
+
+  if (now.tv_sec < ni->d_ttd) {
+    // Not expired
+    ne = *ni;
+    /* instead of moving the entry to the back of the expunge queue on every hit,
+       we only mark it and the pruning gives it a second chance when pruning gets to it */
+    ni->d_referenced = true;
+    return true;
+  }
+
+  // expired
+  moveCacheItemToFront<SequenceTag>(content.d_map, ni);
+  return false;
+}
+
 /*!
  * Set ne to the NegCacheEntry for the last label in qname and return true if there
  * was one.
@@ -62,17 +103,50 @@ bool NegCache::getRootNXTrust(const DNSName& qname, const struct timeval& now, N
   auto& map = getMap(lastLabel);
   auto content = map.lock();
 
-  negcache_t::const_iterator ni = content->d_map.find(tie(lastLabel, qtnull));
+  auto ni = findEntry(*content, lastLabel, qtnull);
+  if (ni == content->d_map.end() || !ni->d_auth.isRoot()) {
+    return false;
+  }
+
+  // We have something
+  if (now.tv_sec < ni->d_ttd) {
+    ne = *ni;
+    ni->d_referenced = true;
+    return true;
+  }
+  moveCacheItemToFront<SequenceTag>(content->d_map, ni);
+  return false;
+}
+
+/*!
+ * Set ne to the NXDOMAIN entry of the top-most strict ancestor of qname that
+ * accept() agrees with, and return true if there was one.
+ *
+ * Each ancestor is looked up in its own shard, under that shard's lock only, so
+ * that a flood of names below the same zone does not serialize on a single lock.
+ *
+ * \param qname    The name whose ancestors are looked up (qname itself is not)
+ * \param now      A timeval with the current time, to check if an entry is expired
+ * \param ne       A NegCacheEntry that is filled when there is a cache entry
+ * \param accept   Decides whether the entry of a denied ancestor can be used
+ * \return         true if ne was filled out, false otherwise
+ */
+bool NegCache::getDeniedAncestor(const DNSName& qname, const struct timeval& now, NegCacheEntry& ne, const std::function<bool(const NegCacheEntry&)>& accept)
+{
+  auto labels = qname.getRawLabels();
+  if (labels.size() < 2) {
+    return false;
+  }
 
-  while (ni != content->d_map.end() && ni->d_name == lastLabel && ni->d_auth.isRoot() && ni->d_qtype == qtnull) {
-    // We have something
-    if (now.tv_sec < ni->d_ttd) {
-      ne = *ni;
-      moveCacheItemToBack<SequenceTag>(content->d_map, ni);
+  /* from the top-level domain down, the top-most denial is the one that covers the largest subtree */
+  DNSName ancestor(g_rootdnsname);
+  for (auto label = labels.rbegin(); label != labels.rend() - 1; ++label) {
+    ancestor.prependRawLabel(*label);
+    auto& map = getMap(ancestor);
+    auto content = map.lock();
+    if (getEntry(*content, ancestor, QType::ENT, now, ne) && accept(ne)) {
       return true;
     }
-    moveCacheItemToFront<SequenceTag>(content->d_map, ni);
-    ++ni;
   }
   return false;
 }
@@ -91,27 +165,17 @@ bool NegCache::get(const DNSName& qname, const QType& qtype, const struct timeva
   auto& map = getMap(qname);
   auto content = map.lock();
 
-  const auto& idx = content->d_map.get<NegCacheEntry>();
-  auto range = idx.equal_range(qname);
-  auto ni = range.first;
-
-  while (ni != range.second) {
-    // We have an entry
-    if ((!typeMustMatch && ni->d_qtype.getCode() == 0) || ni->d_qtype == qtype) {
-      // We match the QType or the whole name is denied
-      auto firstIndexIterator = content->d_map.project<CompositeKey>(ni);
+  // We match the QType
+  if (getEntry(*content, qname, qtype, now, ne)) {
+    return true;
+  }
 
-      if (now.tv_sec < ni->d_ttd) {
-        // Not expired
-        ne = *ni;
-        moveCacheItemToBack<SequenceTag>(content->d_map, firstIndexIterator);
-        return true;
-      }
-      // expired
-      moveCacheItemToFront<SequenceTag>(content->d_map, firstIndexIterator);
-    }
-    ++ni;
+  // or the whole name is denied
+  static const QType qtnull(0);
+  if (!typeMustMatch && qtype != qtnull) {
+    return getEntry(*content, qname, qtnull, now, ne);
   }
+
   return false;
 }
 
@@ -142,12 +206,12 @@ void NegCache::updateValidationStatus(const DNSName& qname, const QType& qtype,
 {
   auto& mc = getMap(qname);
   auto map = mc.lock();
-  auto range = map->d_map.equal_range(tie(qname, qtype));
+  auto entry = findEntry(*map, qname, qtype);
 
-  if (range.first != range.second) {
-    range.first->d_validationState = newState;
+  if (entry != map->d_map.end()) {
+    entry->d_validationState = newState;
     if (capTTD) {
-      range.first->d_ttd = std::min(range.first->d_ttd, *capTTD);
+      entry->d_ttd = std::min(entry->d_ttd, *capTTD);
     }
   }
 }
@@ -174,7 +238,7 @@ size_t NegCache::count(const DNSName& qname, const QType qtype)
 {
   auto& map = getMap(qname);
   auto content = map.lock();
-  return content->d_map.count(tie(qname, qtype));
+  return content->d_map.get<HashedTag>().count(boost::make_tuple(qname, qtype));
 }
 
 /*!
@@ -233,6 +297,9 @@ void NegCache::clear()
 void NegCache::prune(size_t maxEntries)
 {
   size_t cacheSize = size();
+  if (cacheSize > maxEntries) {
+    giveSecondChanceMutexCollectionsVector<SequenceTag>(d_maps, cacheSize - maxEntries);
+  }
   pruneMutexCollectionsVector<SequenceTag>(*this, d_maps, maxEntries, cacheSize);
 }
 
@@ -245,10 +312,17 @@ size_t NegCache::dumpToFile(FILE* fp, const struct timeval& now)
 {
   size_t ret = 0;
 
+  /* copy the entries of a shard under the lock, then write them out without holding it */
+  std::vector<NegCacheEntry> entries;
   for (auto& mc : d_maps) {
-    auto m = mc.lock();
-    auto& sidx = m->d_map.get<SequenceTag>();
-    for (const NegCacheEntry& ne : sidx) {
+    entries.clear();
+    {
+      auto m = mc.lock();
+      const auto& sidx = m->d_map.get<SequenceTag>();
+      entries.reserve(sidx.size());
+      std::copy(sidx.begin(), sidx.end(), std::back_inserter(entries));
+    }
+    for (const NegCacheEntry& ne : entries) {
       ret++;
       int64_t ttl = ne.d_ttd - now.tv_sec;
       fprintf(fp, "%s %" PRId64 " IN %s VIA %s ; (%s)\n", ne.d_name.toString().c_str(), ttl, ne.d_qtype.toString().c_str(), ne.d_auth.toString().c_str(), vStateToString(ne.d_validationState).c_str());
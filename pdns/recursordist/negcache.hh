@@ -21,6 +21,7 @@
  */
 #pragma once
 
+#include <functional>
 #include <vector>
 #include <boost/multi_index_container.hpp>
 #include <boost/multi_index/hashed_index.hpp>
@@ -62,6 +63,7 @@ public:
     mutable time_t d_ttd; // Timestamp when this entry should die
     mutable vState d_validationState{vState::Indeterminate};
     QType d_qtype; // The denied type
+    mutable bool d_referenced{false}; // whether this entry has been used since the last time the pruning went over it
     time_t getTTD() const
     {
       return d_ttd;
@@ -72,6 +74,7 @@ public:
   void updateValidationStatus(const DNSName& qname, const QType& qtype, const vState newState, boost::optional<time_t> capTTD);
   bool get(const DNSName& qname, const QType& qtype, const struct timeval& now, NegCacheEntry& ne, bool typeMustMatch = false);
   bool getRootNXTrust(const DNSName& qname, const struct timeval& now, NegCacheEntry& ne);
+  bool getDeniedAncestor(const DNSName& qname, const struct timeval& now, NegCacheEntry& ne, const std::function<bool(const NegCacheEntry&)>& accept);
   size_t count(const DNSName& qname);
   size_t count(const DNSName& qname, const QType qtype);
   void prune(size_t maxEntries);
@@ -87,6 +90,9 @@ private:
   struct SequenceTag
   {
   };
+  struct HashedTag
+  {
+  };
   typedef boost::multi_index_container<
     NegCacheEntry,
     indexed_by<
@@ -98,8 +104,11 @@ private:
                      composite_key_compare<
                        CanonDNSNameCompare, std::less<QType>>>,
       sequenced<tag<SequenceTag>>,
-      hashed_non_unique<tag<NegCacheEntry>,
-                        member<NegCacheEntry, DNSName, &NegCacheEntry::d_name>>>>
+      hashed_unique<tag<HashedTag>,
+                    composite_key<
+                      NegCacheEntry,
+                      member<NegCacheEntry, DNSName, &NegCacheEntry::d_name>,
+                      member<NegCacheEntry, QType, &NegCacheEntry::d_qtype>>>>>
     negcache_t;
 
   struct MapCombo
@@ -133,6 +142,9 @@ private:
 
   vector<MapCombo> d_maps;
 
+  static negcache_t::iterator findEntry(MapCombo::LockedContent& content, const DNSName& qname, QType qtype);
+  static bool getEntry(MapCombo::LockedContent& content, const DNSName& qname, QType qtype, const struct timeval& now, NegCacheEntry& ne);
+
   MapCombo& getMap(const DNSName& qname)
   {
     return d_maps.at(qname.hash() % d_maps.size());
@@ -0,0 +1,124 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+
+/* A bounded, lock-free queue allowing several threads to push items
+   while a single one pops them, without any system call.
+   This is the classic bounded queue by Dmitry Vyukov: each cell carries a
+   sequence number telling whether it is ready to be written to (for the
+   current lap) or read from, so that producers only compete on the position
+   counter and never on the cells themselves.
+   The capacity is rounded up to the next power of two. */
+template <typename T>
+class MPSCQueue
+{
+public:
+  explicit MPSCQueue(size_t capacity)
+  {
+    if (capacity == 0) {
+      throw std::runtime_error("The capacity of a MPSC queue can not be 0");
+    }
+
+    size_t size = 1;
+    while (size < capacity) {
+      size <<= 1;
+    }
+
+    d_cells = std::make_unique<Cell[]>(size);
+    for (size_t idx = 0; idx < size; idx++) {
+      d_cells[idx].d_sequence.store(idx, std::memory_order_relaxed);
+    }
+    d_mask = size - 1;
+  }
+
+  MPSCQueue(const MPSCQueue&) = delete;
+  MPSCQueue& operator=(const MPSCQueue&) = delete;
+
+  /* can be called from any thread, returns false if the queue is full */
+  bool push(T&& item)
+  {
+    size_t pos = d_enqueuePos.load(std::memory_order_relaxed);
+    Cell* cell;
+    for (;;) {
+      cell = &d_cells[pos & d_mask];
+      size_t seq = cell->d_sequence.load(std::memory_order_acquire);
+      intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+      if (diff == 0) {
+        if (d_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      }
+      else if (diff < 0) {
+        /* the consumer has not yet read this cell during the previous lap */
+        return false;
+      }
+      else {
+        pos = d_enqueuePos.load(std::memory_order_relaxed);
+      }
+    }
+
+    cell->d_data = std::move(item);
+    cell->d_sequence.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  /* must only be called from the consumer thread, returns false if the queue is empty
+     (an item that is still being pushed is not considered as being in the queue yet) */
+  bool pop(T& item)
+  {
+    size_t pos = d_dequeuePos.load(std::memory_order_relaxed);
+    Cell* cell = &d_cells[pos & d_mask];
+    size_t seq = cell->d_sequence.load(std::memory_order_acquire);
+    if (static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1) < 0) {
+      return false;
+    }
+
+    item = std::move(cell->d_data);
+    cell->d_data = T();
+    cell->d_sequence.store(pos + d_mask + 1, std::memory_order_release);
+    d_dequeuePos.store(pos + 1, std::memory_order_relaxed);
+    return true;
+  }
+
+  size_t capacity() const
+  {
+    return d_mask + 1;
+  }
+
+private:
+  struct Cell
+  {
+    std::atomic<size_t> d_sequence{0};
+    T d_data;
+  };
+
+  std::unique_ptr<Cell[]> d_cells;
+  size_t d_mask{0};
+  /* keep the producers' and consumer's positions on different cache lines */
+  alignas(64) std::atomic<size_t> d_enqueuePos{0};
+  alignas(64) std::atomic<size_t> d_dequeuePos{0};
+};
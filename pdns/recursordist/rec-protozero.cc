@@ -24,7 +24,7 @@
 #include "rec-protozero.hh"
 #include <variant>
 
-void pdns::ProtoZero::RecMessage::addRR(const DNSRecord& record, const std::set<uint16_t>& exportTypes, bool udr)
+void pdns::ProtoZero::RecMessage::addRR(const DNSRecord& record, const std::set<uint16_t>& exportTypes, bool udr, const uint8_t* wireRData, size_t wireRDataLen)
 {
   if (record.d_place != DNSResourceRecord::ANSWER || record.d_class != QClass::IN) {
     return;
@@ -34,59 +34,73 @@ void pdns::ProtoZero::RecMessage::addRR(const DNSRecord& record, const std::set<
     return;
   }
 
+  std::string& buffer = *d_rspbufTarget;
   protozero::pbf_writer pbf_rr{d_response, static_cast<protozero::pbf_tag_type>(pdns::ProtoZero::Message::ResponseField::rrs)};
 
-  encodeDNSName(pbf_rr, d_rspbuf, static_cast<protozero::pbf_tag_type>(pdns::ProtoZero::Message::RRField::name), record.d_name);
+  encodeDNSName(pbf_rr, buffer, static_cast<protozero::pbf_tag_type>(pdns::ProtoZero::Message::RRField::name), record.d_name);
   pbf_rr.add_uint32(static_cast<protozero::pbf_tag_type>(pdns::ProtoZero::Message::RRField::type), record.d_type);
   pbf_rr.add_uint32(static_cast<protozero::pbf_tag_type>(pdns::ProtoZero::Message::RRField::class_), record.d_class);
   pbf_rr.add_uint32(static_cast<protozero::pbf_tag_type>(pdns::ProtoZero::Message::RRField::ttl), record.d_ttl);
 
+  /* names are written straight into the buffer instead of going through a temporary string */
+  const auto rdataTag = static_cast<protozero::pbf_tag_type>(pdns::ProtoZero::Message::RRField::rdata);
   switch (record.d_type) {
   case QType::A: {
+    /* the wire representation of an A or AAAA record is exactly what we export. For the other
+       types dnsmessage.proto mandates a text representation (uncompressed names with a trailing
+       dot, TXT without the length prefixes), so the wire rdata can't be copied and is ignored */
+    if (wireRData != nullptr && wireRDataLen == sizeof(struct in_addr)) {
+      pbf_rr.add_bytes(rdataTag, reinterpret_cast<const char*>(wireRData), wireRDataLen);
+      break;
+    }
     const auto& content = dynamic_cast<const ARecordContent&>(*(record.d_content));
     ComboAddress data = content.getCA();
-    pbf_rr.add_bytes(static_cast<protozero::pbf_tag_type>(pdns::ProtoZero::Message::RRField::rdata), reinterpret_cast<const char*>(&data.sin4.sin_addr.s_addr), sizeof(data.sin4.sin_addr.s_addr));
+    pbf_rr.add_bytes(rdataTag, reinterpret_cast<const char*>(&data.sin4.sin_addr.s_addr), sizeof(data.sin4.sin_addr.s_addr));
     break;
   }
   case QType::AAAA: {
+    if (wireRData != nullptr && wireRDataLen == sizeof(struct in6_addr)) {
+      pbf_rr.add_bytes(rdataTag, reinterpret_cast<const char*>(wireRData), wireRDataLen);
+      break;
+    }
     const auto& content = dynamic_cast<const AAAARecordContent&>(*(record.d_content));
     ComboAddress data = content.getCA();
-    pbf_rr.add_bytes(static_cast<protozero::pbf_tag_type>(pdns::ProtoZero::Message::RRField::rdata), reinterpret_cast<const char*>(&data.sin6.sin6_addr.s6_addr), sizeof(data.sin6.sin6_addr.s6_addr));
+    pbf_rr.add_bytes(rdataTag, reinterpret_cast<const char*>(&data.sin6.sin6_addr.s6_addr), sizeof(data.sin6.sin6_addr.s6_addr));
     break;
   }
   case QType::CNAME: {
     const auto& content = dynamic_cast<const CNAMERecordContent&>(*(record.d_content));
-    pbf_rr.add_string(static_cast<protozero::pbf_tag_type>(pdns::ProtoZero::Message::RRField::rdata), content.getTarget().toString());
+    encodeDNSName(pbf_rr, buffer, rdataTag, content.getTarget());
     break;
   }
   case QType::TXT: {
     const auto& content = dynamic_cast<const TXTRecordContent&>(*(record.d_content));
-    pbf_rr.add_string(static_cast<protozero::pbf_tag_type>(pdns::ProtoZero::Message::RRField::rdata), content.d_text);
+    pbf_rr.add_string(rdataTag, content.d_text);
     break;
   }
   case QType::NS: {
     const auto& content = dynamic_cast<const NSRecordContent&>(*(record.d_content));
-    pbf_rr.add_string(static_cast<protozero::pbf_tag_type>(pdns::ProtoZero::Message::RRField::rdata), content.getNS().toString());
+    encodeDNSName(pbf_rr, buffer, rdataTag, content.getNS());
     break;
   }
   case QType::PTR: {
     const auto& content = dynamic_cast<const PTRRecordContent&>(*(record.d_content));
-    pbf_rr.add_string(static_cast<protozero::pbf_tag_type>(pdns::ProtoZero::Message::RRField::rdata), content.getContent().toString());
+    encodeDNSName(pbf_rr, buffer, rdataTag, content.getContent());
     break;
   }
   case QType::MX: {
     const auto& content = dynamic_cast<const MXRecordContent&>(*(record.d_content));
-    pbf_rr.add_string(static_cast<protozero::pbf_tag_type>(pdns::ProtoZero::Message::RRField::rdata), content.d_mxname.toString());
+    encodeDNSName(pbf_rr, buffer, rdataTag, content.d_mxname);
     break;
   }
   case QType::SPF: {
     const auto& content = dynamic_cast<const SPFRecordContent&>(*(record.d_content));
-    pbf_rr.add_string(static_cast<protozero::pbf_tag_type>(pdns::ProtoZero::Message::RRField::rdata), content.getText());
+    pbf_rr.add_string(rdataTag, content.getText());
     break;
   }
   case QType::SRV: {
     const auto& content = dynamic_cast<const SRVRecordContent&>(*(record.d_content));
-    pbf_rr.add_string(static_cast<protozero::pbf_tag_type>(pdns::ProtoZero::Message::RRField::rdata), content.d_target.toString());
+    encodeDNSName(pbf_rr, buffer, rdataTag, content.d_target);
     break;
   }
   default:
@@ -98,7 +112,7 @@ void pdns::ProtoZero::RecMessage::addRR(const DNSRecord& record, const std::set<
 
   // Save the offset of the byte containing the just added bool. We can do this since
   // we know a bit about how protobuf's encoding works.
-  offsets.push_back(d_rspbuf.length() - 1);
+  offsets.push_back(buffer.length() - 1);
 #endif
 }
 
@@ -41,7 +41,7 @@ namespace ProtoZero
     }
 
     RecMessage(std::string& buffer) :
-      Message(buffer)
+      Message(buffer), d_rspbufTarget(&buffer)
     {
       d_response = protozero::pbf_writer(buffer);
     }
@@ -82,6 +82,19 @@ namespace ProtoZero
       }
     }
 
+    // Reuse this message, and the memory already allocated for it, for new (partially) constructed content.
+    // Not for messages constructed on an external buffer.
+    void reset(const std::string& buf1 = std::string(), const std::string& buf2 = std::string())
+    {
+      d_msgbuf.assign(buf1);
+      d_rspbuf.assign(buf2);
+      d_message = protozero::pbf_writer(d_msgbuf);
+      d_response = protozero::pbf_writer(d_rspbuf);
+#ifdef NOD_ENABLED
+      offsets.clear();
+#endif
+    }
+
     const std::string& getMessageBuf() const
     {
       return d_msgbuf;
@@ -100,11 +113,26 @@ namespace ProtoZero
       return std::move(d_msgbuf);
     }
 
+    // Same as finishAndMoveBuf() but the buffer stays here, so that its memory can be reused after a reset()
+    const std::string& finishAndGetBuf()
+    {
+      if (!d_rspbuf.empty()) {
+        d_message.add_message(static_cast<protozero::pbf_tag_type>(Field::response), d_rspbuf);
+      }
+      return d_msgbuf;
+    }
+
     void addEvents(const RecEventTrace& trace);
 
     // DNSResponse related fields below
 
-    void addRR(const DNSRecord& record, const std::set<uint16_t>& exportTypes, bool udr);
+    void addRR(const DNSRecord& record, const std::set<uint16_t>& exportTypes, bool udr)
+    {
+      addRR(record, exportTypes, udr, nullptr, 0);
+    }
+    // When the record has just been written to a packet, its wire rdata can be passed to be copied as is.
+    // Only A and AAAA are exported in their wire format, the rdata is ignored for other types.
+    void addRR(const DNSRecord& record, const std::set<uint16_t>& exportTypes, bool udr, const uint8_t* wireRData, size_t wireRDataLen);
 
     void setAppliedPolicyType(const DNSFilterEngine::PolicyType type)
     {
@@ -137,7 +165,7 @@ namespace ProtoZero
 
     void setAppliedPolicyTrigger(const DNSName& trigger)
     {
-      encodeDNSName(d_response, d_rspbuf, static_cast<protozero::pbf_tag_type>(ResponseField::appliedPolicyTrigger), trigger);
+      encodeDNSName(d_response, *d_rspbufTarget, static_cast<protozero::pbf_tag_type>(ResponseField::appliedPolicyTrigger), trigger);
     }
 
     void setAppliedPolicyHit(const std::string& hit)
@@ -246,6 +274,8 @@ namespace ProtoZero
   private:
     std::string d_msgbuf;
     std::string d_rspbuf;
+    // the buffer d_response writes to
+    std::string* d_rspbufTarget{&d_rspbuf};
 
 #ifdef NOD_ENABLED
     vector<std::string::size_type> offsets;
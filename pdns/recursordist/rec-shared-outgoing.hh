@@ -0,0 +1,131 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+
+#include "dnsname.hh"
+#include "iputils.hh"
+#include "lock.hh"
+
+/* Outgoing UDP queries in flight, shared between the workers when share-outgoing-queries is set.
+   A worker about to send a query identical (same server, qname, qtype, ECS source and RD, EDNS and DO bits)
+   to one another worker has already sent registers as a waiter instead of sending it again. The worker owning
+   the query hands the answer to the waiters through their queries queue, and it is then delivered to the
+   waiting MThread just like an answer to a query chained in the same thread. */
+class SharedOutgoingQueries
+{
+public:
+  struct Key
+  {
+    ComboAddress remote;
+    DNSName qname;
+    Netmask ecs;
+    uint16_t qtype;
+    bool rd;
+    bool edns;
+    bool dnssecOK;
+
+    bool operator==(const Key& rhs) const
+    {
+      return qtype == rhs.qtype && rd == rhs.rd && edns == rhs.edns && dnssecOK == rhs.dnssecOK && remote == rhs.remote && ecs == rhs.ecs && qname == rhs.qname;
+    }
+  };
+
+  struct Waiter
+  {
+    unsigned int threadId;
+    uint16_t id;
+  };
+
+  SharedOutgoingQueries(size_t shardsCount) : d_shards(shardsCount)
+  {
+  }
+
+  /* returns true if the query has been chained onto an identical one sent by another thread */
+  bool addWaiter(const Key& key, unsigned int threadId, uint16_t id)
+  {
+    auto shard = getShard(key).lock();
+    auto it = shard->find(key);
+    if (it == shard->end() || it->second.owner == threadId) {
+      return false;
+    }
+    it->second.waiters.push_back({threadId, id});
+    return true;
+  }
+
+  /* returns true if the query was not already in flight, in which case threadId is now its owner */
+  bool addOwner(const Key& key, unsigned int threadId)
+  {
+    auto shard = getShard(key).lock();
+    return shard->emplace(key, Entry{{}, threadId}).second;
+  }
+
+  /* removes the query if it is owned by threadId, returning the threads waiting for it */
+  std::vector<Waiter> release(const Key& key, unsigned int threadId)
+  {
+    std::vector<Waiter> result;
+    auto shard = getShard(key).lock();
+    auto it = shard->find(key);
+    if (it != shard->end() && it->second.owner == threadId) {
+      result = std::move(it->second.waiters);
+      shard->erase(it);
+    }
+    return result;
+  }
+
+  size_t size()
+  {
+    size_t count = 0;
+    for (auto& shard : d_shards) {
+      count += shard.lock()->size();
+    }
+    return count;
+  }
+
+private:
+  struct Entry
+  {
+    std::vector<Waiter> waiters;
+    unsigned int owner;
+  };
+
+  struct KeyHash
+  {
+    size_t operator()(const Key& key) const
+    {
+      size_t hash = key.qname.hash(ComboAddress::addressOnlyHash()(key.remote));
+      size_t bits = static_cast<size_t>(key.qtype) << 16 | (key.rd ? 1 : 0) | (key.edns ? 2 : 0) | (key.dnssecOK ? 4 : 0);
+      return hash ^ hash_value(key.ecs) ^ bits;
+    }
+  };
+
+  typedef LockGuarded<std::unordered_map<Key, Entry, KeyHash>> shard_t;
+
+  shard_t& getShard(const Key& key)
+  {
+    return d_shards.at(KeyHash()(key) % d_shards.size());
+  }
+
+  std::vector<shard_t> d_shards;
+};
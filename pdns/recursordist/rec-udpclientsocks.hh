@@ -0,0 +1,134 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#pragma once
+
+#include <deque>
+#include <unordered_map>
+#include <sys/socket.h>
+
+#include "misc.hh"
+
+/* Idle outgoing UDP sockets kept by a thread to be reused for later queries, when
+   udp-source-port-pool-size is set. A socket is handed out again only after a cooldown,
+   to one query of the same family, and at most maxUses times in total, so that the
+   source port keeps changing even if the pool is busy. Sockets whose last exchange
+   failed (send error, timeout, invalid answer) are never kept. */
+class UDPClientSocketsPool
+{
+public:
+  /* late answers to the previous query are drained when a socket is reused,
+     but we don't want to reuse a socket while they are still likely to arrive */
+  static const time_t s_cooldown = 2;
+
+  UDPClientSocketsPool(size_t maxSize, uint32_t maxUses) :
+    d_maxSize(maxSize), d_maxUses(maxUses)
+  {
+  }
+
+  ~UDPClientSocketsPool()
+  {
+    for (const auto& entry : d_pool) {
+      close(entry.d_fd);
+    }
+  }
+
+  UDPClientSocketsPool(const UDPClientSocketsPool&) = delete;
+  UDPClientSocketsPool& operator=(const UDPClientSocketsPool&) = delete;
+
+  bool enabled() const
+  {
+    return d_maxSize > 0;
+  }
+
+  /* returns a pooled socket of that family that can be reused at now, or -1 if there is none */
+  int get(int family, time_t now)
+  {
+    for (auto it = d_pool.begin(); it != d_pool.end(); ++it) {
+      if (it->d_returned + s_cooldown > now) {
+        /* the pool is ordered by the time sockets were returned */
+        break;
+      }
+      if (it->d_family == family) {
+        int fd = it->d_fd;
+        d_inUse[fd] = {it->d_uses + 1, it->d_family};
+        d_pool.erase(it);
+        return fd;
+      }
+    }
+    return -1;
+  }
+
+  /* a socket has just been created for a query, and might be pooled once it's done */
+  void add(int fd, int family)
+  {
+    if (enabled()) {
+      d_inUse[fd] = {1, static_cast<sa_family_t>(family)};
+    }
+  }
+
+  /* the query sent from fd is done. The socket is kept in the pool if the query succeeded,
+     the socket can still be used and there is room, and closed otherwise (closesocket() might throw).
+     Returns true if the socket has been kept. */
+  bool release(int fd, bool succeeded, time_t now)
+  {
+    InUse inUse{0, AF_UNSPEC};
+    auto it = d_inUse.find(fd);
+    if (it != d_inUse.end()) {
+      inUse = it->second;
+      d_inUse.erase(it);
+    }
+
+    if (succeeded && inUse.d_uses > 0 && inUse.d_uses < d_maxUses && d_pool.size() < d_maxSize) {
+      d_pool.push_back({now, fd, inUse.d_uses, inUse.d_family});
+      return true;
+    }
+
+    closesocket(fd);
+    return false;
+  }
+
+  size_t size() const
+  {
+    return d_pool.size();
+  }
+
+private:
+  struct PooledSocket
+  {
+    time_t d_returned;
+    int d_fd;
+    uint32_t d_uses;
+    sa_family_t d_family;
+  };
+
+  struct InUse
+  {
+    uint32_t d_uses;
+    sa_family_t d_family;
+  };
+
+  std::deque<PooledSocket> d_pool;
+  /* the sockets handed out, and not yet released, while the pool is enabled */
+  std::unordered_map<int, InUse> d_inUse;
+  const size_t d_maxSize;
+  const uint32_t d_maxUses;
+};
@@ -44,10 +44,11 @@ struct ZoneData
     d_zone(zone),
     d_now(time(nullptr)) {}
 
-  // Potentially the two fields below could be merged into a single map. ATM it is not clear to me
-  // if that would make the code easier to read.
-  std::map<pair<DNSName, QType>, vector<DNSRecord>> d_all;
-  std::map<pair<DNSName, QType>, vector<shared_ptr<RRSIGRecordContent>>> d_sigs;
+  // The records are collected as they come in and sorted once the zone has been read, so that
+  // the records of an RRset (and the signatures covering it) end up next to each other.
+  // The RRSIGs are sorted on the type they cover.
+  vector<DNSRecord> d_records;
+  vector<std::pair<DNSName, shared_ptr<RRSIGRecordContent>>> d_sigs;
 
   // Maybe use a SuffixMatchTree?
   std::set<DNSName> d_delegations;
@@ -58,6 +59,7 @@ struct ZoneData
 
   bool isRRSetAuth(const DNSName& qname, QType qtype) const;
   void parseDRForCache(DNSRecord& dr);
+  vector<MemRecursorCache::BulkRRSet> getRRSets();
   void getByAXFR(const RecZoneToCache::Config&);
   void ZoneToCache(const RecZoneToCache::Config& config, uint64_t gen);
 };
@@ -83,27 +85,19 @@ bool ZoneData::isRRSetAuth(const DNSName& qname, QType qtype) const
 
 void ZoneData::parseDRForCache(DNSRecord& dr)
 {
-  const auto key = make_pair(dr.d_name, dr.d_type);
-
   dr.d_ttl += d_now;
 
   switch (dr.d_type) {
   case QType::NSEC:
   case QType::NSEC3:
-    break;
+    // We ignore NSEC and NSEC3 records, see ZoneToCache()
+    return;
   case QType::RRSIG: {
     const auto& rr = getRR<RRSIGRecordContent>(dr);
-    const auto sigkey = make_pair(key.first, rr->d_type);
-    auto found = d_sigs.find(sigkey);
-    if (found != d_sigs.end()) {
-      found->second.push_back(rr);
+    if (rr) {
+      d_sigs.emplace_back(dr.d_name, rr);
     }
-    else {
-      vector<shared_ptr<RRSIGRecordContent>> sigsrr;
-      sigsrr.push_back(rr);
-      d_sigs.insert({sigkey, sigsrr});
-    }
-    break;
+    return;
   }
   case QType::NS:
     if (dr.d_name != d_zone) {
@@ -114,15 +108,48 @@ void ZoneData::parseDRForCache(DNSRecord& dr)
     break;
   }
 
-  auto found = d_all.find(key);
-  if (found != d_all.end()) {
-    found->second.push_back(dr);
-  }
-  else {
-    vector<DNSRecord> v;
-    v.push_back(dr);
-    d_all.insert({key, v});
+  d_records.push_back(std::move(dr));
+}
+
+vector<MemRecursorCache::BulkRRSet> ZoneData::getRRSets()
+{
+  // stable sorts, to keep the records of an RRset in zone order
+  std::stable_sort(d_records.begin(), d_records.end(), [](const DNSRecord& a, const DNSRecord& b) {
+    return std::tie(a.d_name, a.d_type) < std::tie(b.d_name, b.d_type);
+  });
+  std::stable_sort(d_sigs.begin(), d_sigs.end(), [](const std::pair<DNSName, shared_ptr<RRSIGRecordContent>>& a, const std::pair<DNSName, shared_ptr<RRSIGRecordContent>>& b) {
+    return std::tie(a.first, a.second->d_type) < std::tie(b.first, b.second->d_type);
+  });
+
+  vector<MemRecursorCache::BulkRRSet> rrsets;
+  auto sig = d_sigs.cbegin();
+  auto it = d_records.begin();
+  while (it != d_records.end()) {
+    MemRecursorCache::BulkRRSet rrset;
+    rrset.d_qname = it->d_name;
+    rrset.d_qtype = it->d_type;
+    for (; it != d_records.end() && it->d_type == rrset.d_qtype && it->d_name == rrset.d_qname; ++it) {
+      rrset.d_records.push_back(std::move(*it));
+    }
+
+    // Both vectors are sorted the same way, so the sigs for this RRset (if any) are next
+    while (sig != d_sigs.cend() && (sig->first < rrset.d_qname || (sig->first == rrset.d_qname && sig->second->d_type < rrset.d_qtype.getCode()))) {
+      ++sig;
+    }
+    for (; sig != d_sigs.cend() && sig->second->d_type == rrset.d_qtype.getCode() && sig->first == rrset.d_qname; ++sig) {
+      rrset.d_signatures.push_back(sig->second);
+    }
+
+    rrset.d_auth = isRRSetAuth(rrset.d_qname, rrset.d_qtype);
+    // Same decision as updateCacheFromRecords() (we do not test for NSEC since we skip those completely)
+    if (rrset.d_auth || (rrset.d_qtype == QType::NS || rrset.d_qtype == QType::A || rrset.d_qtype == QType::AAAA || rrset.d_qtype == QType::DS)) {
+      rrsets.push_back(std::move(rrset));
+    }
   }
+
+  d_records.clear();
+  d_sigs.clear();
+  return rrsets;
 }
 
 void ZoneData::getByAXFR(const RecZoneToCache::Config& config)
@@ -153,21 +180,6 @@ void ZoneData::getByAXFR(const RecZoneToCache::Config& config)
   }
 }
 
-static std::vector<std::string> getLinesFromFile(const std::string& file)
-{
-
-  std::vector<std::string> lines;
-  std::ifstream stream(file);
-  if (!stream) {
-    throw std::runtime_error("Cannot read file: " + file);
-  }
-  std::string line;
-  while (std::getline(stream, line)) {
-    lines.push_back(line);
-  }
-  return lines;
-}
-
 static std::vector<std::string> getURL(const RecZoneToCache::Config& config)
 {
   std::vector<std::string> lines;
@@ -207,19 +219,26 @@ void ZoneData::ZoneToCache(const RecZoneToCache::Config& config, uint64_t config
   }
   else {
     vector<string> lines;
+    std::unique_ptr<ZoneParserTNG> zpt;
     if (config.d_method == "url") {
       d_log->info("Getting zone by URL");
       lines = getURL(config);
+      zpt = std::make_unique<ZoneParserTNG>(lines, d_zone);
     }
     else if (config.d_method == "file") {
       d_log->info("Getting zone from file");
-      lines = getLinesFromFile(config.d_sources.at(0));
+      // Parse the file as we read it, instead of reading all lines into memory first
+      zpt = std::make_unique<ZoneParserTNG>(config.d_sources.at(0), d_zone);
+      // but refuse $INCLUDE, as we did when parsing the lines read from the file
+      zpt->disableIncludes();
     }
-    DNSResourceRecord drr;
-    ZoneParserTNG zpt(lines, d_zone);
-    zpt.setMaxGenerateSteps(1);
+    else {
+      zpt = std::make_unique<ZoneParserTNG>(lines, d_zone);
+    }
+    zpt->setMaxGenerateSteps(1);
 
-    while (zpt.get(drr)) {
+    DNSResourceRecord drr;
+    while (zpt->get(drr)) {
       DNSRecord dr(drr);
       parseDRForCache(dr);
     }
@@ -231,32 +250,11 @@ void ZoneData::ZoneToCache(const RecZoneToCache::Config& config, uint64_t config
     return;
   }
 
-  // Rerun, now inserting the rrsets into the cache with associated sigs
+  // Group the records into rrsets with their associated sigs, and insert them into the cache
+  // one shard at a time
+  auto rrsets = getRRSets();
   d_now = time(nullptr);
-  for (const auto& [key, v] : d_all) {
-    const auto& [qname, qtype] = key;
-    switch (qtype) {
-    case QType::NSEC:
-    case QType::NSEC3:
-      break;
-    case QType::RRSIG:
-      break;
-    default: {
-      vector<shared_ptr<RRSIGRecordContent>> sigsrr;
-      auto it = d_sigs.find(key);
-      if (it != d_sigs.end()) {
-        sigsrr = it->second;
-      }
-      bool auth = isRRSetAuth(qname, qtype);
-      // Same decision as updateCacheFromRecords() (we do not test for NSEC since we skip those completely)
-      if (auth || (qtype == QType::NS || qtype == QType::A || qtype == QType::AAAA || qtype == QType::DS)) {
-        g_recCache->replace(d_now, qname, qtype, v, sigsrr,
-                            std::vector<std::shared_ptr<DNSRecord>>(), auth, d_zone);
-      }
-      break;
-    }
-    }
-  }
+  g_recCache->replaceBulk(d_now, rrsets, d_zone);
 }
 
 // Config must be a copy, so call by value!
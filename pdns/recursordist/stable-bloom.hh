@@ -22,11 +22,11 @@
 
 #pragma once
 
-#include <vector>
+#include <atomic>
+#include <memory>
 #include <cmath>
 #include <random>
 #include <arpa/inet.h>
-#include <boost/dynamic_bitset.hpp>
 #include "misc.hh"
 #include "ext/probds/murmur3.h"
 
@@ -36,6 +36,10 @@ namespace bf
 // Max is always 1 in this implementation, which is best for streaming data
 // This also means we can use a bitset for storing values which is very
 // efficient
+// The bitset is made of atomic words, so a single instance can be shared
+// between threads without locking. Concurrent updates might make a
+// domain look new to two threads at the same time, which is fine for
+// a probabilistic data structure.
 class stableBF
 {
 public:
@@ -43,57 +47,77 @@ public:
     d_k(optimalK(fp_rate)),
     d_num_cells(num_cells),
     d_p(p),
-    d_cells(num_cells),
-    d_gen(std::random_device()()),
-    d_dis(0, num_cells) {}
+    d_cells(allocate(num_cells)) {}
   stableBF(uint8_t k, uint32_t num_cells, uint8_t p, const std::string& bitstr) :
     d_k(k),
     d_num_cells(num_cells),
     d_p(p),
-    d_cells(bitstr),
-    d_gen(std::random_device()()),
-    d_dis(0, num_cells) {}
+    d_cells(allocate(num_cells))
+  {
+    if (bitstr.size() != num_cells) {
+      throw std::runtime_error("SBF: invalid bitstr length");
+    }
+    // same format as boost::to_string(dynamic_bitset): the last cell comes first
+    for (uint32_t i = 0; i < num_cells; ++i) {
+      char c = bitstr[num_cells - 1 - i];
+      if (c == '1') {
+        set(i);
+      }
+      else if (c != '0') {
+        throw std::runtime_error("SBF: invalid character in bitstr");
+      }
+    }
+  }
   void add(const std::string& data)
   {
     decrement();
-    auto hashes = hash(data);
-    for (auto& i : hashes) {
-      d_cells.set(i % d_num_cells);
+    uint32_t h1, h2;
+    hash(data, h1, h2);
+    for (uint32_t i = 0; i < d_k; ++i) {
+      set((h1 + i * h2) % d_num_cells);
     }
   }
   bool test(const std::string& data) const
   {
-    auto hashes = hash(data);
-    for (auto& i : hashes) {
-      if (d_cells.test(i % d_num_cells) == false)
+    uint32_t h1, h2;
+    hash(data, h1, h2);
+    for (uint32_t i = 0; i < d_k; ++i) {
+      if (isSet((h1 + i * h2) % d_num_cells) == false)
         return false;
     }
     return true;
   }
   bool testAndAdd(const std::string& data)
   {
-    auto hashes = hash(data);
+    uint32_t h1, h2;
+    hash(data, h1, h2);
     bool retval = true;
-    for (auto& i : hashes) {
-      if (d_cells.test(i % d_num_cells) == false) {
+    for (uint32_t i = 0; i < d_k; ++i) {
+      if (isSet((h1 + i * h2) % d_num_cells) == false) {
         retval = false;
         break;
       }
     }
     decrement();
-    for (auto& i : hashes) {
-      d_cells.set(i % d_num_cells);
+    for (uint32_t i = 0; i < d_k; ++i) {
+      set((h1 + i * h2) % d_num_cells);
     }
     return retval;
   }
-  void dump(std::ostream& os)
+  // Concurrent updates are not blocked, so the dump is not an exact
+  // point-in-time copy of the filter
+  void dump(std::ostream& os) const
   {
     os.write((char*)&d_k, sizeof(d_k));
     uint32_t nint = htonl(d_num_cells);
     os.write((char*)&nint, sizeof(nint));
     os.write((char*)&d_p, sizeof(d_p));
-    std::string temp_str;
-    boost::to_string(d_cells, temp_str);
+    std::string temp_str(d_num_cells, '0');
+    for (uint32_t i = 0; i < d_num_cells; ++i) {
+      if (isSet(i)) {
+        temp_str[d_num_cells - 1 - i] = '1';
+      }
+    }
     uint32_t bitstr_length = htonl((uint32_t)temp_str.length());
     os.write((char*)&bitstr_length, sizeof(bitstr_length));
     os.write((char*)temp_str.c_str(), temp_str.length());
@@ -101,6 +125,7 @@ public:
       throw std::runtime_error("SBF: Failed to dump");
     }
   }
+  // Not thread-safe, only call this before sharing the instance
   void restore(std::istream& is)
   {
     uint8_t k, p;
@@ -137,6 +162,31 @@ public:
   }
 
 private:
+  typedef std::atomic<uint64_t> word_t;
+  static constexpr uint32_t c_bits_per_word = 64;
+
+  static std::unique_ptr<word_t[]> allocate(uint32_t num_cells)
+  {
+    size_t num_words = (static_cast<size_t>(num_cells) + c_bits_per_word - 1) / c_bits_per_word;
+    // value-initialized, so all cells start at zero
+    return std::make_unique<word_t[]>(num_words);
+  }
+  static uint64_t mask(uint32_t cell)
+  {
+    return static_cast<uint64_t>(1) << (cell % c_bits_per_word);
+  }
+  bool isSet(uint32_t cell) const
+  {
+    return (d_cells[cell / c_bits_per_word].load(std::memory_order_relaxed) & mask(cell)) != 0;
+  }
+  void set(uint32_t cell)
+  {
+    d_cells[cell / c_bits_per_word].fetch_or(mask(cell), std::memory_order_relaxed);
+  }
+  void reset(uint32_t cell)
+  {
+    d_cells[cell / c_bits_per_word].fetch_and(~mask(cell), std::memory_order_relaxed);
+  }
   unsigned int optimalK(float fp_rate)
   {
     return std::ceil(std::log2(1 / fp_rate));
@@ -147,9 +197,12 @@ private:
     // The stable bloom algorithm described in the paper says
     // to choose p independent positions, but that is much slower
     // and this shouldn't change the properties of the SBF
-    size_t r = d_dis(d_gen);
+    // The generator is per-thread since the instance is shared
+    static thread_local std::mt19937 gen(std::random_device{}());
+    std::uniform_int_distribution<uint32_t> dis(0, d_num_cells - 1);
+    uint32_t r = dis(gen);
     for (uint64_t i = 0; i < d_p; ++i) {
-      d_cells.reset((r + i) % d_num_cells);
+      reset((r + i) % d_num_cells);
     }
   }
   void swap(stableBF& rhs)
@@ -159,24 +212,16 @@ private:
     std::swap(d_p, rhs.d_p);
     d_cells.swap(rhs.d_cells);
   }
-  // This is a double hash implementation returning an array of
-  // k hashes
-  std::vector<uint32_t> hash(const std::string& data) const
+  // This is a double hash implementation, the k hashes are
+  // h1 + i * h2 for i in [0, k[
+  static void hash(const std::string& data, uint32_t& h1, uint32_t& h2)
   {
-    uint32_t h1, h2;
     MurmurHash3_x86_32(data.c_str(), data.length(), 1, (void*)&h1);
     MurmurHash3_x86_32(data.c_str(), data.length(), 2, (void*)&h2);
-    std::vector<uint32_t> ret_hashes(d_k);
-    for (size_t i = 0; i < d_k; ++i) {
-      ret_hashes[i] = h1 + i * h2;
-    }
-    return ret_hashes;
   }
   uint8_t d_k;
   uint32_t d_num_cells;
   uint8_t d_p;
-  boost::dynamic_bitset<> d_cells;
-  std::mt19937 d_gen;
-  std::uniform_int_distribution<> d_dis;
+  std::unique_ptr<word_t[]> d_cells;
 };
 }
@@ -1340,6 +1340,150 @@ BOOST_AUTO_TEST_CASE(test_aggressive_nsec3_rollover)
   BOOST_CHECK_EQUAL(cache->getDenial(now, other, QType::AAAA, results, res, ComboAddress("192.0.2.1"), boost::none, true), false);
 }
 
+static void insertNSEC3ForName(std::unique_ptr<AggressiveNSECCache>& cache, const DNSName& zone, const DNSName& name, const std::string& salt, unsigned int iterationsCount, time_t now)
+{
+  /* first we need a SOA */
+  std::vector<DNSRecord> records;
+  time_t ttd = now + 30;
+  DNSRecord drSOA;
+  drSOA.d_name = zone;
+  drSOA.d_type = QType::SOA;
+  drSOA.d_class = QClass::IN;
+  drSOA.d_content = std::make_shared<SOARecordContent>("pdns-public-ns1.powerdns.com. pieter\\.lexis.powerdns.com. 2017032301 10800 3600 604800 3600");
+  drSOA.d_ttl = static_cast<uint32_t>(ttd); // XXX truncation
+  drSOA.d_place = DNSResourceRecord::ANSWER;
+  records.push_back(drSOA);
+  g_recCache->replace(now, zone, QType(QType::SOA), records, {}, {}, true, zone, boost::none, boost::none, vState::Secure);
+
+  /* then a NSEC3 whose owner is the hash of name */
+  std::string hashed = hashQNameWithSalt(salt, iterationsCount, name);
+  DNSRecord rec;
+  rec.d_name = DNSName(toBase32Hex(hashed)) + zone;
+  rec.d_type = QType::NSEC3;
+  rec.d_ttl = now + 10;
+
+  NSEC3RecordContent nrc;
+  nrc.d_algorithm = 1;
+  nrc.d_flags = 0;
+  nrc.d_iterations = iterationsCount;
+  nrc.d_salt = salt;
+  nrc.d_nexthash = hashed;
+  incrementHash(nrc.d_nexthash);
+  nrc.set(QType::A);
+
+  rec.d_content = std::make_shared<NSEC3RecordContent>(nrc);
+  auto rrsig = std::make_shared<RRSIGRecordContent>("NSEC3 5 3 10 20370101000000 20370101000000 24567 dummy. data");
+  cache->insertNSEC(zone, rec.d_name, rec, {rrsig}, true);
+}
+
+BOOST_AUTO_TEST_CASE(test_aggressive_nsec_zones_snapshot)
+{
+  /* new zones are added to a pending tree, then published in batches: check that they
+     can be used right away, that the closest zone is used whether it has been published
+     or not, and that they can be removed in both cases */
+  auto cache = make_unique<AggressiveNSECCache>(10000);
+  g_recCache = std::make_unique<MemRecursorCache>();
+
+  const DNSName parent("powerdns.com");
+  const std::string salt = "ab";
+  const size_t zonesCount = 300;
+  time_t now = time(nullptr);
+  int res;
+  std::vector<DNSRecord> results;
+
+  auto zoneName = [&parent](size_t idx) {
+    return DNSName("z" + std::to_string(idx)) + parent;
+  };
+
+  for (size_t idx = 0; idx < zonesCount; idx++) {
+    const DNSName zone = zoneName(idx);
+    insertNSEC3ForName(cache, zone, DNSName("www") + zone, salt, 0, now);
+    BOOST_CHECK_EQUAL(cache->getDenial(now, DNSName("www") + zone, QType::AAAA, results, res, ComboAddress("192.0.2.1"), boost::none, true), true);
+  }
+  BOOST_CHECK_EQUAL(cache->getEntriesCount(), zonesCount);
+
+  /* the parent zone is added last, and is still pending */
+  insertNSEC3ForName(cache, parent, DNSName("www") + parent, salt, 0, now);
+  BOOST_CHECK_EQUAL(cache->getEntriesCount(), zonesCount + 1);
+  BOOST_CHECK_EQUAL(cache->getDenial(now, DNSName("www") + parent, QType::AAAA, results, res, ComboAddress("192.0.2.1"), boost::none, true), true);
+  /* but the children zones, published or not, are still the closest ones */
+  BOOST_CHECK_EQUAL(cache->getDenial(now, DNSName("www") + zoneName(0), QType::AAAA, results, res, ComboAddress("192.0.2.1"), boost::none, true), true);
+  BOOST_CHECK_EQUAL(cache->getDenial(now, DNSName("www") + zoneName(zonesCount - 1), QType::AAAA, results, res, ComboAddress("192.0.2.1"), boost::none, true), true);
+
+  /* remove a zone that has been published, then one that is pending */
+  cache->removeZoneInfo(zoneName(0), false);
+  BOOST_CHECK_EQUAL(cache->getEntriesCount(), zonesCount);
+  BOOST_CHECK_EQUAL(cache->getDenial(now, DNSName("www") + zoneName(0), QType::AAAA, results, res, ComboAddress("192.0.2.1"), boost::none, true), false);
+  cache->removeZoneInfo(zoneName(zonesCount - 1), false);
+  BOOST_CHECK_EQUAL(cache->getEntriesCount(), zonesCount - 1);
+  BOOST_CHECK_EQUAL(cache->getDenial(now, DNSName("www") + zoneName(zonesCount - 1), QType::AAAA, results, res, ComboAddress("192.0.2.1"), boost::none, true), false);
+  BOOST_CHECK_EQUAL(cache->getDenial(now, DNSName("www") + zoneName(1), QType::AAAA, results, res, ComboAddress("192.0.2.1"), boost::none, true), true);
+
+  /* and it can be added back */
+  insertNSEC3ForName(cache, zoneName(0), DNSName("www") + zoneName(0), salt, 0, now);
+  BOOST_CHECK_EQUAL(cache->getEntriesCount(), zonesCount);
+  BOOST_CHECK_EQUAL(cache->getDenial(now, DNSName("www") + zoneName(0), QType::AAAA, results, res, ComboAddress("192.0.2.1"), boost::none, true), true);
+
+  /* remove everything */
+  cache->removeZoneInfo(parent, true);
+  BOOST_CHECK_EQUAL(cache->getEntriesCount(), 0U);
+  BOOST_CHECK_EQUAL(cache->getDenial(now, DNSName("www") + parent, QType::AAAA, results, res, ComboAddress("192.0.2.1"), boost::none, true), false);
+  BOOST_CHECK_EQUAL(cache->getDenial(now, DNSName("www") + zoneName(1), QType::AAAA, results, res, ComboAddress("192.0.2.1"), boost::none, true), false);
+}
+
+BOOST_AUTO_TEST_CASE(test_aggressive_nsec3_hashes_cache)
+{
+  auto cache = make_unique<AggressiveNSECCache>(10000);
+  g_recCache = std::make_unique<MemRecursorCache>();
+
+  const DNSName zone("powerdns.com");
+  time_t now = time(nullptr);
+  int res;
+  std::vector<DNSRecord> results;
+
+  insertNSEC3ForName(cache, zone, DNSName("www.powerdns.com"), "ab", 0, now);
+  BOOST_CHECK_EQUAL(cache->getEntriesCount(), 1U);
+  BOOST_CHECK_EQUAL(cache->getNSEC3HashesCount(zone), 0U);
+
+  /* there is no closest encloser proof for that name, but the hashes of the candidates
+     (b.powerdns.com, powerdns.com, com and the root) are now cached */
+  BOOST_CHECK_EQUAL(cache->getDenial(now, DNSName("a.b.powerdns.com"), QType::A, results, res, ComboAddress("192.0.2.1"), boost::none, true), false);
+  BOOST_CHECK_EQUAL(cache->getNSEC3HashesCount(zone), 4U);
+
+  /* same candidates, and the hash of the name itself is not cached */
+  BOOST_CHECK_EQUAL(cache->getDenial(now, DNSName("c.b.powerdns.com"), QType::A, results, res, ComboAddress("192.0.2.1"), boost::none, true), false);
+  BOOST_CHECK_EQUAL(cache->getNSEC3HashesCount(zone), 4U);
+
+  /* one new candidate */
+  BOOST_CHECK_EQUAL(cache->getDenial(now, DNSName("a.c.powerdns.com"), QType::A, results, res, ComboAddress("192.0.2.1"), boost::none, true), false);
+  BOOST_CHECK_EQUAL(cache->getNSEC3HashesCount(zone), 5U);
+
+  /* we can still use the NSEC3 we have */
+  BOOST_CHECK_EQUAL(cache->getDenial(now, DNSName("www.powerdns.com"), QType::AAAA, results, res, ComboAddress("192.0.2.1"), boost::none, true), true);
+
+  /* fill it up */
+  size_t idx = 0;
+  while (cache->getNSEC3HashesCount(zone) < AggressiveNSECCache::s_maxNSEC3HashesPerZone) {
+    cache->getDenial(now, DNSName("a.n" + std::to_string(idx)) + zone, QType::A, results, res, ComboAddress("192.0.2.1"), boost::none, true);
+    ++idx;
+  }
+  BOOST_CHECK_EQUAL(cache->getNSEC3HashesCount(zone), AggressiveNSECCache::s_maxNSEC3HashesPerZone);
+
+  /* the next new candidate clears it, then the remaining candidates are added back */
+  cache->getDenial(now, DNSName("a.last.powerdns.com"), QType::A, results, res, ComboAddress("192.0.2.1"), boost::none, true);
+  BOOST_CHECK_EQUAL(cache->getNSEC3HashesCount(zone), 4U);
+
+  /* a new salt invalidates the cached hashes */
+  insertNSEC3ForName(cache, zone, DNSName("www.powerdns.com"), "cd", 0, now);
+  BOOST_CHECK_EQUAL(cache->getNSEC3HashesCount(zone), 0U);
+  BOOST_CHECK_EQUAL(cache->getDenial(now, DNSName("a.b.powerdns.com"), QType::A, results, res, ComboAddress("192.0.2.1"), boost::none, true), false);
+  BOOST_CHECK_EQUAL(cache->getNSEC3HashesCount(zone), 4U);
+
+  /* removing the zone releases them */
+  cache->removeZoneInfo(zone, false);
+  BOOST_CHECK_EQUAL(cache->getNSEC3HashesCount(zone), 0U);
+}
+
 BOOST_AUTO_TEST_CASE(test_aggressive_nsec_ancestor_cases)
 {
   auto cache = make_unique<AggressiveNSECCache>(10000);
@@ -815,6 +815,137 @@ BOOST_AUTO_TEST_CASE(test_multiple_filter_policies_order)
   }
 }
 
+BOOST_AUTO_TEST_CASE(test_zone_copies)
+{
+  auto zone = std::make_shared<DNSFilterEngine::Zone>();
+  zone->setName("Unit test policy 0");
+
+  /* enough entries for the names to be spread over several buckets */
+  const size_t count = 10000;
+  for (size_t idx = 0; idx < count; idx++) {
+    zone->addQNameTrigger(DNSName("name" + std::to_string(idx) + ".bad."), DNSFilterEngine::Policy(DNSFilterEngine::PolicyKind::Drop, DNSFilterEngine::PolicyType::QName));
+  }
+  zone->addClientTrigger(Netmask("192.0.2.0/24"), DNSFilterEngine::Policy(DNSFilterEngine::PolicyKind::Drop, DNSFilterEngine::PolicyType::ClientIP));
+  BOOST_CHECK_EQUAL(zone->size(), count + 1);
+
+  /* modifying the copy should not change the original */
+  auto copy = std::make_shared<DNSFilterEngine::Zone>(*zone);
+  BOOST_CHECK_EQUAL(copy->size(), count + 1);
+  BOOST_CHECK(copy->rmQNameTrigger(DNSName("name42.bad."), DNSFilterEngine::Policy(DNSFilterEngine::PolicyKind::Drop, DNSFilterEngine::PolicyType::QName)));
+  copy->addQNameTrigger(DNSName("new.bad."), DNSFilterEngine::Policy(DNSFilterEngine::PolicyKind::Drop, DNSFilterEngine::PolicyType::QName));
+  copy->addClientTrigger(Netmask("198.51.100.0/24"), DNSFilterEngine::Policy(DNSFilterEngine::PolicyKind::Drop, DNSFilterEngine::PolicyType::ClientIP));
+  BOOST_CHECK_EQUAL(copy->size(), count + 2);
+
+  DNSFilterEngine::Policy pol;
+  BOOST_CHECK(zone->findExactQNamePolicy(DNSName("name42.bad."), pol));
+  BOOST_CHECK(!zone->findExactQNamePolicy(DNSName("new.bad."), pol));
+  BOOST_CHECK(!zone->findClientPolicy(ComboAddress("198.51.100.1"), pol));
+  BOOST_CHECK_EQUAL(zone->size(), count + 1);
+
+  BOOST_CHECK(!copy->findExactQNamePolicy(DNSName("name42.bad."), pol));
+  BOOST_CHECK(copy->findExactQNamePolicy(DNSName("new.bad."), pol));
+  BOOST_CHECK(copy->findClientPolicy(ComboAddress("198.51.100.1"), pol));
+  BOOST_CHECK(copy->findClientPolicy(ComboAddress("192.0.2.1"), pol));
+
+  /* and modifying the original should not change the copy either */
+  BOOST_CHECK(zone->rmQNameTrigger(DNSName("name43.bad."), DNSFilterEngine::Policy(DNSFilterEngine::PolicyKind::Drop, DNSFilterEngine::PolicyType::QName)));
+  BOOST_CHECK(zone->rmClientTrigger(Netmask("192.0.2.0/24"), DNSFilterEngine::Policy(DNSFilterEngine::PolicyKind::Drop, DNSFilterEngine::PolicyType::ClientIP)));
+  BOOST_CHECK_EQUAL(zone->size(), count - 1);
+  BOOST_CHECK(copy->findExactQNamePolicy(DNSName("name43.bad."), pol));
+  BOOST_CHECK(copy->findClientPolicy(ComboAddress("192.0.2.1"), pol));
+  BOOST_CHECK_EQUAL(copy->size(), count + 2);
+
+  /* every entry is still reachable */
+  for (size_t idx = 0; idx < count; idx++) {
+    DNSName name("name" + std::to_string(idx) + ".bad.");
+    BOOST_CHECK_EQUAL(copy->findExactQNamePolicy(name, pol), idx != 42);
+    BOOST_CHECK_EQUAL(zone->findExactQNamePolicy(name, pol), idx != 43);
+  }
+
+  copy->clear();
+  BOOST_CHECK_EQUAL(copy->size(), 0U);
+  BOOST_CHECK_EQUAL(zone->size(), count - 1);
+}
+
+BOOST_AUTO_TEST_CASE(test_wildcard_triggers_across_zones)
+{
+  DNSFilterEngine dfe;
+
+  auto zone1 = std::make_shared<DNSFilterEngine::Zone>();
+  zone1->setName("Unit test policy 0");
+  auto zone2 = std::make_shared<DNSFilterEngine::Zone>();
+  zone2->setName("Unit test policy 1");
+  auto zone3 = std::make_shared<DNSFilterEngine::Zone>();
+  zone3->setName("Unit test policy 2");
+
+  /* enough entries for the names to be spread over several buckets */
+  for (size_t idx = 0; idx < 5000; idx++) {
+    zone1->addQNameTrigger(DNSName("name" + std::to_string(idx) + ".bad."), DNSFilterEngine::Policy(DNSFilterEngine::PolicyKind::Drop, DNSFilterEngine::PolicyType::QName));
+  }
+  zone2->addQNameTrigger(DNSName("*.sub.example.com."), DNSFilterEngine::Policy(DNSFilterEngine::PolicyKind::NXDOMAIN, DNSFilterEngine::PolicyType::QName));
+  zone2->addNSTrigger(DNSName("*.bad.wolf."), DNSFilterEngine::Policy(DNSFilterEngine::PolicyKind::NXDOMAIN, DNSFilterEngine::PolicyType::NSDName));
+  zone3->addQNameTrigger(DNSName("www.sub.example.com."), DNSFilterEngine::Policy(DNSFilterEngine::PolicyKind::NODATA, DNSFilterEngine::PolicyType::QName));
+  zone3->addQNameTrigger(DNSName("*.example.com."), DNSFilterEngine::Policy(DNSFilterEngine::PolicyKind::NODATA, DNSFilterEngine::PolicyType::QName));
+  zone3->addQNameTrigger(DNSName("*."), DNSFilterEngine::Policy(DNSFilterEngine::PolicyKind::Truncate, DNSFilterEngine::PolicyType::QName));
+
+  dfe.addZone(zone1);
+  dfe.addZone(zone2);
+  dfe.addZone(zone3);
+
+  {
+    /* the wildcard from zone 2 wins over the exact match from zone 3, regardless of the case */
+    const auto matchingPolicy = dfe.getQueryPolicy(DNSName("WWW.Sub.Example.COM."), std::unordered_map<std::string, bool>(), DNSFilterEngine::maximumPriority);
+    BOOST_CHECK(matchingPolicy.d_kind == DNSFilterEngine::PolicyKind::NXDOMAIN);
+    BOOST_CHECK_EQUAL(matchingPolicy.d_trigger, DNSName("*.sub.example.com."));
+    BOOST_CHECK_EQUAL(matchingPolicy.d_hit, "WWW.Sub.Example.COM");
+  }
+
+  {
+    /* unless zone 2 is disabled, then the exact match from zone 3 wins over its wildcards */
+    const auto matchingPolicy = dfe.getQueryPolicy(DNSName("www.sub.example.com."), {{zone2->getName(), true}}, DNSFilterEngine::maximumPriority);
+    BOOST_CHECK(matchingPolicy.d_kind == DNSFilterEngine::PolicyKind::NODATA);
+    BOOST_CHECK_EQUAL(matchingPolicy.d_trigger, DNSName("www.sub.example.com."));
+  }
+
+  {
+    /* a wildcard does not match its own apex, the most specific one wins */
+    const auto matchingPolicy = dfe.getQueryPolicy(DNSName("sub.example.com."), std::unordered_map<std::string, bool>(), DNSFilterEngine::maximumPriority);
+    BOOST_CHECK(matchingPolicy.d_kind == DNSFilterEngine::PolicyKind::NODATA);
+    BOOST_CHECK_EQUAL(matchingPolicy.d_trigger, DNSName("*.example.com."));
+  }
+
+  {
+    /* the root wildcard covers everything else */
+    const auto matchingPolicy = dfe.getQueryPolicy(DNSName("name1.bad.example.net."), std::unordered_map<std::string, bool>(), DNSFilterEngine::maximumPriority);
+    BOOST_CHECK(matchingPolicy.d_kind == DNSFilterEngine::PolicyKind::Truncate);
+    BOOST_CHECK_EQUAL(matchingPolicy.d_trigger, DNSName("*."));
+  }
+
+  {
+    /* but zones with a priority that is not lower than the current one are skipped */
+    const auto matchingPolicy = dfe.getQueryPolicy(DNSName("name1.bad.example.net."), std::unordered_map<std::string, bool>(), zone3->getPriority());
+    BOOST_CHECK(matchingPolicy.d_type == DNSFilterEngine::PolicyType::None);
+  }
+
+  {
+    const auto matchingPolicy = dfe.getQueryPolicy(DNSName("name4999.bad."), std::unordered_map<std::string, bool>(), DNSFilterEngine::maximumPriority);
+    BOOST_CHECK(matchingPolicy.d_kind == DNSFilterEngine::PolicyKind::Drop);
+    BOOST_CHECK_EQUAL(matchingPolicy.d_trigger, DNSName("name4999.bad."));
+  }
+
+  {
+    const auto matchingPolicy = dfe.getProcessingPolicy(DNSName("ns1.Bad.Wolf."), std::unordered_map<std::string, bool>(), DNSFilterEngine::maximumPriority);
+    BOOST_CHECK(matchingPolicy.d_kind == DNSFilterEngine::PolicyKind::NXDOMAIN);
+    BOOST_CHECK_EQUAL(matchingPolicy.d_trigger, DNSName("*.bad.wolf.rpz-nsdname."));
+    BOOST_CHECK_EQUAL(matchingPolicy.d_hit, "ns1.Bad.Wolf");
+  }
+
+  {
+    const auto matchingPolicy = dfe.getProcessingPolicy(DNSName("bad.wolf."), std::unordered_map<std::string, bool>(), DNSFilterEngine::maximumPriority);
+    BOOST_CHECK(matchingPolicy.d_type == DNSFilterEngine::PolicyType::None);
+  }
+}
+
 BOOST_AUTO_TEST_CASE(test_mask_to_rpz)
 {
   BOOST_CHECK_EQUAL(DNSFilterEngine::Zone::maskToRPZ(Netmask("::2/127")).toString(), "127.2.zz.");
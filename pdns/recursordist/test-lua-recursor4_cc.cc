@@ -0,0 +1,262 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_NO_MAIN
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <boost/test/unit_test.hpp>
+
+#include "dnsrecords.hh"
+#include "lua-recursor4-resolve-ffi.hh"
+#include "syncres.hh"
+
+/* followCNAMERecords() lives in pdns_recursor.cc, which is not linked into the test runner */
+static size_t s_followCNAMERecordsCalls{0};
+
+int followCNAMERecords(std::vector<DNSRecord>& ret, const QType qtype, int oldret)
+{
+  ++s_followCNAMERecordsCalls;
+  return oldret;
+}
+
+struct ResolveFFITestContext
+{
+  ResolveFFITestContext() :
+    dq(remote, local, qname, QType::A, true, variable, wantsRPZ, logResponse, addPaddingToResponse)
+  {
+    dq.currentRecords = &records;
+    dq.policyTags = &policyTags;
+    dq.tag = 42;
+
+    DNSRecord dr;
+    dr.d_name = qname;
+    dr.d_type = QType::A;
+    dr.d_class = QClass::IN;
+    dr.d_ttl = 3600;
+    dr.d_place = DNSResourceRecord::ANSWER;
+    dr.d_content = DNSRecordContent::mastermake(QType::A, QClass::IN, "192.0.2.1");
+    records.push_back(dr);
+  }
+
+  const DNSName qname{"www.powerdns.com."};
+  const ComboAddress remote{"192.0.2.128:4242"};
+  const ComboAddress local{"[2001:db8::1]:53"};
+  std::vector<DNSRecord> records;
+  std::unordered_set<std::string> policyTags{"tag1"};
+  bool variable{false};
+  bool wantsRPZ{true};
+  bool logResponse{false};
+  bool addPaddingToResponse{false};
+  RecursorLua4::DNSQuestion dq;
+};
+
+BOOST_AUTO_TEST_SUITE(test_lua_recursor4_cc)
+
+BOOST_AUTO_TEST_CASE(test_resolve_ffi_handle_getters)
+{
+  ResolveFFITestContext ctx;
+  pdns_resolve_ffi_handle_t handle(ctx.dq, RCode::NXDomain);
+
+  BOOST_CHECK_EQUAL(std::string(pdns_resolve_ffi_handle_get_qname(&handle)), "www.powerdns.com");
+  const char* raw = nullptr;
+  size_t rawSize = 0;
+  pdns_resolve_ffi_handle_get_qname_raw(&handle, &raw, &rawSize);
+  BOOST_CHECK(std::string(raw, rawSize) == ctx.qname.getStorage());
+  BOOST_CHECK_EQUAL(pdns_resolve_ffi_handle_get_qtype(&handle), QType::A);
+
+  BOOST_CHECK_EQUAL(std::string(pdns_resolve_ffi_handle_get_remote(&handle)), "192.0.2.128");
+  BOOST_CHECK_EQUAL(pdns_resolve_ffi_handle_get_remote_port(&handle), 4242U);
+  const void* addr = nullptr;
+  size_t addrSize = 0;
+  pdns_resolve_ffi_handle_get_remote_raw(&handle, &addr, &addrSize);
+  BOOST_CHECK_EQUAL(addrSize, 4U);
+  BOOST_CHECK_EQUAL(std::string(pdns_resolve_ffi_handle_get_local(&handle)), "2001:db8::1");
+  BOOST_CHECK_EQUAL(pdns_resolve_ffi_handle_get_local_port(&handle), 53U);
+  pdns_resolve_ffi_handle_get_local_raw(&handle, &addr, &addrSize);
+  BOOST_CHECK_EQUAL(addrSize, 16U);
+
+  BOOST_CHECK_EQUAL(pdns_resolve_ffi_handle_get_tcp(&handle), true);
+  BOOST_CHECK_EQUAL(pdns_resolve_ffi_handle_get_tag(&handle), 42U);
+  BOOST_CHECK_EQUAL(pdns_resolve_ffi_handle_get_rcode(&handle), RCode::NXDomain);
+  BOOST_CHECK_EQUAL(pdns_resolve_ffi_handle_has_policytag(&handle, "tag1"), true);
+  BOOST_CHECK_EQUAL(pdns_resolve_ffi_handle_has_policytag(&handle, "tag2"), false);
+
+  pdns_resolve_ffi_handle_add_policytag(&handle, "tag2");
+  BOOST_CHECK_EQUAL(pdns_resolve_ffi_handle_has_policytag(&handle, "tag2"), true);
+  pdns_resolve_ffi_handle_set_variable(&handle, true);
+  BOOST_CHECK_EQUAL(ctx.variable, true);
+  pdns_resolve_ffi_handle_set_rcode(&handle, RCode::NoError);
+  BOOST_CHECK_EQUAL(pdns_resolve_ffi_handle_get_rcode(&handle), RCode::NoError);
+}
+
+BOOST_AUTO_TEST_CASE(test_resolve_ffi_handle_records)
+{
+  ResolveFFITestContext ctx;
+  pdns_resolve_ffi_handle_t handle(ctx.dq, RCode::NoError);
+
+  BOOST_REQUIRE_EQUAL(pdns_resolve_ffi_handle_get_records_count(&handle), 1U);
+
+  pdns_ffi_record_t record;
+  BOOST_REQUIRE(pdns_resolve_ffi_handle_get_record(&handle, 0, &record, false));
+  BOOST_CHECK_EQUAL(std::string(record.name, record.name_len), "www.powerdns.com");
+  BOOST_CHECK_EQUAL(std::string(record.content, record.content_len), "192.0.2.1");
+  BOOST_CHECK_EQUAL(record.ttl, 3600U);
+  BOOST_CHECK_EQUAL(record.type, QType::A);
+  BOOST_CHECK_EQUAL(record.place, answer);
+
+  BOOST_REQUIRE(pdns_resolve_ffi_handle_get_record(&handle, 0, &record, true));
+  BOOST_CHECK(std::string(record.name, record.name_len) == ctx.qname.getStorage());
+  BOOST_CHECK_EQUAL(record.content_len, 4U);
+  BOOST_CHECK_EQUAL(pdns_resolve_ffi_handle_get_record(&handle, 1, &record, false), false);
+
+  /* records are modified in place */
+  const std::string newContent("192.0.2.2");
+  BOOST_CHECK(pdns_resolve_ffi_handle_set_record(&handle, 0, newContent.c_str(), newContent.size(), false));
+  BOOST_CHECK_EQUAL(ctx.records.at(0).d_content->getZoneRepresentation(), newContent);
+  const std::string invalid("not an address");
+  BOOST_CHECK_EQUAL(pdns_resolve_ffi_handle_set_record(&handle, 0, invalid.c_str(), invalid.size(), false), false);
+  BOOST_CHECK_EQUAL(pdns_resolve_ffi_handle_set_record(&handle, 1, newContent.c_str(), newContent.size(), false), false);
+
+  const std::string aaaa("2001:db8::2");
+  BOOST_CHECK(pdns_resolve_ffi_handle_add_record(&handle, nullptr, QType::AAAA, 60, aaaa.c_str(), aaaa.size(), answer, false));
+  BOOST_REQUIRE_EQUAL(ctx.records.size(), 2U);
+  BOOST_CHECK_EQUAL(ctx.records.at(1).d_name, ctx.qname);
+  BOOST_CHECK_EQUAL(ctx.records.at(1).d_type, QType::AAAA);
+  BOOST_CHECK_EQUAL(ctx.records.at(1).d_ttl, 60U);
+  BOOST_CHECK_EQUAL(ctx.records.at(1).d_content->getZoneRepresentation(), aaaa);
+  BOOST_CHECK_EQUAL(pdns_resolve_ffi_handle_add_record(&handle, "other.powerdns.com", QType::AAAA, 60, invalid.c_str(), invalid.size(), additional, false), false);
+  BOOST_CHECK_EQUAL(ctx.records.size(), 2U);
+
+  pdns_resolve_ffi_handle_clear_records(&handle);
+  BOOST_CHECK_EQUAL(pdns_resolve_ffi_handle_get_records_count(&handle), 0U);
+  BOOST_CHECK(ctx.records.empty());
+}
+
+BOOST_AUTO_TEST_CASE(test_resolve_ffi_handle_appliedpolicy_kind)
+{
+  ResolveFFITestContext ctx;
+  pdns_resolve_ffi_handle_t handle(ctx.dq, RCode::NoError);
+
+  /* no applied policy */
+  BOOST_CHECK_EQUAL(pdns_resolve_ffi_handle_get_appliedpolicy_kind(&handle), pdns_policy_kind_noaction);
+  BOOST_CHECK_EQUAL(pdns_resolve_ffi_handle_set_appliedpolicy_kind(&handle, pdns_policy_kind_drop), false);
+
+  DNSFilterEngine::Policy policy;
+  ctx.dq.appliedPolicy = &policy;
+  const std::vector<std::pair<pdns_policy_kind_t, DNSFilterEngine::PolicyKind>> kinds = {
+    {pdns_policy_kind_drop, DNSFilterEngine::PolicyKind::Drop},
+    {pdns_policy_kind_nxdomain, DNSFilterEngine::PolicyKind::NXDOMAIN},
+    {pdns_policy_kind_nodata, DNSFilterEngine::PolicyKind::NODATA},
+    {pdns_policy_kind_truncate, DNSFilterEngine::PolicyKind::Truncate},
+    {pdns_policy_kind_custom, DNSFilterEngine::PolicyKind::Custom},
+    {pdns_policy_kind_noaction, DNSFilterEngine::PolicyKind::NoAction}};
+  for (const auto& kind : kinds) {
+    BOOST_CHECK(pdns_resolve_ffi_handle_set_appliedpolicy_kind(&handle, kind.first));
+    BOOST_CHECK(policy.d_kind == kind.second);
+    BOOST_CHECK_EQUAL(pdns_resolve_ffi_handle_get_appliedpolicy_kind(&handle), kind.first);
+  }
+
+  /* values coming from Lua are not checked by the FFI, an invalid one is rejected */
+  BOOST_CHECK(pdns_resolve_ffi_handle_set_appliedpolicy_kind(&handle, pdns_policy_kind_nxdomain));
+  BOOST_CHECK_EQUAL(pdns_resolve_ffi_handle_set_appliedpolicy_kind(&handle, static_cast<pdns_policy_kind_t>(42)), false);
+  BOOST_CHECK_EQUAL(pdns_resolve_ffi_handle_set_appliedpolicy_kind(&handle, static_cast<pdns_policy_kind_t>(-1)), false);
+  BOOST_CHECK(policy.d_kind == DNSFilterEngine::PolicyKind::NXDOMAIN);
+}
+
+BOOST_AUTO_TEST_CASE(test_resolve_ffi_hook_call)
+{
+  ResolveFFITestContext ctx;
+  const auto& histogram = g_stats.luaPreresolve;
+  BOOST_CHECK_EQUAL(histogram.getName(), "cumul-luahooks-preresolve-");
+  const auto countBefore = histogram.getCumulativeCounts().back();
+  s_followCNAMERecordsCalls = 0;
+
+  /* not handled: the rcode is left alone */
+  auto notHandled = [](pdns_resolve_ffi_handle_t* handle) {
+    pdns_resolve_ffi_handle_set_rcode(handle, RCode::ServFail);
+    return false;
+  };
+  int ret = RCode::NXDomain;
+  BOOST_CHECK_EQUAL(callResolveFFIHook(notHandled, ctx.dq, ret, histogram), false);
+  BOOST_CHECK_EQUAL(ret, RCode::NXDomain);
+  BOOST_CHECK_EQUAL(histogram.getCumulativeCounts().back(), countBefore + 1);
+
+  /* handled: the rcode and the records changes are kept, and the CNAMEs followed if requested */
+  auto handled = [](pdns_resolve_ffi_handle_t* handle) {
+    BOOST_CHECK_EQUAL(pdns_resolve_ffi_handle_get_rcode(handle), RCode::NXDomain);
+    const std::string target("target.powerdns.com.");
+    pdns_resolve_ffi_handle_clear_records(handle);
+    pdns_resolve_ffi_handle_add_record(handle, nullptr, QType::CNAME, 60, target.c_str(), target.size(), answer, false);
+    pdns_resolve_ffi_handle_set_rcode(handle, RCode::NoError);
+    pdns_resolve_ffi_handle_set_follow_cname_records(handle, true);
+    return true;
+  };
+  BOOST_CHECK_EQUAL(callResolveFFIHook(handled, ctx.dq, ret, histogram), true);
+  BOOST_CHECK_EQUAL(ret, RCode::NoError);
+  BOOST_REQUIRE_EQUAL(ctx.records.size(), 1U);
+  BOOST_CHECK_EQUAL(ctx.records.at(0).d_type, QType::CNAME);
+  BOOST_CHECK_EQUAL(s_followCNAMERecordsCalls, 1U);
+  BOOST_CHECK_EQUAL(histogram.getCumulativeCounts().back(), countBefore + 2);
+}
+
+BOOST_AUTO_TEST_CASE(test_lua_hooks_histograms)
+{
+  /* each hook has its own histogram, merged under a 'hook' label in the cumul-luahooks metric */
+  const std::vector<std::pair<std::string, const pdns::AtomicHistogram*>> histograms = {
+    {"gettag", &g_stats.luaGettag},
+    {"ipfilter", &g_stats.luaIpfilter},
+    {"nodata", &g_stats.luaNodata},
+    {"nxdomain", &g_stats.luaNxdomain},
+    {"policyeventfilter", &g_stats.luaPolicyEventFilter},
+    {"postresolve", &g_stats.luaPostresolve},
+    {"preoutquery", &g_stats.luaPreoutquery},
+    {"prerpz", &g_stats.luaPrerpz},
+    {"preresolve", &g_stats.luaPreresolve}};
+
+  for (const auto& entry : histograms) {
+    const auto& histogram = *entry.second;
+    BOOST_CHECK_EQUAL(histogram.getName(), "cumul-luahooks-" + entry.first + "-");
+    const auto buckets = histogram.getCumulativeBuckets();
+    BOOST_REQUIRE(!buckets.empty());
+    BOOST_CHECK_EQUAL(buckets.front().d_boundary, 1U);
+    BOOST_CHECK_EQUAL(buckets.back().d_boundary, std::numeric_limits<uint64_t>::max());
+  }
+
+  /* a sample lands in the first bucket that can hold it, and is accounted in the sum */
+  const auto& histogram = g_stats.luaNodata;
+  const auto buckets = histogram.getCumulativeBuckets();
+  const auto before = histogram.getCumulativeCounts();
+  const auto sumBefore = histogram.getSum();
+  histogram(3);
+  const auto after = histogram.getCumulativeCounts();
+  BOOST_REQUIRE_EQUAL(before.size(), buckets.size());
+  BOOST_REQUIRE_EQUAL(after.size(), buckets.size());
+  for (size_t idx = 0; idx < buckets.size(); idx++) {
+    BOOST_CHECK_EQUAL(after.at(idx), before.at(idx) + (buckets.at(idx).d_boundary >= 3 ? 1 : 0));
+  }
+  BOOST_CHECK_EQUAL(histogram.getSum(), sumBefore + 3);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
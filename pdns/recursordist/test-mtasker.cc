@@ -40,6 +40,40 @@ BOOST_AUTO_TEST_CASE(test_Simple)
   BOOST_CHECK_EQUAL(g_result, o);
 }
 
+static char* g_stackAddress;
+
+static void useStack(void* p)
+{
+  volatile char buffer[65536];
+  for (size_t idx = 0; idx < sizeof(buffer); idx++) {
+    buffer[idx] = 1;
+  }
+  g_stackAddress = const_cast<char*>(buffer);
+}
+
+BOOST_AUTO_TEST_CASE(test_StackCacheAndUsage)
+{
+  const size_t stackSize = 16 * 8192;
+  MTasker<> mt(stackSize, 1, true);
+  struct timeval now;
+  gettimeofday(&now, 0);
+
+  mt.makeThread(useStack, nullptr);
+  while (mt.schedule(&now))
+    ;
+  BOOST_REQUIRE(mt.noProcesses());
+  auto firstAddress = g_stackAddress;
+  BOOST_CHECK_GE(mt.getMaxStackTouched(), 65536U);
+  BOOST_CHECK_LE(mt.getMaxStackTouched(), stackSize + 1);
+
+  /* the second thread should get the stack of the first one back */
+  mt.makeThread(useStack, nullptr);
+  while (mt.schedule(&now))
+    ;
+  BOOST_REQUIRE(mt.noProcesses());
+  BOOST_CHECK(g_stackAddress == firstAddress);
+}
+
 static void willThrow(void* p)
 {
   throw std::runtime_error("Help!");
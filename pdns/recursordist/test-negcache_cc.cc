@@ -349,6 +349,38 @@ BOOST_AUTO_TEST_CASE(test_prune_valid_entries)
   BOOST_CHECK_EQUAL(got.d_auth, auth);
 }
 
+BOOST_AUTO_TEST_CASE(test_prune_referenced_entries)
+{
+  DNSName auth("powerdns.com.");
+  DNSName useful("www.powerdns.com.");
+
+  struct timeval now;
+  Utility::gettimeofday(&now, 0);
+
+  NegCache cache(1);
+
+  /* the useful entry is inserted first, then looked up */
+  cache.add(genNegCacheEntry(useful, auth, now, QType::AAAA));
+  NegCache::NegCacheEntry got;
+  BOOST_REQUIRE(cache.get(useful, QType(QType::AAAA), now, got));
+
+  /* then comes a random subdomain attack, filling the cache with entries nobody will ever ask for again */
+  for (size_t idx = 0; idx < 100; idx++) {
+    cache.add(genNegCacheEntry(DNSName("random-" + std::to_string(idx)) + auth, auth, now));
+  }
+  BOOST_CHECK_EQUAL(cache.size(), 101U);
+
+  /* the useful entry is the oldest one, but it has been used so it should survive the pruning */
+  cache.prune(50);
+  BOOST_CHECK_EQUAL(cache.size(), 50U);
+  BOOST_CHECK(cache.get(useful, QType(QType::AAAA), now, got));
+  BOOST_CHECK_EQUAL(got.d_name, useful);
+
+  /* while the oldest attack entries have been removed */
+  BOOST_CHECK(!cache.get(DNSName("random-0") + auth, QType(QType::A), now, got));
+  BOOST_CHECK(cache.get(DNSName("random-99") + auth, QType(QType::A), now, got));
+}
+
 BOOST_AUTO_TEST_CASE(test_wipe_single)
 {
   string qname(".powerdns.com");
@@ -510,4 +542,65 @@ BOOST_AUTO_TEST_CASE(test_count)
   BOOST_CHECK_EQUAL(count, 0U);
 }
 
+BOOST_AUTO_TEST_CASE(test_getDeniedAncestor)
+{
+  DNSName denied("nx.powerdns.com");
+  DNSName auth("powerdns.com");
+  DNSName qname("a.b.nx.powerdns.com");
+  auto acceptAll = [](const NegCache::NegCacheEntry&) { return true; };
+
+  struct timeval now;
+  Utility::gettimeofday(&now, 0);
+
+  NegCache cache;
+  NegCache::NegCacheEntry ne;
+  BOOST_CHECK(!cache.getDeniedAncestor(qname, now, ne, acceptAll));
+
+  /* only whole name entries deny a subtree */
+  cache.add(genNegCacheEntry(denied, auth, now, QType::A));
+  BOOST_CHECK(!cache.getDeniedAncestor(qname, now, ne, acceptAll));
+
+  cache.add(genNegCacheEntry(denied, auth, now));
+  BOOST_CHECK(cache.getDeniedAncestor(qname, now, ne, acceptAll));
+  BOOST_CHECK_EQUAL(ne.d_name, denied);
+  BOOST_CHECK_EQUAL(ne.d_auth, auth);
+
+  /* the name itself is not an ancestor of itself, and neither is a sibling */
+  BOOST_CHECK(!cache.getDeniedAncestor(denied, now, ne, acceptAll));
+  BOOST_CHECK(!cache.getDeniedAncestor(DNSName("a.nx2.powerdns.com"), now, ne, acceptAll));
+
+  /* the entry can be refused */
+  BOOST_CHECK(!cache.getDeniedAncestor(qname, now, ne, [](const NegCache::NegCacheEntry&) { return false; }));
+
+  /* expired */
+  struct timeval later = now;
+  later.tv_sec += 601;
+  BOOST_CHECK(!cache.getDeniedAncestor(qname, later, ne, acceptAll));
+
+  /* the top-most denied ancestor wins */
+  DNSName deniedBelow("b.nx.powerdns.com");
+  cache.add(genNegCacheEntry(deniedBelow, auth, now));
+  BOOST_CHECK(cache.getDeniedAncestor(qname, now, ne, acceptAll));
+  BOOST_CHECK_EQUAL(ne.d_name, denied);
+  BOOST_CHECK(cache.getDeniedAncestor(qname, now, ne, [&denied](const NegCache::NegCacheEntry& entry) { return entry.d_name != denied; }));
+  BOOST_CHECK_EQUAL(ne.d_name, deniedBelow);
+
+  /* wiping, clearing and pruning remove the denials */
+  cache.wipe(denied, false);
+  BOOST_CHECK(cache.getDeniedAncestor(qname, now, ne, acceptAll));
+  BOOST_CHECK_EQUAL(ne.d_name, deniedBelow);
+  cache.wipe(auth, true);
+  BOOST_CHECK(!cache.getDeniedAncestor(qname, now, ne, acceptAll));
+
+  cache.add(genNegCacheEntry(denied, auth, now));
+  cache.clear();
+  BOOST_CHECK(!cache.getDeniedAncestor(qname, now, ne, acceptAll));
+
+  cache.add(genNegCacheEntry(denied, auth, now));
+  BOOST_CHECK(cache.getDeniedAncestor(qname, now, ne, acceptAll));
+  cache.prune(0);
+  BOOST_CHECK_EQUAL(cache.size(), 0U);
+  BOOST_CHECK(!cache.getDeniedAncestor(qname, now, ne, acceptAll));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
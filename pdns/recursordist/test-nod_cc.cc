@@ -1,6 +1,7 @@
 #define BOOST_TEST_DYN_LINK
 #define BOOST_TEST_NO_MAIN
 #include <boost/test/unit_test.hpp>
+#include <thread>
 #include "nod.hh"
 #include "pdnsexception.hh"
 using namespace boost;
@@ -60,4 +61,36 @@ BOOST_AUTO_TEST_CASE(test_basic)
   }
 }
 
+BOOST_AUTO_TEST_CASE(test_shared_between_threads)
+{
+  NODDB noddb;
+  BOOST_CHECK_EQUAL(noddb.init(), true);
+
+  const size_t numThreads = 4;
+  const size_t numDomains = 1000;
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < numThreads; ++t) {
+    threads.emplace_back([&noddb, t]() {
+      for (size_t idx = 0; idx < numDomains; ++idx) {
+        noddb.isNewDomain(DNSName("domain" + std::to_string(idx) + ".thread" + std::to_string(t) + "."));
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  /* the domains seen by one thread are not new to the others anymore,
+     except for the few false negatives caused by the random decrements */
+  size_t stillNew = 0;
+  for (size_t t = 0; t < numThreads; ++t) {
+    for (size_t idx = 0; idx < numDomains; ++idx) {
+      if (noddb.isNewDomain(DNSName("domain" + std::to_string(idx) + ".thread" + std::to_string(t) + "."))) {
+        ++stillNew;
+      }
+    }
+  }
+  BOOST_CHECK_LT(stillNew, numThreads * numDomains / 20);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
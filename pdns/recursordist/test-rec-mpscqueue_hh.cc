@@ -0,0 +1,105 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_NO_MAIN
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <boost/test/unit_test.hpp>
+
+#include <thread>
+#include <vector>
+
+#include "rec-mpscqueue.hh"
+
+BOOST_AUTO_TEST_SUITE(rec_mpscqueue_hh)
+
+BOOST_AUTO_TEST_CASE(test_mpscqueue_basic)
+{
+  MPSCQueue<std::unique_ptr<int>> queue(3);
+  /* rounded up to the next power of two */
+  BOOST_CHECK_EQUAL(queue.capacity(), 4U);
+
+  std::unique_ptr<int> item;
+  BOOST_CHECK(!queue.pop(item));
+
+  for (int idx = 0; idx < 4; idx++) {
+    BOOST_CHECK(queue.push(std::make_unique<int>(idx)));
+  }
+  /* full */
+  BOOST_CHECK(!queue.push(std::make_unique<int>(4)));
+
+  /* FIFO order, wrapping around */
+  for (int lap = 0; lap < 3; lap++) {
+    for (int idx = 0; idx < 4; idx++) {
+      BOOST_REQUIRE(queue.pop(item));
+      BOOST_REQUIRE(item != nullptr);
+      BOOST_CHECK_EQUAL(*item, lap * 4 + idx);
+      BOOST_CHECK(queue.push(std::make_unique<int>((lap + 1) * 4 + idx)));
+    }
+  }
+
+  BOOST_CHECK_THROW(MPSCQueue<int>(0), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(test_mpscqueue_threads)
+{
+  const size_t producersCount = 4;
+  const size_t perProducer = 10000;
+  MPSCQueue<std::pair<size_t, size_t>> queue(128);
+
+  std::vector<std::thread> producers;
+  for (size_t producer = 0; producer < producersCount; producer++) {
+    producers.emplace_back([&queue, producer, perProducer]() {
+      for (size_t idx = 0; idx < perProducer; idx++) {
+        while (!queue.push({producer, idx})) {
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+
+  /* every item has to be received exactly once, in the order it was pushed by its producer */
+  std::vector<size_t> next(producersCount, 0);
+  size_t received = 0;
+  std::pair<size_t, size_t> item;
+  while (received < producersCount * perProducer) {
+    if (!queue.pop(item)) {
+      std::this_thread::yield();
+      continue;
+    }
+    BOOST_REQUIRE_LT(item.first, producersCount);
+    BOOST_REQUIRE_EQUAL(item.second, next.at(item.first));
+    next.at(item.first)++;
+    received++;
+  }
+
+  for (auto& producer : producers) {
+    producer.join();
+  }
+
+  BOOST_CHECK(!queue.pop(item));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,146 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_NO_MAIN
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <boost/test/unit_test.hpp>
+
+#include "dnsrecords.hh"
+#include "dnswriter.hh"
+#include "rec-protozero.hh"
+
+BOOST_AUTO_TEST_SUITE(rec_protozero_cc)
+
+static std::vector<DNSRecord> getRecords()
+{
+  const DNSName name("powerdns.com.");
+  std::vector<DNSRecord> records;
+
+  DNSRecord rec;
+  rec.d_name = name;
+  rec.d_class = QClass::IN;
+  rec.d_ttl = 3600;
+  rec.d_place = DNSResourceRecord::ANSWER;
+
+  rec.d_type = QType::A;
+  rec.d_content = std::make_shared<ARecordContent>(ComboAddress("192.0.2.1"));
+  records.push_back(rec);
+
+  rec.d_type = QType::AAAA;
+  rec.d_content = std::make_shared<AAAARecordContent>(ComboAddress("2001:db8::1"));
+  records.push_back(rec);
+
+  rec.d_type = QType::CNAME;
+  rec.d_content = std::make_shared<CNAMERecordContent>(DNSName("www.powerdns.com."));
+  records.push_back(rec);
+
+  rec.d_type = QType::MX;
+  rec.d_content = std::make_shared<MXRecordContent>(10, DNSName("mx.powerdns.com."));
+  records.push_back(rec);
+
+  rec.d_type = QType::TXT;
+  rec.d_content = std::make_shared<TXTRecordContent>("\"v=spf1 -all\"");
+  records.push_back(rec);
+
+  return records;
+}
+
+BOOST_AUTO_TEST_CASE(test_addRR_from_wire)
+{
+  /* the wire rdata is only copied for A and AAAA, the other types are still exported from the content */
+  const std::set<uint16_t> exportTypes{QType::A, QType::AAAA, QType::CNAME, QType::MX, QType::TXT};
+  const auto records = getRecords();
+
+  pdns::ProtoZero::RecMessage fromContent;
+  pdns::ProtoZero::RecMessage fromWire;
+
+  vector<uint8_t> packet;
+  DNSPacketWriter pw(packet, DNSName("powerdns.com."), QType::ANY);
+  for (const auto& record : records) {
+    fromContent.addRR(record, exportTypes, false);
+
+    pw.startRecord(record.d_name, record.d_type, record.d_ttl, record.d_class, record.d_place);
+    record.d_content->toPacket(pw);
+    const size_t rdataLen = pw.getRecordPayloadSize();
+    fromWire.addRR(record, exportTypes, false, packet.data() + packet.size() - rdataLen, rdataLen);
+  }
+  pw.commit();
+
+  BOOST_CHECK(!fromContent.getResponseBuf().empty());
+  BOOST_CHECK(fromContent.getResponseBuf() == fromWire.getResponseBuf());
+}
+
+BOOST_AUTO_TEST_CASE(test_reset)
+{
+  const std::set<uint16_t> exportTypes{QType::A, QType::AAAA, QType::CNAME, QType::MX};
+  const auto records = getRecords();
+
+  pdns::ProtoZero::RecMessage fresh;
+  fresh.setType(pdns::ProtoZero::Message::MessageType::DNSResponseType);
+  fresh.setResponse(DNSName("powerdns.com."), QType::A, QClass::IN);
+  fresh.addRR(records.at(0), exportTypes, false);
+  fresh.setResponseCode(RCode::NoError);
+  const std::string message = fresh.getMessageBuf();
+  const std::string response = fresh.getResponseBuf();
+  const std::string expected = fresh.finishAndGetBuf();
+
+  /* a reused message starting from the same content gives the same result */
+  pdns::ProtoZero::RecMessage reused;
+  for (const auto& record : records) {
+    reused.addRR(record, exportTypes, false);
+  }
+  reused.finishAndGetBuf();
+
+  reused.reset(message, response);
+  reused.reserve(64, 10);
+  BOOST_CHECK(reused.finishAndGetBuf() == expected);
+
+  /* and a reset without content gives an empty message */
+  reused.reset();
+  BOOST_CHECK(reused.finishAndGetBuf().empty());
+}
+
+BOOST_AUTO_TEST_CASE(test_addRR_external_buffer)
+{
+  /* the response part of a message built on an external buffer goes to that buffer, names included */
+  const std::set<uint16_t> exportTypes{QType::CNAME};
+  const auto records = getRecords();
+
+  std::string buffer;
+  pdns::ProtoZero::RecMessage message{buffer};
+  message.setType(pdns::ProtoZero::Message::MessageType::DNSIncomingResponseType);
+  message.startResponse();
+  for (const auto& record : records) {
+    message.addRR(record, exportTypes, false);
+  }
+  message.commitResponse();
+
+  BOOST_CHECK(message.getResponseBuf().empty());
+  BOOST_CHECK(buffer.find("powerdns.com.") != std::string::npos);
+  BOOST_CHECK(buffer.find("www.powerdns.com.") != std::string::npos);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,118 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_NO_MAIN
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <boost/test/unit_test.hpp>
+
+#include "qtype.hh"
+#include "rec-shared-outgoing.hh"
+
+BOOST_AUTO_TEST_SUITE(rec_shared_outgoing_hh)
+
+static SharedOutgoingQueries::Key makeKey(uint16_t qtype = QType::A)
+{
+  return SharedOutgoingQueries::Key{ComboAddress("192.0.2.1:53"), DNSName("powerdns.com."), Netmask(), qtype, false, true, true};
+}
+
+BOOST_AUTO_TEST_CASE(test_shared_outgoing_owner_waiters)
+{
+  SharedOutgoingQueries queries(4);
+  const auto key = makeKey();
+
+  /* nothing in flight yet */
+  BOOST_CHECK(!queries.addWaiter(key, 1, 42));
+  BOOST_CHECK(queries.addOwner(key, 1));
+  /* already owned */
+  BOOST_CHECK(!queries.addOwner(key, 2));
+  BOOST_CHECK_EQUAL(queries.size(), 1U);
+
+  /* the owner does not wait on itself, it chains in its own MTasker instead */
+  BOOST_CHECK(!queries.addWaiter(key, 1, 43));
+  BOOST_CHECK(queries.addWaiter(key, 2, 44));
+  BOOST_CHECK(queries.addWaiter(key, 3, 45));
+  BOOST_CHECK(queries.addWaiter(key, 2, 46));
+
+  /* only the owner can release it */
+  BOOST_CHECK(queries.release(key, 2).empty());
+  BOOST_CHECK_EQUAL(queries.size(), 1U);
+
+  auto waiters = queries.release(key, 1);
+  BOOST_REQUIRE_EQUAL(waiters.size(), 3U);
+  BOOST_CHECK_EQUAL(waiters.at(0).threadId, 2U);
+  BOOST_CHECK_EQUAL(waiters.at(0).id, 44U);
+  BOOST_CHECK_EQUAL(waiters.at(1).threadId, 3U);
+  BOOST_CHECK_EQUAL(waiters.at(1).id, 45U);
+  BOOST_CHECK_EQUAL(waiters.at(2).threadId, 2U);
+  BOOST_CHECK_EQUAL(waiters.at(2).id, 46U);
+  BOOST_CHECK_EQUAL(queries.size(), 0U);
+
+  /* released, so nothing to wait for and a new owner can take over */
+  BOOST_CHECK(queries.release(key, 1).empty());
+  BOOST_CHECK(!queries.addWaiter(key, 2, 47));
+  BOOST_CHECK(queries.addOwner(key, 2));
+  BOOST_CHECK(queries.release(key, 2).empty());
+}
+
+BOOST_AUTO_TEST_CASE(test_shared_outgoing_key)
+{
+  SharedOutgoingQueries queries(4);
+  const auto key = makeKey();
+  BOOST_CHECK(queries.addOwner(key, 1));
+
+  std::vector<SharedOutgoingQueries::Key> others;
+  others.push_back(makeKey(QType::AAAA));
+  others.push_back(makeKey());
+  others.back().remote = ComboAddress("192.0.2.2:53");
+  others.push_back(makeKey());
+  others.back().qname = DNSName("www.powerdns.com.");
+  others.push_back(makeKey());
+  others.back().ecs = Netmask("192.0.2.0/24");
+  others.push_back(makeKey());
+  others.back().rd = true;
+  others.push_back(makeKey());
+  others.back().edns = false;
+  others.push_back(makeKey());
+  others.back().dnssecOK = false;
+
+  for (const auto& other : others) {
+    BOOST_CHECK(!(other == key));
+    /* a different query, so no chaining onto the one in flight */
+    BOOST_CHECK(!queries.addWaiter(other, 2, 42));
+  }
+
+  /* the qname is compared case-insensitively, like in the MTasker chain */
+  auto same = makeKey();
+  same.qname = DNSName("PowerDNS.COM.");
+  BOOST_CHECK(same == key);
+  BOOST_CHECK(queries.addWaiter(same, 2, 42));
+
+  auto waiters = queries.release(key, 1);
+  BOOST_REQUIRE_EQUAL(waiters.size(), 1U);
+  BOOST_CHECK_EQUAL(waiters.at(0).threadId, 2U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,191 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_NO_MAIN
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <boost/test/unit_test.hpp>
+
+#include <fcntl.h>
+
+#include "rec-udpclientsocks.hh"
+
+BOOST_AUTO_TEST_SUITE(rec_udpclientsocks_hh)
+
+static int makeSocket(int family)
+{
+  int fd = socket(family, SOCK_DGRAM, 0);
+  BOOST_REQUIRE(fd >= 0);
+  return fd;
+}
+
+static bool isOpen(int fd)
+{
+  return fcntl(fd, F_GETFD) != -1;
+}
+
+BOOST_AUTO_TEST_CASE(test_reuse)
+{
+  UDPClientSocketsPool pool(10, 16);
+  time_t now = time(nullptr);
+
+  BOOST_CHECK_EQUAL(pool.get(AF_INET, now), -1);
+
+  int fd = makeSocket(AF_INET);
+  pool.add(fd, AF_INET);
+  BOOST_CHECK(pool.release(fd, true, now));
+  BOOST_CHECK_EQUAL(pool.size(), 1U);
+  BOOST_CHECK(isOpen(fd));
+
+  /* not during the cooldown */
+  BOOST_CHECK_EQUAL(pool.get(AF_INET, now), -1);
+  BOOST_CHECK_EQUAL(pool.get(AF_INET, now + UDPClientSocketsPool::s_cooldown - 1), -1);
+  /* not for another family */
+  BOOST_CHECK_EQUAL(pool.get(AF_INET6, now + UDPClientSocketsPool::s_cooldown), -1);
+
+  BOOST_CHECK_EQUAL(pool.get(AF_INET, now + UDPClientSocketsPool::s_cooldown), fd);
+  BOOST_CHECK_EQUAL(pool.size(), 0U);
+  BOOST_CHECK_EQUAL(pool.get(AF_INET, now + UDPClientSocketsPool::s_cooldown), -1);
+  BOOST_CHECK(pool.release(fd, true, now));
+}
+
+BOOST_AUTO_TEST_CASE(test_families_and_order)
+{
+  UDPClientSocketsPool pool(10, 16);
+  time_t now = time(nullptr);
+
+  int fd4 = makeSocket(AF_INET);
+  pool.add(fd4, AF_INET);
+  int fd6 = makeSocket(AF_INET6);
+  pool.add(fd6, AF_INET6);
+  int fd4bis = makeSocket(AF_INET);
+  pool.add(fd4bis, AF_INET);
+
+  BOOST_CHECK(pool.release(fd4, true, now));
+  BOOST_CHECK(pool.release(fd6, true, now));
+  BOOST_CHECK(pool.release(fd4bis, true, now + 1));
+  BOOST_CHECK_EQUAL(pool.size(), 3U);
+
+  /* the oldest socket of the requested family first, fd4bis is still cooling down */
+  BOOST_CHECK_EQUAL(pool.get(AF_INET6, now + UDPClientSocketsPool::s_cooldown), fd6);
+  BOOST_CHECK_EQUAL(pool.get(AF_INET, now + UDPClientSocketsPool::s_cooldown), fd4);
+  BOOST_CHECK_EQUAL(pool.get(AF_INET, now + UDPClientSocketsPool::s_cooldown), -1);
+  BOOST_CHECK_EQUAL(pool.get(AF_INET, now + 1 + UDPClientSocketsPool::s_cooldown), fd4bis);
+
+  BOOST_CHECK(pool.release(fd4, true, now));
+  BOOST_CHECK(pool.release(fd6, true, now));
+  BOOST_CHECK(pool.release(fd4bis, true, now));
+}
+
+BOOST_AUTO_TEST_CASE(test_max_uses)
+{
+  const uint32_t maxUses = 3;
+  UDPClientSocketsPool pool(10, maxUses);
+  time_t now = time(nullptr);
+
+  int fd = makeSocket(AF_INET);
+  pool.add(fd, AF_INET);
+  /* used once */
+  BOOST_CHECK(pool.release(fd, true, now));
+
+  for (uint32_t uses = 2; uses < maxUses; uses++) {
+    now += UDPClientSocketsPool::s_cooldown;
+    BOOST_CHECK_EQUAL(pool.get(AF_INET, now), fd);
+    BOOST_CHECK(pool.release(fd, true, now));
+  }
+
+  /* last use, the socket is retired and closed */
+  now += UDPClientSocketsPool::s_cooldown;
+  BOOST_CHECK_EQUAL(pool.get(AF_INET, now), fd);
+  BOOST_CHECK(!pool.release(fd, true, now));
+  BOOST_CHECK_EQUAL(pool.size(), 0U);
+  BOOST_CHECK(!isOpen(fd));
+  BOOST_CHECK_EQUAL(pool.get(AF_INET, now + UDPClientSocketsPool::s_cooldown), -1);
+}
+
+BOOST_AUTO_TEST_CASE(test_errored_sockets_are_closed)
+{
+  UDPClientSocketsPool pool(10, 16);
+  time_t now = time(nullptr);
+
+  int fd = makeSocket(AF_INET);
+  pool.add(fd, AF_INET);
+  BOOST_CHECK(!pool.release(fd, false, now));
+  BOOST_CHECK_EQUAL(pool.size(), 0U);
+  BOOST_CHECK(!isOpen(fd));
+
+  /* a reused socket as well */
+  fd = makeSocket(AF_INET);
+  pool.add(fd, AF_INET);
+  BOOST_CHECK(pool.release(fd, true, now));
+  BOOST_CHECK_EQUAL(pool.get(AF_INET, now + UDPClientSocketsPool::s_cooldown), fd);
+  BOOST_CHECK(!pool.release(fd, false, now));
+  BOOST_CHECK(!isOpen(fd));
+}
+
+BOOST_AUTO_TEST_CASE(test_full_or_disabled)
+{
+  {
+    UDPClientSocketsPool pool(1, 16);
+    time_t now = time(nullptr);
+
+    int fd1 = makeSocket(AF_INET);
+    pool.add(fd1, AF_INET);
+    int fd2 = makeSocket(AF_INET);
+    pool.add(fd2, AF_INET);
+    BOOST_CHECK(pool.release(fd1, true, now));
+    /* the pool is full */
+    BOOST_CHECK(!pool.release(fd2, true, now));
+    BOOST_CHECK(!isOpen(fd2));
+    BOOST_CHECK_EQUAL(pool.size(), 1U);
+  }
+
+  {
+    /* a disabled pool never keeps anything */
+    UDPClientSocketsPool pool(0, 16);
+    time_t now = time(nullptr);
+    BOOST_CHECK(!pool.enabled());
+
+    int fd = makeSocket(AF_INET);
+    pool.add(fd, AF_INET);
+    BOOST_CHECK(!pool.release(fd, true, now));
+    BOOST_CHECK(!isOpen(fd));
+    BOOST_CHECK_EQUAL(pool.get(AF_INET, now + UDPClientSocketsPool::s_cooldown), -1);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_destructor_closes_pooled_sockets)
+{
+  int fd = makeSocket(AF_INET);
+  {
+    UDPClientSocketsPool pool(10, 16);
+    pool.add(fd, AF_INET);
+    BOOST_CHECK(pool.release(fd, true, time(nullptr)));
+    BOOST_CHECK(isOpen(fd));
+  }
+  BOOST_CHECK(!isOpen(fd));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
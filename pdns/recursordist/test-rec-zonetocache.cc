@@ -89,4 +89,34 @@ BOOST_AUTO_TEST_CASE(test_zonetocache)
   BOOST_CHECK_GT(g_recCache->get(now, DNSName("aaa."), QType::NS, false, &retrieved, who), 0);
 }
 
+BOOST_AUTO_TEST_CASE(test_zonetocache_include)
+{
+  char included[] = "/tmp/ztcXXXXXXXXXX";
+  int fd = mkstemp(included);
+  BOOST_REQUIRE(fd > 0);
+  FILE* fp = fdopen(fd, "w");
+  BOOST_REQUIRE(fp != nullptr);
+  size_t written = fwrite(zone.data(), 1, zone.length(), fp);
+  BOOST_REQUIRE(written == zone.length());
+  BOOST_REQUIRE(fclose(fp) == 0);
+
+  char temp[] = "/tmp/ztcXXXXXXXXXX";
+  fd = mkstemp(temp);
+  BOOST_REQUIRE(fd > 0);
+  fp = fdopen(fd, "w");
+  BOOST_REQUIRE(fp != nullptr);
+  BOOST_REQUIRE(fprintf(fp, "$INCLUDE %s\n", included) > 0);
+  BOOST_REQUIRE(fclose(fp) == 0);
+
+  RecZoneToCache::Config config{".", "file", {temp}, ComboAddress(), TSIGTriplet()};
+  config.d_refreshPeriod = 0;
+
+  // $INCLUDE is refused, so nothing gets loaded
+  g_recCache = std::unique_ptr<MemRecursorCache>(new MemRecursorCache());
+  RecZoneToCache::ZoneToCache(config, 0);
+  unlink(temp);
+  unlink(included);
+  BOOST_CHECK_EQUAL(g_recCache->size(), 0U);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
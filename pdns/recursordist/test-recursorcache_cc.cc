@@ -1177,4 +1177,348 @@ BOOST_AUTO_TEST_CASE(test_RecursorCacheTagged)
   }
 }
 
+BOOST_AUTO_TEST_CASE(test_RecursorCache_ServeStale)
+{
+  MemRecursorCache MRC;
+  const auto oldMaxServedStaleExtensions = MemRecursorCache::s_maxServedStaleExtensions;
+  MemRecursorCache::s_maxServedStaleExtensions = 2;
+
+  std::vector<DNSRecord> records;
+  std::vector<std::shared_ptr<DNSRecord>> authRecords;
+  std::vector<std::shared_ptr<RRSIGRecordContent>> signatures;
+  const DNSName authZone(".");
+  std::vector<DNSRecord> retrieved;
+  ComboAddress who("192.0.2.1");
+
+  time_t now = time(nullptr);
+  DNSName power("powerdns.com.");
+  DNSRecord dr1;
+  ComboAddress dr1Content("192.0.2.42");
+  dr1.d_name = power;
+  dr1.d_type = QType::A;
+  dr1.d_class = QClass::IN;
+  dr1.d_content = std::make_shared<ARecordContent>(dr1Content);
+  dr1.d_ttl = static_cast<uint32_t>(now + 60);
+  dr1.d_place = DNSResourceRecord::ANSWER;
+  records.push_back(dr1);
+
+  MRC.replace(now, power, QType(QType::A), records, signatures, authRecords, true, authZone, boost::none);
+  BOOST_CHECK_EQUAL(MRC.size(), 1U);
+
+  /* expired, so not returned unless we are willing to serve stale data */
+  now += 61;
+  BOOST_CHECK_LT(MRC.get(now, power, QType(QType::A), false, &retrieved, who), 0);
+  BOOST_CHECK_EQUAL(retrieved.size(), 0U);
+
+  /* served stale, the entry is extended by 30s */
+  BOOST_CHECK_EQUAL(MRC.get(now, power, QType(QType::A), false, &retrieved, who, MemRecursorCache::ServeStale), 30);
+  BOOST_REQUIRE_EQUAL(retrieved.size(), 1U);
+  BOOST_CHECK_EQUAL(getRR<ARecordContent>(retrieved.at(0))->getCA().toString(), dr1Content.toString());
+
+  /* and valid again for the duration of the extension */
+  BOOST_CHECK_EQUAL(MRC.get(now + 10, power, QType(QType::A), false, &retrieved, who), 20);
+
+  /* second and last extension */
+  now += 31;
+  BOOST_CHECK_LT(MRC.get(now, power, QType(QType::A), false, &retrieved, who), 0);
+  BOOST_CHECK_EQUAL(MRC.get(now, power, QType(QType::A), false, &retrieved, who, MemRecursorCache::ServeStale), 30);
+  BOOST_REQUIRE_EQUAL(retrieved.size(), 1U);
+
+  /* no more extensions left */
+  now += 31;
+  BOOST_CHECK_LT(MRC.get(now, power, QType(QType::A), false, &retrieved, who, MemRecursorCache::ServeStale), 0);
+  BOOST_CHECK_EQUAL(retrieved.size(), 0U);
+
+  /* a fresh answer resets the number of extensions */
+  records.at(0).d_ttl = static_cast<uint32_t>(now + 60);
+  MRC.replace(now, power, QType(QType::A), records, signatures, authRecords, true, authZone, boost::none);
+  BOOST_CHECK_EQUAL(MRC.get(now, power, QType(QType::A), false, &retrieved, who), 60);
+  now += 61;
+  BOOST_CHECK_EQUAL(MRC.get(now, power, QType(QType::A), false, &retrieved, who, MemRecursorCache::ServeStale), 30);
+  BOOST_REQUIRE_EQUAL(retrieved.size(), 1U);
+
+  /* an entry that has not been requested for longer than the stale window is not served */
+  now += 100;
+  BOOST_CHECK_LT(MRC.get(now, power, QType(QType::A), false, &retrieved, who, MemRecursorCache::ServeStale), 0);
+
+  MemRecursorCache::s_maxServedStaleExtensions = oldMaxServedStaleExtensions;
+}
+
+BOOST_AUTO_TEST_CASE(test_RecursorCache_SecondChance)
+{
+  /* a single shard, so that the eviction order is fully predictable */
+  MemRecursorCache MRC(1);
+
+  std::vector<DNSRecord> records;
+  std::vector<std::shared_ptr<DNSRecord>> authRecords;
+  std::vector<std::shared_ptr<RRSIGRecordContent>> signatures;
+  const DNSName authZone(".");
+  std::vector<DNSRecord> retrieved;
+  ComboAddress who("192.0.2.1");
+  time_t now = time(nullptr);
+
+  DNSRecord dr;
+  dr.d_type = QType::A;
+  dr.d_class = QClass::IN;
+  dr.d_content = std::make_shared<ARecordContent>(ComboAddress("192.0.2.42"));
+  dr.d_ttl = static_cast<uint32_t>(now + 3600);
+  dr.d_place = DNSResourceRecord::ANSWER;
+
+  for (size_t counter = 0; counter < 10; ++counter) {
+    dr.d_name = DNSName("host" + std::to_string(counter) + ".powerdns.com.");
+    records = {dr};
+    MRC.replace(now, dr.d_name, QType(QType::A), records, signatures, authRecords, true, authZone, boost::none);
+  }
+  /* same name, other type: exact lookups must not mix them up */
+  dr.d_name = DNSName("host0.powerdns.com.");
+  dr.d_type = QType::AAAA;
+  dr.d_content = std::make_shared<AAAARecordContent>(ComboAddress("2001:db8::42"));
+  records = {dr};
+  MRC.replace(now, dr.d_name, QType(QType::AAAA), records, signatures, authRecords, true, authZone, boost::none);
+  BOOST_CHECK_EQUAL(MRC.size(), 11U);
+
+  /* the hashed index is case-insensitive */
+  BOOST_CHECK_EQUAL(MRC.get(now, DNSName("HOST0.PowerDNS.com."), QType(QType::A), false, &retrieved, who), 3600);
+  BOOST_REQUIRE_EQUAL(retrieved.size(), 1U);
+  BOOST_CHECK_EQUAL(retrieved.at(0).d_type, QType::A);
+  BOOST_CHECK_EQUAL(getRR<ARecordContent>(retrieved.at(0))->getCA().toString(), "192.0.2.42");
+  BOOST_CHECK_EQUAL(MRC.get(now, DNSName("host0.powerdns.com."), QType(QType::AAAA), false, &retrieved, who), 3600);
+  BOOST_REQUIRE_EQUAL(retrieved.size(), 1U);
+  BOOST_CHECK_EQUAL(retrieved.at(0).d_type, QType::AAAA);
+  BOOST_CHECK_LT(MRC.get(now, DNSName("host0.powerdns.com."), QType(QType::MX), false, &retrieved, who), 0);
+
+  /* host0 (A, the oldest entry) and host3 have been hit, so they get a second chance:
+     the coldest entries, host1, host2, host4, host5 and host6 in insertion order, go first */
+  BOOST_CHECK_EQUAL(MRC.get(now, DNSName("host3.powerdns.com."), QType(QType::A), false, &retrieved, who), 3600);
+  MRC.doPrune(6);
+  BOOST_CHECK_EQUAL(MRC.size(), 6U);
+
+  BOOST_CHECK_GT(MRC.get(now, DNSName("host0.powerdns.com."), QType(QType::A), false, &retrieved, who), 0);
+  BOOST_CHECK_GT(MRC.get(now, DNSName("host3.powerdns.com."), QType(QType::A), false, &retrieved, who), 0);
+  for (const auto counter : {1, 2, 4, 5, 6}) {
+    BOOST_CHECK_LT(MRC.get(now, DNSName("host" + std::to_string(counter) + ".powerdns.com."), QType(QType::A), false, &retrieved, who), 0);
+  }
+  for (const auto counter : {7, 8, 9}) {
+    BOOST_CHECK_GT(MRC.get(now, DNSName("host" + std::to_string(counter) + ".powerdns.com."), QType(QType::A), false, &retrieved, who), 0);
+  }
+  BOOST_CHECK_GT(MRC.get(now, DNSName("host0.powerdns.com."), QType(QType::AAAA), false, &retrieved, who), 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_RecursorCache_ReplaceBulk)
+{
+  MemRecursorCache MRC(16);
+
+  const DNSName authZone("powerdns.com.");
+  std::vector<DNSRecord> retrieved;
+  std::vector<std::shared_ptr<RRSIGRecordContent>> retrievedSigs;
+  ComboAddress who("192.0.2.1");
+  time_t now = time(nullptr);
+
+  std::vector<MemRecursorCache::BulkRRSet> rrsets;
+  for (size_t counter = 0; counter < 1000; ++counter) {
+    MemRecursorCache::BulkRRSet rrset;
+    rrset.d_qname = DNSName("host" + std::to_string(counter)) + authZone;
+    rrset.d_qtype = QType::A;
+    rrset.d_auth = true;
+
+    DNSRecord dr;
+    dr.d_name = rrset.d_qname;
+    dr.d_type = QType::A;
+    dr.d_class = QClass::IN;
+    dr.d_content = std::make_shared<ARecordContent>(ComboAddress("192.0.2." + std::to_string(counter % 256)));
+    dr.d_ttl = static_cast<uint32_t>(now + 3600);
+    dr.d_place = DNSResourceRecord::ANSWER;
+    rrset.d_records.push_back(dr);
+
+    if (counter % 2 == 0) {
+      auto sig = std::make_shared<RRSIGRecordContent>();
+      sig->d_type = QType::A;
+      rrset.d_signatures.push_back(sig);
+    }
+    rrsets.push_back(std::move(rrset));
+  }
+
+  BOOST_CHECK_EQUAL(MRC.replaceBulk(now, rrsets, authZone), 1000U);
+  BOOST_CHECK_EQUAL(MRC.size(), 1000U);
+
+  for (size_t counter = 0; counter < 1000; ++counter) {
+    const DNSName name = DNSName("host" + std::to_string(counter)) + authZone;
+    bool wasAuth = false;
+    DNSName fromAuthZone;
+    BOOST_CHECK_EQUAL(MRC.get(now, name, QType(QType::A), true, &retrieved, who, MemRecursorCache::None, boost::none, &retrievedSigs, nullptr, nullptr, nullptr, &wasAuth, &fromAuthZone), 3600);
+    BOOST_REQUIRE_EQUAL(retrieved.size(), 1U);
+    BOOST_CHECK_EQUAL(getRR<ARecordContent>(retrieved.at(0))->getCA().toString(), "192.0.2." + std::to_string(counter % 256));
+    BOOST_CHECK_EQUAL(retrievedSigs.size(), counter % 2 == 0 ? 1U : 0U);
+    BOOST_CHECK(wasAuth);
+    BOOST_CHECK_EQUAL(fromAuthZone, authZone);
+  }
+
+  /* a second load replaces the existing entries */
+  BOOST_CHECK_EQUAL(MRC.replaceBulk(now, rrsets, authZone), 1000U);
+  BOOST_CHECK_EQUAL(MRC.size(), 1000U);
+}
+
+BOOST_AUTO_TEST_CASE(test_RecursorCache_PackedRecords)
+{
+  const auto oldPackedRecords = MemRecursorCache::s_packedRecords;
+  MemRecursorCache MRC;
+
+  const DNSName authZone("powerdns.com.");
+  const DNSName power("powerdns.com.");
+  std::vector<std::shared_ptr<DNSRecord>> authRecords;
+  std::vector<std::shared_ptr<RRSIGRecordContent>> signatures;
+  std::vector<DNSRecord> retrieved;
+  ComboAddress who("192.0.2.1");
+  time_t now = time(nullptr);
+
+  auto makeRecords = [power, now](QType qtype, const std::vector<std::string>& contents) {
+    std::vector<DNSRecord> records;
+    for (const auto& content : contents) {
+      DNSRecord dr;
+      dr.d_name = power;
+      dr.d_type = qtype;
+      dr.d_class = QClass::IN;
+      dr.d_content = DNSRecordContent::mastermake(qtype, QClass::IN, content);
+      dr.d_ttl = static_cast<uint32_t>(now + 3600);
+      dr.d_place = DNSResourceRecord::ANSWER;
+      records.push_back(std::move(dr));
+    }
+    return records;
+  };
+
+  auto checkRecords = [&MRC, &retrieved, &who, power, now](QType qtype, const std::vector<std::string>& contents) {
+    BOOST_CHECK_EQUAL(MRC.get(now, power, qtype, false, &retrieved, who), 3600);
+    BOOST_REQUIRE_EQUAL(retrieved.size(), contents.size());
+    for (size_t idx = 0; idx < contents.size(); idx++) {
+      BOOST_CHECK_EQUAL(retrieved.at(idx).d_name, power);
+      BOOST_CHECK_EQUAL(retrieved.at(idx).d_type, qtype.getCode());
+      BOOST_CHECK_EQUAL(retrieved.at(idx).d_content->getZoneRepresentation(), DNSRecordContent::mastermake(qtype, QClass::IN, contents.at(idx))->getZoneRepresentation());
+    }
+  };
+
+  /* the names in the rdata of the MX records are below the owner name, and would be compressed against it */
+  const std::vector<std::pair<QType, std::vector<std::string>>> rrsets = {
+    {QType::A, {"192.0.2.1", "192.0.2.2"}},
+    {QType::AAAA, {"2001:db8::1"}},
+    {QType::MX, {"10 mx1.powerdns.com.", "20 mx2.example.net."}},
+    {QType::TXT, {"\"hello\" \"world\"", "\"\""}}};
+
+  MemRecursorCache::s_packedRecords = true;
+  for (const auto& rrset : rrsets) {
+    MRC.replace(now, power, rrset.first, makeRecords(rrset.first, rrset.second), signatures, authRecords, true, authZone, boost::none);
+  }
+  BOOST_CHECK_EQUAL(MRC.size(), rrsets.size());
+  for (const auto& rrset : rrsets) {
+    checkRecords(rrset.first, rrset.second);
+  }
+
+  /* switching the mode off, existing packed entries are still served, and updated ones are no longer packed */
+  MemRecursorCache::s_packedRecords = false;
+  checkRecords(QType::A, {"192.0.2.1", "192.0.2.2"});
+  MRC.replace(now, power, QType::A, makeRecords(QType::A, {"192.0.2.3"}), signatures, authRecords, true, authZone, boost::none);
+  checkRecords(QType::A, {"192.0.2.3"});
+  checkRecords(QType::MX, {"10 mx1.powerdns.com.", "20 mx2.example.net."});
+
+  /* and back on */
+  MemRecursorCache::s_packedRecords = true;
+  MRC.replace(now, power, QType::A, makeRecords(QType::A, {"192.0.2.4", "192.0.2.5", "192.0.2.6"}), signatures, authRecords, true, authZone, boost::none);
+  checkRecords(QType::A, {"192.0.2.4", "192.0.2.5", "192.0.2.6"});
+  BOOST_CHECK_EQUAL(MRC.size(), rrsets.size());
+
+  MemRecursorCache::s_packedRecords = oldPackedRecords;
+}
+
+BOOST_AUTO_TEST_CASE(test_RecursorCache_Dump)
+{
+  const auto oldPackedRecords = MemRecursorCache::s_packedRecords;
+  MemRecursorCache MRC(1);
+
+  const DNSName authZone("powerdns.com.");
+  std::vector<std::shared_ptr<DNSRecord>> authRecords;
+  std::vector<std::shared_ptr<RRSIGRecordContent>> noSignatures;
+  time_t now = time(nullptr);
+
+  auto makeRecords = [now](const DNSName& name, QType qtype, const std::vector<std::string>& contents) {
+    std::vector<DNSRecord> records;
+    for (const auto& content : contents) {
+      DNSRecord dr;
+      dr.d_name = name;
+      dr.d_type = qtype;
+      dr.d_class = QClass::IN;
+      dr.d_content = DNSRecordContent::mastermake(qtype, QClass::IN, content);
+      dr.d_ttl = static_cast<uint32_t>(now + 3600);
+      dr.d_place = DNSResourceRecord::ANSWER;
+      records.push_back(std::move(dr));
+    }
+    return records;
+  };
+
+  /* name, type and content of the expected lines, in the order of the entries in the shard */
+  std::vector<std::tuple<std::string, std::string, std::string>> expected;
+
+  MRC.replace(now, DNSName("www.powerdns.com."), QType::A, makeRecords(DNSName("www.powerdns.com."), QType::A, {"192.0.2.1", "192.0.2.2"}), noSignatures, authRecords, true, authZone, boost::none);
+  expected.emplace_back("www.powerdns.com.", "A", "192.0.2.1");
+  expected.emplace_back("www.powerdns.com.", "A", "192.0.2.2");
+
+  auto signature = std::make_shared<RRSIGRecordContent>("AAAA 5 3 3600 20370101000000 20370101000000 24567 powerdns.com. data");
+  MRC.replace(now, DNSName("www.powerdns.com."), QType::AAAA, makeRecords(DNSName("www.powerdns.com."), QType::AAAA, {"2001:db8::1"}), {signature}, authRecords, true, authZone, boost::none);
+  expected.emplace_back("www.powerdns.com.", "AAAA", "2001:db8::1");
+  expected.emplace_back("www.powerdns.com.", "RRSIG", signature->getZoneRepresentation());
+
+  /* packed entries are dumped as well */
+  MemRecursorCache::s_packedRecords = true;
+  MRC.replace(now, authZone, QType::MX, makeRecords(authZone, QType::MX, {"10 mx.powerdns.com."}), noSignatures, authRecords, true, authZone, boost::none);
+  expected.emplace_back("powerdns.com.", "MX", "10 mx.powerdns.com.");
+  MemRecursorCache::s_packedRecords = oldPackedRecords;
+
+  auto fp = std::unique_ptr<FILE, int (*)(FILE*)>(tmpfile(), fclose);
+  if (!fp) {
+    BOOST_FAIL("Temporary file could not be opened");
+  }
+
+  BOOST_CHECK_EQUAL(MRC.doDump(fileno(fp.get())), expected.size());
+
+  rewind(fp.get());
+  char* line = nullptr;
+  size_t len = 0;
+  ssize_t read;
+
+  /* skip the header */
+  for (size_t idx = 0; idx < 2; idx++) {
+    read = getline(&line, &len, fp.get());
+    BOOST_REQUIRE(read != -1);
+    BOOST_CHECK_EQUAL(line[0], ';');
+  }
+
+  for (const auto& entry : expected) {
+    read = getline(&line, &len, fp.get());
+    if (read == -1) {
+      BOOST_FAIL("Unable to read a line from the temp file");
+    }
+    /* name, original TTL, remaining TTL (the clock might have ticked), class, type then the content up to the comment */
+    std::string str(line);
+    auto comment = str.find(" ; ");
+    BOOST_REQUIRE(comment != std::string::npos);
+    std::vector<std::string> parts;
+    stringtok(parts, str.substr(0, comment), " ");
+    BOOST_REQUIRE_GE(parts.size(), 6U);
+    BOOST_CHECK_EQUAL(parts.at(0), std::get<0>(entry));
+    BOOST_CHECK_EQUAL(parts.at(1), "3600");
+    BOOST_CHECK_LE(std::stoi(parts.at(2)), 3600);
+    BOOST_CHECK_GE(std::stoi(parts.at(2)), 3590);
+    BOOST_CHECK_EQUAL(parts.at(3), "IN");
+    BOOST_CHECK_EQUAL(parts.at(4), std::get<1>(entry));
+    const auto contentStart = str.find(' ' + parts.at(4) + ' ') + parts.at(4).size() + 2;
+    BOOST_CHECK_EQUAL(str.substr(contentStart, comment - contentStart), std::get<2>(entry));
+  }
+
+  /* nothing else */
+  BOOST_CHECK_EQUAL(getline(&line, &len, fp.get()), -1);
+
+  /* getline() allocates a buffer when called with a nullptr,
+     then reallocates it when needed, but we need to free the
+     last allocation if any. */
+  free(line);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
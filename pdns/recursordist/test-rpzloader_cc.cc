@@ -37,4 +37,61 @@ BOOST_AUTO_TEST_CASE(test_rpz_loader)
   }
 }
 
+BOOST_AUTO_TEST_CASE(test_rpz_snapshot)
+{
+  const DNSName domain("rpz.example.");
+  auto zone = std::make_shared<DNSFilterEngine::Zone>();
+  zone->setName("Unit test policy 0");
+  zone->setDomain(domain);
+  zone->addQNameTrigger(DNSName("bad.example.com."), DNSFilterEngine::Policy(DNSFilterEngine::PolicyKind::NXDOMAIN, DNSFilterEngine::PolicyType::QName, 3600));
+  zone->addQNameTrigger(DNSName("*.wild.example.com."), DNSFilterEngine::Policy(DNSFilterEngine::PolicyKind::Custom, DNSFilterEngine::PolicyType::QName, 60, nullptr, {DNSRecordContent::mastermake(QType::A, QClass::IN, "192.0.2.1")}));
+  zone->addNSTrigger(DNSName("ns.bad.example.net."), DNSFilterEngine::Policy(DNSFilterEngine::PolicyKind::Drop, DNSFilterEngine::PolicyType::NSDName, 60));
+  zone->addClientTrigger(Netmask("192.0.2.0/24"), DNSFilterEngine::Policy(DNSFilterEngine::PolicyKind::Truncate, DNSFilterEngine::PolicyType::ClientIP, 60));
+  zone->addResponseTrigger(Netmask("2001:db8::/32"), DNSFilterEngine::Policy(DNSFilterEngine::PolicyKind::NoAction, DNSFilterEngine::PolicyType::ResponseIP, 60));
+  auto sr = std::dynamic_pointer_cast<SOARecordContent>(DNSRecordContent::mastermake(QType::SOA, QClass::IN, "ns.rpz.example. hostmaster.rpz.example. 42 3600 600 3600000 604800"));
+
+  char temp[] = "/tmp/rpz-snapshotXXXXXX";
+  int fd = mkstemp(temp);
+  BOOST_REQUIRE(fd >= 0);
+  auto fp = std::unique_ptr<FILE, int (*)(FILE*)>(fdopen(fd, "w+"), fclose);
+  BOOST_REQUIRE(fp != nullptr);
+  dumpRPZSnapshot(fp.get(), *zone, sr);
+  fp.reset();
+
+  auto loaded = std::make_shared<DNSFilterEngine::Zone>();
+  loaded->setName("Unit test policy 0");
+  auto loadedSR = loadRPZFromSnapshot(temp, loaded, boost::none, false, std::numeric_limits<uint32_t>::max());
+  BOOST_REQUIRE(loadedSR != nullptr);
+  BOOST_CHECK_EQUAL(loadedSR->d_st.serial, 42U);
+  BOOST_CHECK_EQUAL(loadedSR->d_mname, DNSName("ns.rpz.example."));
+  BOOST_CHECK_EQUAL(loaded->getDomain(), domain);
+  BOOST_CHECK_EQUAL(loaded->getSerial(), 42U);
+  BOOST_CHECK_EQUAL(loaded->getRefresh(), 3600U);
+  BOOST_CHECK_EQUAL(loaded->size(), zone->size());
+
+  DNSFilterEngine::Policy pol;
+  BOOST_CHECK(loaded->findExactQNamePolicy(DNSName("bad.example.com."), pol));
+  BOOST_CHECK(pol.d_kind == DNSFilterEngine::PolicyKind::NXDOMAIN);
+  BOOST_CHECK_EQUAL(pol.d_ttl, 3600);
+  BOOST_CHECK(loaded->findExactQNamePolicy(DNSName("*.wild.example.com."), pol));
+  BOOST_CHECK(pol.d_kind == DNSFilterEngine::PolicyKind::Custom);
+  BOOST_REQUIRE_EQUAL(pol.d_custom.size(), 1U);
+  BOOST_CHECK_EQUAL(pol.d_custom.at(0)->getZoneRepresentation(), "192.0.2.1");
+  BOOST_CHECK(loaded->findExactNSPolicy(DNSName("ns.bad.example.net."), pol));
+  BOOST_CHECK(pol.d_kind == DNSFilterEngine::PolicyKind::Drop);
+  BOOST_CHECK(loaded->findClientPolicy(ComboAddress("192.0.2.42"), pol));
+  BOOST_CHECK(pol.d_kind == DNSFilterEngine::PolicyKind::Truncate);
+  BOOST_CHECK(loaded->findResponsePolicy(ComboAddress("2001:db8::1"), pol));
+  BOOST_CHECK(pol.d_kind == DNSFilterEngine::PolicyKind::NoAction);
+
+  /* a truncated snapshot is rejected */
+  struct stat st;
+  BOOST_REQUIRE_EQUAL(stat(temp, &st), 0);
+  BOOST_REQUIRE_EQUAL(truncate(temp, st.st_size - 1), 0);
+  auto truncated = std::make_shared<DNSFilterEngine::Zone>();
+  BOOST_CHECK_THROW(loadRPZFromSnapshot(temp, truncated, boost::none, false, std::numeric_limits<uint32_t>::max()), std::exception);
+
+  unlink(temp);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
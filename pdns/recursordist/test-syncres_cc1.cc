@@ -2277,4 +2277,46 @@ BOOST_AUTO_TEST_CASE(test_dname_processing_no_CNAME)
 - check preoutquery
 
 */
+BOOST_AUTO_TEST_CASE(test_shared_server_tables)
+{
+  std::unique_ptr<SyncRes> sr;
+  initSR(sr);
+
+  /* these tables are sharded on the server address or name, make sure that
+     entries end up in different shards and are still all found, counted,
+     pruned and cleared */
+  const time_t now = time(nullptr);
+  struct timeval tv;
+  tv.tv_sec = now;
+  tv.tv_usec = 0;
+  for (size_t idx = 0; idx < 256; idx++) {
+    const ComboAddress server("192.0.2." + std::to_string(idx), 53);
+    const DNSName name("ns" + std::to_string(idx) + ".powerdns.com.");
+    SyncRes::doThrottle(now, server, 60, 100);
+    SyncRes::submitNSSpeed(name, server, 1000, tv);
+  }
+  BOOST_CHECK_EQUAL(SyncRes::getThrottledServersSize(), 256U);
+  BOOST_CHECK_EQUAL(SyncRes::getNSSpeedsSize(), 256U);
+
+  for (size_t idx = 0; idx < 256; idx++) {
+    const ComboAddress server("192.0.2." + std::to_string(idx), 53);
+    const DNSName name("ns" + std::to_string(idx) + ".powerdns.com.");
+    BOOST_CHECK(SyncRes::isThrottled(now, server));
+    BOOST_CHECK_EQUAL(SyncRes::getNSSpeed(name, server), 1000U);
+  }
+  BOOST_CHECK(!SyncRes::isThrottled(now, ComboAddress("198.51.100.1", 53)));
+
+  /* the dumps are rate-limited */
+  auto fd = open("/dev/null", O_WRONLY);
+  BOOST_REQUIRE(fd >= 0);
+  BOOST_CHECK_EQUAL(SyncRes::doDumpThrottleMap(fd), 256U);
+  BOOST_CHECK_THROW(SyncRes::doDumpThrottleMap(fd), std::runtime_error);
+  close(fd);
+
+  SyncRes::pruneNSSpeeds(now + 1);
+  BOOST_CHECK_EQUAL(SyncRes::getNSSpeedsSize(), 0U);
+  SyncRes::clearThrottle();
+  BOOST_CHECK_EQUAL(SyncRes::getThrottledServersSize(), 0U);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -1850,4 +1850,199 @@ BOOST_AUTO_TEST_CASE(test_cache_almost_expired_ttl)
   // ATM we are not testing the almost expiry of root infra records, it would require quite some cache massage...
 }
 
+static void addStaleRecordToCache(const DNSName& name, uint16_t type, const std::string& content, time_t now)
+{
+  /* a 60s TTL entry that expired 60s ago */
+  std::vector<DNSRecord> records;
+  std::vector<shared_ptr<RRSIGRecordContent>> sigs;
+  addRecordToList(records, name, type, content, DNSResourceRecord::ANSWER, now - 60);
+  g_recCache->replace(now - 120, name, QType(type), records, sigs, vector<std::shared_ptr<DNSRecord>>(), true, g_rootdnsname, boost::optional<Netmask>());
+}
+
+static void clearTestTasks()
+{
+  while (!g_test_tasks.empty()) {
+    g_test_tasks.pop();
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_servestale_auths_timeout)
+{
+  std::unique_ptr<SyncRes> sr;
+  initSR(sr);
+
+  primeHints();
+  clearTestTasks();
+
+  const DNSName target("powerdns.com.");
+  size_t queries = 0;
+
+  sr->setAsyncCallback([&queries](const ComboAddress& ip, const DNSName& domain, int type, bool doTCP, bool sendRDQuery, int EDNS0Level, struct timeval* now, boost::optional<Netmask>& srcmask, boost::optional<const ResolveContext&> context, LWResult* res, bool* chained) {
+    queries++;
+    return LWResult::Result::Timeout;
+  });
+
+  const time_t now = sr->getNow().tv_sec;
+  addStaleRecordToCache(target, QType::A, "192.0.2.42", now);
+
+  /* serve-stale is disabled */
+  vector<DNSRecord> ret;
+  int res = sr->beginResolve(target, QType(QType::A), QClass::IN, ret);
+  BOOST_CHECK_EQUAL(res, RCode::ServFail);
+  BOOST_CHECK_EQUAL(ret.size(), 0U);
+  BOOST_CHECK_GT(queries, 0U);
+  BOOST_CHECK_EQUAL(g_test_tasks.size(), 0U);
+
+  /* enabled, we get the expired record for at most one extension period */
+  MemRecursorCache::s_maxServedStaleExtensions = 1440;
+  const uint64_t servedStale = SyncRes::s_servedstale;
+
+  ret.clear();
+  res = sr->beginResolve(target, QType(QType::A), QClass::IN, ret);
+  BOOST_CHECK_EQUAL(res, RCode::NoError);
+  BOOST_REQUIRE_EQUAL(ret.size(), 1U);
+  BOOST_REQUIRE(ret[0].d_type == QType::A);
+  BOOST_CHECK_EQUAL(getRR<ARecordContent>(ret[0])->getCA().toStringWithPort(), ComboAddress("192.0.2.42").toStringWithPort());
+  BOOST_CHECK_GT(ret[0].d_ttl, 0U);
+  BOOST_CHECK_LE(ret[0].d_ttl, MemRecursorCache::s_serveStaleExtensionPeriod);
+  BOOST_CHECK_EQUAL(SyncRes::s_servedstale, servedStale + 1);
+
+  /* and a refresh of that record has been scheduled */
+  BOOST_REQUIRE_EQUAL(g_test_tasks.size(), 1U);
+  auto task = g_test_tasks.pop();
+  BOOST_CHECK_EQUAL(task.d_qname, target);
+  BOOST_CHECK_EQUAL(task.d_qtype, QType::A);
+}
+
+BOOST_AUTO_TEST_CASE(test_servestale_time_limit)
+{
+  std::unique_ptr<SyncRes> sr;
+  initSR(sr);
+  MemRecursorCache::s_maxServedStaleExtensions = 1440;
+
+  primeHints();
+  clearTestTasks();
+
+  const DNSName target("powerdns.com.");
+  size_t queries = 0;
+
+  sr->setAsyncCallback([&queries](const ComboAddress& ip, const DNSName& domain, int type, bool doTCP, bool sendRDQuery, int EDNS0Level, struct timeval* now, boost::optional<Netmask>& srcmask, boost::optional<const ResolveContext&> context, LWResult* res, bool* chained) {
+    queries++;
+
+    if (isRootServer(ip)) {
+      setLWResult(res, 0, false, false, true);
+      /* Pretend that this query took 2000 ms */
+      res->d_usec = 2000;
+
+      addRecordToLW(res, domain, QType::NS, "a.gtld-servers.net.", DNSResourceRecord::AUTHORITY, 172800);
+      addRecordToLW(res, "a.gtld-servers.net.", QType::A, "192.0.2.1", DNSResourceRecord::ADDITIONAL, 3600);
+      return LWResult::Result::Success;
+    }
+
+    return LWResult::Result::Timeout;
+  });
+
+  const time_t now = sr->getNow().tv_sec;
+  addStaleRecordToCache(target, QType::A, "192.0.2.42", now);
+
+  /* Set the maximum time to 1 ms, the ImmediateServFailException is replaced by the stale answer */
+  SyncRes::s_maxtotusec = 1000;
+
+  vector<DNSRecord> ret;
+  int res = sr->beginResolve(target, QType(QType::A), QClass::IN, ret);
+  BOOST_CHECK_EQUAL(res, RCode::NoError);
+  BOOST_CHECK_EQUAL(queries, 1U);
+  BOOST_REQUIRE_EQUAL(ret.size(), 1U);
+  BOOST_REQUIRE(ret[0].d_type == QType::A);
+  BOOST_CHECK_EQUAL(getRR<ARecordContent>(ret[0])->getCA().toStringWithPort(), ComboAddress("192.0.2.42").toStringWithPort());
+  BOOST_CHECK_GT(ret[0].d_ttl, 0U);
+  BOOST_CHECK_LE(ret[0].d_ttl, MemRecursorCache::s_serveStaleExtensionPeriod);
+  BOOST_CHECK_EQUAL(g_test_tasks.size(), 1U);
+  clearTestTasks();
+}
+
+BOOST_AUTO_TEST_CASE(test_servestale_qperq_limit)
+{
+  std::unique_ptr<SyncRes> sr;
+  initSR(sr);
+  MemRecursorCache::s_maxServedStaleExtensions = 1440;
+
+  primeHints();
+  clearTestTasks();
+
+  const DNSName target("powerdns.com.");
+  size_t queries = 0;
+
+  sr->setAsyncCallback([&queries](const ComboAddress& ip, const DNSName& domain, int type, bool doTCP, bool sendRDQuery, int EDNS0Level, struct timeval* now, boost::optional<Netmask>& srcmask, boost::optional<const ResolveContext&> context, LWResult* res, bool* chained) {
+    queries++;
+
+    if (isRootServer(ip)) {
+      setLWResult(res, 0, false, false, true);
+      addRecordToLW(res, domain, QType::NS, "a.gtld-servers.net.", DNSResourceRecord::AUTHORITY, 172800);
+      addRecordToLW(res, "a.gtld-servers.net.", QType::A, "192.0.2.1", DNSResourceRecord::ADDITIONAL, 3600);
+      return LWResult::Result::Success;
+    }
+
+    return LWResult::Result::Timeout;
+  });
+
+  const time_t now = sr->getNow().tv_sec;
+  addStaleRecordToCache(target, QType::A, "192.0.2.42", now);
+
+  /* other immediate failures than running out of time do not lead to serving stale */
+  SyncRes::s_maxqperq = 1;
+
+  try {
+    vector<DNSRecord> ret;
+    sr->beginResolve(target, QType(QType::A), QClass::IN, ret);
+    BOOST_CHECK(false);
+  }
+  catch (const ImmediateServFailException& e) {
+  }
+  BOOST_CHECK_EQUAL(queries, 1U);
+  BOOST_CHECK_EQUAL(g_test_tasks.size(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(test_servestale_cname)
+{
+  std::unique_ptr<SyncRes> sr;
+  initSR(sr);
+  MemRecursorCache::s_maxServedStaleExtensions = 1440;
+
+  primeHints();
+  clearTestTasks();
+
+  const DNSName target("cname.powerdns.com.");
+  const DNSName cnameTarget("www.powerdns.com.");
+
+  sr->setAsyncCallback([](const ComboAddress& ip, const DNSName& domain, int type, bool doTCP, bool sendRDQuery, int EDNS0Level, struct timeval* now, boost::optional<Netmask>& srcmask, boost::optional<const ResolveContext&> context, LWResult* res, bool* chained) {
+    return LWResult::Result::Timeout;
+  });
+
+  const time_t now = sr->getNow().tv_sec;
+  addStaleRecordToCache(target, QType::CNAME, cnameTarget.toString(), now);
+  addStaleRecordToCache(cnameTarget, QType::A, "192.0.2.42", now);
+
+  const uint64_t servedStale = SyncRes::s_servedstale;
+
+  vector<DNSRecord> ret;
+  int res = sr->beginResolve(target, QType(QType::A), QClass::IN, ret);
+  BOOST_CHECK_EQUAL(res, RCode::NoError);
+  BOOST_REQUIRE_EQUAL(ret.size(), 2U);
+  BOOST_REQUIRE(ret[0].d_type == QType::CNAME);
+  BOOST_CHECK_EQUAL(getRR<CNAMERecordContent>(ret[0])->getTarget(), cnameTarget);
+  BOOST_REQUIRE(ret[1].d_type == QType::A);
+  BOOST_CHECK_EQUAL(getRR<ARecordContent>(ret[1])->getCA().toStringWithPort(), ComboAddress("192.0.2.42").toStringWithPort());
+  for (const auto& record : ret) {
+    BOOST_CHECK_GT(record.d_ttl, 0U);
+    BOOST_CHECK_LE(record.d_ttl, MemRecursorCache::s_serveStaleExtensionPeriod);
+  }
+
+  /* the target of the CNAME is looked up while we are already serving stale,
+     that lookup is done from the cache only and is not served stale on its own */
+  BOOST_CHECK_EQUAL(SyncRes::s_servedstale, servedStale + 1);
+  BOOST_CHECK_EQUAL(g_test_tasks.size(), 2U);
+  clearTestTasks();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -463,6 +463,57 @@ BOOST_AUTO_TEST_CASE(test_dnssec_rrsig)
   BOOST_CHECK(validateWithKeySet(now, qname, recordcontents, sigs, keyset) == vState::Secure);
 }
 
+BOOST_AUTO_TEST_CASE(test_dnssec_rrsig_signature_cache)
+{
+  initSR();
+  g_signatureCache = std::make_unique<SignatureCache>(100, 1);
+
+  auto dcke = DNSCryptoKeyEngine::make(DNSSECKeeper::ECDSA256);
+  dcke->create(dcke->getBits());
+  DNSSECPrivateKey dpk;
+  dpk.d_flags = 256;
+  dpk.setKey(std::move(dcke));
+
+  sortedRecords_t recordcontents;
+  recordcontents.insert(getRecordContent(QType::A, "192.0.2.1"));
+
+  DNSName qname("powerdns.com.");
+
+  time_t now = time(nullptr);
+  RRSIGRecordContent rrc;
+  computeRRSIG(dpk, qname, qname, QType::A, 600, 0, rrc, recordcontents, boost::none, now);
+
+  skeyset_t keyset;
+  keyset.insert(std::make_shared<DNSKEYRecordContent>(dpk.getDNSKEY()));
+
+  std::vector<std::shared_ptr<RRSIGRecordContent>> sigs;
+  sigs.push_back(std::make_shared<RRSIGRecordContent>(rrc));
+
+  const uint64_t verifications = g_signatureVerifications;
+  BOOST_CHECK(validateWithKeySet(now, qname, recordcontents, sigs, keyset) == vState::Secure);
+  BOOST_CHECK_EQUAL(g_signatureVerifications - verifications, 1U);
+  BOOST_CHECK_EQUAL(g_signatureCache->size(), 1U);
+
+  /* second time, the result comes from the cache */
+  BOOST_CHECK(validateWithKeySet(now, qname, recordcontents, sigs, keyset) == vState::Secure);
+  BOOST_CHECK_EQUAL(g_signatureVerifications - verifications, 1U);
+  BOOST_CHECK_EQUAL(g_signatureCache->d_hits.load(), 1U);
+
+  /* a different RRset with the same signature should not match */
+  sortedRecords_t othercontents;
+  othercontents.insert(getRecordContent(QType::A, "192.0.2.2"));
+  BOOST_CHECK(validateWithKeySet(now, qname, othercontents, sigs, keyset) == vState::BogusNoValidRRSIG);
+  BOOST_CHECK_EQUAL(g_signatureVerifications - verifications, 2U);
+  BOOST_CHECK_EQUAL(g_signatureCache->d_hits.load(), 1U);
+  BOOST_CHECK_EQUAL(g_signatureCache->size(), 1U);
+
+  /* once expired, the entry is not used anymore */
+  g_signatureCache->prune(rrc.d_sigexpire + 1);
+  BOOST_CHECK_EQUAL(g_signatureCache->size(), 0U);
+
+  g_signatureCache.reset();
+}
+
 BOOST_AUTO_TEST_CASE(test_dnssec_root_validation_csk)
 {
   std::unique_ptr<SyncRes> sr;
@@ -13,6 +13,8 @@
 #include "threadname.hh"
 #include "query-local-address.hh"
 
+#include <sys/mman.h>
+
 Netmask makeNetmaskFromRPZ(const DNSName& name)
 {
   auto parts = name.getRawLabels();
@@ -318,7 +320,7 @@ std::shared_ptr<SOARecordContent> loadRPZFromFile(const std::string& fname, std:
   return sr;
 }
 
-static bool dumpZoneToDisk(const shared_ptr<Logr::Logger>& plogger, const DNSName& zoneName, const std::shared_ptr<DNSFilterEngine::Zone>& newZone, const std::string& dumpZoneFileName)
+static bool dumpZoneToDisk(const shared_ptr<Logr::Logger>& plogger, const DNSName& zoneName, const std::string& dumpZoneFileName, const std::function<void(FILE*)>& writer)
 {
   auto logger = plogger->v(1);
   logger->info("Dumping zone to disk", "destination_file", Logging::Loggable(dumpZoneFileName));
@@ -341,7 +343,7 @@ static bool dumpZoneToDisk(const shared_ptr<Logr::Logger>& plogger, const DNSNam
   fd = -1;
 
   try {
-    newZone->dump(fp.get());
+    writer(fp.get());
   }
   catch(const std::exception& e) {
     SLOG(g_log<<Logger::Warning<<"Error while dumping the content of the RPZ zone "<<zoneName<<": "<<e.what()<<endl,
@@ -376,7 +378,234 @@ static bool dumpZoneToDisk(const shared_ptr<Logr::Logger>& plogger, const DNSNam
   return true;
 }
 
-void RPZIXFRTracker(const std::vector<ComboAddress>& primaries, const boost::optional<DNSFilterEngine::Policy>& defpol, bool defpolOverrideLocal, uint32_t maxTTL, size_t zoneIdx, const TSIGTriplet& tt, size_t maxReceivedBytes, const ComboAddress& localAddress, const uint16_t axfrTimeout, const uint32_t refreshFromConf, std::shared_ptr<SOARecordContent> sr, const std::string& dumpZoneFileName, uint64_t configGeneration)
+/* The snapshot format is made of:
+   - a header: magic, version, zone name, SOA content and number of records ;
+   - the records, with names relative to the zone: name, type, TTL and content in wire format.
+   All integers are in network byte order. The records go through RPZRecordToPolicy() when loaded,
+   exactly like the ones from a zone file, so the default policy and maximum TTL settings are applied,
+   but there is no text to parse. */
+static const std::string s_rpzSnapshotMagic("PDNSRPZS");
+static const uint16_t s_rpzSnapshotVersion = 1;
+
+static void appendSnapshotUInt16(std::string& buffer, uint16_t value)
+{
+  value = htons(value);
+  buffer.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+static void appendSnapshotUInt32(std::string& buffer, uint32_t value)
+{
+  value = htonl(value);
+  buffer.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+static void appendSnapshotContent(std::string& buffer, const std::string& content)
+{
+  if (content.size() > std::numeric_limits<uint16_t>::max()) {
+    throw std::runtime_error("Record content is too large to be stored in an RPZ snapshot");
+  }
+  appendSnapshotUInt16(buffer, content.size());
+  buffer.append(content);
+}
+
+static void writeSnapshotBuffer(FILE* fp, std::string& buffer)
+{
+  if (!buffer.empty() && fwrite(buffer.data(), buffer.size(), 1, fp) != 1) {
+    throw std::runtime_error("Error writing the RPZ snapshot: " + stringerror());
+  }
+  buffer.clear();
+}
+
+void dumpRPZSnapshot(FILE* fp, const DNSFilterEngine::Zone& zone, const std::shared_ptr<SOARecordContent>& sr)
+{
+  std::string buffer;
+  buffer.reserve(65536);
+
+  buffer.append(s_rpzSnapshotMagic);
+  appendSnapshotUInt16(buffer, s_rpzSnapshotVersion);
+  buffer.append(zone.getDomain().toDNSString());
+  appendSnapshotContent(buffer, sr->serialize(zone.getDomain()));
+  /* the number of records is only known once they have been written */
+  const auto countOffset = buffer.size();
+  appendSnapshotUInt32(buffer, 0);
+  appendSnapshotUInt32(buffer, 0);
+
+  uint64_t count = 0;
+  zone.visitRecords([fp, &buffer, &count](const DNSRecord& dr) {
+    buffer.append(dr.d_name.toDNSString());
+    appendSnapshotUInt16(buffer, dr.d_type);
+    appendSnapshotUInt32(buffer, dr.d_ttl);
+    appendSnapshotContent(buffer, dr.d_content->serialize(dr.d_name));
+    count++;
+    if (buffer.size() >= 65536) {
+      writeSnapshotBuffer(fp, buffer);
+    }
+  });
+  writeSnapshotBuffer(fp, buffer);
+
+  if (fseek(fp, countOffset, SEEK_SET) != 0) {
+    throw std::runtime_error("Error writing the RPZ snapshot: " + stringerror());
+  }
+  appendSnapshotUInt32(buffer, count >> 32);
+  appendSnapshotUInt32(buffer, count & 0xffffffff);
+  writeSnapshotBuffer(fp, buffer);
+  if (fseek(fp, 0, SEEK_END) != 0) {
+    throw std::runtime_error("Error writing the RPZ snapshot: " + stringerror());
+  }
+}
+
+class RPZSnapshotReader
+{
+public:
+  RPZSnapshotReader(const std::string& fname)
+  {
+    int fd = open(fname.c_str(), O_RDONLY);
+    if (fd < 0) {
+      throw std::runtime_error("Unable to open RPZ snapshot '" + fname + "': " + stringerror());
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+      int err = errno;
+      close(fd);
+      throw std::runtime_error("Unable to get the size of RPZ snapshot '" + fname + "': " + stringerror(err));
+    }
+    d_size = st.st_size;
+    if (d_size > 0) {
+      d_data = mmap(nullptr, d_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    int err = errno;
+    close(fd);
+    if (d_data == MAP_FAILED) {
+      throw std::runtime_error("Unable to map RPZ snapshot '" + fname + "': " + stringerror(err));
+    }
+#ifdef MADV_SEQUENTIAL
+    if (d_data != nullptr) {
+      madvise(d_data, d_size, MADV_SEQUENTIAL);
+    }
+#endif
+  }
+
+  ~RPZSnapshotReader()
+  {
+    if (d_data != nullptr && d_data != MAP_FAILED) {
+      munmap(d_data, d_size);
+    }
+  }
+
+  RPZSnapshotReader(const RPZSnapshotReader&) = delete;
+  RPZSnapshotReader& operator=(const RPZSnapshotReader&) = delete;
+
+  bool atEnd() const
+  {
+    return d_pos == d_size;
+  }
+
+  const char* get(size_t len)
+  {
+    if (len > d_size - d_pos) {
+      throw std::runtime_error("RPZ snapshot is truncated");
+    }
+    const char* result = static_cast<const char*>(d_data) + d_pos;
+    d_pos += len;
+    return result;
+  }
+
+  uint16_t getUInt16()
+  {
+    uint16_t value;
+    memcpy(&value, get(sizeof(value)), sizeof(value));
+    return ntohs(value);
+  }
+
+  uint32_t getUInt32()
+  {
+    uint32_t value;
+    memcpy(&value, get(sizeof(value)), sizeof(value));
+    return ntohl(value);
+  }
+
+  DNSName getName()
+  {
+    /* a name in wire format is at most 255 bytes long */
+    size_t len = std::min(d_size - d_pos, static_cast<size_t>(255));
+    unsigned int consumed = 0;
+    DNSName name(static_cast<const char*>(d_data) + d_pos, len, 0, false, nullptr, nullptr, &consumed);
+    get(consumed);
+    return name;
+  }
+
+  std::string getContent()
+  {
+    uint16_t len = getUInt16();
+    return std::string(get(len), len);
+  }
+
+private:
+  void* d_data{nullptr};
+  size_t d_size{0};
+  size_t d_pos{0};
+};
+
+// this function is silent - you do the logging
+std::shared_ptr<SOARecordContent> loadRPZFromSnapshot(const std::string& fname, std::shared_ptr<DNSFilterEngine::Zone> zone, const boost::optional<DNSFilterEngine::Policy>& defpol, bool defpolOverrideLocal, uint32_t maxTTL)
+{
+  RPZSnapshotReader reader(fname);
+
+  if (std::string(reader.get(s_rpzSnapshotMagic.size()), s_rpzSnapshotMagic.size()) != s_rpzSnapshotMagic) {
+    throw std::runtime_error("'" + fname + "' is not an RPZ snapshot");
+  }
+  auto version = reader.getUInt16();
+  if (version != s_rpzSnapshotVersion) {
+    throw std::runtime_error("Unsupported RPZ snapshot version " + std::to_string(version) + " in '" + fname + "'");
+  }
+
+  DNSName domain = reader.getName();
+  auto sr = std::dynamic_pointer_cast<SOARecordContent>(DNSRecordContent::deserialize(domain, QType::SOA, reader.getContent()));
+  if (!sr) {
+    throw std::runtime_error("Invalid SOA record in RPZ snapshot '" + fname + "'");
+  }
+  uint64_t count = static_cast<uint64_t>(reader.getUInt32()) << 32;
+  count += reader.getUInt32();
+
+  zone->setDomain(domain);
+  zone->reserve(count);
+
+  DNSRecord dr;
+  dr.d_class = QClass::IN;
+  dr.d_place = DNSResourceRecord::ANSWER;
+  for (uint64_t idx = 0; idx < count; idx++) {
+    dr.d_name = reader.getName();
+    dr.d_type = reader.getUInt16();
+    dr.d_ttl = reader.getUInt32();
+    dr.d_content = DNSRecordContent::deserialize(dr.d_name, dr.d_type, reader.getContent());
+    RPZRecordToPolicy(dr, zone, true, defpol, defpolOverrideLocal, maxTTL);
+  }
+
+  if (!reader.atEnd()) {
+    throw std::runtime_error("Unexpected data at the end of RPZ snapshot '" + fname + "'");
+  }
+
+  zone->setSerial(sr->d_st.serial);
+  zone->setRefresh(sr->d_st.refresh);
+  setRPZZoneNewState(zone->getName(), sr->d_st.serial, zone->size(), true, false);
+  return sr;
+}
+
+static void dumpZone(const shared_ptr<Logr::Logger>& logger, const DNSName& zoneName, const std::shared_ptr<DNSFilterEngine::Zone>& newZone, const std::shared_ptr<SOARecordContent>& sr, const std::string& dumpZoneFileName, const std::string& snapshotFileName)
+{
+  if (!dumpZoneFileName.empty()) {
+    dumpZoneToDisk(logger, zoneName, dumpZoneFileName, [&newZone](FILE* fp) {
+      newZone->dump(fp);
+    });
+  }
+  if (!snapshotFileName.empty()) {
+    dumpZoneToDisk(logger, zoneName, snapshotFileName, [&newZone, &sr](FILE* fp) {
+      dumpRPZSnapshot(fp, *newZone, sr);
+    });
+  }
+}
+
+void RPZIXFRTracker(const std::vector<ComboAddress>& primaries, const boost::optional<DNSFilterEngine::Policy>& defpol, bool defpolOverrideLocal, uint32_t maxTTL, size_t zoneIdx, const TSIGTriplet& tt, size_t maxReceivedBytes, const ComboAddress& localAddress, const uint16_t axfrTimeout, const uint32_t refreshFromConf, std::shared_ptr<SOARecordContent> sr, const std::string& dumpZoneFileName, const std::string& snapshotFileName, uint64_t configGeneration)
 {
   setThreadName("pdns-r/RPZIXFR");
   bool isPreloaded = sr != nullptr;
@@ -384,7 +613,7 @@ void RPZIXFRTracker(const std::vector<ComboAddress>& primaries, const boost::opt
 
   auto logger = g_slog->withName("rpz")->v(1);
 
-  /* we can _never_ modify this zone directly, we need to do a full copy then replace the existing zone */
+  /* we can _never_ modify this zone directly, we need to do a copy then replace the existing zone */
   std::shared_ptr<DNSFilterEngine::Zone> oldZone = luaconfsLocal->dfe.getZone(zoneIdx);
   if (!oldZone) {
     SLOG(g_log<<Logger::Error<<"Unable to retrieve RPZ zone with index "<<zoneIdx<<" from the configuration, exiting"<<endl,
@@ -403,7 +632,7 @@ void RPZIXFRTracker(const std::vector<ComboAddress>& primaries, const boost::opt
   while (!sr) {
     /* if we received an empty sr, the zone was not really preloaded */
 
-    /* full copy, as promised */
+    /* copy, as promised */
     std::shared_ptr<DNSFilterEngine::Zone> newZone = std::make_shared<DNSFilterEngine::Zone>(*oldZone);
     for (const auto& primary : primaries) {
       try {
@@ -417,9 +646,7 @@ void RPZIXFRTracker(const std::vector<ComboAddress>& primaries, const boost::opt
             lci.dfe.setZone(zoneIdx, newZone);
           });
 
-        if (!dumpZoneFileName.empty()) {
-          dumpZoneToDisk(logger, zoneName, newZone, dumpZoneFileName);
-        }
+        dumpZone(logger, zoneName, newZone, sr, dumpZoneFileName, snapshotFileName);
 
         /* no need to try another primary */
         break;
@@ -499,7 +726,8 @@ void RPZIXFRTracker(const std::vector<ComboAddress>& primaries, const boost::opt
         g_log<<Logger::Info<<"This policy is no more, stopping the existing RPZ update thread for "<<zoneName << endl;
         return;
       }
-      /* we need to make a _full copy_ of the zone we are going to work on */
+      /* we need to make a copy of the zone we are going to work on. This is cheap since the copy shares
+         its policies with the existing zone, only duplicating the parts touched by the update */
       std::shared_ptr<DNSFilterEngine::Zone> newZone = std::make_shared<DNSFilterEngine::Zone>(*oldZone);
       /* initialize the current serial to the last one */
       std::shared_ptr<SOARecordContent> currentSR = sr;
@@ -577,9 +805,7 @@ void RPZIXFRTracker(const std::vector<ComboAddress>& primaries, const boost::opt
                           lci.dfe.setZone(zoneIdx, newZone);
                         });
 
-      if (!dumpZoneFileName.empty()) {
-        dumpZoneToDisk(logger, zoneName, newZone, dumpZoneFileName);
-      }
+      dumpZone(logger, zoneName, newZone, sr, dumpZoneFileName, snapshotFileName);
       refresh = std::max(refreshFromConf ? refreshFromConf : newZone->getRefresh(), 1U);
     }
     catch (const std::exception& e) {
@@ -38,6 +38,11 @@
 #include "validate-recursor.hh"
 
 thread_local SyncRes::ThreadLocalStorage SyncRes::t_sstorage;
+SharedShardedTable<SyncRes::nsspeeds_t> SyncRes::s_nsSpeeds;
+SharedShardedTable<SyncRes::throttle_t> SyncRes::s_throttle;
+SharedShardedTable<SyncRes::ednsstatus_t> SyncRes::s_ednsstatus;
+SharedShardedTable<fails_t<ComboAddress>> SyncRes::s_fails;
+SharedShardedTable<fails_t<DNSName>> SyncRes::s_nonresolving;
 thread_local std::unique_ptr<addrringbuf_t> t_timeouts;
 
 std::unique_ptr<NetmaskGroup> SyncRes::s_dontQuery{nullptr};
@@ -76,6 +81,7 @@ pdns::stat_t SyncRes::s_dotoutqueries;
 pdns::stat_t SyncRes::s_throttledqueries;
 pdns::stat_t SyncRes::s_dontqueries;
 pdns::stat_t SyncRes::s_qnameminfallbacksuccess;
+pdns::stat_t SyncRes::s_servedstale;
 pdns::stat_t SyncRes::s_unreachables;
 pdns::stat_t SyncRes::s_ecsqueries;
 pdns::stat_t SyncRes::s_ecsresponses;
@@ -426,8 +432,23 @@ bool SyncRes::isForwardOrAuth(const DNSName &qname) const {
   return iter != t_sstorage.domainmap->end() && (iter->second.isAuth() || !iter->second.shouldRecurse());
 }
 
+/* dumping a table copies all of its shards, one after the other, so don't let a script
+   do that in a tight loop */
+static void checkDumpRateLimit(std::atomic<time_t>& lastDump, const std::string& name)
+{
+  static const time_t minInterval = 1;
+  time_t now = time(nullptr);
+  time_t last = lastDump.load();
+  if (now < last + minInterval || !lastDump.compare_exchange_strong(last, now)) {
+    throw std::runtime_error("the " + name + " has been dumped less than " + std::to_string(minInterval) + " second(s) ago, please try again later");
+  }
+}
+
 uint64_t SyncRes::doEDNSDump(int fd)
 {
+  static std::atomic<time_t> lastDump{0};
+  checkDumpRateLimit(lastDump, "EDNS status table");
+
   int newfd = dup(fd);
   if (newfd == -1) {
     return 0;
@@ -439,8 +460,13 @@ uint64_t SyncRes::doEDNSDump(int fd)
   }
   uint64_t count = 0;
 
-  fprintf(fp.get(),"; edns from thread follows\n;\n");
-  for(const auto& eds : t_sstorage.ednsstatus) {
+  // we do not want to hold the locks while writing to the file
+  std::vector<EDNSStatus> copy;
+  s_ednsstatus.forEachShard([&copy](const ednsstatus_t& ednsstatus) {
+    copy.insert(copy.end(), ednsstatus.begin(), ednsstatus.end());
+  });
+  fprintf(fp.get(),"; edns dump follows\n;\n");
+  for(const auto& eds : copy) {
     count++;
     char tmp[26];
     fprintf(fp.get(), "%s\t%d\t%s", eds.address.toString().c_str(), (int)eds.mode, ctime_r(&eds.modeSetAt, tmp));
@@ -450,6 +476,9 @@ uint64_t SyncRes::doEDNSDump(int fd)
 
 uint64_t SyncRes::doDumpNSSpeeds(int fd)
 {
+  static std::atomic<time_t> lastDump{0};
+  checkDumpRateLimit(lastDump, "nameserver speeds table");
+
   int newfd = dup(fd);
   if (newfd == -1) {
     return 0;
@@ -459,19 +488,31 @@ uint64_t SyncRes::doDumpNSSpeeds(int fd)
     close(newfd);
     return 0;
   }
-  fprintf(fp.get(), "; nsspeed dump from thread follows\n;\n");
+  fprintf(fp.get(), "; nsspeed dump follows\n;\n");
   uint64_t count=0;
 
-  for(const auto& i : t_sstorage.nsSpeeds)
+  // the collections are not copyable, and we do not want to hold the locks while writing to the file
+  std::vector<std::pair<DNSName, std::vector<std::pair<ComboAddress, float>>>> copy;
+  s_nsSpeeds.forEachShard([&copy](const nsspeeds_t& nsSpeeds) {
+    for (const auto& i : nsSpeeds) {
+      std::vector<std::pair<ComboAddress, float>> speeds;
+      speeds.reserve(i.second.d_collection.size());
+      for (const auto& j : i.second.d_collection) {
+        speeds.emplace_back(j.first, j.second.peek());
+      }
+      copy.emplace_back(i.first, std::move(speeds));
+    }
+  });
+
+  for(const auto& i : copy)
   {
     count++;
 
     // an <empty> can appear hear in case of authoritative (hosted) zones
     fprintf(fp.get(), "%s -> ", i.first.toLogString().c_str());
-    for(const auto& j : i.second.d_collection)
+    for(const auto& j : i.second)
     {
-      // typedef vector<pair<ComboAddress, DecayingEwma> > collection_t;
-      fprintf(fp.get(), "%s/%f ", j.first.toString().c_str(), j.second.peek());
+      fprintf(fp.get(), "%s/%f ", j.first.toString().c_str(), j.second);
     }
     fprintf(fp.get(), "\n");
   }
@@ -480,6 +521,9 @@ uint64_t SyncRes::doDumpNSSpeeds(int fd)
 
 uint64_t SyncRes::doDumpThrottleMap(int fd)
 {
+  static std::atomic<time_t> lastDump{0};
+  checkDumpRateLimit(lastDump, "throttle map");
+
   int newfd = dup(fd);
   if (newfd == -1) {
     return 0;
@@ -493,7 +537,12 @@ uint64_t SyncRes::doDumpThrottleMap(int fd)
   fprintf(fp.get(), "; remote IP\tqname\tqtype\tcount\tttd\n");
   uint64_t count=0;
 
-  const auto& throttleMap = t_sstorage.throttle.getThrottleMap();
+  // we do not want to hold the locks while writing to the file
+  std::vector<throttle_t::entry_t> throttleMap;
+  s_throttle.forEachShard([&throttleMap](const throttle_t& throttle) {
+    const auto& entries = throttle.getThrottleMap();
+    throttleMap.insert(throttleMap.end(), entries.begin(), entries.end());
+  });
   for(const auto& i : throttleMap)
   {
     count++;
@@ -507,6 +556,9 @@ uint64_t SyncRes::doDumpThrottleMap(int fd)
 
 uint64_t SyncRes::doDumpFailedServers(int fd)
 {
+  static std::atomic<time_t> lastDump{0};
+  checkDumpRateLimit(lastDump, "failed servers map");
+
   int newfd = dup(fd);
   if (newfd == -1) {
     return 0;
@@ -520,7 +572,13 @@ uint64_t SyncRes::doDumpFailedServers(int fd)
   fprintf(fp.get(), "; remote IP\tcount\ttimestamp\n");
   uint64_t count=0;
 
-  for(const auto& i : t_sstorage.fails.getMap())
+  // we do not want to hold the locks while writing to the file
+  std::vector<fails_t<ComboAddress>::value_t> failsMap;
+  s_fails.forEachShard([&failsMap](const fails_t<ComboAddress>& fails) {
+    const auto& entries = fails.getMap();
+    failsMap.insert(failsMap.end(), entries.begin(), entries.end());
+  });
+  for(const auto& i : failsMap)
   {
     count++;
     char tmp[26];
@@ -533,6 +591,9 @@ uint64_t SyncRes::doDumpFailedServers(int fd)
 
 uint64_t SyncRes::doDumpNonResolvingNS(int fd)
 {
+  static std::atomic<time_t> lastDump{0};
+  checkDumpRateLimit(lastDump, "non-resolving nameservers map");
+
   int newfd = dup(fd);
   if (newfd == -1) {
     return 0;
@@ -546,7 +607,13 @@ uint64_t SyncRes::doDumpNonResolvingNS(int fd)
   fprintf(fp.get(), "; name\tcount\ttimestamp\n");
   uint64_t count=0;
 
-  for(const auto& i : t_sstorage.nonresolving.getMap())
+  // we do not want to hold the locks while writing to the file
+  std::vector<fails_t<DNSName>::value_t> nonresolvingMap;
+  s_nonresolving.forEachShard([&nonresolvingMap](const fails_t<DNSName>& nonresolving) {
+    const auto& entries = nonresolving.getMap();
+    nonresolvingMap.insert(nonresolvingMap.end(), entries.begin(), entries.end());
+  });
+  for(const auto& i : nonresolvingMap)
   {
     count++;
     char tmp[26];
@@ -600,15 +667,19 @@ LWResult::Result SyncRes::asyncresolveWrapper(const ComboAddress& ip, bool ednsM
      If '3', send bare queries
   */
 
-  auto ednsstatus = t_sstorage.ednsstatus.insert(ip).first; // does this include port? YES
-  auto &ind = t_sstorage.ednsstatus.get<ComboAddress>();
-  if (ednsstatus->modeSetAt && ednsstatus->modeSetAt + 3600 < d_now.tv_sec) {
-    t_sstorage.ednsstatus.reset(ind, ednsstatus);
-    //    cerr<<"Resetting EDNS Status for "<<ip.toString()<<endl);
+  SyncRes::EDNSStatus::EDNSMode mode;
+  {
+    /* the status is shared between threads, and we can't hold the lock while the query is in flight */
+    auto lock = s_ednsstatus.lock(ip);
+    auto ednsstatus = lock->insert(ip).first; // does this include port? YES
+    if (ednsstatus->modeSetAt && ednsstatus->modeSetAt + 3600 < d_now.tv_sec) {
+      lock->reset(lock->get<ComboAddress>(), ednsstatus);
+      //    cerr<<"Resetting EDNS Status for "<<ip.toString()<<endl);
+    }
+    mode = ednsstatus->mode;
   }
 
-  const SyncRes::EDNSStatus::EDNSMode *mode = &ednsstatus->mode;
-  const SyncRes::EDNSStatus::EDNSMode oldmode = *mode;
+  const SyncRes::EDNSStatus::EDNSMode oldmode = mode;
   int EDNSLevel = 0;
   auto luaconfsLocal = g_luaconfs.getLocal();
   ResolveContext ctx;
@@ -621,11 +692,11 @@ LWResult::Result SyncRes::asyncresolveWrapper(const ComboAddress& ip, bool ednsM
   for(int tries = 0; tries < 3; ++tries) {
     //    cerr<<"Remote '"<<ip.toString()<<"' currently in mode "<<mode<<endl;
     
-    if (*mode == EDNSStatus::NOEDNS) {
+    if (mode == EDNSStatus::NOEDNS) {
       g_stats.noEdnsOutQueries++;
       EDNSLevel = 0; // level != mode
     }
-    else if (ednsMANDATORY || *mode == EDNSStatus::UNKNOWN || *mode == EDNSStatus::EDNSOK || *mode == EDNSStatus::EDNSIGNORANT)
+    else if (ednsMANDATORY || mode == EDNSStatus::UNKNOWN || mode == EDNSStatus::EDNSOK || mode == EDNSStatus::EDNSIGNORANT)
       EDNSLevel = 1;
 
     DNSName sendQname(domain);
@@ -638,9 +709,11 @@ LWResult::Result SyncRes::asyncresolveWrapper(const ComboAddress& ip, bool ednsM
     else {
       ret = asyncresolve(ip, sendQname, type, doTCP, sendRDQuery, EDNSLevel, now, srcmask, ctx, d_outgoingProtobufServers, d_frameStreamServers, luaconfsLocal->outgoingProtobufExportConfig.exportTypes, res, chained);
     }
-    // ednsstatus might be cleared, so do a new lookup
-    ednsstatus = t_sstorage.ednsstatus.insert(ip).first;
-    mode = &ednsstatus->mode;
+    // ednsstatus might be cleared or updated by another thread, so do a new lookup
+    auto lock = s_ednsstatus.lock(ip);
+    auto ednsstatus = lock->insert(ip).first;
+    auto& ind = lock->get<ComboAddress>();
+    mode = ednsstatus->mode;
     if (ret == LWResult::Result::PermanentError || ret == LWResult::Result::OSLimitError || ret == LWResult::Result::Spoofed) {
       return ret; // transport error, nothing to learn here
     }
@@ -648,26 +721,29 @@ LWResult::Result SyncRes::asyncresolveWrapper(const ComboAddress& ip, bool ednsM
     if (ret == LWResult::Result::Timeout) { // timeout, not doing anything with it now
       return ret;
     }
-    else if (*mode == EDNSStatus::UNKNOWN || *mode == EDNSStatus::EDNSOK || *mode == EDNSStatus::EDNSIGNORANT ) {
+    else if (mode == EDNSStatus::UNKNOWN || mode == EDNSStatus::EDNSOK || mode == EDNSStatus::EDNSIGNORANT ) {
       if(res->d_validpacket && !res->d_haveEDNS && res->d_rcode == RCode::FormErr)  {
 	//	cerr<<"Downgrading to NOEDNS because of "<<RCode::to_s(res->d_rcode)<<" for query to "<<ip.toString()<<" for '"<<domain<<"'"<<endl;
-        t_sstorage.ednsstatus.setMode(ind, ednsstatus, EDNSStatus::NOEDNS);
+        lock->setMode(ind, ednsstatus, EDNSStatus::NOEDNS);
+        mode = EDNSStatus::NOEDNS;
         continue;
       }
       else if(!res->d_haveEDNS) {
-        if (*mode != EDNSStatus::EDNSIGNORANT) {
-          t_sstorage.ednsstatus.setMode(ind, ednsstatus, EDNSStatus::EDNSIGNORANT);
+        if (mode != EDNSStatus::EDNSIGNORANT) {
+          lock->setMode(ind, ednsstatus, EDNSStatus::EDNSIGNORANT);
+          mode = EDNSStatus::EDNSIGNORANT;
 	  //	  cerr<<"We find that "<<ip.toString()<<" is an EDNS-ignorer for '"<<domain<<"', moving to mode 2"<<endl;
 	}
       }
       else {
-        t_sstorage.ednsstatus.setMode(ind, ednsstatus, EDNSStatus::EDNSOK);
+        lock->setMode(ind, ednsstatus, EDNSStatus::EDNSOK);
+        mode = EDNSStatus::EDNSOK;
 	//	cerr<<"We find that "<<ip.toString()<<" is EDNS OK!"<<endl;
       }
     }
 
-    if (oldmode != *mode || !ednsstatus->modeSetAt) {
-      t_sstorage.ednsstatus.setTS(ind, ednsstatus, d_now.tv_sec);
+    if (oldmode != mode || !ednsstatus->modeSetAt) {
+      lock->setTS(ind, ednsstatus, d_now.tv_sec);
     }
     //    cerr<<"Result: ret="<<ret<<", EDNS-level: "<<EDNSLevel<<", haveEDNS: "<<res->d_haveEDNS<<", new mode: "<<mode<<endl;  
     return LWResult::Result::Success;
@@ -1035,7 +1111,20 @@ int SyncRes::doResolveNoQNameMinimization(const DNSName &qname, const QType qtyp
     subdomain=getBestNSNamesFromCache(subdomain, qtype, nsset, &flawedNSSet, depth, beenthere); //  pass beenthere to both occasions
   }
 
-  res = doResolveAt(nsset, subdomain, flawedNSSet, qname, qtype, ret, depth, beenthere, state, stopAtDelegation);
+  try {
+    res = doResolveAt(nsset, subdomain, flawedNSSet, qname, qtype, ret, depth, beenthere, state, stopAtDelegation);
+  }
+  catch (const ImmediateServFailException&) {
+    /* running out of time (max-total-msec) is a reason to fall back to stale data,
+       other immediate failures, like a query killed by policy, are not */
+    if (depth > 0 || !s_maxtotusec || d_totUsec <= s_maxtotusec || !serveStaleFromCache(qname, qtype, ret, depth, state, res)) {
+      throw;
+    }
+  }
+
+  if (res < 0 || res == RCode::ServFail) {
+    serveStaleFromCache(qname, qtype, ret, depth, state, res);
+  }
 
   /* Apply Post filtering policies */
   if (d_wantsRPZ && !d_appliedPolicy.wasHit()) {
@@ -1056,6 +1145,51 @@ int SyncRes::doResolveNoQNameMinimization(const DNSName &qname, const QType qtyp
   return res<0 ? RCode::ServFail : res;
 }
 
+// Resolution failed, see if the cache holds expired records for this name that are still within
+// the serve-stale window. The cache extends the records it hands out and schedules their refresh.
+bool SyncRes::serveStaleFromCache(const DNSName& qname, const QType qtype, vector<DNSRecord>& ret, unsigned int depth, vState& state, int& res)
+{
+  if (MemRecursorCache::s_maxServedStaleExtensions == 0 || d_refresh || d_serveStale) {
+    return false;
+  }
+
+  vector<DNSRecord> staleRet;
+  vState staleState = vState::Indeterminate;
+  set<GetBestNSAnswer> staleBeenthere;
+  int staleRes;
+
+  const bool oldCacheOnly = setCacheOnly(true);
+  d_serveStale = true;
+  try {
+    staleRes = doResolveNoQNameMinimization(qname, qtype, staleRet, depth, staleBeenthere, staleState, nullptr, nullptr, false);
+  }
+  catch (const ImmediateServFailException&) {
+    staleRes = RCode::ServFail;
+  }
+  catch (...) {
+    setCacheOnly(oldCacheOnly);
+    d_serveStale = false;
+    throw;
+  }
+  setCacheOnly(oldCacheOnly);
+  d_serveStale = false;
+
+  if (staleRes == RCode::ServFail || staleRet.empty()) {
+    return false;
+  }
+
+  if (doLog()) {
+    string prefix = d_prefix;
+    prefix.append(depth, ' ');
+    LOG(prefix << qname << ": Resolution failed, serving stale data from the cache" << endl);
+  }
+  ++s_servedstale;
+  ret = std::move(staleRet);
+  state = staleState;
+  res = staleRes;
+  return true;
+}
+
 #if 0
 // for testing purposes
 static bool ipv6First(const ComboAddress& a, const ComboAddress& b)
@@ -1094,14 +1228,14 @@ vector<ComboAddress> SyncRes::getAddrs(const DNSName &qname, unsigned int depth,
   try {
     // First look for both A and AAAA in the cache and be satisfied if we find anything
     res_t cset;
-    if (s_doIPv4 && g_recCache->get(d_now.tv_sec, qname, QType::A, false, &cset, d_cacheRemote, d_refresh, d_routingTag) > 0) {
+    if (s_doIPv4 && g_recCache->get(d_now.tv_sec, qname, QType::A, false, &cset, d_cacheRemote, getCacheFlags(), d_routingTag) > 0) {
       for (const auto &i : cset) {
         if (auto rec = getRR<ARecordContent>(i)) {
           ret.push_back(rec->getCA(53));
         }
       }
     }
-    if (s_doIPv6 && g_recCache->get(d_now.tv_sec, qname, QType::AAAA, false, &cset, d_cacheRemote, d_refresh, d_routingTag) > 0) {
+    if (s_doIPv6 && g_recCache->get(d_now.tv_sec, qname, QType::AAAA, false, &cset, d_cacheRemote, getCacheFlags(), d_routingTag) > 0) {
       for (const auto &i : cset) {
         if (auto rec = getRR<AAAARecordContent>(i)) {
           ret.push_back(rec->getCA(53));
@@ -1139,7 +1273,7 @@ vector<ComboAddress> SyncRes::getAddrs(const DNSName &qname, unsigned int depth,
           // We have some IPv4 records, don't bother with going out to get IPv6, but do consult the cache, we might have
           // encountered some IPv6 glue
           cset.clear();
-          if (g_recCache->get(d_now.tv_sec, qname, QType::AAAA, false, &cset, d_cacheRemote, d_refresh, d_routingTag) > 0) {
+          if (g_recCache->get(d_now.tv_sec, qname, QType::AAAA, false, &cset, d_cacheRemote, getCacheFlags(), d_routingTag) > 0) {
             for (const auto &i : cset) {
               if (auto rec = getRR<AAAARecordContent>(i)) {
                 ret.push_back(rec->getCA(53));
@@ -1169,13 +1303,16 @@ vector<ComboAddress> SyncRes::getAddrs(const DNSName &qname, unsigned int depth,
      is only one or none at all in the current set.
   */
   map<ComboAddress, float> speeds;
-  auto& collection = t_sstorage.nsSpeeds[qname];
-  float factor = collection.getFactor(d_now);
-  for(const auto& val: ret) {
-    speeds[val] = collection.d_collection[val].get(factor);
-  }
+  {
+    auto lock = s_nsSpeeds.lock(qname);
+    auto& collection = (*lock)[qname];
+    float factor = collection.getFactor(d_now);
+    for(const auto& val: ret) {
+      speeds[val] = collection.d_collection[val].get(factor);
+    }
 
-  t_sstorage.nsSpeeds[qname].purge(speeds);
+    collection.purge(speeds);
+  }
 
   if (ret.size() > 1) {
     shuffle(ret.begin(), ret.end(), pdns::dns_random_engine());
@@ -1222,7 +1359,7 @@ void SyncRes::getBestNSFromCache(const DNSName &qname, const QType qtype, vector
     vector<DNSRecord> ns;
     *flawedNSSet = false;
 
-    if(g_recCache->get(d_now.tv_sec, subdomain, QType::NS, false, &ns, d_cacheRemote, d_refresh, d_routingTag) > 0) {
+    if(g_recCache->get(d_now.tv_sec, subdomain, QType::NS, false, &ns, d_cacheRemote, getCacheFlags(), d_routingTag) > 0) {
       bestns.reserve(ns.size());
 
       for(auto k=ns.cbegin();k!=ns.cend(); ++k) {
@@ -1238,7 +1375,7 @@ void SyncRes::getBestNSFromCache(const DNSName &qname, const QType qtype, vector
           const DNSRecord& dr=*k;
 	  auto nrr = getRR<NSRecordContent>(dr);
           if(nrr && (!nrr->getNS().isPartOf(subdomain) || g_recCache->get(d_now.tv_sec, nrr->getNS(), nsqt,
-                                                                          false, doLog() ? &aset : 0, d_cacheRemote, d_refresh, d_routingTag) > 5)) {
+                                                                          false, doLog() ? &aset : 0, d_cacheRemote, getCacheFlags(), d_routingTag) > 5)) {
             bestns.push_back(dr);
             LOG(prefix<<qname<<": NS (with ip, or non-glue) in cache for '"<<subdomain<<"' -> '"<<nrr->getNS()<<"'"<<endl);
             LOG(prefix<<qname<<": within bailiwick: "<< nrr->getNS().isPartOf(subdomain));
@@ -1439,7 +1576,7 @@ bool SyncRes::doCNAMECacheCheck(const DNSName &qname, const QType qtype, vector<
   QType foundQT = QType::ENT;
 
   /* we don't require auth data for forward-recurse lookups */
-  if (g_recCache->get(d_now.tv_sec, qname, QType::CNAME, !wasForwardRecurse && d_requireAuthData, &cset, d_cacheRemote, d_refresh, d_routingTag, d_doDNSSEC ? &signatures : nullptr, d_doDNSSEC ? &authorityRecs : nullptr, &d_wasVariable, &state, &wasAuth, &authZone) > 0) {
+  if (g_recCache->get(d_now.tv_sec, qname, QType::CNAME, !wasForwardRecurse && d_requireAuthData, &cset, d_cacheRemote, getCacheFlags(), d_routingTag, d_doDNSSEC ? &signatures : nullptr, d_doDNSSEC ? &authorityRecs : nullptr, &d_wasVariable, &state, &wasAuth, &authZone) > 0) {
     foundName = qname;
     foundQT = QType::CNAME;
   }
@@ -1455,7 +1592,7 @@ bool SyncRes::doCNAMECacheCheck(const DNSName &qname, const QType qtype, vector<
       if (dnameName == qname && qtype != QType::DNAME) { // The client does not want a DNAME, but we've reached the QNAME already. So there is no match
         break;
       }
-      if (g_recCache->get(d_now.tv_sec, dnameName, QType::DNAME, !wasForwardRecurse && d_requireAuthData, &cset, d_cacheRemote, d_refresh, d_routingTag, d_doDNSSEC ? &signatures : nullptr, d_doDNSSEC ? &authorityRecs : nullptr, &d_wasVariable, &state, &wasAuth, &authZone) > 0) {
+      if (g_recCache->get(d_now.tv_sec, dnameName, QType::DNAME, !wasForwardRecurse && d_requireAuthData, &cset, d_cacheRemote, getCacheFlags(), d_routingTag, d_doDNSSEC ? &signatures : nullptr, d_doDNSSEC ? &authorityRecs : nullptr, &d_wasVariable, &state, &wasAuth, &authZone) > 0) {
         foundName = dnameName;
         foundQT = QType::DNAME;
         break;
@@ -1782,29 +1919,15 @@ bool SyncRes::doCacheCheck(const DNSName &qname, const DNSName& authname, bool w
       }
     }
   } else if (s_hardenNXD != HardenNXD::No && !qname.isRoot() && !wasForwardedOrAuthZone) {
-    auto labels = qname.getRawLabels();
-    DNSName negCacheName(g_rootdnsname);
-    negCacheName.prependRawLabel(labels.back());
-    labels.pop_back();
-    while(!labels.empty()) {
-      if (g_negCache->get(negCacheName, QType::ENT, d_now, ne, true)) {
-        if (ne.d_validationState == vState::Indeterminate && validationEnabled()) {
-          // LOG(prefix << negCacheName <<  " negatively cached and vState::Indeterminate, trying to validate NXDOMAIN" << endl);
-          // ...
-          // And get the updated ne struct
-          //t_sstorage.negcache.get(negCacheName, QType(0), d_now, ne, true);
-        }
-        if ((s_hardenNXD == HardenNXD::Yes && !vStateIsBogus(ne.d_validationState)) || ne.d_validationState == vState::Secure) {
-          res = RCode::NXDomain;
-          sttl = ne.d_ttd - d_now.tv_sec;
-          giveNegative = true;
-          cachedState = ne.d_validationState;
-          LOG(prefix<<qname<<": Name '"<<negCacheName<<"' and below, is negatively cached via '"<<ne.d_auth<<"' for another "<<sttl<<" seconds"<<endl);
-          break;
-        }
-      }
-      negCacheName.prependRawLabel(labels.back());
-      labels.pop_back();
+    auto acceptDenial = [](const NegCache::NegCacheEntry& entry) {
+      return (s_hardenNXD == HardenNXD::Yes && !vStateIsBogus(entry.d_validationState)) || entry.d_validationState == vState::Secure;
+    };
+    if (g_negCache->getDeniedAncestor(qname, d_now, ne, acceptDenial)) {
+      res = RCode::NXDomain;
+      sttl = ne.d_ttd - d_now.tv_sec;
+      giveNegative = true;
+      cachedState = ne.d_validationState;
+      LOG(prefix<<qname<<": Name '"<<ne.d_name<<"' and below, is negatively cached via '"<<ne.d_auth<<"' for another "<<sttl<<" seconds"<<endl);
     }
   }
 
@@ -1841,7 +1964,7 @@ bool SyncRes::doCacheCheck(const DNSName &qname, const DNSName& authname, bool w
   uint32_t capTTL = std::numeric_limits<uint32_t>::max();
   bool wasCachedAuth;
 
-  if(g_recCache->get(d_now.tv_sec, sqname, sqt, !wasForwardRecurse && d_requireAuthData, &cset, d_cacheRemote, d_refresh, d_routingTag, d_doDNSSEC ? &signatures : nullptr, d_doDNSSEC ? &authorityRecs : nullptr, &d_wasVariable, &cachedState, &wasCachedAuth) > 0) {
+  if(g_recCache->get(d_now.tv_sec, sqname, sqt, !wasForwardRecurse && d_requireAuthData, &cset, d_cacheRemote, getCacheFlags(), d_routingTag, d_doDNSSEC ? &signatures : nullptr, d_doDNSSEC ? &authorityRecs : nullptr, &d_wasVariable, &cachedState, &wasCachedAuth) > 0) {
 
     LOG(prefix<<sqname<<": Found cache hit for "<<sqt.toString()<<": ");
 
@@ -1975,7 +2098,7 @@ inline std::vector<std::pair<DNSName, float>> SyncRes::shuffleInSpeedOrder(NsSet
   std::vector<std::pair<DNSName, float>> rnameservers;
   rnameservers.reserve(tnameservers.size());
   for(const auto& tns: tnameservers) {
-    float speed = t_sstorage.nsSpeeds[tns.first].get(d_now);
+    float speed = (*s_nsSpeeds.lock(tns.first))[tns.first].get(d_now);
     rnameservers.push_back({tns.first, speed});
     if(tns.first.empty()) // this was an authoritative OOB zone, don't pollute the nsSpeeds with that
       return rnameservers;
@@ -2009,7 +2132,7 @@ inline vector<ComboAddress> SyncRes::shuffleForwardSpeed(const vector<ComboAddre
   for(const auto& val: nameservers) {
     float speed;
     DNSName nsName = DNSName(val.toStringWithPort());
-    speed=t_sstorage.nsSpeeds[nsName].get(d_now);
+    speed=(*s_nsSpeeds.lock(nsName))[nsName].get(d_now);
     speeds[val]=speed;
   }
   shuffle(nameservers.begin(),nameservers.end(), pdns::dns_random_engine());
@@ -2313,7 +2436,7 @@ vector<ComboAddress> SyncRes::retrieveAddressesForNS(const std::string& prefix,
   size_t nonresolvingfails = 0;
   if (!tns->first.empty()) {
     if (s_nonresolvingnsmaxfails > 0) {
-      nonresolvingfails = t_sstorage.nonresolving.value(tns->first);
+      nonresolvingfails = s_nonresolving.lock(tns->first)->value(tns->first);
       if (nonresolvingfails >= s_nonresolvingnsmaxfails) {
         LOG(prefix<<qname<<": NS "<<tns->first<< " in non-resolving map, skipping"<<endl);
         return result;
@@ -2330,7 +2453,7 @@ vector<ComboAddress> SyncRes::retrieveAddressesForNS(const std::string& prefix,
       if (s_nonresolvingnsmaxfails > 0 && d_outqueries > oldOutQueries) {
         auto dontThrottleNames = g_dontThrottleNames.getLocal();
         if (!dontThrottleNames->check(tns->first)) {
-          t_sstorage.nonresolving.incr(tns->first, d_now);
+          s_nonresolving.lock(tns->first)->incr(tns->first, d_now);
         }
       }
       throw ex;
@@ -2339,12 +2462,12 @@ vector<ComboAddress> SyncRes::retrieveAddressesForNS(const std::string& prefix,
       if (result.empty()) {
         auto dontThrottleNames = g_dontThrottleNames.getLocal();
         if (!dontThrottleNames->check(tns->first)) {
-          t_sstorage.nonresolving.incr(tns->first, d_now);
+          s_nonresolving.lock(tns->first)->incr(tns->first, d_now);
         }
       }
       else if (nonresolvingfails > 0) {
         // Succeeding resolve, clear memory of recent failures
-        t_sstorage.nonresolving.clear(tns->first);
+        s_nonresolving.lock(tns->first)->clear(tns->first);
       }
     }
     pierceDontQuery=false;
@@ -2366,12 +2489,12 @@ vector<ComboAddress> SyncRes::retrieveAddressesForNS(const std::string& prefix,
 
 bool SyncRes::throttledOrBlocked(const std::string& prefix, const ComboAddress& remoteIP, const DNSName& qname, const QType qtype, bool pierceDontQuery)
 {
-  if(t_sstorage.throttle.shouldThrottle(d_now.tv_sec, boost::make_tuple(remoteIP, "", 0))) {
+  if(isThrottled(d_now.tv_sec, remoteIP)) {
     LOG(prefix<<qname<<": server throttled "<<endl);
     s_throttledqueries++; d_throttledqueries++;
     return true;
   }
-  else if(t_sstorage.throttle.shouldThrottle(d_now.tv_sec, boost::make_tuple(remoteIP, qname, qtype.getCode()))) {
+  else if(isThrottled(d_now.tv_sec, remoteIP, qname, qtype.getCode())) {
     LOG(prefix<<qname<<": query throttled "<<remoteIP.toString()<<", "<<qname<<"; "<<qtype<<endl);
     s_throttledqueries++; d_throttledqueries++;
     return true;
@@ -4011,21 +4134,21 @@ bool SyncRes::doResolveAtThisIP(const std::string& prefix, const DNSName& qname,
     if (resolveret != LWResult::Result::OSLimitError && !chained && !dontThrottle) {
       // don't account for resource limits, they are our own fault
       // And don't throttle when the IP address is on the dontThrottleNetmasks list or the name is part of dontThrottleNames
-      t_sstorage.nsSpeeds[nsName.empty()? DNSName(remoteIP.toStringWithPort()) : nsName].submit(remoteIP, 1000000, d_now); // 1 sec
+      submitNSSpeed(nsName.empty()? DNSName(remoteIP.toStringWithPort()) : nsName, remoteIP, 1000000, d_now); // 1 sec
 
       // code below makes sure we don't filter COM or the root
-      if (s_serverdownmaxfails > 0 && (auth != g_rootdnsname) && t_sstorage.fails.incr(remoteIP, d_now) >= s_serverdownmaxfails) {
+      if (s_serverdownmaxfails > 0 && (auth != g_rootdnsname) && s_fails.lock(remoteIP)->incr(remoteIP, d_now) >= s_serverdownmaxfails) {
         LOG(prefix<<qname<<": Max fails reached resolving on "<< remoteIP.toString() <<". Going full throttle for "<< s_serverdownthrottletime <<" seconds" <<endl);
         // mark server as down
-        t_sstorage.throttle.throttle(d_now.tv_sec, boost::make_tuple(remoteIP, "", 0), s_serverdownthrottletime, 10000);
+        doThrottle(d_now.tv_sec, remoteIP, s_serverdownthrottletime, 10000);
       }
       else if (resolveret == LWResult::Result::Timeout) {
         // unreachable, 1 minute or 100 queries
-        t_sstorage.throttle.throttle(d_now.tv_sec, boost::make_tuple(remoteIP, qname, qtype.getCode()), 60, 100);
+        doThrottle(d_now.tv_sec, remoteIP, qname, qtype.getCode(), 60, 100);
       }
       else {
         // timeout, 10 seconds or 5 queries
-        t_sstorage.throttle.throttle(d_now.tv_sec, boost::make_tuple(remoteIP, qname, qtype.getCode()), 10, 5);
+        doThrottle(d_now.tv_sec, remoteIP, qname, qtype.getCode(), 10, 5);
       }
     }
 
@@ -4037,14 +4160,14 @@ bool SyncRes::doResolveAtThisIP(const std::string& prefix, const DNSName& qname,
     if (!chained && !dontThrottle) {
 
       // let's make sure we prefer a different server for some time, if there is one available
-      t_sstorage.nsSpeeds[nsName.empty()? DNSName(remoteIP.toStringWithPort()) : nsName].submit(remoteIP, 1000000, d_now); // 1 sec
+      submitNSSpeed(nsName.empty()? DNSName(remoteIP.toStringWithPort()) : nsName, remoteIP, 1000000, d_now); // 1 sec
 
       if (doTCP) {
         // we can be more heavy-handed over TCP
-        t_sstorage.throttle.throttle(d_now.tv_sec, boost::make_tuple(remoteIP, qname, qtype.getCode()), 60, 10);
+        doThrottle(d_now.tv_sec, remoteIP, qname, qtype.getCode(), 60, 10);
       }
       else {
-        t_sstorage.throttle.throttle(d_now.tv_sec, boost::make_tuple(remoteIP, qname, qtype.getCode()), 10, 2);
+        doThrottle(d_now.tv_sec, remoteIP, qname, qtype.getCode(), 10, 2);
       }
     }
     return false;
@@ -4058,10 +4181,10 @@ bool SyncRes::doResolveAtThisIP(const std::string& prefix, const DNSName& qname,
           // rather than throttling what could be the only server we have for this destination, let's make sure we try a different one if there is one available
           // on the other hand, we might keep hammering a server under attack if there is no other alternative, or the alternative is overwhelmed as well, but
           // at the very least we will detect that if our packets stop being answered
-          t_sstorage.nsSpeeds[nsName.empty()? DNSName(remoteIP.toStringWithPort()) : nsName].submit(remoteIP, 1000000, d_now); // 1 sec
+          submitNSSpeed(nsName.empty()? DNSName(remoteIP.toStringWithPort()) : nsName, remoteIP, 1000000, d_now); // 1 sec
         }
         else {
-          t_sstorage.throttle.throttle(d_now.tv_sec, boost::make_tuple(remoteIP, qname, qtype.getCode()), 60, 3);
+          doThrottle(d_now.tv_sec, remoteIP, qname, qtype.getCode(), 60, 3);
         }
       }
       return false;
@@ -4070,7 +4193,7 @@ bool SyncRes::doResolveAtThisIP(const std::string& prefix, const DNSName& qname,
 
   /* this server sent a valid answer, mark it backup up if it was down */
   if(s_serverdownmaxfails > 0) {
-    t_sstorage.fails.clear(remoteIP);
+    s_fails.lock(remoteIP)->clear(remoteIP);
   }
 
   if (lwr.d_tcbit) {
@@ -4080,7 +4203,7 @@ bool SyncRes::doResolveAtThisIP(const std::string& prefix, const DNSName& qname,
       LOG(prefix<<qname<<": truncated bit set, over TCP?"<<endl);
       if (!dontThrottle) {
         /* let's treat that as a ServFail answer from this server */
-        t_sstorage.throttle.throttle(d_now.tv_sec, boost::make_tuple(remoteIP, qname, qtype.getCode()), 60, 3);
+        doThrottle(d_now.tv_sec, remoteIP, qname, qtype.getCode(), 60, 3);
       }
       return false;
     }
@@ -4460,7 +4583,7 @@ int SyncRes::doResolveAt(NsSet &nameservers, DNSName auth, bool flawedNSSet, con
           */
           //        cout<<"msec: "<<lwr.d_usec/1000.0<<", "<<g_avgLatency/1000.0<<'\n';
 
-          t_sstorage.nsSpeeds[tns->first.empty()? DNSName(remoteIP->toStringWithPort()) : tns->first].submit(*remoteIP, lwr.d_usec, d_now);
+          submitNSSpeed(tns->first.empty()? DNSName(remoteIP->toStringWithPort()) : tns->first, *remoteIP, lwr.d_usec, d_now);
 
           /* we have received an answer, are we done ? */
           bool done = processAnswer(depth, lwr, qname, qtype, auth, wasForwarded, ednsmask, sendRDQuery, nameservers, ret, luaconfsLocal->dfe, &gotNewServers, &rcode, state, *remoteIP);
@@ -4475,7 +4598,7 @@ int SyncRes::doResolveAt(NsSet &nameservers, DNSName auth, bool flawedNSSet, con
             break;
           }
           /* was lame */
-          t_sstorage.throttle.throttle(d_now.tv_sec, boost::make_tuple(*remoteIP, qname, qtype.getCode()), 60, 100);
+          doThrottle(d_now.tv_sec, *remoteIP, qname, qtype.getCode(), 60, 100);
         }
 
         if (gotNewServers) {
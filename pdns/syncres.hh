@@ -33,6 +33,7 @@
 #include <iostream>
 #include <utility>
 #include "misc.hh"
+#include "lock.hh"
 #include "lwres.hh"
 #include <boost/optional.hpp>
 #include <boost/utility.hpp>
@@ -210,7 +211,7 @@ public:
                                   ordered_non_unique<tag<time_t>, member<value_t, time_t, &value_t::last>>
                                   >> cont_t;
 
-  cont_t getMap() const {
+  const cont_t& getMap() const {
     return d_cont;
   }
   counter_t value(const T& t) const
@@ -260,6 +261,59 @@ private:
   cont_t d_cont;
 };
 
+/* A table shared between all threads, split into shards that each have their own lock,
+   so that threads looking up or updating different servers or names do not contend.
+   The shard is picked from the address or name an entry is about, like the record and
+   negative caches do. */
+template<class T>
+class SharedShardedTable : public boost::noncopyable
+{
+public:
+  SharedShardedTable(size_t shardsCount = 64) : d_shards(shardsCount)
+  {
+  }
+
+  LockGuardedHolder<T> lock(const ComboAddress& address)
+  {
+    return getShard(ComboAddress::addressOnlyHash()(address)).lock();
+  }
+
+  LockGuardedHolder<T> lock(const DNSName& name)
+  {
+    return getShard(name.hash()).lock();
+  }
+
+  /* calls func on every shard in turn, holding only the lock of that shard */
+  template<typename F>
+  void forEachShard(F func)
+  {
+    for (auto& shard : d_shards) {
+      auto lock = shard.lock();
+      func(*lock);
+    }
+  }
+
+  uint64_t size()
+  {
+    uint64_t count = 0;
+    forEachShard([&count](T& table) { count += table.size(); });
+    return count;
+  }
+
+  void clear()
+  {
+    forEachShard([](T& table) { table.clear(); });
+  }
+
+private:
+  LockGuarded<T>& getShard(size_t hash)
+  {
+    return d_shards.at(hash % d_shards.size());
+  }
+
+  std::vector<LockGuarded<T>> d_shards;
+};
+
 extern std::unique_ptr<NegCache> g_negCache;
 
 class SyncRes : public boost::noncopyable
@@ -281,6 +335,10 @@ public:
 
     float getFactor(const struct timeval &now) {
       float diff = makeFloat(d_lastget - now);
+      if (diff > 0) {
+        // the table is shared between threads, another one might have used a slightly more recent 'now'
+        return 1.0f;
+      }
       return expf(diff / 60.0f); // is 1.0 or less
     }
     
@@ -407,11 +465,6 @@ public:
   };
 
   struct ThreadLocalStorage {
-    nsspeeds_t nsSpeeds;
-    throttle_t throttle;
-    ednsstatus_t ednsstatus;
-    fails_t<ComboAddress> fails;
-    fails_t<DNSName> nonresolving;
     std::shared_ptr<domainmap_t> domainmap;
   };
 
@@ -471,102 +524,109 @@ public:
   }
   static void pruneNSSpeeds(time_t limit)
   {
-    for(auto i = t_sstorage.nsSpeeds.begin(), end = t_sstorage.nsSpeeds.end(); i != end; ) {
-      if(i->second.stale(limit)) {
-        i = t_sstorage.nsSpeeds.erase(i);
-      }
-      else {
-        ++i;
+    s_nsSpeeds.forEachShard([limit](nsspeeds_t& nsSpeeds) {
+      for(auto i = nsSpeeds.begin(), end = nsSpeeds.end(); i != end; ) {
+        if(i->second.stale(limit)) {
+          i = nsSpeeds.erase(i);
+        }
+        else {
+          ++i;
+        }
       }
-    }
+    });
   }
   static uint64_t getNSSpeedsSize()
   {
-    return t_sstorage.nsSpeeds.size();
+    return s_nsSpeeds.size();
   }
   static void submitNSSpeed(const DNSName& server, const ComboAddress& ca, uint32_t usec, const struct timeval& now)
   {
-    t_sstorage.nsSpeeds[server].submit(ca, usec, now);
+    (*s_nsSpeeds.lock(server))[server].submit(ca, usec, now);
   }
   static void clearNSSpeeds()
   {
-    t_sstorage.nsSpeeds.clear();
+    s_nsSpeeds.clear();
   }
   static float getNSSpeed(const DNSName& server, const ComboAddress& ca)
   {
-    return t_sstorage.nsSpeeds[server].d_collection[ca].peek();
+    return (*s_nsSpeeds.lock(server))[server].d_collection[ca].peek();
   }
   static EDNSStatus::EDNSMode getEDNSStatus(const ComboAddress& server)
   {
-    const auto& it = t_sstorage.ednsstatus.find(server);
-    if (it == t_sstorage.ednsstatus.end())
+    auto lock = s_ednsstatus.lock(server);
+    const auto& it = lock->find(server);
+    if (it == lock->end())
       return EDNSStatus::UNKNOWN;
 
     return it->mode;
   }
   static uint64_t getEDNSStatusesSize()
   {
-    return t_sstorage.ednsstatus.size();
+    return s_ednsstatus.size();
   }
   static void clearEDNSStatuses()
   {
-    t_sstorage.ednsstatus.clear();
+    s_ednsstatus.clear();
   }
   static void pruneEDNSStatuses(time_t cutoff)
   {
-    t_sstorage.ednsstatus.prune(cutoff);
+    s_ednsstatus.forEachShard([cutoff](ednsstatus_t& ednsstatus) { ednsstatus.prune(cutoff); });
   }
   static uint64_t getThrottledServersSize()
   {
-    return t_sstorage.throttle.size();
+    return s_throttle.size();
   }
   static void pruneThrottledServers()
   {
-    t_sstorage.throttle.prune();
+    s_throttle.forEachShard([](throttle_t& throttle) { throttle.prune(); });
   }
   static void clearThrottle()
   {
-    t_sstorage.throttle.clear();
+    s_throttle.clear();
   }
   static bool isThrottled(time_t now, const ComboAddress& server, const DNSName& target, uint16_t qtype)
   {
-    return t_sstorage.throttle.shouldThrottle(now, boost::make_tuple(server, target, qtype));
+    return s_throttle.lock(server)->shouldThrottle(now, boost::make_tuple(server, target, qtype));
   }
   static bool isThrottled(time_t now, const ComboAddress& server)
   {
-    return t_sstorage.throttle.shouldThrottle(now, boost::make_tuple(server, "", 0));
+    return s_throttle.lock(server)->shouldThrottle(now, boost::make_tuple(server, "", 0));
   }
   static void doThrottle(time_t now, const ComboAddress& server, time_t duration, unsigned int tries)
   {
-    t_sstorage.throttle.throttle(now, boost::make_tuple(server, "", 0), duration, tries);
+    s_throttle.lock(server)->throttle(now, boost::make_tuple(server, "", 0), duration, tries);
+  }
+  static void doThrottle(time_t now, const ComboAddress& server, const DNSName& target, uint16_t qtype, time_t duration, unsigned int tries)
+  {
+    s_throttle.lock(server)->throttle(now, boost::make_tuple(server, target, qtype), duration, tries);
   }
   static uint64_t getFailedServersSize()
   {
-    return t_sstorage.fails.size();
+    return s_fails.size();
   }
   static uint64_t getNonResolvingNSSize()
   {
-    return t_sstorage.nonresolving.size();
+    return s_nonresolving.size();
   }
   static void clearFailedServers()
   {
-    t_sstorage.fails.clear();
+    s_fails.clear();
   }
   static void clearNonResolvingNS()
   {
-    t_sstorage.nonresolving.clear();
+    s_nonresolving.clear();
   }
   static void pruneFailedServers(time_t cutoff)
   {
-    t_sstorage.fails.prune(cutoff);
+    s_fails.forEachShard([cutoff](fails_t<ComboAddress>& fails) { fails.prune(cutoff); });
   }
   static unsigned long getServerFailsCount(const ComboAddress& server)
   {
-    return t_sstorage.fails.value(server);
+    return s_fails.lock(server)->value(server);
   }
   static void pruneNonResolving(time_t cutoff)
   {
-    t_sstorage.nonresolving.prune(cutoff);
+    s_nonresolving.forEachShard([cutoff](fails_t<DNSName>& nonresolving) { nonresolving.prune(cutoff); });
   }
   static void setDomainMap(std::shared_ptr<domainmap_t> newMap)
   {
@@ -736,6 +796,14 @@ public:
 
   static thread_local ThreadLocalStorage t_sstorage;
 
+  /* what we learn about authoritative servers is shared between all threads,
+     so that a dead or slow server only has to be discovered once */
+  static SharedShardedTable<nsspeeds_t> s_nsSpeeds;
+  static SharedShardedTable<throttle_t> s_throttle;
+  static SharedShardedTable<ednsstatus_t> s_ednsstatus;
+  static SharedShardedTable<fails_t<ComboAddress>> s_fails;
+  static SharedShardedTable<fails_t<DNSName>> s_nonresolving;
+
   static pdns::stat_t s_queries;
   static pdns::stat_t s_outgoingtimeouts;
   static pdns::stat_t s_outgoing4timeouts;
@@ -743,6 +811,7 @@ public:
   static pdns::stat_t s_throttledqueries;
   static pdns::stat_t s_dontqueries;
   static pdns::stat_t s_qnameminfallbacksuccess;
+  static pdns::stat_t s_servedstale;
   static pdns::stat_t s_authzonequeries;
   static pdns::stat_t s_outqueries;
   static pdns::stat_t s_tcpoutqueries;
@@ -854,6 +923,19 @@ private:
   bool doCacheCheck(const DNSName &qname, const DNSName& authname, bool wasForwardedOrAuthZone, bool wasAuthZone, bool wasForwardRecurse, QType qtype, vector<DNSRecord>&ret, unsigned int depth, int &res, vState& state);
   void getBestNSFromCache(const DNSName &qname, QType qtype, vector<DNSRecord>&bestns, bool* flawedNSSet, unsigned int depth, set<GetBestNSAnswer>& beenthere, const boost::optional<DNSName>& cutOffDomain = boost::none);
   DNSName getBestNSNamesFromCache(const DNSName &qname, QType qtype, NsSet& nsset, bool* flawedNSSet, unsigned int depth, set<GetBestNSAnswer>&beenthere);
+  bool serveStaleFromCache(const DNSName& qname, QType qtype, vector<DNSRecord>& ret, unsigned int depth, vState& state, int& res);
+
+  MemRecursorCache::Flags getCacheFlags() const
+  {
+    MemRecursorCache::Flags flags = MemRecursorCache::None;
+    if (d_refresh) {
+      flags |= MemRecursorCache::Refresh;
+    }
+    if (d_serveStale) {
+      flags |= MemRecursorCache::ServeStale;
+    }
+    return flags;
+  }
 
   inline vector<std::pair<DNSName, float>> shuffleInSpeedOrder(NsSet &nameservers, const string &prefix);
   inline vector<ComboAddress> shuffleForwardSpeed(const vector<ComboAddress> &rnameservers, const string &prefix, const bool wasRd);
@@ -933,6 +1015,7 @@ private:
   bool d_queryReceivedOverTCP{false};
   bool d_followCNAME{true};
   bool d_refresh{false};
+  bool d_serveStale{false};
 
   LogMode d_lm;
 };
@@ -966,6 +1049,7 @@ struct PacketID
   int fd{-1};
   int tcpsock{0};  // or wait for an event on a TCP fd
   mutable bool closed{false}; // Processing already started, don't accept new chained ids
+  bool sharedTimeout{false}; // the query shared by another thread we are waiting for timed out
   bool inIncompleteOkay{false};
   uint16_t id{0};  // wait for a specific id/remote pair
   uint16_t type{0};             // and this is its type
@@ -1024,7 +1108,7 @@ struct PacketIDBirthdayCompare
   }
 };
 extern std::unique_ptr<MemRecursorCache> g_recCache;
-extern thread_local std::unique_ptr<RecursorPacketCache> t_packetCache;
+extern std::unique_ptr<RecursorPacketCache> g_packetCache;
 typedef MTasker<std::shared_ptr<PacketID>, PacketBuffer, PacketIDCompare> MT_t;
 MT_t* getMT();
 
@@ -1040,6 +1124,16 @@ struct RecursorStats
   pdns::AtomicHistogram cumulativeAnswers;
   pdns::AtomicHistogram cumulativeAuth4Answers;
   pdns::AtomicHistogram cumulativeAuth6Answers;
+  // Time spent in each Lua hook, the FFI variant of a hook is accounted with the regular one
+  pdns::AtomicHistogram luaGettag;
+  pdns::AtomicHistogram luaIpfilter;
+  pdns::AtomicHistogram luaPrerpz;
+  pdns::AtomicHistogram luaPreresolve;
+  pdns::AtomicHistogram luaNxdomain;
+  pdns::AtomicHistogram luaNodata;
+  pdns::AtomicHistogram luaPostresolve;
+  pdns::AtomicHistogram luaPreoutquery;
+  pdns::AtomicHistogram luaPolicyEventFilter;
   pdns::stat_t_trait<double> avgLatencyUsec;
   pdns::stat_t_trait<double> avgLatencyOursUsec;
   pdns::stat_t qcounter;     // not increased for unauth packets
@@ -1075,6 +1169,7 @@ struct RecursorStats
   pdns::stat_t dnssecCheckDisabledQueries;
   pdns::stat_t variableResponses;
   pdns::stat_t maxMThreadStackUsage;
+  pdns::stat_t maxMThreadStackTouched;
   pdns::stat_t dnssecValidations; // should be the sum of all dnssecResult* stats
   std::map<vState, pdns::stat_t > dnssecResults;
   std::map<vState, pdns::stat_t > xdnssecResults;
@@ -1084,6 +1179,10 @@ struct RecursorStats
   pdns::stat_t proxyProtocolInvalidCount{0};
   pdns::stat_t nodLookupsDroppedOversize{0};
   pdns::stat_t dns64prefixanswers{0};
+  pdns::stat_t udpSocketsCreated{0};
+  pdns::stat_t udpSocketsReused{0};
+  pdns::stat_t sharedOutgoingQueries{0};
+  pdns::stat_t sharedOutgoingDrops{0};
 
   RecursorStats() :
     answers("answers", { 1000, 10000, 100000, 1000000 }),
@@ -1093,7 +1192,17 @@ struct RecursorStats
     cumulativeAnswers("cumul-clientanswers-", 10, 19),
     // These two will be merged when outputting
     cumulativeAuth4Answers("cumul-authanswers-", 1000, 13),
-    cumulativeAuth6Answers("cumul-authanswers-", 1000, 13)
+    cumulativeAuth6Answers("cumul-authanswers-", 1000, 13),
+    // These will be merged when outputting, with a label indicating the hook
+    luaGettag("cumul-luahooks-gettag-", 1, 16),
+    luaIpfilter("cumul-luahooks-ipfilter-", 1, 16),
+    luaPrerpz("cumul-luahooks-prerpz-", 1, 16),
+    luaPreresolve("cumul-luahooks-preresolve-", 1, 16),
+    luaNxdomain("cumul-luahooks-nxdomain-", 1, 16),
+    luaNodata("cumul-luahooks-nodata-", 1, 16),
+    luaPostresolve("cumul-luahooks-postresolve-", 1, 16),
+    luaPreoutquery("cumul-luahooks-preoutquery-", 1, 16),
+    luaPolicyEventFilter("cumul-luahooks-policyeventfilter-", 1, 16)
   {
   }
 };
@@ -1179,28 +1288,13 @@ int getFakePTRRecords(const DNSName& qname, vector<DNSRecord>& ret);
 template<class T> T broadcastAccFunction(const boost::function<T*()>& func);
 
 std::shared_ptr<SyncRes::domainmap_t> parseAuthAndForwards();
-uint64_t* pleaseGetNsSpeedsSize();
-uint64_t* pleaseGetFailedServersSize();
-uint64_t* pleaseGetEDNSStatusesSize();
-uint64_t* pleaseGetConcurrentQueries();
-uint64_t* pleaseGetThrottleSize();
-uint64_t* pleaseGetPacketCacheHits();
-uint64_t* pleaseGetPacketCacheSize();
-uint64_t* pleaseWipePacketCache(const DNSName& canon, bool subtree, uint16_t qtype=0xffff);
+/* these are read from the threads' state directly, without asking them over their pipe */
+uint64_t getConcurrentQueries();
+uint64_t getThreadCPUMsec(unsigned int n);
 void doCarbonDump(void*);
 bool primeHints(time_t now = time(nullptr));
 void primeRootNSZones(bool, unsigned int depth);
 
 extern __thread struct timeval g_now;
 
-struct ThreadTimes
-{
-  uint64_t msec;
-  vector<uint64_t> times;
-  ThreadTimes& operator+=(const ThreadTimes& rhs)
-  {
-    times.push_back(rhs.msec);
-    return *this;
-  }
-};
 
@@ -503,6 +503,7 @@ public:
   OpenSSLTLSIOCtx(TLSFrontend& fe): d_feContext(std::make_shared<OpenSSLFrontendContext>(fe.d_addr, fe.d_tlsConfig)), d_tlsCtx(std::unique_ptr<SSL_CTX, void(*)(SSL_CTX*)>(nullptr, SSL_CTX_free))
   {
     d_ticketsKeyRotationDelay = fe.d_tlsConfig.d_ticketsKeyRotationDelay;
+    d_reloadTicketKeyFile = fe.d_tlsConfig.d_reloadTicketKeyFile;
 
     if (fe.d_tlsConfig.d_enableTickets && fe.d_tlsConfig.d_numberOfTicketsKeys > 0) {
       /* use our own ticket keys handler so we can rotate them */
@@ -679,7 +680,16 @@ public:
 
   void rotateTicketsKey(time_t now) override
   {
-    d_feContext->d_ticketKeys.rotateTicketsKey(now);
+    try {
+      if (!d_reloadTicketKeyFile || !d_feContext->d_ticketKeys.reloadModifiedTicketsKeysFile()) {
+        d_feContext->d_ticketKeys.rotateTicketsKey(now);
+      }
+    }
+    catch (const std::exception& e) {
+      /* this might be called from a TLS callback, so we can't let the exception escape.
+         Keep the current keys and try again at the next rotation */
+      warnlog("Error while rotating the TLS tickets keys, keeping the current ones: %s", e.what());
+    }
 
     if (d_ticketsKeyRotationDelay > 0) {
       d_ticketsKeyNextRotation = now + d_ticketsKeyRotationDelay;
@@ -1433,6 +1443,7 @@ public:
   {
     int rc = 0;
     d_ticketsKeyRotationDelay = fe.d_tlsConfig.d_ticketsKeyRotationDelay;
+    d_reloadTicketKeyFile = fe.d_tlsConfig.d_reloadTicketKeyFile;
 
     gnutls_certificate_credentials_t creds;
     rc = gnutls_certificate_allocate_credentials(&creds);
@@ -1559,6 +1570,27 @@ public:
       return;
     }
 
+    auto currentState = *(d_ticketsKeyFileState.lock());
+    if (d_reloadTicketKeyFile && !currentState.d_file.empty()) {
+      /* the key is distributed via a file, possibly shared with other instances,
+         so only reload it if it has been updated */
+      if (TLSTicketsKeyFileState(currentState.d_file) != currentState) {
+        try {
+          loadTicketsKeys(currentState.d_file);
+          return;
+        }
+        catch (const std::exception& e) {
+          /* this is called from getConnection(), so we can't let the exception escape.
+             Keep the current key and try again at the next rotation */
+          warnlog("Error while reloading the TLS tickets key from '%s', keeping the current one: %s", currentState.d_file, e.what());
+        }
+      }
+      if (d_ticketsKeyRotationDelay > 0) {
+        d_ticketsKeyNextRotation = now + d_ticketsKeyRotationDelay;
+      }
+      return;
+    }
+
     auto newKey = std::make_shared<GnuTLSTicketsKey>();
 
     {
@@ -1576,10 +1608,12 @@ public:
       return;
     }
 
+    TLSTicketsKeyFileState state(file);
     auto newKey = std::make_shared<GnuTLSTicketsKey>(file);
     {
       *(d_ticketsKey.write_lock()) = newKey;
     }
+    *(d_ticketsKeyFileState.lock()) = std::move(state);
 
     if (d_ticketsKeyRotationDelay > 0) {
       d_ticketsKeyNextRotation = time(nullptr) + d_ticketsKeyRotationDelay;
@@ -1611,6 +1645,7 @@ private:
   std::vector<std::vector<uint8_t>> d_protos;
   gnutls_priority_t d_priorityCache{nullptr};
   SharedLockGuarded<std::shared_ptr<GnuTLSTicketsKey>> d_ticketsKey{nullptr};
+  LockGuarded<TLSTicketsKeyFileState> d_ticketsKeyFileState;
   bool d_enableTickets{true};
   bool d_validateCerts{true};
 };
@@ -128,6 +128,8 @@ protected:
   std::atomic_flag d_rotatingTicketsKey;
   std::atomic<time_t> d_ticketsKeyNextRotation{0};
   time_t d_ticketsKeyRotationDelay{0};
+  /* reload the tickets keys file, if modified, instead of generating a new key on rotation */
+  bool d_reloadTicketKeyFile{false};
 };
 
 class TLSFrontend
@@ -371,6 +371,40 @@ BOOST_AUTO_TEST_CASE(addECSWithoutEDNSAlreadyParsed)
   validateECS(packet, remote);
 }
 
+BOOST_AUTO_TEST_CASE(cachedECSOption)
+{
+  /* the same network, the same prefix length: same option, served from the cache */
+  string expected;
+  generateECSOption(ComboAddress("192.0.2.1"), expected, ECSSourcePrefixV4);
+  BOOST_CHECK_EQUAL(getCachedECSOption(ComboAddress("192.0.2.1"), ECSSourcePrefixV4), expected);
+  BOOST_CHECK_EQUAL(getCachedECSOption(ComboAddress("192.0.2.42"), ECSSourcePrefixV4), expected);
+  BOOST_CHECK_EQUAL(&getCachedECSOption(ComboAddress("192.0.2.1:53"), ECSSourcePrefixV4), &getCachedECSOption(ComboAddress("192.0.2.254"), ECSSourcePrefixV4));
+
+  /* a different prefix length */
+  expected.clear();
+  generateECSOption(ComboAddress("192.0.2.42"), expected, 32);
+  BOOST_CHECK_EQUAL(getCachedECSOption(ComboAddress("192.0.2.42"), 32), expected);
+  expected.clear();
+  generateECSOption(ComboAddress("192.0.2.42"), expected, ECSSourcePrefixV4);
+  BOOST_CHECK_EQUAL(getCachedECSOption(ComboAddress("192.0.2.42"), ECSSourcePrefixV4), expected);
+
+  /* a different network */
+  expected.clear();
+  generateECSOption(ComboAddress("198.51.100.1"), expected, ECSSourcePrefixV4);
+  BOOST_CHECK_EQUAL(getCachedECSOption(ComboAddress("198.51.100.1"), ECSSourcePrefixV4), expected);
+
+  /* IPv6 */
+  expected.clear();
+  generateECSOption(ComboAddress("2001:db8::1"), expected, ECSSourcePrefixV6);
+  BOOST_CHECK_EQUAL(getCachedECSOption(ComboAddress("2001:db8::1"), ECSSourcePrefixV6), expected);
+  BOOST_CHECK_EQUAL(getCachedECSOption(ComboAddress("2001:db8::ffff"), ECSSourcePrefixV6), expected);
+
+  /* and we should still have the IPv4 one */
+  expected.clear();
+  generateECSOption(ComboAddress("198.51.100.1"), expected, ECSSourcePrefixV4);
+  BOOST_CHECK_EQUAL(getCachedECSOption(ComboAddress("198.51.100.200"), ECSSourcePrefixV4), expected);
+}
+
 BOOST_AUTO_TEST_CASE(addECSWithEDNSNoECS) {
   bool ednsAdded = false;
   bool ecsAdded = false;
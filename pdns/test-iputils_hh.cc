@@ -245,6 +245,48 @@ BOOST_AUTO_TEST_CASE(test_Netmask) {
   BOOST_CHECK(full < empty);
 }
 
+BOOST_AUTO_TEST_CASE(test_Netmask_equality) {
+  /* all empty netmasks are equal, whatever is left in their address part */
+  Netmask empty1;
+  Netmask empty2;
+  BOOST_CHECK(empty1.empty());
+  BOOST_CHECK(empty1 == empty2);
+  BOOST_CHECK(!(empty1 < empty2));
+  BOOST_CHECK(!(empty2 < empty1));
+  BOOST_CHECK_EQUAL(hash_value(empty1), hash_value(empty2));
+
+  /* an empty netmask is not equal to a non-empty one, even one matching everything */
+  Netmask all("0.0.0.0/0");
+  Netmask all6("::/0");
+  Netmask full("255.255.255.255/32");
+  for (const auto& nm : {all, all6, full}) {
+    BOOST_CHECK(!(empty1 == nm));
+    BOOST_CHECK(!(nm == empty1));
+  }
+
+  /* same network and bits */
+  Netmask nm1("192.0.2.0/24");
+  Netmask nm2("192.0.2.42/24");
+  BOOST_CHECK(nm1 == nm2);
+  BOOST_CHECK_EQUAL(hash_value(nm1), hash_value(nm2));
+
+  /* different bits */
+  Netmask nm3("192.0.2.0/25");
+  BOOST_CHECK(!(nm1 == nm3));
+
+  /* different addresses */
+  Netmask nm4("192.0.3.0/24");
+  BOOST_CHECK(!(nm1 == nm4));
+
+  /* different families */
+  Netmask nm5("2001:db8::/24");
+  BOOST_CHECK(!(nm1 == nm5));
+  Netmask nm6("2001:db8::1/64");
+  Netmask nm7("2001:db8::2/64");
+  BOOST_CHECK(nm6 == nm7);
+  BOOST_CHECK_EQUAL(hash_value(nm6), hash_value(nm7));
+}
+
 static std::string NMGOutputToSorted(const std::string& str)
 {
   std::vector<std::string> vect;
@@ -398,4 +398,24 @@ BOOST_AUTO_TEST_CASE(test_makeBytesFromHex) {
   BOOST_CHECK_THROW(makeBytesFromHex("123"), std::range_error);
 }
 
+BOOST_AUTO_TEST_CASE(test_burtleCI) {
+  /* the case-insensitive hash should be equivalent to hashing the lowercased input,
+     for every length and for bytes outside of the ASCII range as well */
+  std::string input;
+  for (size_t idx = 0; idx < 80; idx++) {
+    input.push_back(static_cast<char>((idx * 37 + 11) % 256));
+  }
+  input.append("WwW.PowerDNS.CoM@[`{zZaA\x80\xc1\xda\xff");
+
+  for (size_t len = 0; len <= input.size(); len++) {
+    std::string lower;
+    for (size_t idx = 0; idx < len; idx++) {
+      lower.push_back(static_cast<char>(dns_tolower(static_cast<unsigned char>(input.at(idx)))));
+    }
+    for (const uint32_t init : { 0U, 42U, 0xffffffffU }) {
+      BOOST_CHECK_EQUAL(burtleCI(reinterpret_cast<const unsigned char*>(input.data()), len, init), burtle(reinterpret_cast<const unsigned char*>(lower.data()), len, init));
+    }
+  }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -393,4 +393,51 @@ BOOST_AUTO_TEST_CASE(test_recPacketCache_TCP) {
   BOOST_CHECK_EQUAL(fpacket, r1packet);
 }
 
+BOOST_AUTO_TEST_CASE(test_recPacketCache_Shards) {
+  /* a small number of shards, so that entries actually end up in different ones */
+  RecursorPacketCache rpc(4);
+  string fpacket;
+  uint32_t age = 0;
+  uint32_t qhash = 0;
+  const uint32_t ttd = 3600;
+  const size_t count = 100;
+
+  ::arg().set("rng")="auto";
+  ::arg().set("entropy-source")="/dev/urandom";
+
+  for (size_t idx = 0; idx < count; idx++) {
+    DNSName qname = DNSName(std::to_string(idx)) + DNSName("powerdns.com");
+    vector<uint8_t> packet;
+    DNSPacketWriter pw(packet, qname, QType::A);
+    pw.getHeader()->rd = true;
+    pw.getHeader()->qr = false;
+    pw.getHeader()->id = dns_random_uint16();
+    string qpacket(reinterpret_cast<const char*>(&packet[0]), packet.size());
+    pw.startRecord(qname, QType::A, ttd);
+
+    BOOST_CHECK_EQUAL(rpc.getResponsePacket(0, qpacket, time(nullptr), &fpacket, &age, &qhash), false);
+
+    ARecordContent ar("127.0.0.1");
+    ar.toPacket(pw);
+    pw.commit();
+    string rpacket(reinterpret_cast<const char*>(&packet[0]), packet.size());
+
+    rpc.insertResponsePacket(0, qhash, string(qpacket), qname, QType::A, QClass::IN, string(rpacket), time(nullptr), ttd, vState::Indeterminate, boost::none, false);
+    BOOST_CHECK_EQUAL(rpc.getResponsePacket(0, qpacket, time(nullptr), &fpacket, &age, &qhash), true);
+    BOOST_CHECK_EQUAL(fpacket, rpacket);
+  }
+
+  BOOST_CHECK_EQUAL(rpc.size(), count);
+  BOOST_CHECK_EQUAL(rpc.getHits(), count);
+  BOOST_CHECK_EQUAL(rpc.getMisses(), count);
+
+  /* the budget is global, not per shard */
+  rpc.doPruneTo(count / 2);
+  BOOST_CHECK_EQUAL(rpc.size(), count / 2);
+
+  /* wiping is done across all shards */
+  BOOST_CHECK_EQUAL(rpc.doWipePacketCache(DNSName("powerdns.com"), 0xffff, true), count / 2);
+  BOOST_CHECK_EQUAL(rpc.size(), 0U);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
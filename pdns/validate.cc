@@ -5,9 +5,12 @@
 #include "rec-lua-conf.hh"
 #include "base32.hh"
 #include "logger.hh"
+#include "sha.hh"
 bool g_dnssecLOG{false};
 time_t g_signatureInceptionSkew{0};
 uint16_t g_maxNSEC3Iterations{0};
+pdns::stat_t g_signatureVerifications{0};
+std::unique_ptr<SignatureCache> g_signatureCache{nullptr};
 
 #define LOG(x) if(g_dnssecLOG) { g_log <<Logger::Warning << x; }
 
@@ -920,6 +923,97 @@ bool isRRSIGIncepted(const time_t now, const shared_ptr<RRSIGRecordContent>& sig
   return sig->d_siginception - g_signatureInceptionSkew <= now;
 }
 
+SignatureCache::SignatureCache(size_t maxEntries, size_t shards): d_shards(shards > 0 ? shards : 1)
+{
+  d_maxEntriesPerShard = std::max(maxEntries / d_shards.size(), static_cast<size_t>(1));
+}
+
+std::string SignatureCache::getKey(const DNSKEYRecordContent& key, const RRSIGRecordContent& sig, const std::string& msg)
+{
+  std::string input;
+  input.reserve(1 + key.d_key.size() + msg.size() + sig.d_signature.size());
+  input.append(1, static_cast<char>(key.d_algorithm));
+  input.append(key.d_key);
+  input.append(msg);
+  input.append(sig.d_signature);
+  return pdns_sha256sum(input);
+}
+
+LockGuarded<SignatureCache::Shard>& SignatureCache::getShard(const std::string& key)
+{
+  /* the key is a SHA-256 digest, any part of it is as good as a hash */
+  uint32_t hash;
+  memcpy(&hash, key.data(), sizeof(hash));
+  return d_shards.at(hash % d_shards.size());
+}
+
+bool SignatureCache::isValid(const std::string& key, time_t now)
+{
+  auto shard = getShard(key).lock();
+  auto it = shard->d_map.find(key);
+  if (it == shard->d_map.end()) {
+    return false;
+  }
+  if (it->second < now) {
+    shard->d_map.erase(it);
+    return false;
+  }
+  ++d_hits;
+  return true;
+}
+
+void SignatureCache::insert(std::string&& key, time_t expiration)
+{
+  auto shard = getShard(key).lock();
+  if (shard->d_map.size() >= d_maxEntriesPerShard) {
+    /* make room: get rid of expired entries first, then of whatever comes first */
+    time_t now = time(nullptr);
+    for (auto it = shard->d_map.begin(); it != shard->d_map.end(); ) {
+      if (it->second < now) {
+        it = shard->d_map.erase(it);
+      }
+      else {
+        ++it;
+      }
+    }
+    if (shard->d_map.size() >= d_maxEntriesPerShard) {
+      shard->d_map.erase(shard->d_map.begin());
+    }
+  }
+  shard->d_map[std::move(key)] = expiration;
+}
+
+void SignatureCache::prune(time_t now)
+{
+  for (auto& lockedShard : d_shards) {
+    auto shard = lockedShard.lock();
+    for (auto it = shard->d_map.begin(); it != shard->d_map.end(); ) {
+      if (it->second < now) {
+        it = shard->d_map.erase(it);
+      }
+      else {
+        ++it;
+      }
+    }
+  }
+}
+
+void SignatureCache::clear()
+{
+  for (auto& lockedShard : d_shards) {
+    lockedShard.lock()->d_map.clear();
+  }
+}
+
+size_t SignatureCache::size()
+{
+  size_t count = 0;
+  for (auto& lockedShard : d_shards) {
+    count += lockedShard.lock()->d_map.size();
+  }
+  return count;
+}
+
 static bool checkSignatureWithKey(time_t now, const shared_ptr<RRSIGRecordContent> sig, const shared_ptr<DNSKEYRecordContent> key, const std::string& msg)
 {
   bool result = false;
@@ -929,8 +1023,21 @@ static bool checkSignatureWithKey(time_t now, const shared_ptr<RRSIGRecordConten
        - The validator's notion of the current time MUST be greater than or equal to the time listed in the RRSIG RR's Inception field.
     */
     if (isRRSIGIncepted(now, sig) && isRRSIGNotExpired(now, sig)) {
+      std::string cacheKey;
+      if (g_signatureCache) {
+        cacheKey = SignatureCache::getKey(*key, *sig, msg);
+        if (g_signatureCache->isValid(cacheKey, now)) {
+          LOG("signature by key with tag "<<sig->d_tag<<" and algorithm "<<DNSSECKeeper::algorithm2name(sig->d_algorithm)<<" was already verified"<<endl);
+          return true;
+        }
+      }
+
       auto dke = DNSCryptoKeyEngine::makeFromPublicKeyString(key->d_algorithm, key->d_key);
+      ++g_signatureVerifications;
       result = dke->verify(msg, sig->d_signature);
+      if (result && g_signatureCache) {
+        g_signatureCache->insert(std::move(cacheKey), sig->d_sigexpire);
+      }
       LOG("signature by key with tag "<<sig->d_tag<<" and algorithm "<<DNSSECKeeper::algorithm2name(sig->d_algorithm)<<" was " << (result ? "" : "NOT ")<<"valid"<<endl);
     }
     else {
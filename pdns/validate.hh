@@ -23,14 +23,19 @@
 
 #include "dnsparser.hh"
 #include "dnsname.hh"
+#include <unordered_map>
 #include <vector>
 #include "namespaces.hh"
 #include "dnsrecords.hh"
 #include "dnssecinfra.hh"
+#include "lock.hh"
+#include "stat_t.hh"
  
 extern bool g_dnssecLOG;
 extern time_t g_signatureInceptionSkew;
 extern uint16_t g_maxNSEC3Iterations;
+/* number of signatures actually verified with the crypto library */
+extern pdns::stat_t g_signatureVerifications;
 
 // 4033 5
 enum class vState : uint8_t { Indeterminate, Insecure, Secure, NTA, TA, BogusNoValidDNSKEY, BogusInvalidDenial, BogusUnableToGetDSs, BogusUnableToGetDNSKEYs, BogusSelfSignedDS, BogusNoRRSIG, BogusNoValidRRSIG, BogusMissingNegativeIndication, BogusSignatureNotYetValid, BogusSignatureExpired, BogusUnsupportedDNSKEYAlgo, BogusUnsupportedDSDigestType, BogusNoZoneKeyBitSet, BogusRevokedDNSKEY, BogusInvalidDNSKEYProtocol };
@@ -72,6 +77,42 @@ struct sharedDNSKeyRecordContentCompare
 
 typedef set<shared_ptr<DNSKEYRecordContent>, sharedDNSKeyRecordContentCompare > skeyset_t;
 
+/* Remembers which signatures have already been verified, so that the same
+   RRSIG over the same RRset with the same key does not go through the crypto
+   library again after every record cache refresh.
+   Entries are keyed by a SHA-256 digest of the algorithm, the public key,
+   the signed data (RRSIG RDATA and canonical RRset) and the signature, so
+   that nothing but a verified signature can ever match them.
+   Only successful verifications are stored, until the signature expires. */
+class SignatureCache
+{
+public:
+  SignatureCache(size_t maxEntries, size_t shards = 1024);
+
+  static std::string getKey(const DNSKEYRecordContent& key, const RRSIGRecordContent& sig, const std::string& msg);
+
+  bool isValid(const std::string& key, time_t now);
+  void insert(std::string&& key, time_t expiration);
+  void prune(time_t now);
+  void clear();
+  size_t size();
+
+  pdns::stat_t d_hits{0};
+
+private:
+  struct Shard
+  {
+    std::unordered_map<std::string, time_t> d_map;
+  };
+
+  LockGuarded<Shard>& getShard(const std::string& key);
+
+  std::vector<LockGuarded<Shard>> d_shards;
+  size_t d_maxEntriesPerShard;
+};
+
+extern std::unique_ptr<SignatureCache> g_signatureCache;
+
 
 vState validateWithKeySet(time_t now, const DNSName& name, const sortedRecords_t& records, const vector<shared_ptr<RRSIGRecordContent> >& signatures, const skeyset_t& keys, bool validateAllSigs=true);
 bool isCoveredByNSEC(const DNSName& name, const DNSName& begin, const DNSName& next);
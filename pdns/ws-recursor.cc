@@ -391,7 +391,7 @@ static void apiServerCacheFlush(HttpRequest* req, HttpResponse* resp) {
   }
 
   int count = g_recCache->doWipeCache(canon, subtree, qtype);
-  count += broadcastAccFunction<uint64_t>([=]{return pleaseWipePacketCache(canon, subtree, qtype);});
+  count += g_packetCache->doWipePacketCache(canon, qtype, subtree);
   count += g_negCache->wipe(canon, subtree);
   resp->setJsonBody(Json::object {
     { "count", count },
@@ -685,6 +685,9 @@ const std::map<std::string, MetricDefinition> MetricDefinitionStorage::d_metrics
   {"max-mthread-stack",
    MetricDefinition(PrometheusMetricType::gauge,
                     "Maximum amount of thread stack ever used")},
+  {"max-mthread-stack-touched",
+   MetricDefinition(PrometheusMetricType::gauge,
+                    "Maximum amount of thread stack ever touched, if measure-mthread-stack-usage is enabled")},
 
   {"negcache-entries",
    MetricDefinition(PrometheusMetricType::gauge,
@@ -725,9 +728,15 @@ const std::map<std::string, MetricDefinition> MetricDefinitionStorage::d_metrics
   {"over-capacity-drops",
    MetricDefinition(PrometheusMetricType::counter,
                     "Number of questions dropped because over maximum concurrent query limit")},
+  {"packetcache-acquired",
+   MetricDefinition(PrometheusMetricType::counter,
+                    "Number of packet cache lock acquisitions")},
   {"packetcache-bytes",
    MetricDefinition(PrometheusMetricType::gauge,
                     "Size of the packet cache in bytes")},
+  {"packetcache-contended",
+   MetricDefinition(PrometheusMetricType::counter,
+                    "Number of contended packet cache lock acquisitions")},
   {"packetcache-entries",
    MetricDefinition(PrometheusMetricType::gauge,
                     "Number of packet cache entries")},
@@ -1022,6 +1031,10 @@ const std::map<std::string, MetricDefinition> MetricDefinitionStorage::d_metrics
     MetricDefinition(PrometheusMetricType::counter,
                      "number of contented record cache lock acquisitions")},
 
+  { "record-cache-served-stale",
+    MetricDefinition(PrometheusMetricType::counter,
+                     "number of times expired records from the record cache were served because resolving failed")},
+
   { "taskqueue-expired",
     MetricDefinition(PrometheusMetricType::counter,
                      "number of tasks expired before they could be run")},
@@ -1041,6 +1054,22 @@ const std::map<std::string, MetricDefinition> MetricDefinitionStorage::d_metrics
   { "dns64-prefix-answers",
     MetricDefinition(PrometheusMetricType::counter,
                      "Number of AAAA and PTR generated by a matching dns64-prefix")},
+
+  { "udp-sockets-created",
+    MetricDefinition(PrometheusMetricType::counter,
+                     "Number of outgoing UDP sockets created to send queries")},
+
+  { "udp-sockets-reused",
+    MetricDefinition(PrometheusMetricType::counter,
+                     "Number of outgoing UDP queries sent from a reused socket")},
+
+  { "shared-outgoing-queries",
+    MetricDefinition(PrometheusMetricType::counter,
+                     "Number of outgoing UDP queries not sent because an identical query from another thread was in flight")},
+
+  { "shared-outgoing-drops",
+    MetricDefinition(PrometheusMetricType::counter,
+                     "Number of answers to shared outgoing queries that could not be handed to a waiting thread")},
   { "aggressive-nsec-cache-entries",
     MetricDefinition(PrometheusMetricType::counter,
                      "Number of entries in the aggressive NSEC cache")},
@@ -1069,6 +1098,10 @@ const std::map<std::string, MetricDefinition> MetricDefinitionStorage::d_metrics
   { "cumul-authanswers-count4",
     MetricDefinition(PrometheusMetricType::histogram,
                      "histogram of answer times of authoritative servers")},
+  // For cumulative histogram, state the xxx_count name where xxx matches the name in rec_channel_rec
+  { "cumul-luahooks-gettag-count",
+    MetricDefinition(PrometheusMetricType::histogram,
+                     "histogram of the time spent in Lua hooks")},
   { "almost-expired-pushed",
     MetricDefinition(PrometheusMetricType::counter,
                      "number of almost-expired tasks pushed")},
@@ -1081,6 +1114,18 @@ const std::map<std::string, MetricDefinition> MetricDefinitionStorage::d_metrics
     MetricDefinition(PrometheusMetricType::counter,
                      "number of almost-expired tasks that caused an exception")},
 
+  { "signature-cache-entries",
+    MetricDefinition(PrometheusMetricType::gauge,
+                     "Number of entries in the DNSSEC signature cache")},
+
+  { "signature-cache-hits",
+    MetricDefinition(PrometheusMetricType::counter,
+                     "Number of DNSSEC signatures found already verified in the signature cache")},
+
+  { "signature-verifications",
+    MetricDefinition(PrometheusMetricType::counter,
+                     "Number of DNSSEC signatures verified with the crypto library")},
+
   // For multicounters, state the first
   { "policy-hits",
     MetricDefinition(PrometheusMetricType::multicounter,
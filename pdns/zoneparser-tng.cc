@@ -317,6 +317,9 @@ bool ZoneParserTNG::get(DNSResourceRecord& rr, std::string* comment)
       d_havedollarttl=true;
     }
     else if(pdns_iequals(command,"$INCLUDE") && d_parts.size() > 1 && d_fromfile) {
+      if (!d_includesEnabled) {
+        throw exception("$INCLUDE is not allowed in this zone");
+      }
       string fname=unquotify(makeString(d_line, d_parts[1]));
       if(!fname.empty() && fname[0]!='/' && !d_reldir.empty())
         fname=d_reldir+"/"+fname;
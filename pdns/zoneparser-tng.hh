@@ -45,6 +45,10 @@ public:
   {
     d_generateEnabled = false;
   }
+  void disableIncludes()
+  {
+    d_includesEnabled = false;
+  }
   void setMaxGenerateSteps(size_t max)
   {
     d_maxGenerateSteps = max;
@@ -78,5 +82,6 @@ private:
   bool d_havedollarttl;
   bool d_fromfile;
   bool d_generateEnabled{true};
+  bool d_includesEnabled{true};
   bool d_upgradeContent;
 };
@@ -0,0 +1,72 @@
+#!/usr/bin/env python
+import base64
+import re
+from dnsdisttests import DNSDistTest
+
+class TestBenchQueryPipeline(DNSDistTest):
+
+    _consoleKey = DNSDistTest.generateConsoleKey()
+    _consoleKeyB64 = base64.b64encode(_consoleKey).decode('ascii')
+    # the generated queries come from 192.0.2.X, where X is the index of the name modulo 256
+    _acl = ['127.0.0.1/32', '192.0.2.0/25']
+    _config_params = ['_consoleKeyB64', '_consolePort', '_testServerPort']
+    _config_template = """
+    setKey("%s")
+    controlSocket("127.0.0.1:%s")
+    newServer{address="127.0.0.1:%d"}:setUp()
+    addAction("answered.bench.tests.powerdns.com.", RCodeAction(DNSRCode.REFUSED))
+    addAction("dropped.bench.tests.powerdns.com.", DropAction())
+    """
+
+    def runBenchmark(self, options):
+        output = self.sendConsoleCommand('benchQueryPipeline(%s)' % (options), timeout=30.0)
+        print(output)
+        lines = output.splitlines()
+        self.assertGreaterEqual(len(lines), 3)
+
+        processed = re.match(r'^Processed (\d+) queries \((\d+) distinct\) with (\d+) thread\(s\) in [0-9.]+ ms, [0-9.]+ qps$', lines[0])
+        self.assertTrue(processed, lines[0])
+        counts = re.match(r'^(\d+) ACL drops, (\d+) drops, (\d+) answered directly, (\d+) forwarded, (\d+) responses dropped, (\d+) errors$', lines[1])
+        self.assertTrue(counts, lines[1])
+
+        stages = [line.split()[0] for line in lines[2:]]
+        self.assertEqual(stages, ['parsing', 'acl', 'rings', 'dynblocks', 'rules', 'policy', 'cache', 'backend', 'response', 'total'])
+        for line in lines[2:]:
+            self.assertTrue(re.match(r'^\S+\s+[0-9.]+ ns/query$', line), line)
+
+        return ([int(value) for value in processed.groups()], [int(value) for value in counts.groups()])
+
+    def testForwarded(self):
+        """
+        benchQueryPipeline: Queries forwarded to the backend
+        """
+        (processed, counts) = self.runBenchmark('{suffix="forwarded.bench.tests.powerdns.com.", names=100, iterations=1000}')
+        self.assertEqual(processed, [1000, 100, 1])
+        self.assertEqual(counts, [0, 0, 0, 1000, 0, 0])
+
+    def testAnsweredAndDropped(self):
+        """
+        benchQueryPipeline: Queries answered or dropped by rules
+        """
+        (processed, counts) = self.runBenchmark('{suffix="answered.bench.tests.powerdns.com.", names=100, iterations=1000}')
+        self.assertEqual(processed, [1000, 100, 1])
+        self.assertEqual(counts, [0, 0, 1000, 0, 0, 0])
+
+        (processed, counts) = self.runBenchmark('{suffix="dropped.bench.tests.powerdns.com.", names=100, iterations=1000}')
+        self.assertEqual(processed, [1000, 100, 1])
+        self.assertEqual(counts, [0, 1000, 0, 0, 0, 0])
+
+    def testACLAndThreads(self):
+        """
+        benchQueryPipeline: Half of the clients are not allowed by the ACL, several threads
+        """
+        (processed, counts) = self.runBenchmark('{suffix="forwarded.bench.tests.powerdns.com.", names=256, iterations=1024, threads=3}')
+        self.assertEqual(processed, [1024, 256, 3])
+        self.assertEqual(counts, [512, 0, 0, 512, 0, 0])
+
+    def testNoQueries(self):
+        """
+        benchQueryPipeline: Nothing to benchmark
+        """
+        output = self.sendConsoleCommand('benchQueryPipeline({names=0})')
+        self.assertTrue(output.startswith('Error while benchmarking the query pipeline: No queries'), output)
@@ -58,6 +58,12 @@ class DNSDistTLSSessionResumptionTest(DNSDistTest):
         with open(outputFile, 'wb') as fp:
             fp.write(os.urandom(numberOfTickets * 80))
 
+    @classmethod
+    def replaceTicketKeysFile(cls, numberOfTickets, outputFile):
+        # write the new keys to a temporary file then move it into place, the way a distribution script would
+        cls.generateTicketKeysFile(numberOfTickets, outputFile + '.tmp')
+        os.rename(outputFile + '.tmp', outputFile)
+
 @unittest.skipIf('SKIP_DOH_TESTS' in os.environ, 'DNS over HTTPS tests are disabled')
 class TestNoTLSSessionResumptionDOH(DNSDistTLSSessionResumptionTest):
 
@@ -176,6 +182,57 @@ class TestTLSSessionResumptionDOH(DNSDistTLSSessionResumptionTest):
         self.sendConsoleCommand("getDOHFrontend(0):loadTicketsKeys('/tmp/ticketKeys.2')")
         self.assertTrue(self.checkSessionResumed('127.0.0.1', self._dohServerPort, self._serverName, self._caCert, '/tmp/session.doh.2', '/tmp/session.doh.2', allowNoTicket=True))
 
+@unittest.skipIf('SKIP_DOH_TESTS' in os.environ, 'DNS over HTTPS tests are disabled')
+class TestTLSSessionResumptionReloadKeyFileDOH(DNSDistTLSSessionResumptionTest):
+
+    _serverKey = 'server.key'
+    _serverCert = 'server.chain'
+    _serverName = 'tls.tests.dnsdist.org'
+    _caCert = 'ca.pem'
+    _dohServerPort = 8443
+    _numberOfKeys = 5
+    _ticketKeyFile = '/tmp/ticketKeys.reload.doh'
+    _config_template = """
+    setKey("%s")
+    controlSocket("127.0.0.1:%s")
+    newServer{address="127.0.0.1:%s"}
+
+    addDOHLocal("127.0.0.1:%s", "%s", "%s", { "/" }, { numberOfTicketsKeys=%d, ticketKeyFile='%s', reloadTicketKeyFile=true })
+    """
+    _config_params = ['_consoleKeyB64', '_consolePort', '_testServerPort', '_dohServerPort', '_serverCert', '_serverKey', '_numberOfKeys', '_ticketKeyFile']
+
+    @classmethod
+    def setUpClass(cls):
+        # the keys file has to exist before dnsdist starts
+        cls.generateTicketKeysFile(cls._numberOfKeys, cls._ticketKeyFile)
+        super(TestTLSSessionResumptionReloadKeyFileDOH, cls).setUpClass()
+
+    def testSessionResumptionReloadKeyFile(self):
+        """
+        Session Resumption: DoH, reloading the keys file on rotation
+        """
+        self.assertFalse(self.checkSessionResumed('127.0.0.1', self._dohServerPort, self._serverName, self._caCert, '/tmp/session.reload.doh', None))
+        self.assertTrue(self.checkSessionResumed('127.0.0.1', self._dohServerPort, self._serverName, self._caCert, '/tmp/session.reload.doh', '/tmp/session.reload.doh', allowNoTicket=True))
+
+        # the file has not been modified, so the current keys are kept, even after more rotations than there are keys
+        for _ in range(self._numberOfKeys + 1):
+            self.sendConsoleCommand("getDOHFrontend(0):rotateTicketsKey()")
+        self.assertTrue(self.checkSessionResumed('127.0.0.1', self._dohServerPort, self._serverName, self._caCert, '/tmp/session.reload.doh', '/tmp/session.reload.doh', allowNoTicket=True))
+
+        # replace the file with entirely new keys, the next rotation loads them
+        self.replaceTicketKeysFile(self._numberOfKeys, self._ticketKeyFile)
+        self.sendConsoleCommand("getDOHFrontend(0):rotateTicketsKey()")
+
+        # none of the keys we knew are left, so we should not be able to resume
+        self.assertFalse(self.checkSessionResumed('127.0.0.1', self._dohServerPort, self._serverName, self._caCert, '/tmp/session.reload.doh', '/tmp/session.reload.doh'))
+        # but a new session, encrypted with the new active key, can be resumed
+        self.assertTrue(self.checkSessionResumed('127.0.0.1', self._dohServerPort, self._serverName, self._caCert, '/tmp/session.reload.doh', '/tmp/session.reload.doh', allowNoTicket=True))
+
+        # and it still can after more rotations, since the file is unchanged again
+        for _ in range(self._numberOfKeys + 1):
+            self.sendConsoleCommand("getDOHFrontend(0):rotateTicketsKey()")
+        self.assertTrue(self.checkSessionResumed('127.0.0.1', self._dohServerPort, self._serverName, self._caCert, '/tmp/session.reload.doh', '/tmp/session.reload.doh', allowNoTicket=True))
+
 class TestNoTLSSessionResumptionDOT(DNSDistTLSSessionResumptionTest):
 
     _serverKey = 'server.key'
@@ -291,3 +348,53 @@ class TestTLSSessionResumptionDOT(DNSDistTLSSessionResumptionTest):
         # reload from file 2, the latest session should resume
         self.sendConsoleCommand("getTLSContext(0):loadTicketsKeys('/tmp/ticketKeys.2')")
         self.assertTrue(self.checkSessionResumed('127.0.0.1', self._tlsServerPort, self._serverName, self._caCert, '/tmp/session.dot.2', '/tmp/session.dot.2', allowNoTicket=True))
+
+class TestTLSSessionResumptionReloadKeyFileDOT(DNSDistTLSSessionResumptionTest):
+
+    _serverKey = 'server.key'
+    _serverCert = 'server.chain'
+    _serverName = 'tls.tests.dnsdist.org'
+    _caCert = 'ca.pem'
+    _tlsServerPort = 8443
+    _numberOfKeys = 5
+    _ticketKeyFile = '/tmp/ticketKeys.reload.dot'
+    _config_template = """
+    setKey("%s")
+    controlSocket("127.0.0.1:%s")
+    newServer{address="127.0.0.1:%s"}
+
+    addTLSLocal("127.0.0.1:%s", "%s", "%s", { provider="openssl", numberOfTicketsKeys=%d, ticketKeyFile='%s', reloadTicketKeyFile=true })
+    """
+    _config_params = ['_consoleKeyB64', '_consolePort', '_testServerPort', '_tlsServerPort', '_serverCert', '_serverKey', '_numberOfKeys', '_ticketKeyFile']
+
+    @classmethod
+    def setUpClass(cls):
+        # the keys file has to exist before dnsdist starts
+        cls.generateTicketKeysFile(cls._numberOfKeys, cls._ticketKeyFile)
+        super(TestTLSSessionResumptionReloadKeyFileDOT, cls).setUpClass()
+
+    def testSessionResumptionReloadKeyFile(self):
+        """
+        Session Resumption: DoT, reloading the keys file on rotation
+        """
+        self.assertFalse(self.checkSessionResumed('127.0.0.1', self._tlsServerPort, self._serverName, self._caCert, '/tmp/session.reload.dot', None))
+        self.assertTrue(self.checkSessionResumed('127.0.0.1', self._tlsServerPort, self._serverName, self._caCert, '/tmp/session.reload.dot', '/tmp/session.reload.dot', allowNoTicket=True))
+
+        # the file has not been modified, so the current keys are kept, even after more rotations than there are keys
+        for _ in range(self._numberOfKeys + 1):
+            self.sendConsoleCommand("getTLSContext(0):rotateTicketsKey()")
+        self.assertTrue(self.checkSessionResumed('127.0.0.1', self._tlsServerPort, self._serverName, self._caCert, '/tmp/session.reload.dot', '/tmp/session.reload.dot', allowNoTicket=True))
+
+        # replace the file with entirely new keys, the next rotation loads them
+        self.replaceTicketKeysFile(self._numberOfKeys, self._ticketKeyFile)
+        self.sendConsoleCommand("getTLSContext(0):rotateTicketsKey()")
+
+        # none of the keys we knew are left, so we should not be able to resume
+        self.assertFalse(self.checkSessionResumed('127.0.0.1', self._tlsServerPort, self._serverName, self._caCert, '/tmp/session.reload.dot', '/tmp/session.reload.dot'))
+        # but a new session, encrypted with the new active key, can be resumed
+        self.assertTrue(self.checkSessionResumed('127.0.0.1', self._tlsServerPort, self._serverName, self._caCert, '/tmp/session.reload.dot', '/tmp/session.reload.dot', allowNoTicket=True))
+
+        # and it still can after more rotations, since the file is unchanged again
+        for _ in range(self._numberOfKeys + 1):
+            self.sendConsoleCommand("getTLSContext(0):rotateTicketsKey()")
+        self.assertTrue(self.checkSessionResumed('127.0.0.1', self._tlsServerPort, self._serverName, self._caCert, '/tmp/session.reload.dot', '/tmp/session.reload.dot', allowNoTicket=True))